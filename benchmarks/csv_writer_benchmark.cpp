@@ -0,0 +1,234 @@
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <arrow/api.h>
+#include <arrow/io/memory.h>
+#include <boost/program_options.hpp>
+
+#include "arrow_result.h"
+#include "options.h"
+#include "parallel_csv_writer.h"
+#include "writer.h"
+
+
+// Compares the throughput of Arrow's CSV writer, which deval used to write CSV with, against ParallelCsvWriter. Both
+// write to a sink that only counts bytes, so the figures are for encoding alone.
+namespace {
+class BenchmarkOptions final : public Options {
+public:
+    BenchmarkOptions() {
+        namespace po = boost::program_options;
+
+        // clang-format off
+        description().add_options()
+        ("rows,n", po::value(&rows_)->default_value(2'000'000),
+            "Rows in the narrow table. The wide table has the same number of values spread over more columns.")
+        ("wide-columns,w", po::value(&wide_columns_)->default_value(64), "Number of columns in the wide table.")
+        ("batch-rows", po::value(&batch_rows_)->default_value(122'880), "Rows per record batch written.")
+        ("threads,j", po::value(&threads_)->default_value(0), "Encoding threads, or 0 for one per core up to 8.")
+        ("repeats,r", po::value(&repeats_)->default_value(3), "Runs of each writer; the fastest is reported.")
+        ;
+        // clang-format on
+    }
+
+    [[nodiscard]] std::int64_t rows() const {
+        return std::max<std::int64_t>(rows_, 1);
+    }
+
+    [[nodiscard]] int wide_columns() const {
+        return std::max(wide_columns_, NARROW_COLUMNS);
+    }
+
+    [[nodiscard]] std::int64_t batch_rows() const {
+        return std::max<std::int64_t>(batch_rows_, 1);
+    }
+
+    [[nodiscard]] std::size_t threads() const {
+        return threads_;
+    }
+
+    [[nodiscard]] int repeats() const {
+        return std::max(repeats_, 1);
+    }
+
+    static constexpr int NARROW_COLUMNS = 5;
+
+private:
+    std::int64_t rows_ = 0;
+    int wide_columns_ = 0;
+    std::int64_t batch_rows_ = 0;
+    std::size_t threads_ = 0;
+    int repeats_ = 0;
+};
+
+void check(
+    const arrow::Status &status
+) {
+    if (!status.ok()) {
+        throw ArrowException("Error doing Arrow action. " + status.ToString());
+    }
+}
+
+// Cycles through integer, floating point, string, timestamp and boolean columns, with about one null in twenty.
+std::shared_ptr<arrow::Array> make_column(
+    const int index,
+    const std::int64_t rows,
+    std::mt19937_64 &rng
+) {
+    std::bernoulli_distribution is_null(0.05);
+    const auto build = [&](
+        auto &builder,
+        auto &&next_value
+    ) {
+        check(builder.Reserve(rows));
+        for (std::int64_t i = 0; i < rows; ++i) {
+            if (is_null(rng)) {
+                builder.UnsafeAppendNull();
+            } else {
+                check(builder.Append(next_value()));
+            }
+        }
+        return assign_or_raise(builder.Finish());
+    };
+
+    switch (index % 5) {
+        case 0: {
+            arrow::Int64Builder builder;
+            std::uniform_int_distribution<std::int64_t> values(-1'000'000, 1'000'000);
+            return build(builder, [&] { return values(rng); });
+        }
+        case 1: {
+            arrow::DoubleBuilder builder;
+            std::normal_distribution values(100.0, 25.0);
+            return build(builder, [&] { return values(rng); });
+        }
+        case 2: {
+            arrow::StringBuilder builder;
+            std::uniform_int_distribution<int> words(0, 9999);
+            return build(builder, [&] { return "value-" + std::to_string(words(rng)); });
+        }
+        case 3: {
+            arrow::TimestampBuilder builder(arrow::timestamp(arrow::TimeUnit::MICRO), arrow::default_memory_pool());
+            std::uniform_int_distribution<std::int64_t> values(1'577'836'800'000'000, 1'609'459'199'000'000);
+            return build(builder, [&] { return values(rng); });
+        }
+        default: {
+            arrow::BooleanBuilder builder;
+            std::bernoulli_distribution values(0.5);
+            return build(builder, [&] { return values(rng); });
+        }
+    }
+}
+
+std::vector<std::shared_ptr<arrow::RecordBatch> > make_table(
+    const int columns,
+    const std::int64_t rows,
+    const std::int64_t batch_rows
+) {
+    std::mt19937_64 rng(42);
+    arrow::FieldVector fields;
+    arrow::ArrayVector arrays;
+    for (int i = 0; i < columns; ++i) {
+        auto column = make_column(i, rows, rng);
+        fields.push_back(arrow::field("c" + std::to_string(i + 1), column->type()));
+        arrays.push_back(std::move(column));
+    }
+    const auto table = arrow::Table::Make(arrow::schema(fields), arrays, rows);
+
+    std::vector<std::shared_ptr<arrow::RecordBatch> > batches;
+    arrow::TableBatchReader reader(*table);
+    reader.set_chunksize(batch_rows);
+    for (auto batch = assign_or_raise(reader.Next()); batch; batch = assign_or_raise(reader.Next())) {
+        batches.push_back(std::move(batch));
+    }
+    return batches;
+}
+
+struct Measurement {
+    std::int64_t bytes = 0;
+    double seconds = std::numeric_limits<double>::infinity();
+};
+
+Measurement measure(
+    const std::vector<std::shared_ptr<arrow::RecordBatch> > &batches,
+    const std::function<std::unique_ptr<Writer> (std::shared_ptr<arrow::io::OutputStream>)> &make,
+    const int repeats
+) {
+    Measurement best;
+    for (int i = 0; i < repeats; ++i) {
+        const auto sink = std::make_shared<arrow::io::MockOutputStream>();
+        const auto start = std::chrono::steady_clock::now();
+        {
+            const auto writer = make(sink);
+            for (const auto &batch: batches) {
+                writer->write(batch);
+            }
+            writer->flush();
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        best.bytes = assign_or_raise(sink->Tell());
+        best.seconds = std::min(best.seconds, elapsed.count());
+    }
+    return best;
+}
+}
+
+int main(
+    const int argc,
+    const char *argv[]
+) {
+    BenchmarkOptions options;
+    if (!options.parse(argc, argv)) {
+        return 1;
+    }
+
+    const std::vector<std::pair<std::string, int> > shapes{
+        {"narrow", BenchmarkOptions::NARROW_COLUMNS},
+        {"wide", options.wide_columns()},
+    };
+
+    std::cout << std::left << std::setw(8) << "table" << std::setw(10) << "writer" << std::right << std::setw(14)
+            << "bytes" << std::setw(10) << "seconds" << std::setw(8) << "GB/s" << '\n';
+    for (const auto &[name, columns]: shapes) {
+        const auto rows = options.rows() * BenchmarkOptions::NARROW_COLUMNS / columns;
+        const auto batches = make_table(columns, rows, options.batch_rows());
+        const auto schema = batches.front()->schema();
+
+        const std::vector<std::pair<std::string, Measurement> > measurements{
+            {
+                "arrow",
+                measure(batches, [&schema](auto stream) {
+                    return std::make_unique<CsvWriter>(schema, std::move(stream));
+                }, options.repeats())
+            },
+            {
+                "parallel",
+                measure(batches, [&schema, &options](auto stream) {
+                    return std::make_unique<ParallelCsvWriter>(
+                        schema,
+                        std::move(stream),
+                        CsvDialect{},
+                        options.threads()
+                    );
+                }, options.repeats())
+            },
+        };
+
+        for (const auto &[writer, measurement]: measurements) {
+            const auto gb_per_second = static_cast<double>(measurement.bytes) / measurement.seconds / 1e9;
+            std::cout << std::left << std::setw(8) << name << std::setw(10) << writer << std::right << std::setw(14)
+                    << measurement.bytes << std::setw(10) << std::fixed << std::setprecision(3) << measurement.seconds
+                    << std::setw(8) << std::setprecision(2) << gb_per_second << '\n';
+        }
+        std::cout << std::left << std::setw(8) << name << "speedup " << std::setprecision(1)
+                << measurements[0].second.seconds / measurements[1].second.seconds << "x\n";
+    }
+    return 0;
+}
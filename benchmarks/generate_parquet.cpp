@@ -0,0 +1,331 @@
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <boost/program_options.hpp>
+#include <json/json.h>
+#include <parquet/arrow/writer.h>
+
+#include "arrow_result.h"
+#include "options.h"
+
+
+namespace {
+enum class ColumnType {
+    INT64,
+    DOUBLE,
+    STRING,
+    TIMESTAMP,
+    BOOL,
+};
+
+ColumnType parse_column_type(
+    const std::string &name
+) {
+    if (name == "int64") {
+        return ColumnType::INT64;
+    }
+    if (name == "double") {
+        return ColumnType::DOUBLE;
+    }
+    if (name == "string") {
+        return ColumnType::STRING;
+    }
+    if (name == "timestamp") {
+        return ColumnType::TIMESTAMP;
+    }
+    if (name == "bool") {
+        return ColumnType::BOOL;
+    }
+    throw std::runtime_error("Unknown column type '" + name + "'. Expected int64, double, string, timestamp or bool.");
+}
+
+std::shared_ptr<arrow::DataType> arrow_type(
+    const ColumnType type
+) {
+    switch (type) {
+        case ColumnType::INT64:
+            return arrow::int64();
+        case ColumnType::DOUBLE:
+            return arrow::float64();
+        case ColumnType::STRING:
+            return arrow::utf8();
+        case ColumnType::TIMESTAMP:
+            return arrow::timestamp(arrow::TimeUnit::MICRO);
+        case ColumnType::BOOL:
+            return arrow::boolean();
+    }
+    throw std::logic_error("Unhandled column type.");
+}
+
+void check(
+    const arrow::Status &status
+) {
+    if (!status.ok()) {
+        throw ArrowException("Error doing Arrow action. " + status.ToString());
+    }
+}
+
+class GenerateOptions final : public Options {
+public:
+    GenerateOptions() {
+        namespace po = boost::program_options;
+
+        // clang-format off
+        description().add_options()
+        ("output-dir,o", po::value(&output_dir_), "Directory to write the dataset and its manifest to.")
+        ("rows,n", po::value(&rows_)->default_value(1'000'000), "Total number of rows.")
+        ("files,f", po::value(&files_)->default_value(1), "Number of files to spread the rows over.")
+        ("columns,c", po::value(&columns_)->default_value(8), "Number of value columns, besides 'id' and 'key'.")
+        ("types,t", po::value(&types_)->composing(),
+            "Column types to cycle through: int64, double, string, timestamp or bool. Defaults to all of them.")
+        ("key-cardinality,k", po::value(&key_cardinality_)->default_value(1000),
+            "Number of distinct values in the 'key' column, for joins and selective filters.")
+        ("row-group-rows", po::value(&row_group_rows_)->default_value(122'880), "Rows per Parquet row group.")
+        ("seed,s", po::value(&seed_)->default_value(42), "Random seed; the same seed gives the same files.")
+        ;
+        // clang-format on
+        add_positional_argument("output-dir", {.min_args = 1, .max_args = 1});
+    }
+
+    [[nodiscard]] std::filesystem::path output_dir() const {
+        return output_dir_;
+    }
+
+    [[nodiscard]] std::int64_t rows() const {
+        return rows_;
+    }
+
+    [[nodiscard]] std::int64_t files() const {
+        return std::max<std::int64_t>(files_, 1);
+    }
+
+    [[nodiscard]] std::int64_t columns() const {
+        return columns_;
+    }
+
+    [[nodiscard]] std::vector<ColumnType> types() const {
+        if (types_.empty()) {
+            return {ColumnType::INT64, ColumnType::DOUBLE, ColumnType::STRING, ColumnType::TIMESTAMP, ColumnType::BOOL};
+        }
+        std::vector<ColumnType> types;
+        for (const auto &type: types_) {
+            types.push_back(parse_column_type(type));
+        }
+        return types;
+    }
+
+    [[nodiscard]] std::int64_t key_cardinality() const {
+        return std::max<std::int64_t>(key_cardinality_, 1);
+    }
+
+    [[nodiscard]] std::int64_t row_group_rows() const {
+        return std::max<std::int64_t>(row_group_rows_, 1);
+    }
+
+    [[nodiscard]] std::uint64_t seed() const {
+        return seed_;
+    }
+
+private:
+    std::string output_dir_;
+    std::int64_t rows_ = 0;
+    std::int64_t files_ = 0;
+    std::int64_t columns_ = 0;
+    std::vector<std::string> types_;
+    std::int64_t key_cardinality_ = 0;
+    std::int64_t row_group_rows_ = 0;
+    std::uint64_t seed_ = 0;
+};
+
+std::shared_ptr<arrow::Schema> make_schema(
+    const std::vector<ColumnType> &column_types
+) {
+    arrow::FieldVector fields{arrow::field("id", arrow::int64(), false), arrow::field("key", arrow::int64(), false)};
+    for (std::size_t i = 0; i < column_types.size(); ++i) {
+        fields.push_back(arrow::field("c" + std::to_string(i + 1), arrow_type(column_types[i])));
+    }
+    return arrow::schema(fields);
+}
+
+std::shared_ptr<arrow::Array> make_column(
+    const ColumnType type,
+    const std::int64_t rows,
+    std::mt19937_64 &rng
+) {
+    // About one value in twenty is null, so the writers' null handling is exercised too.
+    std::bernoulli_distribution is_null(0.05);
+
+    const auto build = [&](
+        auto &builder,
+        auto &&next_value
+    ) {
+        check(builder.Reserve(rows));
+        for (std::int64_t i = 0; i < rows; ++i) {
+            if (is_null(rng)) {
+                builder.UnsafeAppendNull();
+            } else {
+                check(builder.Append(next_value()));
+            }
+        }
+        return assign_or_raise(builder.Finish());
+    };
+
+    switch (type) {
+        case ColumnType::INT64: {
+            arrow::Int64Builder builder;
+            std::uniform_int_distribution<std::int64_t> values(-1'000'000, 1'000'000);
+            return build(builder, [&] { return values(rng); });
+        }
+        case ColumnType::DOUBLE: {
+            arrow::DoubleBuilder builder;
+            std::normal_distribution values(100.0, 25.0);
+            return build(builder, [&] { return values(rng); });
+        }
+        case ColumnType::STRING: {
+            // A limited vocabulary keeps dictionary encoding representative of real categorical data.
+            arrow::StringBuilder builder;
+            std::uniform_int_distribution<int> words(0, 9999);
+            return build(builder, [&] { return "value-" + std::to_string(words(rng)); });
+        }
+        case ColumnType::TIMESTAMP: {
+            arrow::TimestampBuilder builder(arrow::timestamp(arrow::TimeUnit::MICRO), arrow::default_memory_pool());
+            // Somewhere in 2020, in microseconds since the epoch.
+            std::uniform_int_distribution<std::int64_t> values(1'577'836'800'000'000, 1'609'459'199'000'000);
+            return build(builder, [&] { return values(rng); });
+        }
+        case ColumnType::BOOL: {
+            arrow::BooleanBuilder builder;
+            std::bernoulli_distribution values(0.5);
+            return build(builder, [&] { return values(rng); });
+        }
+    }
+    throw std::logic_error("Unhandled column type.");
+}
+
+std::shared_ptr<arrow::RecordBatch> make_batch(
+    const std::shared_ptr<arrow::Schema> &schema,
+    const std::vector<ColumnType> &column_types,
+    const std::int64_t first_id,
+    const std::int64_t rows,
+    const std::int64_t key_cardinality,
+    std::mt19937_64 &rng
+) {
+    arrow::Int64Builder ids;
+    arrow::Int64Builder keys;
+    check(ids.Reserve(rows));
+    check(keys.Reserve(rows));
+    for (std::int64_t i = 0; i < rows; ++i) {
+        ids.UnsafeAppend(first_id + i);
+        keys.UnsafeAppend((first_id + i) % key_cardinality);
+    }
+
+    arrow::ArrayVector columns{assign_or_raise(ids.Finish()), assign_or_raise(keys.Finish())};
+    for (const auto type: column_types) {
+        columns.push_back(make_column(type, rows, rng));
+    }
+    return arrow::RecordBatch::Make(schema, rows, columns);
+}
+
+std::string file_name(
+    const std::int64_t index
+) {
+    std::ostringstream name;
+    name << "part-" << std::setw(5) << std::setfill('0') << index << ".parquet";
+    return name.str();
+}
+}
+
+int main(
+    const int argc,
+    const char *argv[]
+) {
+    GenerateOptions options;
+    if (!options.parse(argc, argv)) {
+        return 1;
+    }
+
+    const auto all_types = options.types();
+    std::vector<ColumnType> column_types;
+    for (std::int64_t i = 0; i < options.columns(); ++i) {
+        column_types.push_back(all_types[static_cast<std::size_t>(i) % all_types.size()]);
+    }
+    const auto schema = make_schema(column_types);
+
+    std::filesystem::create_directories(options.output_dir());
+
+    // Each file gets its own generator seeded from the base seed, so a file's contents don't depend on how many files
+    // come before it.
+    const auto rows_per_file = (options.rows() + options.files() - 1) / options.files();
+    std::uintmax_t total_bytes = 0;
+    Json::Value files(Json::arrayValue);
+
+    for (std::int64_t file = 0, first_id = 0; file < options.files(); ++file) {
+        const auto rows = std::max<std::int64_t>(std::min(rows_per_file, options.rows() - first_id), 0);
+        const auto path = options.output_dir() / file_name(file);
+        std::mt19937_64 rng(options.seed() + static_cast<std::uint64_t>(file));
+
+        const auto stream = assign_or_raise(arrow::io::FileOutputStream::Open(path.string()));
+        const auto properties = parquet::WriterProperties::Builder()
+                .max_row_group_length(options.row_group_rows())
+                ->compression(arrow::Compression::SNAPPY)
+                ->build();
+        auto opened = parquet::arrow::FileWriter::Open(*schema, arrow::default_memory_pool(), stream, properties);
+        check(opened.status());
+        const auto writer = std::move(*opened);
+
+        for (std::int64_t written = 0; written < rows;) {
+            const auto batch_rows = std::min(options.row_group_rows(), rows - written);
+            const auto batch = make_batch(
+                schema,
+                column_types,
+                first_id + written,
+                batch_rows,
+                options.key_cardinality(),
+                rng
+            );
+            check(writer->WriteTable(*assign_or_raise(arrow::Table::FromRecordBatches({batch})), batch_rows));
+            written += batch_rows;
+        }
+        check(writer->Close());
+        check(stream->Close());
+
+        const auto bytes = std::filesystem::file_size(path);
+        total_bytes += bytes;
+
+        Json::Value entry;
+        entry["path"] = path.string();
+        entry["rows"] = Json::Int64{rows};
+        entry["bytes"] = Json::UInt64{bytes};
+        files.append(entry);
+
+        first_id += rows;
+    }
+
+    Json::Value manifest;
+    manifest["rows"] = Json::Int64{options.rows()};
+    manifest["bytes"] = Json::UInt64{total_bytes};
+    manifest["key_cardinality"] = Json::Int64{options.key_cardinality()};
+    manifest["seed"] = Json::UInt64{options.seed()};
+    manifest["glob"] = (options.output_dir() / "*.parquet").string();
+    manifest["files"] = files;
+    for (const auto &field: schema->fields()) {
+        Json::Value column;
+        column["name"] = field->name();
+        column["type"] = field->type()->ToString();
+        manifest["schema"].append(column);
+    }
+
+    std::ofstream manifest_file(options.output_dir() / "manifest.json");
+    manifest_file << manifest << '\n';
+    std::cout << manifest << '\n';
+    return 0;
+}
@@ -0,0 +1,322 @@
+#!/usr/bin/env python3
+"""Run end-to-end pipelines over generated Parquet data and report timings as JSON.
+
+Each pipeline stage is run on its own, with the previous stage's query plan as its standard input, so every stage's
+wall time and peak RSS can be attributed to it. Every stage except `deval` only rewrites the plan (`dcat` also reads
+Parquet footers), so their times are effectively process startup. Throughput is the generated dataset's rows and
+bytes divided by `deval`'s wall time.
+Scenarios ending in -duckdb and -arrow run the same pipeline with each `deval --engine`, and the report's `engines`
+compares the two.
+
+Startup is also measured on its own: each binary printing its help, and each planning stage rewriting a small plan.
+`dcat` is reported both resolving the schema, as it does by default, and with --no-schema.
+With --baseline-bin-dir, the same is measured for another build, such as the previous revision, to compare against.
+--startup-only skips generating data and running the pipelines.
+"""
+
+import argparse
+import json
+import os
+import shutil
+import statistics
+import subprocess
+import sys
+import tempfile
+import time
+
+BINARIES = ['dcat', 'dcut', 'dgrep', 'dhead', 'djoin', 'dsort', 'deval']
+
+# Stages that only rewrite the plan they're given, which is all most stages of a pipeline do, by the name they're
+# reported under. `dcat` is timed both as it runs by default, loading the engine module to read the schema from the
+# footer of '{facts}', and with --no-schema.
+PLANNING_STAGES = [
+    ('dcat', ['dcat', "'{facts}'"]),
+    ('dcat --no-schema', ['dcat', '--no-schema', "'{facts}'"]),
+    ('dcut', ['dcut', 'id', 'key']),
+    ('dgrep', ['dgrep', '-i', 'id', '>', '0']),
+    ('djoin', ['djoin', '-t', "'dimension.parquet'", 'key', '=', 'key']),
+    ('dsort', ['dsort', 'id']),
+    ('dhead', ['dhead', '-n', '10']),
+]
+
+
+def generate(generator, directory, rows, files, columns, key_cardinality, seed):
+    """Generate a dataset, unless one with the same parameters is already there."""
+    manifest_path = os.path.join(directory, 'manifest.json')
+    if os.path.exists(manifest_path):
+        with open(manifest_path) as f:
+            manifest = json.load(f)
+        if (manifest['rows'], len(manifest['files']), len(manifest['schema']) - 2, manifest['key_cardinality'],
+                manifest['seed']) == (rows, files, columns, key_cardinality, seed):
+            return manifest
+        shutil.rmtree(directory)
+
+    subprocess.run(
+        [generator, directory, '--rows', str(rows), '--files', str(files), '--columns', str(columns),
+         '--key-cardinality', str(key_cardinality), '--seed', str(seed)],
+        check=True, stdout=subprocess.DEVNULL)
+    with open(manifest_path) as f:
+        return json.load(f)
+
+
+def scenarios(facts, dimension, out_dir):
+    facts_table = "'{}'".format(facts['glob'])
+    dimension_table = "'{}'".format(dimension['glob'])
+    deval = ['deval', '--no-cache', '--no-server']
+
+    # The same pipeline evaluated by each engine, to compare them.
+    def filter_scan(engine):
+        return [
+            ['dcat', facts_table],
+            ['dcut', 'id', 'key', 'c1', 'c2', 'c3'],
+            ['dgrep', '-i', '-p', '>', 'c1', '500000'],
+            deval + ['--engine', engine, '-p', '-o', os.path.join(out_dir, 'filter-scan-{}.parquet'.format(engine))],
+        ]
+
+    def head_scan(engine):
+        return [
+            ['dcat', facts_table],
+            ['dhead', '-n', '1000000'],
+            deval + ['--engine', engine, '-o', os.path.join(out_dir, 'head-scan-{}.csv'.format(engine))],
+        ]
+
+    return {
+        'filter-sort-head': [
+            ['dcat', facts_table],
+            ['dcut', 'id', 'key', 'c1', 'c2', 'c3'],
+            ['dgrep', '-i', '-p', '>', 'c1', '500000'],
+            ['dsort', '-r', 'c2'],
+            ['dhead', '-n', '1000'],
+            deval + ['-o', os.path.join(out_dir, 'filter-sort-head.csv')],
+        ],
+        'scan-csv': [
+            ['dcat', facts_table],
+            deval + ['-o', os.path.join(out_dir, 'scan.csv')],
+        ],
+        'scan-parquet': [
+            ['dcat', facts_table],
+            deval + ['-p', '-o', os.path.join(out_dir, 'scan.parquet')],
+        ],
+        # Columnar output renders every cell separately, so keep it to a sample.
+        'head-columnar': [
+            ['dcat', facts_table],
+            ['dhead', '-n', '100000'],
+            deval + ['-t', '-o', os.path.join(out_dir, 'head.txt')],
+        ],
+        'join': [
+            ['dcat', '-a', 'f', facts_table],
+            ['djoin', '-t', dimension_table, '-a', 'd', 'f.key', '=', 'd.key'],
+            ['dcut', 'f.id', 'f.c1', 'd.c1'],
+            deval + ['-o', os.path.join(out_dir, 'join.csv')],
+        ],
+        'filter-scan-duckdb': filter_scan('duckdb'),
+        'filter-scan-arrow': filter_scan('arrow'),
+        'head-scan-duckdb': head_scan('duckdb'),
+        'head-scan-arrow': head_scan('arrow'),
+    }
+
+
+def compare_engines(scenario_reports):
+    """deval's time with each engine for the scenarios run with both, keyed by the scenario name without the engine."""
+    engines = {}
+    for name, arrow in scenario_reports.items():
+        if not name.endswith('-arrow'):
+            continue
+        base = name[:-len('-arrow')]
+        duckdb = scenario_reports.get(base + '-duckdb')
+        if duckdb is None:
+            continue
+        engines[base] = {
+            'duckdb_seconds': duckdb['evaluate_wall_seconds'],
+            'arrow_seconds': arrow['evaluate_wall_seconds'],
+            'arrow_speedup': (duckdb['evaluate_wall_seconds'] / arrow['evaluate_wall_seconds']
+                              if arrow['evaluate_wall_seconds'] > 0 else None),
+        }
+    return engines
+
+
+def run_stage(argv, stdin, env, check=True):
+    """Run one stage to completion, returning its standard output, wall time and peak RSS in bytes."""
+    with tempfile.TemporaryFile() as stdin_file, tempfile.TemporaryFile() as stdout_file, \
+            tempfile.TemporaryFile() as stderr_file:
+        if stdin is not None:
+            stdin_file.write(stdin)
+            stdin_file.seek(0)
+
+        start = time.perf_counter()
+        process = subprocess.Popen(argv, stdin=stdin_file if stdin is not None else subprocess.DEVNULL,
+                                   stdout=stdout_file, stderr=stderr_file, env=env)
+        # Reap the child ourselves; it's the only way to get the resource usage of this one process.
+        _, status, rusage = os.wait4(process.pid, 0)
+        wall = time.perf_counter() - start
+        process.returncode = os.waitstatus_to_exitcode(status)
+
+        if check and process.returncode != 0:
+            stderr_file.seek(0)
+            raise RuntimeError('{} failed with status {}:\n{}'.format(
+                ' '.join(argv), process.returncode, stderr_file.read().decode(errors='replace')))
+
+        stdout_file.seek(0)
+        # ru_maxrss is in kilobytes on Linux.
+        return stdout_file.read(), wall, rusage.ru_maxrss * 1024
+
+
+def run_pipeline(bin_dir, stages, env):
+    results = []
+    plan = None
+    for argv in stages:
+        plan, wall, peak_rss = run_stage([os.path.join(bin_dir, argv[0])] + argv[1:], plan, env)
+        results.append({'command': ' '.join(argv), 'wall_seconds': wall, 'peak_rss_bytes': peak_rss})
+    return results
+
+
+def summarise(runs, dataset):
+    """Medians over repeated runs of one scenario."""
+    stages = []
+    for i, stage in enumerate(runs[0]):
+        stages.append({
+            'command': stage['command'],
+            'wall_seconds': statistics.median(run[i]['wall_seconds'] for run in runs),
+            'peak_rss_bytes': max(run[i]['peak_rss_bytes'] for run in runs),
+        })
+
+    evaluate = stages[-1]
+    wall = evaluate['wall_seconds']
+    return {
+        'stages': stages,
+        'total_wall_seconds': statistics.median(sum(stage['wall_seconds'] for stage in run) for run in runs),
+        'planning_wall_seconds': sum(stage['wall_seconds'] for stage in stages[:-1]),
+        'evaluate_wall_seconds': wall,
+        'peak_rss_bytes': evaluate['peak_rss_bytes'],
+        'rows_per_second': dataset['rows'] / wall if wall > 0 else None,
+        'bytes_per_second': dataset['bytes'] / wall if wall > 0 else None,
+        'repeats': len(runs),
+    }
+
+
+def startup_times(bin_dir, env, repeats):
+    """Median time for each binary to start, print its help and exit."""
+    times = {}
+    for binary in BINARIES:
+        samples = [run_stage([os.path.join(bin_dir, binary), '--help'], None, env, check=False)[1]
+                   for _ in range(repeats)]
+        times[binary] = statistics.median(samples)
+    return times
+
+
+def planning_times(bin_dir, env, repeats):
+    """Median time for each planning stage to rewrite a plan of a single select."""
+    with tempfile.TemporaryDirectory() as directory:
+        # A one-row file written by the build being measured, so that dcat has a real footer to read.
+        facts = os.path.join(directory, 'facts.parquet')
+        values, _, _ = run_stage([os.path.join(bin_dir, 'dsql'), 'SELECT 1 AS id, 1 AS key'], b'{"plans": []}', env)
+        run_stage([os.path.join(bin_dir, 'deval'), '--no-cache', '--no-server', '-p', '-o', facts], values, env)
+
+        env = dict(env)
+        metadata_cache = os.path.join(directory, 'metadata-cache')
+        env['DEVAL_METADATA_CACHE_DIR'] = metadata_cache
+        plan, _, _ = run_stage([os.path.join(bin_dir, 'dcat'), '--no-schema', "'{}'".format(facts)],
+                               b'{"plans": []}', env)
+
+        times = {}
+        for name, argv in PLANNING_STAGES:
+            argv = [os.path.join(bin_dir, argv[0])] + [arg.format(facts=facts) for arg in argv[1:]]
+            samples = []
+            for _ in range(repeats):
+                shutil.rmtree(metadata_cache, ignore_errors=True)
+                samples.append(run_stage(argv, plan, env)[1])
+            times[name] = statistics.median(samples)
+        return times
+
+
+def measure_startup(bin_dir, env, repeats):
+    return {
+        'bin_dir': os.path.abspath(bin_dir),
+        'startup_seconds': startup_times(bin_dir, env, repeats),
+        'planning_seconds': planning_times(bin_dir, env, repeats),
+    }
+
+
+def git_describe():
+    try:
+        return subprocess.run(['git', 'describe', '--always', '--dirty'], cwd=os.path.dirname(__file__),
+                              capture_output=True, text=True, check=True).stdout.strip()
+    except (OSError, subprocess.CalledProcessError):
+        return None
+
+
+def run_scenarios(args, env, report):
+    facts = generate(args.generator, os.path.join(args.work_dir, 'facts'), args.rows, args.files, args.columns,
+                     args.key_cardinality, args.seed)
+    dimension = generate(args.generator, os.path.join(args.work_dir, 'dimension'), args.key_cardinality, 1, 4,
+                         args.key_cardinality, args.seed + 1)
+    out_dir = os.path.join(args.work_dir, 'output')
+    os.makedirs(out_dir, exist_ok=True)
+
+    env = dict(env)
+    metadata_cache = os.path.join(args.work_dir, 'metadata-cache')
+    env['DEVAL_METADATA_CACHE_DIR'] = metadata_cache
+
+    report['dataset'] = {key: facts[key] for key in ('rows', 'bytes', 'key_cardinality', 'seed', 'schema')}
+    report['dataset']['files'] = len(facts['files'])
+    report['scenarios'] = {}
+
+    for name, stages in scenarios(facts, dimension, out_dir).items():
+        if args.scenario and name not in args.scenario:
+            continue
+        runs = []
+        for _ in range(args.repeats):
+            shutil.rmtree(metadata_cache, ignore_errors=True)
+            runs.append(run_pipeline(args.bin_dir, stages, env))
+        report['scenarios'][name] = summarise(runs, report['dataset'])
+        print('{}: {:.3f} s'.format(name, report['scenarios'][name]['total_wall_seconds']), file=sys.stderr)
+
+    engines = compare_engines(report['scenarios'])
+    if engines:
+        report['engines'] = engines
+
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument('--bin-dir', required=True, help='Directory containing the built d* executables.')
+    parser.add_argument('--generator', help='Path to the generate-parquet executable.')
+    parser.add_argument('--baseline-bin-dir', help='Also measure the startup of the executables in this directory.')
+    parser.add_argument('--startup-only', action='store_true', help="Only measure startup; don't run pipelines.")
+    parser.add_argument('--work-dir', default=os.path.join(tempfile.gettempdir(), 'deval-benchmarks'),
+                        help='Where to keep generated datasets (reused between runs) and outputs.')
+    parser.add_argument('--output', help='Write the JSON report here as well as to standard output.')
+    parser.add_argument('--rows', type=int, default=int(os.environ.get('DEVAL_BENCHMARK_ROWS', 5_000_000)))
+    parser.add_argument('--files', type=int, default=8)
+    parser.add_argument('--columns', type=int, default=12)
+    parser.add_argument('--key-cardinality', type=int, default=1000)
+    parser.add_argument('--seed', type=int, default=42)
+    parser.add_argument('--repeats', type=int, default=int(os.environ.get('DEVAL_BENCHMARK_REPEATS', 3)))
+    parser.add_argument('--scenario', action='append', help='Only run these scenarios (may be repeated).')
+    args = parser.parse_args()
+    if not args.startup_only and not args.generator:
+        parser.error('--generator is needed to run the pipelines')
+
+    # Nothing cached by a previous run, or by the user's own pipelines, should make a run faster than a first run.
+    env = {key: value for key, value in os.environ.items() if not key.startswith('DEVAL_')}
+    startup_repeats = max(args.repeats, 5)
+    startup = measure_startup(args.bin_dir, env, startup_repeats)
+    report = {
+        'build': {'bin_dir': startup['bin_dir'], 'revision': git_describe()},
+        'startup_seconds': startup['startup_seconds'],
+        'planning_seconds': startup['planning_seconds'],
+    }
+    if args.baseline_bin_dir:
+        report['baseline'] = measure_startup(args.baseline_bin_dir, env, startup_repeats)
+    if not args.startup_only:
+        run_scenarios(args, env, report)
+
+    encoded = json.dumps(report, indent=2)
+    if args.output:
+        with open(args.output, 'w') as f:
+            f.write(encoded + '\n')
+    print(encoded)
+
+
+if __name__ == '__main__':
+    main()
@@ -2,6 +2,7 @@
 
 #include <arrow/result.h>
 #include <string>
+#include <utility>
 
 struct ArrowException final : std::runtime_error {
     explicit ArrowException(
@@ -18,5 +19,5 @@ T assign_or_raise(
     if (!result.ok()) {
         throw ArrowException("Error doing Arrow action. " + result.status().ToString());
     }
-    return *result;
+    return std::move(result).ValueUnsafe();
 }
@@ -0,0 +1,307 @@
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include <arrow/compute/api.h>
+#include <arrow/dataset/api.h>
+#include <arrow/filesystem/api.h>
+#include <arrow/util/config.h>
+#if ARROW_VERSION_MAJOR >= 21
+#include <arrow/compute/initialize.h>
+#endif
+
+#include "ascii_case.h"
+#include "input_files.h"
+#include "parquet_metadata.h"
+#include "query.h"
+#include "queryplan.h"
+
+#include "arrow_scan.h"
+
+
+namespace cp = arrow::compute;
+
+std::optional<EvaluationBackend> parse_evaluation_backend(
+    const std::string &name
+) {
+    if (name == "duckdb") {
+        return EvaluationBackend::DUCKDB;
+    }
+    if (name == "arrow") {
+        return EvaluationBackend::ARROW;
+    }
+    if (name == "auto") {
+        return EvaluationBackend::AUTO;
+    }
+    return std::nullopt;
+}
+
+std::string to_string(
+    const EvaluationBackend backend
+) {
+    switch (backend) {
+        case EvaluationBackend::DUCKDB:
+            return "duckdb";
+        case EvaluationBackend::ARROW:
+            return "arrow";
+        case EvaluationBackend::AUTO:
+            return "auto";
+    }
+    throw std::logic_error("Unhandled evaluation backend.");
+}
+
+// DuckDb's LIKE has no escape character unless one is given, but Arrow's treats a backslash as one.
+static std::string arrow_like_pattern(
+    const std::string &pattern
+) {
+    std::string escaped;
+    for (const auto c: pattern) {
+        if (c == '\\') {
+            escaped.push_back('\\');
+        }
+        escaped.push_back(c);
+    }
+    return escaped;
+}
+
+// The field a column of the query names. DuckDb matches identifiers case-insensitively, whether quoted or not, and
+// only needs the case to match when that is what tells two columns apart.
+static std::optional<std::string> resolve_column(
+    const arrow::Schema &schema,
+    const std::string &column
+) {
+    std::string name = column;
+    if (column.size() >= 2 && column.front() == '"' && column.back() == '"') {
+        name = column.substr(1, column.size() - 2);
+        if (name.find('"') != std::string::npos) {
+            return std::nullopt;
+        }
+    } else if (!std::ranges::all_of(column, [](const unsigned char c) { return std::isalnum(c) || c == '_'; })) {
+        return std::nullopt;
+    }
+
+    std::vector<std::string> matches;
+    for (const auto &field: schema.fields()) {
+        if (to_lower(field->name()) == to_lower(name)) {
+            matches.push_back(field->name());
+        }
+    }
+    if (matches.size() == 1) {
+        return matches.front();
+    }
+    if (std::ranges::count(matches, name) == 1) {
+        return name;
+    }
+    return std::nullopt;
+}
+
+// The condition's value as a literal of the kind DuckDb would convert it to for a column of this type.
+static std::optional<cp::Expression> literal_for(
+    const QueryParam &value,
+    const arrow::DataType &type
+) {
+    switch (value.type()) {
+        case ParamType::NUMERIC:
+            return cp::literal(value.get<std::int64_t>());
+        case ParamType::TEXT:
+            return cp::literal(value.get<std::string>());
+        case ParamType::UNKNOWN:
+            break;
+    }
+    const auto text = value.get<std::string>();
+    try {
+        if (arrow::is_integer(type.id())) {
+            return cp::literal(static_cast<std::int64_t>(std::stoll(text)));
+        }
+        if (arrow::is_floating(type.id())) {
+            return cp::literal(std::stod(text));
+        }
+    } catch (const std::exception &) {
+        return std::nullopt;
+    }
+    if (arrow::is_string(type.id())) {
+        return cp::literal(text);
+    }
+    return std::nullopt;
+}
+
+static std::optional<cp::Expression> condition_expression(
+    const arrow::Schema &schema,
+    const Condition &condition,
+    std::string &reason
+) {
+    const auto column = resolve_column(schema, condition.column);
+    if (!column) {
+        reason = "'" + condition.column + "' isn't a column of the files";
+        return std::nullopt;
+    }
+    const auto field = cp::field_ref(*column);
+    const auto predicate = to_upper(condition.predicate);
+
+    if (condition.value.is_null()) {
+        if (predicate == "IS" || predicate == "IS NOT") {
+            const auto is_null = cp::is_null(field);
+            return predicate == "IS" ? is_null : cp::not_(is_null);
+        }
+        reason = "the condition " + predicate + " NULL on '" + condition.column + "' isn't supported";
+        return std::nullopt;
+    }
+
+    const auto &type = *schema.GetFieldByName(*column)->type();
+    if (predicate == "LIKE" || predicate == "NOT LIKE" || predicate == "ILIKE" || predicate == "NOT ILIKE") {
+        if (condition.value.type() == ParamType::NUMERIC || !arrow::is_string(type.id())) {
+            reason = predicate + " on '" + condition.column + "' needs a string column and value";
+            return std::nullopt;
+        }
+        const auto pattern = arrow_like_pattern(condition.value.get<std::string>());
+        const auto match = cp::call(
+            "match_like",
+            {field},
+            cp::MatchSubstringOptions(pattern, predicate.ends_with("ILIKE"))
+        );
+        return predicate.starts_with("NOT") ? cp::not_(match) : match;
+    }
+
+    const auto value = literal_for(condition.value, type);
+    if (!value) {
+        reason = "the value of the condition on '" + condition.column + "' can't be compared with its type, "
+                 + type.ToString();
+        return std::nullopt;
+    }
+    if (predicate == "=" || predicate == "==") {
+        return cp::equal(field, *value);
+    }
+    if (predicate == "!=" || predicate == "<>") {
+        return cp::not_equal(field, *value);
+    }
+    if (predicate == "<") {
+        return cp::less(field, *value);
+    }
+    if (predicate == "<=") {
+        return cp::less_equal(field, *value);
+    }
+    if (predicate == ">") {
+        return cp::greater(field, *value);
+    }
+    if (predicate == ">=") {
+        return cp::greater_equal(field, *value);
+    }
+    reason = "the predicate '" + condition.predicate + "' isn't supported";
+    return std::nullopt;
+}
+
+static arrow::Result<std::shared_ptr<arrow::dataset::Dataset> > open_dataset(
+    const std::vector<InputFile> &files
+) {
+#if ARROW_VERSION_MAJOR >= 21
+    // As for the dataset writer, the compute functions filters use have to be registered first.
+    static const auto registered = cp::Initialize();
+    ARROW_RETURN_NOT_OK(registered);
+#endif
+    std::vector<std::string> absolute_paths;
+    for (const auto &file: files) {
+        absolute_paths.push_back(std::filesystem::absolute(file.path).string());
+    }
+    ARROW_ASSIGN_OR_RAISE(
+        const auto factory,
+        arrow::dataset::FileSystemDatasetFactory::Make(
+            std::make_shared<arrow::fs::LocalFileSystem>(),
+            absolute_paths,
+            std::make_shared<arrow::dataset::ParquetFileFormat>(),
+            arrow::dataset::FileSystemFactoryOptions{}
+        )
+    );
+    return factory->Finish();
+}
+
+std::optional<ArrowScan> plan_arrow_scan(
+    const OverallQueryPlan &query_plan,
+    const ArrowScanOptions &options,
+    const std::int64_t batch_rows,
+    std::string &reason
+) {
+    const auto &plans = query_plan.get_plans();
+    if (plans.size() != 1) {
+        reason = "it has more than one stage";
+        return std::nullopt;
+    }
+    const auto &plan = plans.front();
+    if (!plan.select || plan.sql || plan.join || plan.order) {
+        reason = "only selects with conditions and a limit are supported";
+        return std::nullopt;
+    }
+
+    std::vector<InputFile> files;
+    for (const auto &tablename: plan.select->get_tablenames()) {
+        const auto table = parquet_table_files(tablename);
+        if (!table) {
+            reason = tablename + " isn't a quoted local Parquet path or glob";
+            return std::nullopt;
+        }
+        files.insert(files.end(), table->begin(), table->end());
+    }
+    // The dataset takes its columns from the first file and pads the others with nulls where DuckDb would fail, so the
+    // cached footers have to show that every file has the same columns.
+    if (!same_columns(ParquetMetadataCache(default_metadata_cache_directory()).load(files))) {
+        reason = "its files don't all have the same columns";
+        return std::nullopt;
+    }
+
+    const auto scan = [&]() -> arrow::Result<ArrowScan> {
+        ARROW_ASSIGN_OR_RAISE(const auto dataset, open_dataset(files));
+        const auto &schema = *dataset->schema();
+
+        std::vector<cp::Expression> projection;
+        std::vector<std::string> names;
+        for (const auto &column: plan.select->get_columns()) {
+            if (column == "*") {
+                for (const auto &field: schema.fields()) {
+                    projection.push_back(cp::field_ref(field->name()));
+                    names.push_back(field->name());
+                }
+                continue;
+            }
+            const auto name = resolve_column(schema, column);
+            if (!name) {
+                return arrow::Status::Invalid("'", column, "' isn't a column of the files");
+            }
+            projection.push_back(cp::field_ref(*name));
+            names.push_back(*name);
+        }
+
+        auto filter = cp::literal(true);
+        for (const auto &condition: plan.where ? plan.where->get_conditions() : std::vector<Condition>{}) {
+            std::string condition_reason;
+            const auto expression = condition_expression(schema, condition, condition_reason);
+            if (!expression) {
+                return arrow::Status::Invalid(condition_reason);
+            }
+            filter = cp::and_(filter, *expression);
+        }
+
+        ARROW_ASSIGN_OR_RAISE(const auto builder, dataset->NewScan());
+        ARROW_RETURN_NOT_OK(builder->Project(projection, names));
+        ARROW_RETURN_NOT_OK(builder->Filter(filter));
+        ARROW_RETURN_NOT_OK(builder->UseThreads(true));
+        ARROW_RETURN_NOT_OK(builder->BatchReadahead(options.batch_readahead));
+        ARROW_RETURN_NOT_OK(builder->FragmentReadahead(options.fragment_readahead));
+        if (batch_rows > 0) {
+            ARROW_RETURN_NOT_OK(builder->BatchSize(batch_rows));
+        }
+        ARROW_ASSIGN_OR_RAISE(auto scanner, builder->Finish());
+        return ArrowScan{
+            .scanner = std::move(scanner),
+            .limit = plan.limit ? std::make_optional<std::int64_t>(plan.limit->get_limit()) : std::nullopt,
+            .files = files.size()
+        };
+    }();
+    if (!scan.ok()) {
+        reason = scan.status().message();
+        return std::nullopt;
+    }
+    return *scan;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include <arrow/dataset/type_fwd.h>
+
+class OverallQueryPlan;
+
+// What evaluates a query plan: DuckDb, Arrow's Dataset scanner, or the scanner whenever it can (see plan_arrow_scan)
+// and DuckDb otherwise.
+enum class EvaluationBackend : std::uint8_t { DUCKDB, ARROW, AUTO };
+
+std::optional<EvaluationBackend> parse_evaluation_backend(
+    const std::string &name
+);
+
+std::string to_string(
+    EvaluationBackend backend
+);
+
+struct ArrowScanOptions {
+    // Batches read ahead within each file, and files read at once. Arrow's defaults.
+    std::int32_t batch_readahead = 16;
+    std::int32_t fragment_readahead = 4;
+};
+
+struct ArrowScan {
+    std::shared_ptr<arrow::dataset::Scanner> scanner;
+    std::optional<std::int64_t> limit;
+    std::size_t files = 0;
+};
+
+// A multi-threaded scan of the plan's Parquet files with its columns projected and its conditions pushed into the
+// scanner, if the plan is one stage selecting plain columns from quoted local Parquet paths or globs, with conditions
+// comparing plain columns to values (=, !=, <, <=, >, >=, LIKE, NOT LIKE, ILIKE, IS NULL and IS NOT NULL) and at most
+// a LIMIT besides. Column names are matched as DuckDb matches them, case-insensitively. Otherwise returns nullopt and
+// says why in `reason`.
+std::optional<ArrowScan> plan_arrow_scan(
+    const OverallQueryPlan &query_plan,
+    const ArrowScanOptions &options,
+    std::int64_t batch_rows,
+    std::string &reason
+);
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <string>
+
+// ASCII case conversions, which is all SQL keywords and DuckDb's case-insensitive identifiers need.
+inline std::string to_lower(
+    std::string text
+) {
+    std::ranges::transform(text, text.begin(), [](const unsigned char c) {
+        return static_cast<char>(std::tolower(c));
+    });
+    return text;
+}
+
+inline std::string to_upper(
+    std::string text
+) {
+    std::ranges::transform(text, text.begin(), [](const unsigned char c) {
+        return static_cast<char>(std::toupper(c));
+    });
+    return text;
+}
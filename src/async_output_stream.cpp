@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "async_output_stream.h"
+
+
+std::ostream &operator<<(
+    std::ostream &os,
+    const AsyncOutputStats &stats
+) {
+    const auto millis = [](
+        const std::chrono::nanoseconds ns
+    ) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(ns).count();
+    };
+
+    os << "Output: " << stats.bytes << " bytes in " << stats.writes << " writes (" << millis(stats.write_time)
+            << " ms), at most " << stats.max_in_flight_bytes << " bytes in flight; writer waited " << stats.stalls
+            << " times (" << millis(stats.stall_time) << " ms)\n";
+    return os;
+}
+
+static std::size_t aligned_size(
+    const std::size_t size
+) {
+    return (size + AsyncOutputStream::BUFFER_ALIGNMENT - 1) / AsyncOutputStream::BUFFER_ALIGNMENT
+           * AsyncOutputStream::BUFFER_ALIGNMENT;
+}
+
+AsyncOutputStream::AsyncOutputStream(
+    std::shared_ptr<arrow::io::OutputStream> stream,
+    const AsyncOutputOptions &options
+) :
+    stream_(std::move(stream)),
+    buffer_bytes_(aligned_size(std::max<std::size_t>(options.buffer_bytes, 1))),
+    summary_(options.summary),
+    free_(options.buffers),
+    pending_(options.buffers) {
+    if (options.buffers < 2) {
+        throw std::logic_error("Asynchronous output needs at least two buffers.");
+    }
+    for (std::size_t i = 0; i < options.buffers; ++i) {
+        auto *buffer = static_cast<std::byte *>(std::aligned_alloc(BUFFER_ALIGNMENT, buffer_bytes_)); // NOLINT
+        if (buffer == nullptr) {
+            throw std::bad_alloc();
+        }
+        buffers_.emplace_back(buffer);
+        if (i > 0) {
+            free_.push(buffer);
+        }
+    }
+    buffer_ = buffers_.front().get();
+    thread_ = std::jthread([this] { write_blocks(); });
+}
+
+AsyncOutputStream::~AsyncOutputStream() {
+    if (!closed_) {
+        (void) submit_buffer();
+    }
+    stop();
+}
+
+arrow::Status AsyncOutputStream::Write(
+    const void *data,
+    const int64_t nbytes
+) {
+    if (closed_) {
+        return arrow::Status::Invalid("Write to closed stream.");
+    }
+    ARROW_RETURN_NOT_OK(error());
+    const auto *bytes = static_cast<const std::byte *>(data);
+    auto remaining = static_cast<std::size_t>(nbytes);
+    while (remaining > 0) {
+        const auto length = std::min(remaining, buffer_bytes_ - buffer_size_);
+        std::memcpy(buffer_ + buffer_size_, bytes, length);
+        buffer_size_ += length;
+        bytes += length;
+        remaining -= length;
+        if (buffer_size_ == buffer_bytes_) {
+            ARROW_RETURN_NOT_OK(submit_buffer());
+        }
+    }
+    position_ += nbytes;
+    return arrow::Status::OK();
+}
+
+arrow::Status AsyncOutputStream::Flush() {
+    if (closed_) {
+        return arrow::Status::Invalid("Flush on closed stream.");
+    }
+    ARROW_RETURN_NOT_OK(submit_buffer());
+    for (auto in_flight = in_flight_bytes_.load(); in_flight > 0; in_flight = in_flight_bytes_.load()) {
+        in_flight_bytes_.wait(in_flight);
+    }
+    ARROW_RETURN_NOT_OK(error());
+    return stream_->Flush();
+}
+
+arrow::Status AsyncOutputStream::Close() {
+    if (closed_) {
+        return arrow::Status::OK();
+    }
+    const auto status = Flush();
+    closed_ = true;
+    stop();
+    const auto close_status = stream_->Close();
+    return status.ok() ? close_status : status;
+}
+
+arrow::Result<int64_t> AsyncOutputStream::Tell() const {
+    return position_;
+}
+
+bool AsyncOutputStream::closed() const {
+    return closed_;
+}
+
+std::uint64_t AsyncOutputStream::in_flight_bytes() const {
+    return in_flight_bytes_.load();
+}
+
+AsyncOutputStats AsyncOutputStream::stats() const {
+    const auto free_stats = free_.stats();
+    return {
+        .bytes = static_cast<std::uint64_t>(position_),
+        .writes = writes_.load(),
+        .max_in_flight_bytes = max_in_flight_bytes_,
+        .stalls = free_stats.pop_stalls,
+        .stall_time = free_stats.pop_stall_time,
+        .write_time = std::chrono::nanoseconds(write_ns_.load())
+    };
+}
+
+// Hands the buffer being filled to the I/O thread and takes the next free one, waiting for it if all are in flight.
+arrow::Status AsyncOutputStream::submit_buffer() {
+    if (buffer_size_ == 0) {
+        return arrow::Status::OK();
+    }
+    const auto in_flight = in_flight_bytes_.fetch_add(buffer_size_) + buffer_size_;
+    max_in_flight_bytes_ = std::max(max_in_flight_bytes_, in_flight);
+    if (!pending_.push({.data = buffer_, .size = buffer_size_})) {
+        return arrow::Status::Invalid("Write to closed stream.");
+    }
+    buffer_ = *free_.pop();
+    buffer_size_ = 0;
+    return arrow::Status::OK();
+}
+
+// After an error, blocks are dropped rather than written, so that the writer isn't blocked forever.
+void AsyncOutputStream::write_blocks() {
+    while (const auto block = pending_.pop()) {
+        if (error().ok()) {
+            const auto start = std::chrono::steady_clock::now();
+            auto status = stream_->Write(block->data, static_cast<int64_t>(block->size));
+            const auto elapsed = std::chrono::steady_clock::now() - start;
+            write_ns_.fetch_add(static_cast<std::uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()
+            ));
+            writes_.fetch_add(1);
+            if (!status.ok()) {
+                const std::lock_guard lock(error_mutex_);
+                error_ = std::move(status);
+            }
+        }
+        free_.push(block->data);
+        in_flight_bytes_.fetch_sub(block->size);
+        in_flight_bytes_.notify_all();
+    }
+}
+
+arrow::Status AsyncOutputStream::error() const {
+    const std::lock_guard lock(error_mutex_);
+    return error_;
+}
+
+void AsyncOutputStream::stop() {
+    if (stopped_) {
+        return;
+    }
+    stopped_ = true;
+    pending_.close();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    if (summary_) {
+        *summary_ << stats();
+    }
+}
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+#include <arrow/io/api.h>
+
+#include "bounded_queue.h"
+
+struct AsyncOutputOptions {
+    // One buffer is filled while the others are written, so at least two are needed.
+    std::size_t buffers = 4;
+    std::size_t buffer_bytes = 1 << 20;
+    // If set, the stream's statistics are printed here once it is closed or destroyed.
+    std::ostream *summary = nullptr;
+};
+
+struct AsyncOutputStats {
+    std::uint64_t bytes = 0;
+    std::uint64_t writes = 0;
+    std::uint64_t max_in_flight_bytes = 0;
+    // Number of times the writer found every buffer in flight and had to wait, and for how long in total.
+    std::uint64_t stalls = 0;
+    std::chrono::nanoseconds stall_time{0};
+    // Time spent writing to the underlying stream.
+    std::chrono::nanoseconds write_time{0};
+};
+
+std::ostream &operator<<(
+    std::ostream &os,
+    const AsyncOutputStats &stats
+);
+
+// Copies what is written into a ring of page aligned buffers, which a thread of its own writes to the underlying stream
+// in order, so that the writer only waits for I/O once every buffer is in flight. Errors of the underlying stream are
+// returned by the next call after they happen. Flushing waits for everything to be written.
+class AsyncOutputStream final : public arrow::io::OutputStream {
+public:
+    static constexpr std::size_t BUFFER_ALIGNMENT = 4096;
+
+    explicit AsyncOutputStream(
+        std::shared_ptr<arrow::io::OutputStream> stream,
+        const AsyncOutputOptions &options = {}
+    );
+
+    AsyncOutputStream(
+        const AsyncOutputStream &
+    ) = delete;
+
+    AsyncOutputStream &operator=(
+        const AsyncOutputStream &
+    ) = delete;
+
+    // Writes whatever is buffered, but leaves the underlying stream open.
+    ~AsyncOutputStream() override;
+
+    arrow::Status Write(
+        const void *data,
+        int64_t nbytes
+    ) override;
+
+    arrow::Status Flush() override;
+
+    arrow::Status Close() override;
+
+    [[nodiscard]] arrow::Result<int64_t> Tell() const override;
+
+    [[nodiscard]] bool closed() const override;
+
+    // Bytes handed to the I/O thread that it hasn't written yet.
+    [[nodiscard]] std::uint64_t in_flight_bytes() const;
+
+    [[nodiscard]] AsyncOutputStats stats() const;
+
+private:
+    struct FreeBuffer {
+        void operator()(
+            std::byte *buffer
+        ) const {
+            std::free(buffer); // NOLINT(*-no-malloc)
+        }
+    };
+
+    struct Block {
+        std::byte *data;
+        std::size_t size;
+    };
+
+    arrow::Status submit_buffer();
+
+    void write_blocks();
+
+    [[nodiscard]] arrow::Status error() const;
+
+    // Stops the I/O thread once it has written every submitted block, and prints the summary.
+    void stop();
+
+    std::shared_ptr<arrow::io::OutputStream> stream_;
+    std::size_t buffer_bytes_;
+    std::ostream *summary_;
+    std::vector<std::unique_ptr<std::byte, FreeBuffer>> buffers_;
+    BoundedQueue<std::byte *> free_;
+    BoundedQueue<Block> pending_;
+    std::byte *buffer_ = nullptr;
+    std::size_t buffer_size_ = 0;
+    int64_t position_ = 0;
+    bool closed_ = false;
+    bool stopped_ = false;
+    std::uint64_t max_in_flight_bytes_ = 0;
+    std::atomic<std::uint64_t> in_flight_bytes_{0};
+    std::atomic<std::uint64_t> writes_{0};
+    std::atomic<std::uint64_t> write_ns_{0};
+    mutable std::mutex error_mutex_;
+    arrow::Status error_;
+    std::jthread thread_;
+};
@@ -0,0 +1,65 @@
+#include <utility>
+
+#include <arrow/util/byte_size.h>
+
+#include "arrow_result.h"
+
+#include "batch_coalescer.h"
+
+
+BatchCoalescer::BatchCoalescer(
+    std::shared_ptr<arrow::Schema> schema,
+    const std::int64_t target_rows,
+    const std::int64_t target_bytes,
+    Sink sink
+) :
+    schema_(std::move(schema)),
+    target_rows_(target_rows),
+    target_bytes_(target_bytes),
+    sink_(std::move(sink)) {}
+
+void BatchCoalescer::add(
+    std::shared_ptr<arrow::RecordBatch> batch
+) {
+    if (batch->num_rows() == 0) {
+        return;
+    }
+
+    pending_rows_ += batch->num_rows();
+    pending_bytes_ += arrow::util::TotalBufferSize(*batch);
+    pending_.push_back(std::move(batch));
+
+    if (target_reached()) {
+        flush();
+    }
+}
+
+void BatchCoalescer::flush() {
+    if (pending_.empty()) {
+        return;
+    }
+
+    std::shared_ptr<arrow::RecordBatch> combined;
+    if (pending_.size() == 1) {
+        combined = std::move(pending_.front());
+    } else {
+        const auto table = assign_or_raise(arrow::Table::FromRecordBatches(schema_, pending_));
+        combined = assign_or_raise(table->CombineChunksToBatch());
+    }
+
+    pending_.clear();
+    pending_rows_ = 0;
+    pending_bytes_ = 0;
+
+    sink_(std::move(combined));
+}
+
+bool BatchCoalescer::target_reached() const {
+    if (target_rows_ <= 0 && target_bytes_ <= 0) {
+        return true;
+    }
+    if (target_rows_ > 0 && pending_rows_ >= target_rows_) {
+        return true;
+    }
+    return target_bytes_ > 0 && pending_bytes_ >= target_bytes_;
+}
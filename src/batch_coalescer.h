@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <arrow/api.h>
+
+// Accumulates record batches until they reach a target number of rows or bytes, then hands a single combined batch
+// to the sink. A target of zero disables that limit; if both are zero every batch is passed straight through.
+class BatchCoalescer {
+public:
+    using Sink = std::function<void (std::shared_ptr<arrow::RecordBatch>)>;
+
+    BatchCoalescer(
+        std::shared_ptr<arrow::Schema> schema,
+        std::int64_t target_rows,
+        std::int64_t target_bytes,
+        Sink sink
+    );
+
+    void add(
+        std::shared_ptr<arrow::RecordBatch> batch
+    );
+
+    // Emit whatever is left, even if it is smaller than the target.
+    void flush();
+
+private:
+    [[nodiscard]] bool target_reached() const;
+
+    std::shared_ptr<arrow::Schema> schema_;
+    std::int64_t target_rows_;
+    std::int64_t target_bytes_;
+    Sink sink_;
+
+    std::vector<std::shared_ptr<arrow::RecordBatch> > pending_;
+    std::int64_t pending_rows_{0};
+    std::int64_t pending_bytes_{0};
+};
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <utility>
+
+struct QueueStats {
+    // Number of times a producer found the queue full and had to wait, and for how long in total.
+    std::uint64_t push_stalls = 0;
+    std::chrono::nanoseconds push_stall_time{0};
+    // Number of times a consumer found the queue empty and had to wait, and for how long in total.
+    std::uint64_t pop_stalls = 0;
+    std::chrono::nanoseconds pop_stall_time{0};
+};
+
+// Bounded multi-producer, multi-consumer queue. The ring buffer itself is lock-free (Vyukov's sequence-numbered
+// cells); a producer facing a full queue or a consumer facing an empty one parks on an atomic epoch counter instead of
+// spinning, which is what provides the backpressure between pipeline stages.
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(
+        const std::size_t capacity
+    ) :
+        capacity_(std::bit_ceil(capacity < 2 ? std::size_t{2} : capacity)),
+        mask_(capacity_ - 1),
+        cells_(std::make_unique<Cell[]>(capacity_)) {
+        for (std::size_t i = 0; i < capacity_; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(
+        const BoundedQueue &
+    ) = delete;
+
+    BoundedQueue &operator=(
+        const BoundedQueue &
+    ) = delete;
+
+    BoundedQueue(
+        BoundedQueue &&
+    ) = delete;
+
+    BoundedQueue &operator=(
+        BoundedQueue &&
+    ) = delete;
+
+    ~BoundedQueue() = default;
+
+    // Blocks while the queue is full. Returns false, dropping the value, if the queue has been closed.
+    bool push(
+        T value
+    ) {
+        if (closed_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        if (try_push(value)) {
+            notify(pushed_epoch_);
+            return true;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        push_stalls_.fetch_add(1, std::memory_order_relaxed);
+        while (true) {
+            const auto epoch = popped_epoch_.load(std::memory_order_acquire);
+            if (closed_.load(std::memory_order_acquire)) {
+                return false;
+            }
+            if (try_push(value)) {
+                break;
+            }
+            popped_epoch_.wait(epoch, std::memory_order_acquire);
+        }
+        push_stall_ns_.fetch_add(elapsed_since(start), std::memory_order_relaxed);
+        notify(pushed_epoch_);
+        return true;
+    }
+
+    // Blocks while the queue is empty. Returns nullopt once the queue is closed and drained.
+    std::optional<T> pop() {
+        std::optional<T> value = try_pop();
+        if (value) {
+            notify(popped_epoch_);
+            return value;
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        pop_stalls_.fetch_add(1, std::memory_order_relaxed);
+        while (true) {
+            const auto epoch = pushed_epoch_.load(std::memory_order_acquire);
+            const auto closed = closed_.load(std::memory_order_acquire);
+            value = try_pop();
+            if (value || closed) {
+                break;
+            }
+            pushed_epoch_.wait(epoch, std::memory_order_acquire);
+        }
+        pop_stall_ns_.fetch_add(elapsed_since(start), std::memory_order_relaxed);
+        if (value) {
+            notify(popped_epoch_);
+        }
+        return value;
+    }
+
+    // Wakes every waiting thread. Pending values can still be popped, but nothing more can be pushed.
+    void close() {
+        closed_.store(true, std::memory_order_release);
+        notify(pushed_epoch_);
+        notify(popped_epoch_);
+    }
+
+    [[nodiscard]] QueueStats stats() const {
+        return QueueStats{
+            .push_stalls = push_stalls_.load(std::memory_order_relaxed),
+            .push_stall_time = std::chrono::nanoseconds(push_stall_ns_.load(std::memory_order_relaxed)),
+            .pop_stalls = pop_stalls_.load(std::memory_order_relaxed),
+            .pop_stall_time = std::chrono::nanoseconds(pop_stall_ns_.load(std::memory_order_relaxed)),
+        };
+    }
+
+    [[nodiscard]] std::size_t capacity() const {
+        return capacity_;
+    }
+
+private:
+    struct Cell {
+        std::atomic<std::size_t> sequence{0};
+        std::optional<T> value;
+    };
+
+    // The value is only moved from if the push succeeds.
+    bool try_push(
+        T &value
+    ) {
+        auto pos = enqueue_pos_.load(std::memory_order_relaxed);
+        Cell *cell = nullptr;
+        while (true) {
+            cell = &cells_[pos & mask_];
+            const auto sequence = cell->sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+            if (diff == 0) {
+                if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = enqueue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value.emplace(std::move(value));
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    std::optional<T> try_pop() {
+        auto pos = dequeue_pos_.load(std::memory_order_relaxed);
+        Cell *cell = nullptr;
+        while (true) {
+            cell = &cells_[pos & mask_];
+            const auto sequence = cell->sequence.load(std::memory_order_acquire);
+            const auto diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos + 1);
+            if (diff == 0) {
+                if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return std::nullopt;
+            } else {
+                pos = dequeue_pos_.load(std::memory_order_relaxed);
+            }
+        }
+        std::optional<T> value = std::move(cell->value);
+        cell->value.reset();
+        cell->sequence.store(pos + capacity_, std::memory_order_release);
+        return value;
+    }
+
+    static void notify(
+        std::atomic<std::uint32_t> &epoch
+    ) {
+        epoch.fetch_add(1, std::memory_order_release);
+        epoch.notify_all();
+    }
+
+    static std::uint64_t elapsed_since(
+        const std::chrono::steady_clock::time_point start
+    ) {
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    }
+
+    std::size_t capacity_;
+    std::size_t mask_;
+    std::unique_ptr<Cell[]> cells_; // NOLINT(*-avoid-c-arrays)
+
+    alignas(64) std::atomic<std::size_t> enqueue_pos_{0};
+    alignas(64) std::atomic<std::size_t> dequeue_pos_{0};
+
+    // Bumped after every successful push/pop so that blocked threads have something to wait on.
+    alignas(64) std::atomic<std::uint32_t> pushed_epoch_{0};
+    alignas(64) std::atomic<std::uint32_t> popped_epoch_{0};
+    std::atomic<bool> closed_{false};
+
+    std::atomic<std::uint64_t> push_stalls_{0};
+    std::atomic<std::uint64_t> push_stall_ns_{0};
+    std::atomic<std::uint64_t> pop_stalls_{0};
+    std::atomic<std::uint64_t> pop_stall_ns_{0};
+};
@@ -0,0 +1,160 @@
+#include <array>
+#include <cerrno>
+#include <csignal>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cancellation.h"
+
+
+constexpr int WATCH_INTERVAL_MS = 100;
+
+namespace {
+// The signal handler can't do more than write to this pipe, which the watcher thread polls.
+std::array<int, 2> signal_pipe{-1, -1};
+volatile std::sig_atomic_t signals_received = 0;
+struct sigaction previous_sigint{};
+struct sigaction previous_sigterm{};
+
+void on_signal(
+    const int signal
+) {
+    if (signals_received != 0) {
+        std::signal(signal, SIG_DFL);
+        std::raise(signal);
+        return;
+    }
+    signals_received = 1;
+    const auto saved_errno = errno;
+    const char byte = 0;
+    [[maybe_unused]] const auto written = write(signal_pipe[1], &byte, 1);
+    errno = saved_errno;
+}
+
+void install_signal_handlers() {
+    if (signal_pipe[0] == -1 && pipe2(signal_pipe.data(), O_CLOEXEC | O_NONBLOCK) != 0) {
+        return;
+    }
+    signals_received = 0;
+    struct sigaction action{};
+    action.sa_handler = on_signal;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGINT, &action, &previous_sigint);
+    sigaction(SIGTERM, &action, &previous_sigterm);
+}
+
+void restore_signal_handlers() {
+    sigaction(SIGINT, &previous_sigint, nullptr);
+    sigaction(SIGTERM, &previous_sigterm, nullptr);
+}
+
+bool is_pipe_or_socket(
+    const int fd
+) {
+    struct stat status{};
+    return fstat(fd, &status) == 0 && (S_ISFIFO(status.st_mode) || S_ISSOCK(status.st_mode));
+}
+}
+
+CancellationToken::Registration::Registration(
+    CancellationToken *token,
+    const std::uint64_t id
+) :
+    token_(token),
+    id_(id) {}
+
+CancellationToken::Registration::~Registration() {
+    const std::lock_guard lock(token_->mutex_);
+    token_->callbacks_.erase(id_);
+}
+
+void CancellationToken::cancel(
+    const CancelReason reason
+) {
+    // Callbacks run under the lock, so a Registration being destroyed waits for its callback to return.
+    const std::lock_guard lock(mutex_);
+    auto expected = CancelReason::NONE;
+    if (!reason_.compare_exchange_strong(expected, reason, std::memory_order_acq_rel)) {
+        return;
+    }
+    for (const auto &[id, callback]: callbacks_) {
+        callback();
+    }
+}
+
+std::unique_ptr<CancellationToken::Registration> CancellationToken::on_cancel(
+    CancellationToken *token,
+    std::function<void ()> callback
+) {
+    if (token == nullptr) {
+        return nullptr;
+    }
+    const std::lock_guard lock(token->mutex_);
+    if (token->cancelled()) {
+        callback();
+    }
+    const auto id = token->next_id_++;
+    token->callbacks_.emplace(id, std::move(callback));
+    return std::make_unique<Registration>(token, id);
+}
+
+CancellationWatcher::CancellationWatcher(
+    CancellationToken &token,
+    std::optional<int> output_fd,
+    const bool handle_signals
+) :
+    handle_signals_(handle_signals) {
+    // Terminals and regular files don't go away while being written to.
+    if (output_fd && !is_pipe_or_socket(*output_fd)) {
+        output_fd.reset();
+    }
+    if (handle_signals_) {
+        install_signal_handlers();
+    }
+
+    std::vector<pollfd> fds;
+    if (output_fd) {
+        // With no events requested, poll only reports POLLERR (a pipe's reader closed it) and POLLHUP (a socket's peer
+        // closed it).
+        fds.push_back({.fd = *output_fd, .events = 0, .revents = 0});
+    }
+    if (handle_signals_ && signal_pipe[0] != -1) {
+        fds.push_back({.fd = signal_pipe[0], .events = POLLIN, .revents = 0});
+    }
+    if (fds.empty()) {
+        return;
+    }
+
+    thread_ = std::jthread([&token, fds](
+        const std::stop_token &stop
+    ) mutable {
+        while (!stop.stop_requested()) {
+            if (poll(fds.data(), fds.size(), WATCH_INTERVAL_MS) <= 0) {
+                continue;
+            }
+            for (auto &fd: fds) {
+                if (fd.revents == 0) {
+                    continue;
+                }
+                token.cancel(fd.fd == signal_pipe[0] ? CancelReason::SIGNAL : CancelReason::OUTPUT_CLOSED);
+                // Negative descriptors are skipped by poll, so this one isn't reported again.
+                fd.fd = -1;
+            }
+        }
+    });
+}
+
+CancellationWatcher::~CancellationWatcher() {
+    if (thread_.joinable()) {
+        thread_.request_stop();
+        thread_.join();
+    }
+    if (handle_signals_) {
+        restore_signal_handlers();
+    }
+}
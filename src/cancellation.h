@@ -0,0 +1,107 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+// Why evaluation stopped before producing the whole result.
+enum class CancelReason : std::uint8_t { NONE, OUTPUT_CLOSED, SIGNAL };
+
+// Shared by whatever notices that the results are no longer wanted and the query producing them. Only the first
+// reason is kept.
+class CancellationToken {
+public:
+    // Unregisters its callback when destroyed.
+    class Registration {
+    public:
+        Registration(
+            CancellationToken *token,
+            std::uint64_t id
+        );
+
+        Registration(
+            const Registration &
+        ) = delete;
+
+        Registration &operator=(
+            const Registration &
+        ) = delete;
+
+        Registration(
+            Registration &&
+        ) = delete;
+
+        Registration &operator=(
+            Registration &&
+        ) = delete;
+
+        ~Registration();
+
+    private:
+        CancellationToken *token_;
+        std::uint64_t id_;
+    };
+
+    void cancel(
+        CancelReason reason
+    );
+
+    [[nodiscard]] CancelReason reason() const {
+        return reason_.load(std::memory_order_acquire);
+    }
+
+    [[nodiscard]] bool cancelled() const {
+        return reason() != CancelReason::NONE;
+    }
+
+    // Called on whichever thread cancels, or straight away if that has already happened. A null token registers
+    // nothing, so callers needn't check whether cancellation is in use.
+    [[nodiscard]] static std::unique_ptr<Registration> on_cancel(
+        CancellationToken *token,
+        std::function<void ()> callback
+    );
+
+private:
+    std::atomic<CancelReason> reason_{CancelReason::NONE};
+    std::mutex mutex_;
+    std::map<std::uint64_t, std::function<void ()> > callbacks_;
+    std::uint64_t next_id_ = 0;
+};
+
+// Cancels the token when the reader of an output pipe or socket goes away, and optionally on SIGINT or SIGTERM. A
+// second signal kills the process as usual.
+class CancellationWatcher {
+public:
+    CancellationWatcher(
+        CancellationToken &token,
+        std::optional<int> output_fd,
+        bool handle_signals
+    );
+
+    CancellationWatcher(
+        const CancellationWatcher &
+    ) = delete;
+
+    CancellationWatcher &operator=(
+        const CancellationWatcher &
+    ) = delete;
+
+    CancellationWatcher(
+        CancellationWatcher &&
+    ) = delete;
+
+    CancellationWatcher &operator=(
+        CancellationWatcher &&
+    ) = delete;
+
+    ~CancellationWatcher();
+
+private:
+    bool handle_signals_;
+    std::jthread thread_;
+};
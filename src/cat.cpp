@@ -3,10 +3,13 @@
 #include <boost/program_options.hpp>
 #include <boost/optional.hpp>
 
+#include "engine.h"
 #include "options.h"
+#include "partitioning.h"
 #include "query.h"
 #include "queryplan.h"
 #include "serde.h"
+#include "stages.h"
 
 
 class CatOptions final : public Options {
@@ -18,25 +21,74 @@ public:
         description().add_options()
         ("dataset,d", po::value(&datasets_)->composing(), "Dataset location.")
         ("alias,a", po::value(&alias_), "Alias used for this dataset.")
+        ("no-schema", po::bool_switch(&no_schema_), "Don't resolve the dataset schema now; leave it to 'deval'.")
+        ("partitioned", po::value(&partitioned_),
+            "Directory of a partitioned Parquet dataset, to read instead of a dataset.")
+        ("partitioning", po::value(&partitioning_)->default_value("hive"),
+            "How partition values are encoded in directory names: 'hive' (key=value) or 'directory:col1,col2'.")
         ;
         // clang-format on
-        add_positional_argument("dataset", {.min_args = 1, .max_args = std::nullopt});
+        add_positional_argument("dataset", {.min_args = 0, .max_args = std::nullopt});
+    }
+
+    bool parse(
+        const int argc,
+        const char *argv[]
+    ) override { // NOLINT(*-avoid-c-arrays)
+        if (!Options::parse(argc, argv)) {
+            return false;
+        }
+
+        if (datasets_.empty() == !partitioned_) {
+            std::cerr << "Give either a dataset or --partitioned.\n";
+            return false;
+        }
+        if (!partitioned_) {
+            return true;
+        }
+
+        const auto partitioning = parse_partitioning(partitioning_);
+        if (!partitioning) {
+            std::cerr << "Partitioning must be 'hive' or 'directory:' followed by column names, not '" << partitioning_
+                    << "'.\n";
+            return false;
+        }
+        try {
+            partitions_ = discover_partitions(*partitioned_, partitioning->first, partitioning->second);
+        } catch (const std::runtime_error &error) {
+            std::cerr << error.what() << '\n';
+            return false;
+        }
+        datasets_ = {partitioned_table_expression(*partitions_)};
+        return true;
     }
 
     [[nodiscard]] std::vector<std::string> get_datasets() const {
         return datasets_;
     }
 
+    [[nodiscard]] std::optional<PartitionedDataset> get_partitions() const {
+        return partitions_;
+    }
+
     [[nodiscard ]] std::optional<std::string> get_alias() const {
         return alias_ ? std::make_optional(*alias_) : std::nullopt;
     }
 
+    [[nodiscard]] bool resolve_schema() const {
+        return !no_schema_;
+    }
+
 private:
     std::vector<std::string> datasets_;
     boost::optional<std::string> alias_;
+    bool no_schema_ = false;
+    boost::optional<std::string> partitioned_;
+    std::string partitioning_;
+    std::optional<PartitionedDataset> partitions_;
 };
 
-int main(
+int cat_main(
     const int argc,
     const char *argv[]
 ) {
@@ -53,6 +105,15 @@ int main(
     QueryPlan query_plan;
     query_plan.select = SelectFragment(options.get_datasets(), {"*"}, options.get_alias());
 
+    // Resolving the schema once here saves every later stage (and deval) from re-reading the file footers.
+    if (options.resolve_schema()) {
+        if (const auto schema = engine().resolve_select_schema(overall_plan, *query_plan.select)) {
+            query_plan.select = SelectFragment(options.get_datasets(), {"*"}, options.get_alias(), schema);
+            query_plan.schema = schema;
+        }
+    }
+
+    query_plan.partitions = options.get_partitions();
     overall_plan.add_plan(query_plan);
 
     return static_cast<int>(dump_or_eval_query_plan(overall_plan));
@@ -0,0 +1,233 @@
+#include <sstream>
+#include <string_view>
+#include <utility>
+
+#include <arrow/pretty_print.h>
+#include <arrow/util/config.h>
+#include <arrow/util/formatting.h>
+
+#include "cell_formatter.h"
+
+
+constexpr std::string_view NULL_TEXT = "null";
+
+// Runs of newlines become a single space, so every row stays on one line.
+static void append_single_line(
+    std::string_view text,
+    std::string &out
+) {
+    while (true) {
+        const auto newline = text.find('\n');
+        out.append(text.substr(0, newline));
+        if (newline == std::string_view::npos) {
+            return;
+        }
+        out.push_back(' ');
+        const auto next = text.find_first_not_of('\n', newline);
+        if (next == std::string_view::npos) {
+            return;
+        }
+        text.remove_prefix(next);
+    }
+}
+
+namespace {
+// Numbers, dates, times and timestamps, formatted the way Arrow formats them when casting to strings.
+template<typename ArrowType>
+class ValueFormatter final : public CellFormatter {
+    using ArrayType = typename arrow::TypeTraits<ArrowType>::ArrayType;
+
+public:
+    explicit ValueFormatter(
+        std::shared_ptr<arrow::Array> array
+    ) :
+        array_(std::static_pointer_cast<ArrayType>(std::move(array))),
+        formatter_(array_->type().get()) {}
+
+    void append(
+        const std::int64_t row,
+        std::string &out
+    ) override {
+        if (array_->IsNull(row)) {
+            out.append(NULL_TEXT);
+            return;
+        }
+        formatter_(array_->Value(row), [&out](const std::string_view text) { out.append(text); });
+    }
+
+private:
+    std::shared_ptr<ArrayType> array_;
+    arrow::internal::StringFormatter<ArrowType> formatter_;
+};
+
+template<typename ArrayType>
+class DecimalFormatter final : public CellFormatter {
+public:
+    explicit DecimalFormatter(
+        std::shared_ptr<arrow::Array> array
+    ) :
+        array_(std::static_pointer_cast<ArrayType>(std::move(array))) {}
+
+    void append(
+        const std::int64_t row,
+        std::string &out
+    ) override {
+        if (array_->IsNull(row)) {
+            out.append(NULL_TEXT);
+            return;
+        }
+        out.append(array_->FormatValue(row));
+    }
+
+private:
+    std::shared_ptr<ArrayType> array_;
+};
+
+// Strings are quoted.
+template<typename ArrayType>
+class TextFormatter final : public CellFormatter {
+public:
+    explicit TextFormatter(
+        std::shared_ptr<arrow::Array> array
+    ) :
+        array_(std::static_pointer_cast<ArrayType>(std::move(array))) {}
+
+    void append(
+        const std::int64_t row,
+        std::string &out
+    ) override {
+        if (array_->IsNull(row)) {
+            out.append(NULL_TEXT);
+            return;
+        }
+        out.push_back('"');
+        append_single_line(array_->GetView(row), out);
+        out.push_back('"');
+    }
+
+private:
+    std::shared_ptr<ArrayType> array_;
+};
+
+// Writes the dictionary value rather than the index.
+class DictionaryFormatter final : public CellFormatter {
+public:
+    explicit DictionaryFormatter(
+        std::shared_ptr<arrow::Array> array
+    ) :
+        array_(std::static_pointer_cast<arrow::DictionaryArray>(std::move(array))),
+        values_(make_cell_formatter(array_->dictionary())) {}
+
+    void append(
+        const std::int64_t row,
+        std::string &out
+    ) override {
+        if (array_->IsNull(row)) {
+            out.append(NULL_TEXT);
+            return;
+        }
+        values_->append(array_->GetValueIndex(row), out);
+    }
+
+private:
+    std::shared_ptr<arrow::DictionaryArray> array_;
+    std::unique_ptr<CellFormatter> values_;
+};
+
+class PrettyPrintFormatter final : public CellFormatter {
+public:
+    explicit PrettyPrintFormatter(
+        std::shared_ptr<arrow::Array> array
+    ) :
+        array_(std::move(array)) {
+        options_.show_field_metadata = false;
+        options_.array_delimiters = {.open = "", .close = ""};
+        options_.indent_size = 0;
+        options_.skip_new_lines = true;
+    }
+
+    void append(
+        const std::int64_t row,
+        std::string &out
+    ) override {
+        stream_.str({});
+        if (const auto status = arrow::PrettyPrint(*array_->Slice(row, 1), options_, &stream_); !status.ok()) {
+            throw std::runtime_error("Error printing column: " + status.ToString());
+        }
+        const auto printed = stream_.str();
+
+        // Nested types have `-- child 0 type: ...` style comments, each ending at a newline.
+        std::string_view text(printed);
+        while (true) {
+            const auto comment = text.find("--");
+            const auto end = comment == std::string_view::npos ? comment : text.find('\n', comment);
+            if (end == std::string_view::npos) {
+                break;
+            }
+            append_single_line(text.substr(0, comment), out);
+            text.remove_prefix(end + 1);
+        }
+        append_single_line(text, out);
+    }
+
+private:
+    std::shared_ptr<arrow::Array> array_;
+    arrow::PrettyPrintOptions options_;
+    std::ostringstream stream_;
+};
+}
+
+std::unique_ptr<CellFormatter> make_cell_formatter(
+    std::shared_ptr<arrow::Array> array
+) {
+    switch (array->type_id()) {
+        case arrow::Type::BOOL:
+            return std::make_unique<ValueFormatter<arrow::BooleanType> >(std::move(array));
+        case arrow::Type::INT8:
+            return std::make_unique<ValueFormatter<arrow::Int8Type> >(std::move(array));
+        case arrow::Type::INT16:
+            return std::make_unique<ValueFormatter<arrow::Int16Type> >(std::move(array));
+        case arrow::Type::INT32:
+            return std::make_unique<ValueFormatter<arrow::Int32Type> >(std::move(array));
+        case arrow::Type::INT64:
+            return std::make_unique<ValueFormatter<arrow::Int64Type> >(std::move(array));
+        case arrow::Type::UINT8:
+            return std::make_unique<ValueFormatter<arrow::UInt8Type> >(std::move(array));
+        case arrow::Type::UINT16:
+            return std::make_unique<ValueFormatter<arrow::UInt16Type> >(std::move(array));
+        case arrow::Type::UINT32:
+            return std::make_unique<ValueFormatter<arrow::UInt32Type> >(std::move(array));
+        case arrow::Type::UINT64:
+            return std::make_unique<ValueFormatter<arrow::UInt64Type> >(std::move(array));
+        case arrow::Type::FLOAT:
+            return std::make_unique<ValueFormatter<arrow::FloatType> >(std::move(array));
+        case arrow::Type::DOUBLE:
+            return std::make_unique<ValueFormatter<arrow::DoubleType> >(std::move(array));
+        case arrow::Type::DATE32:
+            return std::make_unique<ValueFormatter<arrow::Date32Type> >(std::move(array));
+        case arrow::Type::DATE64:
+            return std::make_unique<ValueFormatter<arrow::Date64Type> >(std::move(array));
+        case arrow::Type::TIME32:
+            return std::make_unique<ValueFormatter<arrow::Time32Type> >(std::move(array));
+        case arrow::Type::TIME64:
+            return std::make_unique<ValueFormatter<arrow::Time64Type> >(std::move(array));
+        case arrow::Type::TIMESTAMP:
+            return std::make_unique<ValueFormatter<arrow::TimestampType> >(std::move(array));
+        case arrow::Type::DECIMAL128:
+            return std::make_unique<DecimalFormatter<arrow::Decimal128Array> >(std::move(array));
+        case arrow::Type::DECIMAL256:
+            return std::make_unique<DecimalFormatter<arrow::Decimal256Array> >(std::move(array));
+        case arrow::Type::STRING:
+            return std::make_unique<TextFormatter<arrow::StringArray> >(std::move(array));
+        case arrow::Type::LARGE_STRING:
+            return std::make_unique<TextFormatter<arrow::LargeStringArray> >(std::move(array));
+#if ARROW_VERSION_MAJOR >= 15
+        case arrow::Type::STRING_VIEW:
+            return std::make_unique<TextFormatter<arrow::StringViewArray> >(std::move(array));
+#endif
+        case arrow::Type::DICTIONARY:
+            return std::make_unique<DictionaryFormatter>(std::move(array));
+        default:
+            return std::make_unique<PrettyPrintFormatter>(std::move(array));
+    }
+}
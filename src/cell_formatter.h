@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <arrow/api.h>
+
+// Appends the text of a cell to a string, reading straight from the array's buffers. Values are written as Arrow's
+// pretty printer writes them, but always on a single line. Made once per batch, since it holds on to the array.
+class CellFormatter {
+public:
+    virtual ~CellFormatter() = default;
+
+    CellFormatter() = default;
+
+    CellFormatter(
+        const CellFormatter &
+    ) = delete;
+
+    CellFormatter &operator=(
+        const CellFormatter &
+    ) = delete;
+
+    CellFormatter(
+        CellFormatter &&
+    ) = delete;
+
+    CellFormatter &operator=(
+        CellFormatter &&
+    ) = delete;
+
+    // Nulls are written as `null`.
+    virtual void append(
+        std::int64_t row,
+        std::string &out
+    ) = 0;
+};
+
+// Numbers, dates, times, timestamps, strings and dictionaries have their own formatters. Anything else, such as lists
+// and structs, falls back to pretty printing a slice of the array for each cell.
+std::unique_ptr<CellFormatter> make_cell_formatter(
+    std::shared_ptr<arrow::Array> array
+);
@@ -0,0 +1,177 @@
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <utility>
+
+#include <arrow/util/io_util.h>
+
+#include "arrow_result.h"
+#include "writer.h"
+
+#include "compressed_stream.h"
+
+
+std::optional<StreamCompression> parse_stream_compression(
+    const std::string &spec
+) {
+    const auto separator = spec.find(':');
+    const auto name = spec.substr(0, separator);
+    StreamCompression compression;
+    if (name == "gzip") {
+        compression.codec = arrow::Compression::GZIP;
+    } else if (name == "zstd") {
+        compression.codec = arrow::Compression::ZSTD;
+    } else {
+        return std::nullopt;
+    }
+    if (separator != std::string::npos) {
+        const auto level = std::string_view(spec).substr(separator + 1);
+        int value = 0;
+        const auto [end, error] = std::from_chars(level.data(), level.data() + level.size(), value);
+        if (level.empty() || error != std::errc{} || end != level.data() + level.size()) {
+            return std::nullopt;
+        }
+        compression.level = value;
+    }
+    return compression;
+}
+
+std::string stream_compression_spec(
+    const StreamCompression &compression
+) {
+    if (!compression.enabled()) {
+        return "";
+    }
+    const std::string name = compression.codec == arrow::Compression::GZIP ? "gzip" : "zstd";
+    return compression.level ? name + ":" + std::to_string(*compression.level) : name;
+}
+
+std::optional<StreamCompression> stream_compression_for_path(
+    const std::string &path
+) {
+    if (path.ends_with(".gz")) {
+        return StreamCompression{.codec = arrow::Compression::GZIP, .level = std::nullopt};
+    }
+    if (path.ends_with(".zst") || path.ends_with(".zstd")) {
+        return StreamCompression{.codec = arrow::Compression::ZSTD, .level = std::nullopt};
+    }
+    return std::nullopt;
+}
+
+std::shared_ptr<arrow::io::OutputStream> compress_stream(
+    std::shared_ptr<arrow::io::OutputStream> stream,
+    const StreamCompression &compression
+) {
+    if (!compression.enabled()) {
+        return stream;
+    }
+    return std::make_shared<ParallelCompressedOutputStream>(std::move(stream), compression);
+}
+
+// Keeps the errno of a closed output in the status, so that writers can tell it from other failures.
+template<typename Action>
+static arrow::Status capture_status(
+    Action &&action
+) {
+    try {
+        action();
+        return arrow::Status::OK();
+    } catch (const OutputClosedException &e) {
+        return arrow::internal::IOErrorFromErrno(EPIPE, e.what());
+    } catch (const std::exception &e) {
+        return arrow::Status::IOError(e.what());
+    }
+}
+
+ParallelCompressedOutputStream::ParallelCompressedOutputStream(
+    std::shared_ptr<arrow::io::OutputStream> stream,
+    StreamCompression compression,
+    const std::size_t threads
+) :
+    stream_(stream),
+    compression_(std::move(compression)),
+    encoder_(std::move(stream), "Error writing compressed output", threads) {
+    // Fails early for an unsupported codec or level.
+    assign_or_raise(arrow::util::Codec::Create(
+        compression_.codec,
+        compression_.level.value_or(arrow::util::kUseDefaultCompressionLevel)
+    ));
+    buffer_.reserve(BLOCK_BYTES);
+}
+
+arrow::Status ParallelCompressedOutputStream::Write(
+    const void *data,
+    const int64_t nbytes
+) {
+    if (closed_) {
+        return arrow::Status::Invalid("Write to closed stream.");
+    }
+    return capture_status([&] {
+        const auto *bytes = static_cast<const char *>(data);
+        auto remaining = nbytes;
+        while (remaining > 0) {
+            const auto length = std::min(remaining, BLOCK_BYTES - static_cast<int64_t>(buffer_.size()));
+            buffer_.append(bytes, static_cast<std::size_t>(length));
+            bytes += length;
+            remaining -= length;
+            position_ += length;
+            if (static_cast<int64_t>(buffer_.size()) == BLOCK_BYTES) {
+                submit_block();
+            }
+        }
+        encoder_.write_ready();
+    });
+}
+
+arrow::Status ParallelCompressedOutputStream::Flush() {
+    return capture_status([this] {
+        submit_block();
+        encoder_.flush();
+    });
+}
+
+arrow::Status ParallelCompressedOutputStream::Close() {
+    if (closed_) {
+        return arrow::Status::OK();
+    }
+    closed_ = true;
+    ARROW_RETURN_NOT_OK(Flush());
+    return stream_->Close();
+}
+
+arrow::Result<int64_t> ParallelCompressedOutputStream::Tell() const {
+    return position_;
+}
+
+bool ParallelCompressedOutputStream::closed() const {
+    return closed_;
+}
+
+// Codecs keep state between calls, so each block gets its own.
+void ParallelCompressedOutputStream::submit_block() {
+    if (buffer_.empty()) {
+        return;
+    }
+    encoder_.submit([compression = compression_, block = std::move(buffer_)] {
+        const auto codec = assign_or_raise(arrow::util::Codec::Create(
+            compression.codec,
+            compression.level.value_or(arrow::util::kUseDefaultCompressionLevel)
+        ));
+        const auto *input = reinterpret_cast<const uint8_t *>(block.data());
+        const auto input_length = static_cast<int64_t>(block.size());
+        std::string compressed(static_cast<std::size_t>(codec->MaxCompressedLen(input_length, input)), '\0');
+        const auto length = codec->Compress(
+            input_length,
+            input,
+            static_cast<int64_t>(compressed.size()),
+            reinterpret_cast<uint8_t *>(compressed.data())
+        );
+        if (!length.ok()) {
+            throw std::runtime_error("Error compressing output: " + length.status().ToString());
+        }
+        compressed.resize(static_cast<std::size_t>(*length));
+        return compressed;
+    });
+    buffer_ = {};
+    buffer_.reserve(BLOCK_BYTES);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include <arrow/io/api.h>
+#include <arrow/util/compression.h>
+
+#include "parallel_encoder.h"
+
+// Compression of a whole output stream, as opposed to the buffers or pages of Arrow and Parquet output.
+struct StreamCompression {
+    arrow::Compression::type codec = arrow::Compression::UNCOMPRESSED;
+    std::optional<int> level;
+
+    [[nodiscard]] bool enabled() const {
+        return codec != arrow::Compression::UNCOMPRESSED;
+    }
+};
+
+// "gzip" or "zstd", optionally followed by ":<level>".
+std::optional<StreamCompression> parse_stream_compression(
+    const std::string &spec
+);
+
+std::string stream_compression_spec(
+    const StreamCompression &compression
+);
+
+// gzip for `.gz` and zstd for `.zst` or `.zstd`.
+std::optional<StreamCompression> stream_compression_for_path(
+    const std::string &path
+);
+
+// Returns the stream itself if compression isn't enabled.
+std::shared_ptr<arrow::io::OutputStream> compress_stream(
+    std::shared_ptr<arrow::io::OutputStream> stream,
+    const StreamCompression &compression
+);
+
+// Cuts what is written into blocks of BLOCK_BYTES and compresses each on a pool of threads as an independent gzip
+// member or zstd frame. Decompressors read the concatenated blocks as a single stream. Flushing compresses whatever
+// is buffered as a shorter block. Tell() is the uncompressed position.
+class ParallelCompressedOutputStream final : public arrow::io::OutputStream {
+public:
+    static constexpr std::int64_t BLOCK_BYTES = 4 << 20;
+
+    ParallelCompressedOutputStream(
+        std::shared_ptr<arrow::io::OutputStream> stream,
+        StreamCompression compression,
+        std::size_t threads = 0
+    );
+
+    arrow::Status Write(
+        const void *data,
+        int64_t nbytes
+    ) override;
+
+    arrow::Status Flush() override;
+
+    arrow::Status Close() override;
+
+    [[nodiscard]] arrow::Result<int64_t> Tell() const override;
+
+    [[nodiscard]] bool closed() const override;
+
+private:
+    void submit_block();
+
+    std::shared_ptr<arrow::io::OutputStream> stream_;
+    StreamCompression compression_;
+    std::string buffer_;
+    int64_t position_ = 0;
+    bool closed_ = false;
+    ParallelEncoder encoder_;
+};
@@ -8,6 +8,7 @@
 #include "query.h"
 #include "queryplan.h"
 #include "serde.h"
+#include "stages.h"
 
 
 class CutOptions final : public Options {
@@ -31,7 +32,7 @@ private:
 };
 
 
-int main(
+int cut_main(
     const int argc,
     const char *argv[]
 ) {
@@ -51,11 +52,16 @@ int main(
     }
 
     auto &query_plan = overall_query_plan->get_plans().back();
+    const auto source_schema = query_plan.select->get_schema();
     query_plan.select.emplace(
         query_plan.select->get_tablenames(),
         options.get_fields(),
-        query_plan.select->get_alias()
+        query_plan.select->get_alias(),
+        source_schema
     );
+    query_plan.schema = source_schema && !query_plan.join
+                            ? project_schema(*source_schema, options.get_fields())
+                            : std::nullopt;
 
     return static_cast<int>(dump_or_eval_query_plan(*overall_query_plan));
 }
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <optional>
+
+#include "exit_status.h"
+
+class OverallQueryPlan;
+class SelectFragment;
+struct ResolvedSchema;
+
+// What the stages need of DuckDb and Arrow. The stages are a single executable that only rewrites query plans, and
+// loads the engine module, which links DuckDb and Arrow, the first time one of them has to evaluate something.
+struct Engine {
+    int (*eval_main)(
+        int argc,
+        const char *argv[] // NOLINT(*-avoid-c-arrays)
+    );
+
+    // Evaluates to stdout as CSV, on the evaluation server if one is running.
+    ExitStatus (*evaluate_to_stdout)(
+        const OverallQueryPlan &query_plan
+    );
+
+    std::optional<ResolvedSchema> (*resolve_select_schema)(
+        const OverallQueryPlan &query_plan,
+        const SelectFragment &select
+    );
+};
+
+// Name of the function the engine module exports, returning a pointer to its Engine.
+constexpr auto ENGINE_ENTRY_POINT = "deval_engine";
+
+// Loads the engine module on first use, or throws a std::runtime_error if it can't. Within the module itself, returns
+// its own entry points.
+const Engine &engine();
+
+// `deval`, which is defined by the engine module.
+int eval_main(
+    int argc,
+    const char *argv[] // NOLINT(*-avoid-c-arrays)
+);
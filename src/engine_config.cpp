@@ -0,0 +1,157 @@
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <utility>
+
+#include <duckdb.hpp>
+
+#include "engine_config.h"
+
+
+static std::optional<std::string> environment_value(
+    const char *name
+) {
+    const char *value = std::getenv(name); // NOLINT(*-mt-unsafe)
+    if (value == nullptr || *value == '\0') {
+        return std::nullopt;
+    }
+    return std::string(value);
+}
+
+static bool parse_bool(
+    const std::string &name,
+    const std::string &value
+) {
+    if (value == "1" || value == "true" || value == "yes" || value == "on") {
+        return true;
+    }
+    if (value == "0" || value == "false" || value == "no" || value == "off") {
+        return false;
+    }
+    throw std::runtime_error("Environment variable " + name + " must be a boolean, not '" + value + "'.");
+}
+
+EngineOptions with_environment_defaults(
+    EngineOptions options
+) {
+    if (!options.threads) {
+        if (const auto value = environment_value("DEVAL_THREADS")) {
+            try {
+                options.threads = std::stoll(*value);
+            } catch (const std::exception &) {
+                throw std::runtime_error(
+                    "Environment variable DEVAL_THREADS must be an integer, not '" + *value + "'."
+                );
+            }
+        }
+    }
+    if (!options.memory_limit) {
+        options.memory_limit = environment_value("DEVAL_MEMORY_LIMIT");
+    }
+    if (!options.temp_directory) {
+        options.temp_directory = environment_value("DEVAL_TEMP_DIRECTORY");
+    }
+    if (!options.max_temp_directory_size) {
+        options.max_temp_directory_size = environment_value("DEVAL_MAX_TEMP_DIRECTORY_SIZE");
+    }
+    if (!options.preserve_insertion_order) {
+        if (const auto value = environment_value("DEVAL_PRESERVE_INSERTION_ORDER")) {
+            options.preserve_insertion_order = parse_bool("DEVAL_PRESERVE_INSERTION_ORDER", *value);
+        }
+    }
+    return options;
+}
+
+void configure_engine(
+    duckdb::DBConfig &config,
+    const EngineOptions &options
+) {
+    if (options.threads) {
+        config.SetOptionByName("threads", duckdb::Value::BIGINT(*options.threads));
+    }
+    if (options.memory_limit) {
+        config.SetOptionByName("memory_limit", duckdb::Value(*options.memory_limit));
+    }
+    if (options.temp_directory) {
+        config.SetOptionByName("temp_directory", duckdb::Value(*options.temp_directory));
+    }
+    if (options.max_temp_directory_size) {
+        config.SetOptionByName("max_temp_directory_size", duckdb::Value(*options.max_temp_directory_size));
+    }
+    if (options.preserve_insertion_order) {
+        config.SetOptionByName("preserve_insertion_order", duckdb::Value::BOOLEAN(*options.preserve_insertion_order));
+    }
+    if (options.cache_metadata) {
+        config.SetOptionByName("parquet_metadata_cache", duckdb::Value::BOOLEAN(true));
+    }
+}
+
+std::unique_ptr<duckdb::DuckDB> open_database(
+    const EngineOptions &options
+) {
+    duckdb::DBConfig config;
+    configure_engine(config, with_environment_defaults(options));
+    return std::make_unique<duckdb::DuckDB>(nullptr, &config);
+}
+
+void print_engine_summary(
+    std::ostream &os,
+    duckdb::DuckDB &db,
+    const std::uint64_t peak_temp_bytes
+) {
+    duckdb::Connection con(db);
+    const auto result = con.Query(
+        "SELECT name, value FROM duckdb_settings() "
+        "WHERE name IN ('threads', 'memory_limit', 'temp_directory', 'max_temp_directory_size', "
+        "'preserve_insertion_order') ORDER BY name"
+    );
+
+    os << "DuckDb settings:\n";
+    if (result->HasError()) {
+        os << "  unavailable: " << result->GetError() << '\n';
+    } else {
+        for (duckdb::idx_t row = 0; row < result->RowCount(); ++row) {
+            os << "  " << result->GetValue(0, row).ToString() << " = " << result->GetValue(1, row).ToString() << '\n';
+        }
+    }
+    os << "  peak temp directory size (sampled) = " << peak_temp_bytes << " bytes\n";
+}
+
+SpillMonitor::SpillMonitor(
+    duckdb::DuckDB &db,
+    const std::chrono::milliseconds interval
+) :
+    thread_([this, &db, interval](
+        const std::stop_token &stop
+    ) {
+        duckdb::Connection con(db);
+        std::mutex mutex;
+        std::condition_variable_any wakeup;
+
+        while (!stop.stop_requested()) {
+            const auto result = con.Query("SELECT coalesce(sum(size), 0)::UBIGINT FROM duckdb_temporary_files()");
+            if (!result->HasError() && result->RowCount() > 0) {
+                const auto bytes = result->GetValue(0, 0).GetValue<std::uint64_t>();
+                auto peak = peak_bytes_.load();
+                while (bytes > peak && !peak_bytes_.compare_exchange_weak(peak, bytes)) {}
+            }
+
+            std::unique_lock lock(mutex);
+            wakeup.wait_for(lock, stop, interval, [] {
+                return false;
+            });
+        }
+    }) {}
+
+SpillMonitor::~SpillMonitor() {
+    stop();
+}
+
+std::uint64_t SpillMonitor::stop() {
+    if (thread_.joinable()) {
+        thread_.request_stop();
+        thread_.join();
+    }
+    return peak_bytes_.load();
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+
+namespace duckdb {
+struct DBConfig;
+class DuckDB;
+}
+
+// DuckDb resource settings. Anything left unset falls back to the corresponding DEVAL_* environment variable, and
+// then to DuckDb's own default.
+struct EngineOptions {
+    std::optional<std::int64_t> threads;
+    // Sizes are passed through to DuckDb as given, e.g. "4GB" or "80%".
+    std::optional<std::string> memory_limit;
+    std::optional<std::string> temp_directory;
+    std::optional<std::string> max_temp_directory_size;
+    std::optional<bool> preserve_insertion_order;
+    // Let DuckDb keep parsed Parquet footers, so a file described while resolving parameter types isn't parsed again by
+    // the query itself, and a long-lived instance doesn't parse it again for every query.
+    bool cache_metadata = true;
+};
+
+// Fill unset options from DEVAL_THREADS, DEVAL_MEMORY_LIMIT, DEVAL_TEMP_DIRECTORY, DEVAL_MAX_TEMP_DIRECTORY_SIZE and
+// DEVAL_PRESERVE_INSERTION_ORDER.
+EngineOptions with_environment_defaults(
+    EngineOptions options
+);
+
+void configure_engine(
+    duckdb::DBConfig &config,
+    const EngineOptions &options
+);
+
+// An in-memory DuckDb instance configured from the options and their environment defaults.
+std::unique_ptr<duckdb::DuckDB> open_database(
+    const EngineOptions &options
+);
+
+// Print the settings DuckDb actually ended up with, plus the largest size of its temporary files that was sampled.
+void print_engine_summary(
+    std::ostream &os,
+    duckdb::DuckDB &db,
+    std::uint64_t peak_temp_bytes
+);
+
+// Polls the size of DuckDb's temporary files on its own connection while a query runs, because spill files are
+// removed as soon as the operator that created them finishes. Spills between two polls go unseen, and the files of
+// every query running on the instance are counted.
+class SpillMonitor {
+public:
+    explicit SpillMonitor(
+        duckdb::DuckDB &db,
+        std::chrono::milliseconds interval = std::chrono::milliseconds(100)
+    );
+
+    SpillMonitor(
+        const SpillMonitor &
+    ) = delete;
+
+    SpillMonitor &operator=(
+        const SpillMonitor &
+    ) = delete;
+
+    SpillMonitor(
+        SpillMonitor &&
+    ) = delete;
+
+    SpillMonitor &operator=(
+        SpillMonitor &&
+    ) = delete;
+
+    ~SpillMonitor();
+
+    // Stops polling and returns the largest total size of temporary files seen.
+    std::uint64_t stop();
+
+private:
+    std::atomic<std::uint64_t> peak_bytes_{0};
+    std::jthread thread_;
+};
@@ -0,0 +1,60 @@
+#include <cstdlib>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <dlfcn.h>
+
+#include "engine.h"
+
+// Where the module is installed, which the build defines.
+#ifndef DEVAL_ENGINE_DIR
+#define DEVAL_ENGINE_DIR ""
+#endif
+
+constexpr auto ENGINE_MODULE = "deval-engine.so";
+
+// DEVAL_ENGINE if set, then next to the executable, as in a build directory, then where it is installed.
+static std::vector<std::filesystem::path> engine_paths() {
+    std::vector<std::filesystem::path> paths;
+    if (const auto *path = std::getenv("DEVAL_ENGINE")) {
+        paths.emplace_back(path);
+    }
+    std::error_code error;
+    if (const auto executable = std::filesystem::read_symlink("/proc/self/exe", error); !error) {
+        paths.push_back(executable.parent_path() / ENGINE_MODULE);
+    }
+    if (const std::string directory = DEVAL_ENGINE_DIR; !directory.empty()) {
+        paths.push_back(std::filesystem::path(directory) / ENGINE_MODULE);
+    }
+    return paths;
+}
+
+// The module stays loaded until the process exits.
+static const Engine &load_engine() {
+    std::string errors;
+    for (const auto &path: engine_paths()) {
+        if (std::error_code error; !std::filesystem::exists(path, error)) {
+            continue;
+        }
+        auto *const handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (handle == nullptr) {
+            errors += std::string("\n  ") + dlerror();
+            continue;
+        }
+        const auto entry_point = reinterpret_cast<const Engine *(*)()>(dlsym(handle, ENGINE_ENTRY_POINT));
+        if (entry_point == nullptr) {
+            errors += "\n  " + path.string() + " isn't an engine module.";
+            dlclose(handle);
+            continue;
+        }
+        return *entry_point();
+    }
+    throw std::runtime_error(std::string("Unable to load the evaluation engine, ") + ENGINE_MODULE + "." + errors);
+}
+
+const Engine &engine() {
+    static const Engine &loaded = load_engine();
+    return loaded;
+}
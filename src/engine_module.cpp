@@ -0,0 +1,33 @@
+#include "engine.h"
+
+#include "query_evaluator.h"
+#include "queryplan.h"
+#include "server.h"
+#include "writer.h"
+
+
+static ExitStatus evaluate_to_stdout(
+    const OverallQueryPlan &query_plan
+) {
+    if (const auto socket_path = default_socket_path()) {
+        if (const auto status = evaluate_remotely(*socket_path, query_plan, OutputFormat::CSV, {}, {}, "")) {
+            return *status;
+        }
+    }
+    AliasGenerator alias_generator;
+    return evaluate_query(query_plan, default_writer, alias_generator);
+}
+
+static constexpr Engine ENGINE{
+    .eval_main = eval_main,
+    .evaluate_to_stdout = evaluate_to_stdout,
+    .resolve_select_schema = resolve_select_schema
+};
+
+extern "C" [[gnu::visibility("default")]] const Engine *deval_engine() {
+    return &ENGINE;
+}
+
+const Engine &engine() {
+    return ENGINE;
+}
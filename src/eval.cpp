@@ -1,13 +1,26 @@
+#include <csignal>
+#include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
 
+#include <unistd.h>
+
+#include <boost/optional.hpp>
 #include <boost/program_options.hpp>
 #include <duckdb.hpp>
 
+#include "cancellation.h"
+#include "engine.h"
+#include "follow.h"
 #include "options.h"
+#include "partitioned_writer.h"
 #include "queryplan.h"
 #include "query_evaluator.h"
+#include "result_cache.h"
 #include "serde.h"
+#include "server.h"
+#include "tracer.h"
 #include "writer.h"
 
 
@@ -21,8 +34,124 @@ public:
             ("csv,c", po::bool_switch(&write_csv_), "Write results in CSV format.")
             ("parquet,p", po::bool_switch(&write_parquet_), "Write results in Parquet format.")
             ("column,t", po::bool_switch(&write_columnar_), "Write columnated results.")
+            ("arrow", po::bool_switch(&write_arrow_), "Write results as an Arrow IPC stream.")
+            ("arrow-file", po::bool_switch(&write_arrow_file_),
+                "Write results in the Arrow IPC file format (Feather v2), which readers can memory-map.")
+            ("ndjson", po::bool_switch(&write_ndjson_), "Write results as newline-delimited JSON, one object per row.")
+            ("compression", po::value(&compression_),
+                "Compression of Arrow buffers, 'none' (default), 'lz4' or 'zstd', or of Parquet pages, which can also "
+                "be 'snappy', 'gzip' or 'brotli'.")
+            ("compression-level", po::value(&compression_level_), "Codec specific Parquet compression level.")
+            ("compress", po::value(&compress_),
+                "Compress CSV, columnar or NDJSON output with 'gzip' or 'zstd', optionally followed by ':<level>'. "
+                "Detected from a '.gz', '.zst' or '.zstd' --out file.")
+            ("row-group-rows", po::value(&writer_options_.parquet.row_group_rows)->default_value(0),
+                "Fill each Parquet row group up to this many rows (0 to write a row group per batch).")
+            ("row-group-bytes", po::value(&writer_options_.parquet.row_group_bytes)->default_value(0),
+                "Fill each Parquet row group up to about this many bytes of uncompressed data.")
+            ("no-dictionary", po::value(&no_dictionary_)->composing(),
+                "Don't dictionary encode these Parquet columns (comma separated or repeated, '*' for all).")
+            ("no-statistics", po::value(&no_statistics_)->composing(),
+                "Don't write min/max statistics for these Parquet columns (comma separated or repeated, '*' for all).")
+            ("page-index", po::bool_switch(&writer_options_.parquet.page_index),
+                "Write Parquet page indexes, so readers can skip pages as well as row groups.")
+            ("bloom-filter", po::value(&bloom_filter_)->composing(),
+                "Write Parquet bloom filters for these columns (comma separated or repeated, '*' for all).")
+            ("bloom-filter-fpp", po::value(&bloom_filter_fpp_), "False positive probability of bloom filters (0.05).")
+            ("sorted-by", po::value(&sorted_by_)->composing(),
+                "Record in the Parquet metadata that rows are sorted by these columns, each optionally followed by "
+                "':desc'.")
+            ("tsv", po::bool_switch(&write_tsv_),
+                "Write tab separated values, only quoting values that contain a tab, quote or line break.")
+            ("delimiter", po::value(&delimiter_), "CSV field delimiter: a single character, or 'tab' (default ',').")
+            ("quote", po::value(&quoting_),
+                "Which CSV values to quote: 'strings' (default), 'minimal' (only where needed), 'all' or 'none'.")
+            ("null", po::value(&writer_options_.csv.null_token), "Text written for nulls in CSV (default empty).")
+            ("no-header", po::bool_switch(&no_header_), "Don't write a CSV header.")
             ("out,o", po::value(&out_), "Write to this file instead of stdout.")
-            ("query,q", po::bool_switch(&print_query_), "Print generated SQL query instead of executing it.");
+            ("output-buffers", po::value(&output_options_.buffers)->default_value(output_options_.buffers),
+                "Number of output buffers, one filled while the others are written in the background.")
+            ("output-buffer-bytes",
+                po::value(&output_options_.buffer_bytes)->default_value(output_options_.buffer_bytes),
+                "Size of each output buffer.")
+            ("query,q", po::bool_switch(&print_query_),
+                "Print generated SQL query instead of executing it, and the query before rewriting if it differs.")
+            ("no-pushdown", po::bool_switch(&no_pushdown_),
+                "Don't move the conditions of later stages down to the scans they filter.")
+            ("no-simplify", po::bool_switch(&no_simplify_),
+                "Don't merge, drop or reorder the conditions on a column.")
+            ("no-prune-partitions", po::bool_switch(&no_prune_partitions_),
+                "Read every partition of partitioned datasets, whatever the conditions on partition columns.")
+            ("no-prune-columns", po::bool_switch(&no_prune_columns_),
+                "Don't narrow earlier stages to the columns later stages use.")
+            ("engine", po::value(&engine_)->default_value(engine_),
+                "Evaluate with 'duckdb', with 'arrow' (Arrow's Dataset scanner, for selects with conditions and a "
+                "limit over local Parquet files) or with 'auto', which uses the scanner whenever it can.")
+            ("readahead-batches",
+                po::value(&evaluation_options_.arrow_scan.batch_readahead)
+                    ->default_value(evaluation_options_.arrow_scan.batch_readahead),
+                "Batches the Arrow scanner reads ahead within each file.")
+            ("readahead-files",
+                po::value(&evaluation_options_.arrow_scan.fragment_readahead)
+                    ->default_value(evaluation_options_.arrow_scan.fragment_readahead),
+                "Files the Arrow scanner reads at once.")
+            ("batch-rows", po::value(&evaluation_options_.batch_rows)->default_value(DEFAULT_BATCH_ROWS),
+                "Target number of rows in each batch passed to the writer (0 to disable).")
+            ("batch-bytes", po::value(&evaluation_options_.batch_bytes)->default_value(0),
+                "Target number of bytes in each batch passed to the writer (0 to disable).")
+            ("pipeline", po::bool_switch(&evaluation_options_.pipelined),
+                "Fetch, convert and write results on separate threads.")
+            ("queue-depth", po::value(&evaluation_options_.queue_depth)->default_value(evaluation_options_.queue_depth),
+                "Number of batches that may be queued between pipeline stages.")
+            ("convert-threads",
+                po::value(&evaluation_options_.convert_threads)->default_value(evaluation_options_.convert_threads),
+                "Number of threads converting results to Arrow in pipelined mode.")
+            ("stats", po::bool_switch(&evaluation_options_.print_stats),
+                "Print execution statistics and the effective DuckDb settings to stderr.")
+            ("threads", po::value(&threads_), "Number of DuckDb (or Arrow scanner) worker threads [DEVAL_THREADS].")
+            ("memory-limit", po::value(&memory_limit_),
+                "DuckDb memory limit, e.g. '4GB' or '50%' [DEVAL_MEMORY_LIMIT].")
+            ("temp-directory", po::value(&temp_directory_),
+                "Directory DuckDb spills to when out of memory [DEVAL_TEMP_DIRECTORY].")
+            ("max-temp-directory-size", po::value(&max_temp_directory_size_),
+                "Maximum size of the spill directory [DEVAL_MAX_TEMP_DIRECTORY_SIZE].")
+            ("preserve-insertion-order", po::value(&preserve_insertion_order_),
+                "Whether results must keep the order of the input when unsorted; 'false' saves memory "
+                "[DEVAL_PRESERVE_INSERTION_ORDER].")
+            ("serve", po::value(&serve_),
+                "Evaluate query plans sent to this Unix socket instead of reading one from stdin.")
+            ("serve-workers", po::value(&serve_workers_)->default_value(DEFAULT_SERVE_WORKERS),
+                "Number of connections the server evaluates queries for at once.")
+            ("connect", po::value(&connect_),
+                "Evaluate on the server listening on this socket, if it is running [DEVAL_SOCKET].")
+            ("no-server", po::bool_switch(&no_server_), "Always evaluate in this process.")
+            ("no-cache", po::bool_switch(&no_cache_), "Neither reuse nor store results in the result cache.")
+            ("cache-dir", po::value(&cache_dir_), "Directory of the result cache [DEVAL_CACHE_DIR].")
+            ("cache-size", po::value(&cache_size_)->default_value(DEFAULT_RESULT_CACHE_BYTES),
+                "Maximum size of the result cache in bytes; least recently used results are removed beyond it.")
+            ("cache-stats", po::bool_switch(&print_cache_stats_),
+                "Print result cache hit, miss and eviction counts and exit.")
+            ("trace", po::value(&trace_),
+                "Write a timeline of evaluation, with DuckDb's profile of the query, to this file in Chrome trace "
+                "format.")
+            ("follow", po::bool_switch(&follow_),
+                "Keep running, and evaluate the pipeline over each new file matching the dataset as it arrives.")
+            ("checkpoint", po::value(&checkpoint_),
+                "With --follow, record evaluated files here and skip them when restarted.")
+            ("settle-time", po::value(&settle_time_ms_)->default_value(settle_time_ms_),
+                "With --follow, milliseconds a new file must go unmodified before it is read.")
+            ("partition-by", po::value(&partition_by_)->composing(),
+                "Write a directory with a subdirectory per value of these columns (comma separated or repeated).")
+            ("bucket-by", po::value(&bucket_by_),
+                "Also spread rows over --buckets subdirectories by a hash of this column.")
+            ("buckets", po::value(&partitioning_.buckets)->default_value(0), "Number of buckets for --bucket-by.")
+            ("max-partitions", po::value(&partitioning_.max_partitions)->default_value(partitioning_.max_partitions),
+                "Fail rather than spread a batch of rows over more partition directories than this.")
+            ("max-rows-per-file", po::value(&partitioning_.max_rows_per_file)->default_value(0),
+                "Write a directory of files holding at most this many rows each.")
+            ("file-name-template", po::value(&file_name_template_),
+                "Names of files written to a directory, with '{i}' replaced by a counter "
+                "(default 'part-{i}.<format>').");
         // clang-format on
     }
 
@@ -35,12 +164,16 @@ public:
         }
 
         int num_formats = 0;
-        num_formats += write_csv_ ? 1 : 0;
+        num_formats += write_csv_ || write_tsv_ ? 1 : 0;
         num_formats += write_parquet_ ? 1 : 0;
         num_formats += write_columnar_ ? 1 : 0;
+        num_formats += write_arrow_ ? 1 : 0;
+        num_formats += write_arrow_file_ ? 1 : 0;
+        num_formats += write_ndjson_ ? 1 : 0;
 
         if (num_formats > 1) {
-            std::cerr << "Only one of 'csv', 'parquet' or 'column' may be specified.\n";
+            std::cerr << "Only one of 'csv' (or 'tsv'), 'parquet', 'column', 'arrow', 'arrow-file' or 'ndjson' may "
+                    "be specified.\n";
             return false;
         }
 
@@ -49,65 +182,429 @@ public:
             write_csv_ = true;
         }
 
+        if (!parse_csv_dialect() || !parse_compression_option() || !parse_parquet_options()) {
+            return false;
+        }
+
+        if (evaluation_options_.batch_rows < 0 || evaluation_options_.batch_bytes < 0) {
+            std::cerr << "Batch row and byte targets must not be negative.\n";
+            return false;
+        }
+
+        if (output_options_.buffers < 2 || output_options_.buffer_bytes == 0) {
+            std::cerr << "Output needs at least two buffers of at least one byte.\n";
+            return false;
+        }
+        // Printed with the execution statistics.
+        output_options_.summary = evaluation_options_.print_stats ? &std::cerr : nullptr;
+
+        evaluation_options_.optimiser = {
+            .push_down_filters = !no_pushdown_,
+            .simplify_conditions = !no_simplify_,
+            .prune_partitions = !no_prune_partitions_,
+            .prune_columns = !no_prune_columns_
+        };
+
+        const auto backend = parse_evaluation_backend(engine_);
+        if (!backend) {
+            std::cerr << "Unknown engine '" << engine_ << "'. Expected duckdb, arrow or auto.\n";
+            return false;
+        }
+        evaluation_options_.backend = *backend;
+        const auto &arrow_scan = evaluation_options_.arrow_scan;
+        if (arrow_scan.batch_readahead < 1 || arrow_scan.fragment_readahead < 1) {
+            std::cerr << "The Arrow scanner must read ahead at least one batch and one file.\n";
+            return false;
+        }
+
+        if (evaluation_options_.queue_depth == 0 || evaluation_options_.convert_threads == 0) {
+            std::cerr << "Queue depth and number of conversion threads must be at least 1.\n";
+            return false;
+        }
+
+        if (follow_ && !can_append_output(format())) {
+            std::cerr << "Only CSV, columnar and NDJSON output can be appended to, so only they can be used with "
+                    "--follow.\n";
+            return false;
+        }
+
+        if (serve_workers_ == 0) {
+            std::cerr << "--serve-workers must be at least 1.\n";
+            return false;
+        }
+
+        if (follow_ && (trace_ || serve_)) {
+            std::cerr << "--follow can't be combined with --trace or --serve.\n";
+            return false;
+        }
+
+        partitioning_.partition_by = split_columns(partition_by_);
+        partitioning_.bucket_by = bucket_by_ ? std::make_optional(*bucket_by_) : std::nullopt;
+        partitioning_.file_name_template = file_name_template_
+                                               ? std::make_optional(*file_name_template_)
+                                               : std::nullopt;
+
+        if (partitioning_.bucket_by.has_value() != (partitioning_.buckets > 0)) {
+            std::cerr << "--bucket-by and a positive number of --buckets must be given together.\n";
+            return false;
+        }
+
+        if (partitioning_.max_partitions <= 0 || partitioning_.buckets > partitioning_.max_partitions) {
+            std::cerr << "--max-partitions must be positive and at least the number of --buckets.\n";
+            return false;
+        }
+
+        if (partitioning_.file_name_template && partitioning_.file_name_template->find("{i}") == std::string::npos) {
+            std::cerr << "--file-name-template must contain '{i}'.\n";
+            return false;
+        }
+
+        const auto partitionable = format() == OutputFormat::CSV || format() == OutputFormat::PARQUET;
+        if (partitioning_.enabled() && (out_.empty() || !partitionable || follow_)) {
+            std::cerr << "Partitioned output needs an --out directory and CSV or Parquet format, and can't be "
+                    "followed.\n";
+            return false;
+        }
+
+        if (!parse_compress_option()) {
+            return false;
+        }
+
+        if (!connect_ && !no_server_) {
+            if (const auto socket_path = default_socket_path()) {
+                connect_ = *socket_path;
+            }
+        }
+
+        if (!no_cache_) {
+            auto cache_options = default_result_cache_options();
+            if (cache_dir_) {
+                cache_options.directory = *cache_dir_;
+            }
+            cache_options.max_bytes = cache_size_;
+            evaluation_options_.result_cache = cache_options;
+        }
+
+        auto &engine = evaluation_options_.engine;
+        engine.threads = threads_ ? std::make_optional(*threads_) : std::nullopt;
+        engine.memory_limit = memory_limit_ ? std::make_optional(*memory_limit_) : std::nullopt;
+        engine.temp_directory = temp_directory_ ? std::make_optional(*temp_directory_) : std::nullopt;
+        engine.max_temp_directory_size = max_temp_directory_size_
+                                             ? std::make_optional(*max_temp_directory_size_)
+                                             : std::nullopt;
+        engine.preserve_insertion_order = preserve_insertion_order_
+                                              ? std::make_optional(*preserve_insertion_order_)
+                                              : std::nullopt;
+
         return true;
     }
 
+    [[nodiscard]] OutputFormat format() const {
+        if (write_parquet_) {
+            return OutputFormat::PARQUET;
+        }
+        if (write_columnar_) {
+            return OutputFormat::COLUMNAR;
+        }
+        if (write_arrow_) {
+            return OutputFormat::ARROW;
+        }
+        if (write_arrow_file_) {
+            return OutputFormat::ARROW_FILE;
+        }
+        if (write_ndjson_) {
+            return OutputFormat::NDJSON;
+        }
+        return OutputFormat::CSV;
+    }
+
     [[nodiscard]] std::unique_ptr<Writer> get_writer(
         const std::shared_ptr<arrow::Schema> &schema
     ) const {
-        if (out_.empty()) {
-            return stdout_writer(schema);
+        if (partitioning_.enabled()) {
+            return std::make_unique<PartitionedDatasetWriter>(format(), schema, out_, partitioning_, writer_options_);
+        }
+        if (!out_.empty()) {
+            const auto stream = open_file_stream(out_, false, output_options_);
+            return make_writer(format(), schema, stream, true, writer_options_);
         }
-        return file_writer(schema);
+        if (requires_seekable_output(format())) {
+            throw std::runtime_error("Parquet output requires a seekable stream; cannot write to stdout.");
+        }
+        return make_writer(format(), schema, open_stdout_stream(output_options_), true, writer_options_);
+    }
+
+    [[nodiscard]] const WriterOptions &writer_options() const {
+        return writer_options_;
+    }
+
+    [[nodiscard]] const std::string &out() const {
+        return out_;
+    }
+
+    [[nodiscard]] bool print_cache_stats() const {
+        return print_cache_stats_;
     }
 
     [[nodiscard]] bool print_query() const {
         return print_query_;
     }
 
+    [[nodiscard]] const EvaluationOptions &evaluation_options() const {
+        return evaluation_options_;
+    }
+
+    [[nodiscard]] std::optional<std::string> serve() const {
+        return serve_ ? std::make_optional(*serve_) : std::nullopt;
+    }
+
+    [[nodiscard]] std::size_t serve_workers() const {
+        return serve_workers_;
+    }
+
+    [[nodiscard]] std::optional<std::string> trace() const {
+        return trace_ ? std::make_optional(*trace_) : std::nullopt;
+    }
+
+    [[nodiscard]] bool follow() const {
+        return follow_;
+    }
+
+    [[nodiscard]] FollowOptions follow_options() const {
+        return {
+            .format = format(),
+            .out_path = out_,
+            .writer_options = writer_options_,
+            .checkpoint = checkpoint_ ? std::make_optional<std::filesystem::path>(*checkpoint_) : std::nullopt,
+            .settle_time = std::chrono::milliseconds(settle_time_ms_)
+        };
+    }
+
+    // Parquet and partitioned output are always written locally, because the server can only stream to us, and so is
+    // anything being traced or followed.
+    [[nodiscard]] std::optional<std::string> server_socket() const {
+        if (requires_seekable_output(format()) || partitioning_.enabled() || trace_ || follow_) {
+            return std::nullopt;
+        }
+        if (no_server_ || !connect_) {
+            return std::nullopt;
+        }
+        return *connect_;
+    }
+
 private:
-    [[nodiscard]] std::unique_ptr<Writer> stdout_writer(
-        const std::shared_ptr<arrow::Schema> &schema
-    ) const {
-        if (write_csv_) {
-            return std::make_unique<CsvWriter>(schema);
+    bool parse_csv_dialect() {
+        if (write_tsv_) {
+            writer_options_.csv.delimiter = '\t';
+            writer_options_.csv.quoting = CsvQuoting::MINIMAL;
         }
-        if (write_parquet_) {
-            throw std::runtime_error("Parquet output requires a seekable stream; cannot write to stdout.");
+        if (delimiter_) {
+            if (*delimiter_ == "tab" || *delimiter_ == "\\t") {
+                writer_options_.csv.delimiter = '\t';
+            } else if (delimiter_->size() == 1 && *delimiter_ != "\"" && *delimiter_ != "\n" && *delimiter_ != "\r") {
+                writer_options_.csv.delimiter = delimiter_->front();
+            } else {
+                std::cerr << "The delimiter must be a single character other than a quote or line break, or 'tab'.\n";
+                return false;
+            }
         }
-        if (write_columnar_) {
-            return std::make_unique<ColumnarWriter>(schema);
+        if (quoting_) {
+            const auto quoting = parse_csv_quoting(*quoting_);
+            if (!quoting) {
+                std::cerr << "Unknown quoting '" << *quoting_ << "'. Expected strings, minimal, all or none.\n";
+                return false;
+            }
+            writer_options_.csv.quoting = *quoting;
         }
+        writer_options_.csv.header = !no_header_;
 
-        throw std::logic_error("Invariant failure: Neither write_csv or write_parquet set.");
+        const auto customised = write_tsv_
+                                || delimiter_
+                                || quoting_
+                                || !writer_options_.csv.null_token.empty()
+                                || no_header_;
+        if (customised && format() != OutputFormat::CSV) {
+            std::cerr << "--tsv, --delimiter, --quote, --null and --no-header only apply to CSV output.\n";
+            return false;
+        }
+        return true;
     }
 
-    [[nodiscard]] std::unique_ptr<Writer> file_writer(
-        const std::shared_ptr<arrow::Schema> &schema
-    ) const {
-        if (write_csv_) {
-            return std::make_unique<CsvWriter>(schema, out_);
+    bool parse_compression_option() {
+        if (!compression_) {
+            return true;
         }
-        if (write_parquet_) {
-            return std::make_unique<ParquetWriter>(schema, out_);
+        const auto compression = parse_compression(*compression_);
+        if (!compression) {
+            std::cerr << "Unknown compression '" << *compression_ << "'. Expected none, lz4 or zstd.\n";
+            return false;
         }
-        if (write_columnar_) {
-            return std::make_unique<ColumnarWriter>(schema, out_);
+        const auto arrow_output = format() == OutputFormat::ARROW || format() == OutputFormat::ARROW_FILE;
+        if (!arrow_output && format() != OutputFormat::PARQUET) {
+            std::cerr << "--compression only applies to Arrow and Parquet output.\n";
+            return false;
         }
+        if (arrow_output && !supports_ipc_compression(*compression)) {
+            std::cerr << "Arrow output can only be compressed with lz4 or zstd.\n";
+            return false;
+        }
+        writer_options_.compression = *compression;
+        return true;
+    }
 
-        throw std::logic_error("Invariant failure: Neither write_csv or write_parquet set.");
+    // Runs after the partitioning is parsed, as partitioned output isn't compressed as a whole.
+    bool parse_compress_option() {
+        const auto compressible = format() == OutputFormat::CSV
+                                  || format() == OutputFormat::COLUMNAR
+                                  || format() == OutputFormat::NDJSON;
+        if (!compress_) {
+            if (compressible && !partitioning_.enabled()) {
+                writer_options_.compress = stream_compression_for_path(out_).value_or(writer_options_.compress);
+            }
+            return true;
+        }
+        const auto compress = parse_stream_compression(*compress_);
+        if (!compress) {
+            std::cerr << "Unknown --compress '" << *compress_ << "'. Expected gzip or zstd, optionally followed by "
+                    "':<level>'.\n";
+            return false;
+        }
+        if (!compressible || partitioning_.enabled()) {
+            std::cerr << "--compress only applies to CSV, columnar and NDJSON output written to a single file or "
+                    "stdout.\n";
+            return false;
+        }
+        writer_options_.compress = *compress;
+        return true;
     }
 
+    bool parse_parquet_options() {
+        auto &parquet = writer_options_.parquet;
+        parquet.compression_level = compression_level_ ? std::make_optional(*compression_level_) : std::nullopt;
+        parquet.no_dictionary = split_columns(no_dictionary_);
+        parquet.no_statistics = split_columns(no_statistics_);
+        parquet.bloom_filter = split_columns(bloom_filter_);
+        parquet.bloom_filter_fpp = bloom_filter_fpp_.value_or(parquet.bloom_filter_fpp);
+        for (const auto &column: split_columns(sorted_by_)) {
+            const auto separator = column.rfind(':');
+            const auto direction = separator == std::string::npos ? "" : column.substr(separator + 1);
+            if (direction != "" && direction != "asc" && direction != "desc") {
+                std::cerr << "Unknown sort direction '" << direction << "' in --sorted-by. Expected asc or desc.\n";
+                return false;
+            }
+            parquet.sorting_columns.push_back({
+                .column = direction.empty() ? column : column.substr(0, separator),
+                .descending = direction == "desc"
+            });
+        }
+        // Printed with the execution statistics.
+        parquet.layout_summary = evaluation_options_.print_stats ? &std::cerr : nullptr;
+
+        if (parquet.row_group_rows < 0 || parquet.row_group_bytes < 0) {
+            std::cerr << "Row group row and byte limits must not be negative.\n";
+            return false;
+        }
+        if (parquet.bloom_filter_fpp <= 0 || parquet.bloom_filter_fpp >= 1) {
+            std::cerr << "The bloom filter false positive probability must be between 0 and 1.\n";
+            return false;
+        }
+        if (compression_level_ && writer_options_.compression == arrow::Compression::UNCOMPRESSED) {
+            std::cerr << "--compression-level needs a --compression codec.\n";
+            return false;
+        }
+
+        const auto customised = compression_level_
+                                || parquet.row_group_rows > 0
+                                || parquet.row_group_bytes > 0
+                                || !parquet.no_dictionary.empty()
+                                || !parquet.no_statistics.empty()
+                                || parquet.page_index
+                                || !parquet.bloom_filter.empty()
+                                || bloom_filter_fpp_
+                                || !parquet.sorting_columns.empty();
+        if (customised && format() != OutputFormat::PARQUET) {
+            std::cerr << "--compression-level, --row-group-rows, --row-group-bytes, --no-dictionary, --no-statistics, "
+                    "--page-index, --bloom-filter, --bloom-filter-fpp and --sorted-by only apply to Parquet output.\n";
+            return false;
+        }
+        return true;
+    }
+
+    // Comma separated lists, which may also be given by repeating the option.
+    static std::vector<std::string> split_columns(
+        const std::vector<std::string> &values
+    ) {
+        std::vector<std::string> columns;
+        for (const auto &value: values) {
+            std::istringstream stream(value);
+            for (std::string column; std::getline(stream, column, ',');) {
+                if (!column.empty()) {
+                    columns.push_back(column);
+                }
+            }
+        }
+        return columns;
+    }
 
     bool write_csv_{};
+    bool write_tsv_{};
     bool write_parquet_{};
     bool write_columnar_{};
+    bool write_arrow_{};
+    bool write_arrow_file_{};
+    bool write_ndjson_{};
+    boost::optional<std::string> delimiter_;
+    boost::optional<std::string> quoting_;
+    bool no_header_{false};
+    boost::optional<std::string> compression_;
+    boost::optional<int> compression_level_;
+    boost::optional<std::string> compress_;
+    std::vector<std::string> no_dictionary_;
+    std::vector<std::string> no_statistics_;
+    std::vector<std::string> bloom_filter_;
+    boost::optional<double> bloom_filter_fpp_;
+    std::vector<std::string> sorted_by_;
+    WriterOptions writer_options_;
+    AsyncOutputOptions output_options_;
     std::string out_;
     bool print_query_{false};
+    bool no_pushdown_{false};
+    bool no_simplify_{false};
+    bool no_prune_partitions_{false};
+    bool no_prune_columns_{false};
+    std::string engine_{"duckdb"};
+    EvaluationOptions evaluation_options_;
+
+    boost::optional<std::int64_t> threads_;
+    boost::optional<std::string> memory_limit_;
+    boost::optional<std::string> temp_directory_;
+    boost::optional<std::string> max_temp_directory_size_;
+    boost::optional<bool> preserve_insertion_order_;
+
+    boost::optional<std::string> serve_;
+    std::size_t serve_workers_{DEFAULT_SERVE_WORKERS};
+    boost::optional<std::string> connect_;
+    bool no_server_{false};
+
+    bool no_cache_{false};
+    boost::optional<std::string> cache_dir_;
+    std::uint64_t cache_size_{DEFAULT_RESULT_CACHE_BYTES};
+    bool print_cache_stats_{false};
+
+    boost::optional<std::string> trace_;
+
+    bool follow_{false};
+    boost::optional<std::string> checkpoint_;
+    std::int64_t settle_time_ms_{1000};
+
+    PartitioningOptions partitioning_;
+    std::vector<std::string> partition_by_;
+    boost::optional<std::string> bucket_by_;
+    boost::optional<std::string> file_name_template_;
 };
 
 
-int main(
+int eval_main(
     const int argc,
     const char *argv[]
 ) {
@@ -116,7 +613,43 @@ int main(
         return 1;
     }
 
-    const auto overall_query_plan = load_query_plan(std::cin);
+    if (options.print_cache_stats()) {
+        const auto &cache_options = options.evaluation_options().result_cache;
+        if (!cache_options) {
+            std::cerr << "The result cache is disabled.\n";
+            return 1;
+        }
+        const ResultCache cache(*cache_options);
+        const auto [entries, bytes] = cache.usage();
+        std::cout << cache_options->directory.string() << ": " << entries << " results, " << bytes << " of "
+                << cache_options->max_bytes << " bytes, " << cache.counters() << '\n';
+        return static_cast<int>(ExitStatus::SUCCESS);
+    }
+
+    // A server may be asked to use the Arrow engine by any client.
+    if (options.serve() || options.evaluation_options().backend != EvaluationBackend::DUCKDB) {
+        try {
+            configure_arrow_threads(options.evaluation_options().engine);
+        } catch (const std::runtime_error &error) {
+            std::cerr << error.what() << '\n';
+            return static_cast<int>(ExitStatus::EXECUTION_ERROR);
+        }
+    }
+
+    if (options.serve()) {
+        return static_cast<int>(serve(
+            *options.serve(),
+            options.evaluation_options().engine,
+            options.serve_workers()
+        ));
+    }
+
+    const auto tracer = options.trace() ? std::make_unique<Tracer>() : nullptr;
+
+    const auto overall_query_plan = [&tracer] {
+        const Tracer::Span span(tracer.get(), "load query plan");
+        return load_query_plan(std::cin);
+    }();
     if (!overall_query_plan) {
         std::cerr << "Unable to parse query plan from standard input.\n";
         return 1;
@@ -130,18 +663,87 @@ int main(
 
     AliasGenerator alias_generator;
     if (options.print_query()) {
-        auto query = overall_query_plan->generate_query(alias_generator);
+        PlanRewrites rewrites;
+        const auto optimised_plan = optimise_query_plan(
+            *overall_query_plan,
+            options.evaluation_options().optimiser,
+            rewrites
+        );
+        auto query = optimised_plan.generate_query(alias_generator);
         if (!query) {
             std::cerr << "Error generating query from query plan.\n";
             return static_cast<int>(ExitStatus::QUERY_GENERATION_ERROR);
         }
+        if (rewrites.any()) {
+            // The query as written, for comparison with the rewritten one that is executed.
+            AliasGenerator original_alias_generator;
+            if (const auto original = overall_query_plan->generate_query(original_alias_generator)) {
+                std::cout << "-- Before rewriting, which " << rewrites << ":\n";
+                std::istringstream lines(original->query);
+                for (std::string line; std::getline(lines, line);) {
+                    std::cout << "-- " << line << '\n';
+                }
+                std::cout << "-- After:\n";
+            }
+        }
         const auto [query_str, query_params] = *query;
         std::cout << query_str << '\n';
         for (const auto &[column, value] : query_params) {
             std::cout << "-- Colum " << column << ": " << value << '\n';
         }
+        if (const auto &evaluation_options = options.evaluation_options();
+            evaluation_options.backend != EvaluationBackend::DUCKDB) {
+            std::string reason;
+            if (plan_arrow_scan(optimised_plan, evaluation_options.arrow_scan, evaluation_options.batch_rows, reason)) {
+                std::cout << "-- Evaluated by the Arrow scanner instead.\n";
+            } else if (evaluation_options.backend == EvaluationBackend::ARROW) {
+                std::cout << "-- The Arrow engine can't evaluate this query, because " << reason << ".\n";
+            } else {
+                std::cout << "-- Evaluated with DuckDb, because " << reason << ".\n";
+            }
+        }
         return static_cast<int>(ExitStatus::SUCCESS);
     }
 
-    return static_cast<int>(evaluate_query(*overall_query_plan, writer_factory, alias_generator));
+    // A closed pipe then fails the write, which cancels the query, rather than killing the process part way through.
+    std::signal(SIGPIPE, SIG_IGN);
+    CancellationToken cancellation;
+    const CancellationWatcher watcher(
+        cancellation,
+        options.out().empty() ? std::optional<int>(STDOUT_FILENO) : std::nullopt,
+        true
+    );
+    auto evaluation_options = options.evaluation_options();
+    evaluation_options.cancellation = &cancellation;
+
+    if (options.follow()) {
+        const auto status = follow_query(*overall_query_plan, evaluation_options, options.follow_options());
+        return static_cast<int>(status);
+    }
+
+    if (const auto socket_path = options.server_socket()) {
+        const auto remote_status = evaluate_remotely(
+            *socket_path,
+            *overall_query_plan,
+            options.format(),
+            options.writer_options(),
+            evaluation_options,
+            options.out()
+        );
+        if (remote_status) {
+            return static_cast<int>(*remote_status);
+        }
+    }
+
+    evaluation_options.tracer = tracer.get();
+    const auto status = evaluate_query(*overall_query_plan, writer_factory, alias_generator, evaluation_options);
+
+    if (tracer) {
+        std::ofstream trace_file(*options.trace());
+        tracer->write(trace_file);
+        if (!trace_file) {
+            std::cerr << "Unable to write trace to " << *options.trace() << ".\n";
+        }
+    }
+    return static_cast<int>(status);
 }
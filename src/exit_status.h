@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+enum class ExitStatus : std::int8_t {
+    SUCCESS = 0,
+    QUERY_GENERATION_ERROR = 1,
+    EXECUTION_ERROR = 2,
+    PROGRAMMING_ERROR = 3,
+    // Stopped early because nothing was reading the output any more, which isn't an error.
+    OUTPUT_CLOSED = 4,
+    // Stopped early by SIGINT or SIGTERM.
+    INTERRUPTED = 5
+};
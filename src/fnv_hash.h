@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <string_view>
+
+// 64-bit FNV-1a, chosen because it is stable across builds and platforms, unlike std::hash.
+class Fnv1aHash {
+public:
+    // Each update is followed by a separator, so ("ab", "c") and ("a", "bc") hash differently.
+    void update(
+        const std::string_view text
+    ) {
+        for (const auto c: text) {
+            mix(static_cast<unsigned char>(c));
+        }
+        mix(0xff);
+    }
+
+    [[nodiscard]] std::uint64_t value() const {
+        return hash_;
+    }
+
+    [[nodiscard]] std::string hex() const {
+        std::ostringstream stream;
+        stream << std::hex << std::setw(16) << std::setfill('0') << hash_;
+        return stream.str();
+    }
+
+private:
+    static constexpr std::uint64_t OFFSET_BASIS = 14695981039346656037ULL;
+    static constexpr std::uint64_t PRIME = 1099511628211ULL;
+
+    void mix(
+        const std::uint8_t byte
+    ) {
+        hash_ ^= byte;
+        hash_ *= PRIME;
+    }
+
+    std::uint64_t hash_ = OFFSET_BASIS;
+};
@@ -0,0 +1,451 @@
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <map>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+
+#include <poll.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+
+#include <duckdb.hpp>
+
+#include "ascii_case.h"
+#include "input_files.h"
+#include "parquet_metadata.h"
+#include "queryplan.h"
+
+#include "follow.h"
+
+
+// Also the longest it takes to notice new files where inotify doesn't work, such as on network filesystems.
+constexpr std::chrono::milliseconds POLL_INTERVAL{5000};
+// How long it can take to stop waiting once cancelled.
+constexpr std::chrono::milliseconds CANCEL_CHECK_INTERVAL{200};
+
+namespace {
+class Checkpoint {
+public:
+    explicit Checkpoint(
+        std::optional<std::filesystem::path> path
+    ) :
+        path_(std::move(path)) {
+        if (!path_) {
+            return;
+        }
+        std::ifstream in(*path_);
+        for (std::string line; std::getline(in, line);) {
+            if (!line.empty()) {
+                evaluated_.insert(line);
+            }
+        }
+    }
+
+    [[nodiscard]] bool contains(
+        const std::string &path
+    ) const {
+        return evaluated_.contains(path);
+    }
+
+    [[nodiscard]] bool empty() const {
+        return evaluated_.empty();
+    }
+
+    void add(
+        const std::vector<InputFile> &files
+    ) {
+        for (const auto &file: files) {
+            evaluated_.insert(file.path);
+        }
+        if (!path_) {
+            return;
+        }
+
+        std::ofstream out(*path_, std::ios::app);
+        for (const auto &file: files) {
+            out << file.path << '\n';
+        }
+        out.close();
+        if (!out) {
+            throw std::runtime_error("Unable to update checkpoint " + path_->string() + ".");
+        }
+    }
+
+private:
+    std::optional<std::filesystem::path> path_;
+    std::unordered_set<std::string> evaluated_;
+};
+
+// Wakes up when a file is created, moved into or finishes being written in any directory a glob can match in.
+class DirectoryWatcher {
+public:
+    explicit DirectoryWatcher(
+        const std::string &pattern
+    ) {
+        const auto wildcard = pattern.find_first_of("*?[{");
+        if (wildcard == std::string::npos) {
+            root_ = std::filesystem::path(pattern).parent_path();
+        } else {
+            const auto separator = pattern.rfind('/', wildcard);
+            root_ = separator == std::string::npos ? "." : pattern.substr(0, separator + 1);
+            // A wildcard in a directory name (or `**`) means new subdirectories can hold matches too.
+            recursive_ = pattern.find('/', wildcard) != std::string::npos;
+        }
+        if (root_.empty()) {
+            root_ = ".";
+        }
+#ifdef __linux__
+        fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    }
+
+    DirectoryWatcher(
+        const DirectoryWatcher &
+    ) = delete;
+
+    DirectoryWatcher &operator=(
+        const DirectoryWatcher &
+    ) = delete;
+
+    DirectoryWatcher(
+        DirectoryWatcher &&
+    ) = delete;
+
+    DirectoryWatcher &operator=(
+        DirectoryWatcher &&
+    ) = delete;
+
+    ~DirectoryWatcher() {
+        if (fd_ != -1) {
+            close(fd_);
+        }
+    }
+
+    // Wait until something changes, the timeout passes or evaluation is cancelled. Without inotify this only waits
+    // for the timeout or cancellation.
+    void wait(
+        const std::chrono::milliseconds timeout,
+        const CancellationToken *cancellation
+    ) {
+        watch_directories();
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        while (!(cancellation && cancellation->cancelled())) {
+            const auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()
+            );
+            if (remaining <= std::chrono::milliseconds::zero()) {
+                return;
+            }
+            const auto slice = cancellation ? std::min(remaining, CANCEL_CHECK_INTERVAL) : remaining;
+            if (fd_ == -1) {
+                std::this_thread::sleep_for(slice);
+                continue;
+            }
+            pollfd poll_fd{.fd = fd_, .events = POLLIN, .revents = 0};
+            if (poll(&poll_fd, 1, static_cast<int>(slice.count())) > 0) {
+                drain_events();
+                return;
+            }
+        }
+    }
+
+private:
+    void watch_directories() {
+#ifdef __linux__
+        if (fd_ == -1) {
+            return;
+        }
+        std::error_code error;
+        const auto watch = [this](
+            const std::filesystem::path &directory
+        ) {
+            if (watched_.contains(directory)) {
+                return;
+            }
+            const auto wd = inotify_add_watch(fd_, directory.c_str(), IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE);
+            if (wd != -1) {
+                watched_.emplace(directory, wd);
+                directories_.emplace(wd, directory);
+            }
+        };
+
+        if (!std::filesystem::is_directory(root_, error)) {
+            return;
+        }
+        watch(root_);
+        if (!recursive_) {
+            return;
+        }
+        for (std::filesystem::recursive_directory_iterator it(root_, error), end; !error && it != end;
+             it.increment(error)) {
+            if (it->is_directory(error)) {
+                watch(it->path());
+            }
+        }
+#endif
+    }
+
+    void drain_events() {
+#ifdef __linux__
+        alignas(inotify_event) char buffer[4096]; // NOLINT(*-avoid-c-arrays)
+        while (true) {
+            const auto length = read(fd_, buffer, sizeof(buffer));
+            if (length <= 0) {
+                return;
+            }
+            for (ssize_t offset = 0; offset < length;) {
+                const auto *event = reinterpret_cast<const inotify_event *>(buffer + offset); // NOLINT
+                // Watches on removed directories are dropped, so a directory recreated under the same name is watched
+                // again.
+                if ((event->mask & IN_IGNORED) != 0) {
+                    if (const auto it = directories_.find(event->wd); it != directories_.end()) {
+                        watched_.erase(it->second);
+                        directories_.erase(it);
+                    }
+                }
+                offset += static_cast<ssize_t>(sizeof(inotify_event) + event->len);
+            }
+        }
+#endif
+    }
+
+    std::filesystem::path root_;
+    bool recursive_ = false;
+    int fd_ = -1;
+    std::map<std::filesystem::path, int> watched_;
+    std::map<int, std::filesystem::path> directories_;
+};
+
+class ForwardingWriter final : public Writer {
+public:
+    explicit ForwardingWriter(
+        Writer &target
+    ) :
+        target_(target) {}
+
+    void write(
+        std::shared_ptr<arrow::RecordBatch> batch
+    ) override {
+        target_.write(std::move(batch));
+    }
+
+    void flush() override {
+        target_.flush();
+    }
+
+private:
+    Writer &target_;
+};
+
+// One writer for the whole run, so there is a single header however many times the plan is evaluated.
+class AppendingOutput {
+public:
+    AppendingOutput(
+        const FollowOptions &options,
+        const bool resuming
+    ) :
+        format_(options.format),
+        out_path_(options.out_path),
+        writer_options_(options.writer_options),
+        append_(resuming) {}
+
+    std::unique_ptr<Writer> writer(
+        const std::shared_ptr<arrow::Schema> &schema
+    ) {
+        if (!writer_) {
+            const auto continues_output = continues_existing_output();
+            const auto stream = out_path_.empty() ? open_stdout_stream() : open_file_stream(out_path_, append_);
+            writer_ = make_writer(format_, schema, stream, !continues_output, writer_options_);
+            schema_ = schema;
+        } else if (!schema->Equals(*schema_, false)) {
+            throw std::runtime_error(
+                "The new files produce columns " + schema->ToString() + " instead of " + schema_->ToString() + "."
+            );
+        }
+        return std::make_unique<ForwardingWriter>(*writer_);
+    }
+
+private:
+    // Whether the output already holds rows, such as a file being resumed or standard output redirected with `>>`, in
+    // which case no header is written.
+    [[nodiscard]] bool continues_existing_output() const {
+        if (out_path_.empty()) {
+            struct stat status{};
+            return fstat(STDOUT_FILENO, &status) == 0 && S_ISREG(status.st_mode) && status.st_size > 0;
+        }
+        std::error_code error;
+        return append_ && std::filesystem::file_size(out_path_, error) > 0 && !error;
+    }
+
+    OutputFormat format_;
+    std::string out_path_;
+    WriterOptions writer_options_;
+    bool append_;
+    std::unique_ptr<Writer> writer_;
+    std::shared_ptr<arrow::Schema> schema_;
+};
+}
+
+// The stage whose files are followed: the first that selects from a quoted local Parquet path or glob.
+static std::optional<std::size_t> followed_stage(
+    const OverallQueryPlan &query_plan
+) {
+    const auto &plans = query_plan.get_plans();
+    for (std::size_t i = 0; i < plans.size(); ++i) {
+        const auto tablenames = plans[i].select ? plans[i].select->get_tablenames() : std::vector<std::string>{};
+        if (tablenames.size() == 1 && parquet_table_pattern(tablenames.front())) {
+            return i;
+        }
+    }
+    return std::nullopt;
+}
+
+std::optional<std::string> follow_unsupported_reason(
+    const OverallQueryPlan &query_plan
+) {
+    for (const auto &plan: query_plan.get_plans()) {
+        if (plan.order) {
+            return "Can't follow a plan with 'dsort', because the order of rows in files that haven't arrived yet is "
+                    "unknown.";
+        }
+        if (plan.limit) {
+            return "Can't follow a plan with 'dhead', because its limit applies to the whole dataset rather than to "
+                    "each new file.";
+        }
+        if (plan.sql) {
+            return "Can't follow a plan with 'dsql', because its query may aggregate or sort across files.";
+        }
+    }
+    const auto stage = followed_stage(query_plan);
+    if (!stage) {
+        return "Can only follow a 'dcat' of a quoted local Parquet path or glob, such as \"'data/*/*.parquet'\".";
+    }
+
+    const auto followed_literals = table_literals(query_plan.get_plans()[*stage].select->get_tablenames().front());
+    for (const auto &plan: query_plan.get_plans()) {
+        if (!plan.join) {
+            continue;
+        }
+        const auto how = to_upper(plan.join->get_how());
+        if (how != "INNER") {
+            return "Can't follow a plan with a " + how + " join, because rows without a match would be output again "
+                   "for every new file.";
+        }
+        // Each evaluation only sees the new files, so pairs of rows from an old and a new file would be missed, and
+        // reading the followed files directly would join the old ones again.
+        const auto table = plan.join->get_table();
+        const auto reads_followed_files = std::ranges::any_of(table_literals(table), [&](const std::string &literal) {
+            return std::ranges::find(followed_literals, literal) != followed_literals.end();
+        });
+        if (query_plan.find_plan(table) || reads_followed_files) {
+            return "Can't follow a plan that joins the followed files with themselves.";
+        }
+    }
+    return std::nullopt;
+}
+
+static std::int64_t now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::filesystem::file_time_type::clock::now().time_since_epoch()
+    ).count();
+}
+
+ExitStatus follow_query(
+    const OverallQueryPlan &query_plan,
+    const EvaluationOptions &options,
+    const FollowOptions &follow_options
+) {
+    auto &diagnostics = *options.diagnostics;
+    if (const auto reason = follow_unsupported_reason(query_plan)) {
+        diagnostics << *reason << '\n';
+        return ExitStatus::QUERY_GENERATION_ERROR;
+    }
+
+    const auto stage = *followed_stage(query_plan);
+    const auto &select = *query_plan.get_plans()[stage].select;
+    const auto tablename = select.get_tablenames().front();
+
+    try {
+        Checkpoint checkpoint(follow_options.checkpoint);
+        AppendingOutput output(follow_options, !checkpoint.empty());
+        DirectoryWatcher watcher(*parquet_table_pattern(tablename));
+
+        // Each evaluation only covers new files, so its result would never be asked for again.
+        auto evaluation_options = options;
+        evaluation_options.result_cache.reset();
+        evaluation_options.tracer = nullptr;
+        const auto db = open_database(options.engine);
+
+        const auto writer_factory = [&output](
+            const std::shared_ptr<arrow::Schema> &schema
+        ) {
+            return output.writer(schema);
+        };
+
+        while (true) {
+            // Stopping between evaluations is how following normally ends, so it isn't reported.
+            if (options.cancellation && options.cancellation->cancelled()) {
+                return cancelled_status(options.cancellation->reason());
+            }
+            const auto settle_ns = std::chrono::nanoseconds(follow_options.settle_time).count();
+            const auto now = now_ns();
+            std::vector<InputFile> ready;
+            std::optional<std::int64_t> next_settled_ns;
+            for (auto &file: list_input_files({tablename})) {
+                if (checkpoint.contains(file.path)) {
+                    continue;
+                }
+                if (now - file.mtime >= settle_ns) {
+                    ready.push_back(std::move(file));
+                } else {
+                    next_settled_ns = std::min(next_settled_ns.value_or(settle_ns), file.mtime + settle_ns - now);
+                }
+            }
+
+            if (ready.empty()) {
+                watcher.wait(
+                    next_settled_ns
+                        ? std::chrono::duration_cast<std::chrono::milliseconds>(
+                              std::chrono::nanoseconds(*next_settled_ns)
+                          ) + std::chrono::milliseconds(1)
+                        : POLL_INTERVAL,
+                    options.cancellation
+                );
+                continue;
+            }
+
+            OverallQueryPlan increment;
+            for (std::size_t i = 0; i < query_plan.get_plans().size(); ++i) {
+                auto plan = query_plan.get_plans()[i];
+                if (i == stage) {
+                    plan.select = SelectFragment(
+                        {read_parquet_expression(ready)},
+                        select.get_columns(),
+                        select.get_alias(),
+                        select.get_schema()
+                    );
+                }
+                increment.add_plan(plan);
+            }
+
+            if (options.print_stats) {
+                diagnostics << "Following: evaluating " << ready.size() << " new files.\n";
+            }
+            AliasGenerator alias_generator;
+            const auto status = evaluate_query(increment, writer_factory, alias_generator, evaluation_options, *db);
+            if (status != ExitStatus::SUCCESS) {
+                return status;
+            }
+            // Only recorded once the results are written, so a file is never skipped without its rows being output.
+            checkpoint.add(ready);
+        }
+    } catch (const std::runtime_error &error) {
+        diagnostics << "Error following " << tablename << ". " << error.what() << '\n';
+        return ExitStatus::EXECUTION_ERROR;
+    }
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <chrono>
+#include <filesystem>
+#include <optional>
+#include <string>
+
+#include "query_evaluator.h"
+#include "writer.h"
+
+class OverallQueryPlan;
+
+struct FollowOptions {
+    OutputFormat format = OutputFormat::CSV;
+    // Standard output if empty.
+    std::string out_path;
+    WriterOptions writer_options;
+    // Files listed here (one path per line) have already been evaluated and are skipped; files are added as their
+    // results are written. Without a checkpoint every matching file is evaluated on startup.
+    std::optional<std::filesystem::path> checkpoint;
+    // A new file is only read once it hasn't been modified for this long, so files still being written are skipped.
+    std::chrono::milliseconds settle_time{1000};
+};
+
+// Why the plan can't be evaluated incrementally, or nullopt if it can.
+std::optional<std::string> follow_unsupported_reason(
+    const OverallQueryPlan &query_plan
+);
+
+// Evaluate the plan over the files of its first quoted Parquet path or glob, then again over only the new files each
+// time more appear, appending the results to the output. Runs until it fails or the process is killed.
+ExitStatus follow_query(
+    const OverallQueryPlan &query_plan,
+    const EvaluationOptions &options,
+    const FollowOptions &follow_options
+);
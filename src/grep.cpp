@@ -7,6 +7,7 @@
 #include "query.h"
 #include "queryplan.h"
 #include "serde.h"
+#include "stages.h"
 
 
 class GrepOptions final : public Options {
@@ -96,7 +97,7 @@ private:
 };
 
 
-int main(
+int grep_main(
     const int argc,
     const char *argv[]
 ) {
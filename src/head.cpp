@@ -6,6 +6,7 @@
 #include "options.h"
 #include "queryplan.h"
 #include "serde.h"
+#include "stages.h"
 
 constexpr int DEFAULT_NUMBER_OF_LINES = 10;
 
@@ -41,7 +42,7 @@ private:
 };
 
 
-int main(
+int head_main(
     const int argc,
     const char *argv[]
 ) {
@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+
+#include <fnmatch.h>
+#include <glob.h>
+
+#include "fnv_hash.h"
+
+#include "input_files.h"
+
+
+static bool has_wildcard(
+    const std::string &pattern
+) {
+    return pattern.find_first_of("*?[{") != std::string::npos;
+}
+
+static std::int64_t mtime_ns(
+    const std::filesystem::file_time_type time
+) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+}
+
+static void add_if_regular_file(
+    const std::filesystem::path &path,
+    std::vector<InputFile> &files
+) {
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(path, error)) {
+        return;
+    }
+    const auto size = std::filesystem::file_size(path, error);
+    const auto mtime = std::filesystem::last_write_time(path, error);
+    if (error) {
+        return;
+    }
+    files.push_back(InputFile{.path = path.string(), .size = size, .mtime = mtime_ns(mtime)});
+}
+
+// glob(3) has no notion of `**`, so walk everything under the non-wildcard prefix and match each path against the
+// pattern with `*` allowed to cross directory separators.
+static void expand_recursive_glob(
+    const std::string &pattern,
+    std::vector<InputFile> &files
+) {
+    const auto wildcard = pattern.find_first_of("*?[{");
+    const auto separator = pattern.rfind('/', wildcard);
+    const std::filesystem::path root = separator == std::string::npos ? "." : pattern.substr(0, separator + 1);
+
+    std::error_code error;
+    for (std::filesystem::recursive_directory_iterator it(root, error), end; !error && it != end; it.increment(error)) {
+        auto path = it->path().string();
+        if (separator == std::string::npos && path.starts_with("./")) {
+            path = path.substr(2);
+        }
+        if (fnmatch(pattern.c_str(), path.c_str(), 0) == 0) {
+            add_if_regular_file(path, files);
+        }
+    }
+}
+
+static void expand_glob(
+    const std::string &pattern,
+    std::vector<InputFile> &files
+) {
+    glob_t matches{};
+    if (glob(pattern.c_str(), GLOB_BRACE, nullptr, &matches) == 0) {
+        for (std::size_t i = 0; i < matches.gl_pathc; ++i) {
+            add_if_regular_file(matches.gl_pathv[i], files); // NOLINT(*-pointer-arithmetic)
+        }
+    }
+    globfree(&matches);
+}
+
+// Reads the quoted literal starting at tablename[i], leaving i on its closing quote.
+static std::string read_literal(
+    const std::string &tablename,
+    std::size_t &i
+) {
+    std::string literal;
+    for (++i; i < tablename.size(); ++i) {
+        if (tablename[i] == '\'') {
+            // A doubled quote is an escaped quote inside the literal.
+            if (i + 1 < tablename.size() && tablename[i + 1] == '\'') {
+                literal.push_back('\'');
+                ++i;
+                continue;
+            }
+            break;
+        }
+        literal.push_back(tablename[i]);
+    }
+    return literal;
+}
+
+std::vector<std::string> table_literals(
+    const std::string &tablename
+) {
+    std::vector<std::string> literals;
+
+    for (std::size_t i = 0; i < tablename.size(); ++i) {
+        if (tablename[i] == '\'') {
+            literals.push_back(read_literal(tablename, i));
+        }
+    }
+
+    return literals;
+}
+
+std::string resolve_table_literals(
+    const std::string &tablename,
+    const std::filesystem::path &base
+) {
+    std::string resolved;
+
+    for (std::size_t i = 0; i < tablename.size(); ++i) {
+        if (tablename[i] != '\'') {
+            resolved.push_back(tablename[i]);
+            continue;
+        }
+
+        const auto last = resolved.find_last_not_of(" \t\n");
+        const auto is_named_argument = last != std::string::npos && resolved[last] == '=';
+        auto literal = read_literal(tablename, i);
+        if (!is_named_argument && !literal.empty() && !is_remote_literal(literal)
+            && std::filesystem::path(literal).is_relative()) {
+            literal = (base / literal).string();
+        }
+
+        resolved.push_back('\'');
+        for (const auto c: literal) {
+            if (c == '\'') {
+                resolved.push_back('\'');
+            }
+            resolved.push_back(c);
+        }
+        resolved.push_back('\'');
+    }
+
+    return resolved;
+}
+
+bool is_remote_literal(
+    const std::string &literal
+) {
+    return literal.find("://") != std::string::npos;
+}
+
+bool is_special_file_literal(
+    const std::string &literal
+) {
+    std::error_code error;
+    const auto status = std::filesystem::status(literal, error);
+    return !error && std::filesystem::exists(status) && !std::filesystem::is_regular_file(status)
+        && !std::filesystem::is_directory(status);
+}
+
+std::vector<InputFile> list_input_files(
+    const std::vector<std::string> &tablenames
+) {
+    std::vector<InputFile> files;
+
+    for (const auto &tablename: tablenames) {
+        for (const auto &literal: table_literals(tablename)) {
+            if (is_remote_literal(literal)) {
+                continue;
+            }
+            if (literal.find("**") != std::string::npos) {
+                expand_recursive_glob(literal, files);
+            } else if (has_wildcard(literal)) {
+                expand_glob(literal, files);
+            } else {
+                add_if_regular_file(literal, files);
+            }
+        }
+    }
+
+    std::ranges::sort(files, {}, &InputFile::path);
+    const auto duplicates = std::ranges::unique(files, {}, &InputFile::path);
+    files.erase(duplicates.begin(), duplicates.end());
+    return files;
+}
+
+std::string fingerprint_inputs(
+    const std::vector<std::string> &tablenames
+) {
+    // Relative paths are hashed as absolute ones, so that a plan whose paths were resolved (say by a server, against
+    // the client's working directory) still matches the schemas stored in it.
+    std::error_code error;
+    const auto cwd = std::filesystem::current_path(error);
+    Fnv1aHash hash;
+    for (const auto &tablename: tablenames) {
+        hash.update(resolve_table_literals(tablename, cwd));
+    }
+    for (const auto &file: list_input_files(tablenames)) {
+        hash.update(std::filesystem::absolute(file.path, error).string());
+        hash.update(std::to_string(file.size));
+        hash.update(std::to_string(file.mtime));
+    }
+    return hash.hex();
+}
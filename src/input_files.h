@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+struct InputFile {
+    std::string path;
+    std::uintmax_t size;
+    // Modification time in nanoseconds since the epoch.
+    std::int64_t mtime;
+};
+
+// Quoted string literals in a table expression such as `'data/*.parquet'` or
+// `read_parquet(['a.parquet', 'b.parquet'])`.
+std::vector<std::string> table_literals(
+    const std::string &tablename
+);
+
+// The table expression with every relative local path among its literals resolved against base. Literals
+// given as named arguments, such as `delim=','`, are left alone.
+std::string resolve_table_literals(
+    const std::string &tablename,
+    const std::filesystem::path &base
+);
+
+// Whether a literal refers to something other than the local filesystem (s3://, https://, ...).
+bool is_remote_literal(
+    const std::string &literal
+);
+
+// Whether a literal names a FIFO, device or socket (such as /dev/stdin or /dev/fd/N), which can yield different rows on
+// every read while its size and modification time stay the same.
+bool is_special_file_literal(
+    const std::string &literal
+);
+
+// Local files matched by the literals in the given table expressions, sorted by path. Globs are expanded, with `**`
+// matching across directories as it does in DuckDb.
+std::vector<InputFile> list_input_files(
+    const std::vector<std::string> &tablenames
+);
+
+// Hash of the absolute path, size and modification time of every local input file. Remote literals and table
+// expressions without any literal (such as a CTE alias) contribute only their text, because they can't be checked
+// cheaply. Relative paths hash the same as the absolute paths they resolve to.
+std::string fingerprint_inputs(
+    const std::vector<std::string> &tablenames
+);
@@ -6,6 +6,7 @@
 #include "options.h"
 #include "queryplan.h"
 #include "serde.h"
+#include "stages.h"
 
 
 class JoinOptions final : public Options {
@@ -93,7 +94,7 @@ private:
 };
 
 
-int main(
+int join_main(
     const int argc,
     const char *argv[]
 ) {
@@ -116,6 +117,8 @@ int main(
     query_plan.join.emplace(
         JoinFragment{options.get_table(), options.get_how(), options.get_conditions(), options.get_alias()}
     );
+    // The joined table contributes columns we haven't resolved.
+    query_plan.schema = std::nullopt;
 
     return static_cast<int>(dump_or_eval_query_plan(*overall_query_plan));
 }
@@ -0,0 +1,64 @@
+#include <array>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <string_view>
+
+#include "engine.h"
+#include "stages.h"
+
+struct Stage {
+    std::string_view name;
+    int (*main)(
+        int argc,
+        const char *argv[] // NOLINT(*-avoid-c-arrays)
+    );
+};
+
+static int deval_main(
+    const int argc,
+    const char *argv[] // NOLINT(*-avoid-c-arrays)
+) {
+    return engine().eval_main(argc, argv);
+}
+
+constexpr std::array STAGES{
+    Stage{.name = "dcat", .main = cat_main},
+    Stage{.name = "dcut", .main = cut_main},
+    Stage{.name = "dgrep", .main = grep_main},
+    Stage{.name = "dhead", .main = head_main},
+    Stage{.name = "djoin", .main = join_main},
+    Stage{.name = "dsort", .main = sort_main},
+    Stage{.name = "dsql", .main = sql_main},
+    Stage{.name = "deval", .main = deval_main},
+};
+
+// Runs the stage named by the symlink it was invoked through, or by its first argument, as in `dtool dcat ...`.
+int main(
+    int argc,
+    const char *argv[] // NOLINT(*-avoid-c-arrays)
+) {
+    auto name = std::filesystem::path(argv[0]).filename().string();
+    if (name == "dtool" && argc > 1) {
+        name = argv[1];
+        ++argv;
+        --argc;
+    }
+    for (const auto &stage: STAGES) {
+        if (stage.name != name) {
+            continue;
+        }
+        try {
+            return stage.main(argc, argv);
+        } catch (const std::exception &e) {
+            std::cerr << e.what() << '\n';
+            return static_cast<int>(ExitStatus::EXECUTION_ERROR);
+        }
+    }
+    std::cerr << "Unknown stage '" << name << "'. Run dtool as one of";
+    for (const auto &stage: STAGES) {
+        std::cerr << ' ' << stage.name;
+    }
+    std::cerr << ".\n";
+    return 1;
+}
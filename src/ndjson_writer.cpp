@@ -0,0 +1,496 @@
+#include <cmath>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+
+#include <arrow/compute/api.h>
+#include <arrow/util/base64.h>
+#include <arrow/util/config.h>
+#include <arrow/util/formatting.h>
+
+#include "ndjson_writer.h"
+
+
+constexpr std::string_view NULL_JSON = "null";
+
+// Quotes, backslashes and control characters are escaped; everything else, including UTF-8, is copied as is.
+static void append_string(
+    const std::string_view text,
+    std::string &out
+) {
+    static constexpr std::string_view HEX_DIGITS = "0123456789abcdef";
+
+    out.push_back('"');
+    std::size_t start = 0;
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        const auto c = static_cast<unsigned char>(text[i]);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out.append(text.substr(start, i - start));
+        start = i + 1;
+        switch (c) {
+            case '"':
+                out.append("\\\"");
+                break;
+            case '\\':
+                out.append("\\\\");
+                break;
+            case '\n':
+                out.append("\\n");
+                break;
+            case '\r':
+                out.append("\\r");
+                break;
+            case '\t':
+                out.append("\\t");
+                break;
+            default:
+                out.append("\\u00");
+                out.push_back(HEX_DIGITS[c >> 4]);
+                out.push_back(HEX_DIGITS[c & 0xf]);
+        }
+    }
+    out.append(text.substr(start));
+    out.push_back('"');
+}
+
+// `{"name":` for the first field and `,"name":` for the rest.
+static std::vector<std::string> object_keys(
+    const arrow::FieldVector &fields
+) {
+    std::vector<std::string> keys;
+    for (const auto &field: fields) {
+        std::string key(keys.empty() ? "{" : ",");
+        append_string(field->name(), key);
+        key.push_back(':');
+        keys.push_back(std::move(key));
+    }
+    return keys;
+}
+
+namespace {
+// Appends one row's value of a column.
+class JsonEncoder {
+public:
+    virtual ~JsonEncoder() = default;
+
+    virtual void append(
+        std::int64_t row,
+        std::string &out
+    ) = 0;
+};
+
+std::unique_ptr<JsonEncoder> make_encoder(
+    const std::shared_ptr<arrow::Array> &array
+);
+
+// Booleans and numbers, formatted the way Arrow formats them when casting to strings, which is valid JSON apart from
+// NaN and infinities.
+template<typename ArrowType>
+class NumberEncoder final : public JsonEncoder {
+    using ArrayType = typename arrow::TypeTraits<ArrowType>::ArrayType;
+
+public:
+    explicit NumberEncoder(
+        const std::shared_ptr<arrow::Array> &array
+    ) :
+        array_(std::static_pointer_cast<ArrayType>(array)),
+        formatter_(array_->type().get()) {}
+
+    void append(
+        const std::int64_t row,
+        std::string &out
+    ) override {
+        if (array_->IsNull(row)) {
+            out.append(NULL_JSON);
+            return;
+        }
+        const auto value = array_->Value(row);
+        if constexpr (std::is_floating_point_v<decltype(value)>) {
+            if (!std::isfinite(value)) {
+                out.append(NULL_JSON);
+                return;
+            }
+        }
+        formatter_(value, [&out](const std::string_view text) { out.append(text); });
+    }
+
+private:
+    std::shared_ptr<ArrayType> array_;
+    arrow::internal::StringFormatter<ArrowType> formatter_;
+};
+
+// Dates, times and timestamps, which need no escaping.
+template<typename ArrowType>
+class TemporalEncoder final : public JsonEncoder {
+    using ArrayType = typename arrow::TypeTraits<ArrowType>::ArrayType;
+
+public:
+    explicit TemporalEncoder(
+        const std::shared_ptr<arrow::Array> &array
+    ) :
+        array_(std::static_pointer_cast<ArrayType>(array)),
+        formatter_(array_->type().get()) {}
+
+    void append(
+        const std::int64_t row,
+        std::string &out
+    ) override {
+        if (array_->IsNull(row)) {
+            out.append(NULL_JSON);
+            return;
+        }
+        out.push_back('"');
+        formatter_(array_->Value(row), [&out](const std::string_view text) { out.append(text); });
+        out.push_back('"');
+    }
+
+private:
+    std::shared_ptr<ArrayType> array_;
+    arrow::internal::StringFormatter<ArrowType> formatter_;
+};
+
+template<typename ArrayType>
+class DecimalEncoder final : public JsonEncoder {
+public:
+    explicit DecimalEncoder(
+        const std::shared_ptr<arrow::Array> &array
+    ) :
+        array_(std::static_pointer_cast<ArrayType>(array)) {}
+
+    void append(
+        const std::int64_t row,
+        std::string &out
+    ) override {
+        if (array_->IsNull(row)) {
+            out.append(NULL_JSON);
+            return;
+        }
+        out.append(array_->FormatValue(row));
+    }
+
+private:
+    std::shared_ptr<ArrayType> array_;
+};
+
+template<typename ArrayType>
+class StringEncoder final : public JsonEncoder {
+public:
+    explicit StringEncoder(
+        const std::shared_ptr<arrow::Array> &array
+    ) :
+        array_(std::static_pointer_cast<ArrayType>(array)) {}
+
+    void append(
+        const std::int64_t row,
+        std::string &out
+    ) override {
+        if (array_->IsNull(row)) {
+            out.append(NULL_JSON);
+            return;
+        }
+        append_string(array_->GetView(row), out);
+    }
+
+private:
+    std::shared_ptr<ArrayType> array_;
+};
+
+// Binary values needn't be valid UTF-8, so they are base64 encoded.
+template<typename ArrayType>
+class BinaryEncoder final : public JsonEncoder {
+public:
+    explicit BinaryEncoder(
+        const std::shared_ptr<arrow::Array> &array
+    ) :
+        array_(std::static_pointer_cast<ArrayType>(array)) {}
+
+    void append(
+        const std::int64_t row,
+        std::string &out
+    ) override {
+        if (array_->IsNull(row)) {
+            out.append(NULL_JSON);
+            return;
+        }
+        out.push_back('"');
+        out.append(arrow::util::base64_encode(array_->GetView(row)));
+        out.push_back('"');
+    }
+
+private:
+    std::shared_ptr<ArrayType> array_;
+};
+
+class DictionaryEncoder final : public JsonEncoder {
+public:
+    explicit DictionaryEncoder(
+        const std::shared_ptr<arrow::Array> &array
+    ) :
+        array_(std::static_pointer_cast<arrow::DictionaryArray>(array)),
+        values_(make_encoder(array_->dictionary())) {}
+
+    void append(
+        const std::int64_t row,
+        std::string &out
+    ) override {
+        if (array_->IsNull(row)) {
+            out.append(NULL_JSON);
+            return;
+        }
+        values_->append(array_->GetValueIndex(row), out);
+    }
+
+private:
+    std::shared_ptr<arrow::DictionaryArray> array_;
+    std::unique_ptr<JsonEncoder> values_;
+};
+
+class StructEncoder final : public JsonEncoder {
+public:
+    explicit StructEncoder(
+        const std::shared_ptr<arrow::Array> &array
+    ) :
+        array_(std::static_pointer_cast<arrow::StructArray>(array)),
+        keys_(object_keys(array_->struct_type()->fields())) {
+        // Unlike fields(), field() accounts for the struct's offset.
+        for (int i = 0; i < array_->num_fields(); ++i) {
+            fields_.push_back(make_encoder(array_->field(i)));
+        }
+    }
+
+    void append(
+        const std::int64_t row,
+        std::string &out
+    ) override {
+        if (array_->IsNull(row)) {
+            out.append(NULL_JSON);
+            return;
+        }
+        for (std::size_t i = 0; i < fields_.size(); ++i) {
+            out.append(keys_[i]);
+            fields_[i]->append(row, out);
+        }
+        out.append(fields_.empty() ? "{}" : "}");
+    }
+
+private:
+    std::shared_ptr<arrow::StructArray> array_;
+    std::vector<std::string> keys_;
+    std::vector<std::unique_ptr<JsonEncoder> > fields_;
+};
+
+// Lists of any kind, whose offsets index into their whole values array.
+template<typename ArrayType>
+class ListEncoder final : public JsonEncoder {
+public:
+    explicit ListEncoder(
+        const std::shared_ptr<arrow::Array> &array
+    ) :
+        array_(std::static_pointer_cast<ArrayType>(array)),
+        values_(make_encoder(array_->values())) {}
+
+    void append(
+        const std::int64_t row,
+        std::string &out
+    ) override {
+        if (array_->IsNull(row)) {
+            out.append(NULL_JSON);
+            return;
+        }
+        out.push_back('[');
+        const std::int64_t offset = array_->value_offset(row);
+        const std::int64_t length = array_->value_length(row);
+        for (std::int64_t i = 0; i < length; ++i) {
+            if (i > 0) {
+                out.push_back(',');
+            }
+            values_->append(offset + i, out);
+        }
+        out.push_back(']');
+    }
+
+private:
+    std::shared_ptr<ArrayType> array_;
+    std::unique_ptr<JsonEncoder> values_;
+};
+
+// Maps become objects. Keys that aren't written as strings, such as numbers, are quoted.
+class MapEncoder final : public JsonEncoder {
+public:
+    explicit MapEncoder(
+        const std::shared_ptr<arrow::Array> &array
+    ) :
+        array_(std::static_pointer_cast<arrow::MapArray>(array)) {
+        const auto entries = std::static_pointer_cast<arrow::StructArray>(array_->values());
+        keys_ = make_encoder(entries->field(0));
+        items_ = make_encoder(entries->field(1));
+    }
+
+    void append(
+        const std::int64_t row,
+        std::string &out
+    ) override {
+        if (array_->IsNull(row)) {
+            out.append(NULL_JSON);
+            return;
+        }
+        out.push_back('{');
+        const std::int64_t offset = array_->value_offset(row);
+        const std::int64_t length = array_->value_length(row);
+        for (std::int64_t i = 0; i < length; ++i) {
+            if (i > 0) {
+                out.push_back(',');
+            }
+            key_.clear();
+            keys_->append(offset + i, key_);
+            if (key_.starts_with('"')) {
+                out.append(key_);
+            } else {
+                append_string(key_, out);
+            }
+            out.push_back(':');
+            items_->append(offset + i, out);
+        }
+        out.push_back('}');
+    }
+
+private:
+    std::shared_ptr<arrow::MapArray> array_;
+    std::unique_ptr<JsonEncoder> keys_;
+    std::unique_ptr<JsonEncoder> items_;
+    std::string key_;
+};
+
+// Anything else that Arrow can cast to a string, such as durations, is cast a slice at a time.
+std::unique_ptr<JsonEncoder> make_cast_encoder(
+    const std::shared_ptr<arrow::Array> &array
+) {
+    auto cast = arrow::compute::Cast(*array, arrow::large_utf8());
+    if (!cast.ok()) {
+        throw std::runtime_error(
+            "Can't write values of type " + array->type()->ToString() + " as JSON. " + cast.status().ToString()
+        );
+    }
+    return std::make_unique<StringEncoder<arrow::LargeStringArray> >(*cast);
+}
+
+std::unique_ptr<JsonEncoder> make_encoder(
+    const std::shared_ptr<arrow::Array> &array
+) {
+    switch (array->type_id()) {
+        case arrow::Type::BOOL:
+            return std::make_unique<NumberEncoder<arrow::BooleanType> >(array);
+        case arrow::Type::INT8:
+            return std::make_unique<NumberEncoder<arrow::Int8Type> >(array);
+        case arrow::Type::INT16:
+            return std::make_unique<NumberEncoder<arrow::Int16Type> >(array);
+        case arrow::Type::INT32:
+            return std::make_unique<NumberEncoder<arrow::Int32Type> >(array);
+        case arrow::Type::INT64:
+            return std::make_unique<NumberEncoder<arrow::Int64Type> >(array);
+        case arrow::Type::UINT8:
+            return std::make_unique<NumberEncoder<arrow::UInt8Type> >(array);
+        case arrow::Type::UINT16:
+            return std::make_unique<NumberEncoder<arrow::UInt16Type> >(array);
+        case arrow::Type::UINT32:
+            return std::make_unique<NumberEncoder<arrow::UInt32Type> >(array);
+        case arrow::Type::UINT64:
+            return std::make_unique<NumberEncoder<arrow::UInt64Type> >(array);
+        case arrow::Type::FLOAT:
+            return std::make_unique<NumberEncoder<arrow::FloatType> >(array);
+        case arrow::Type::DOUBLE:
+            return std::make_unique<NumberEncoder<arrow::DoubleType> >(array);
+        case arrow::Type::DATE32:
+            return std::make_unique<TemporalEncoder<arrow::Date32Type> >(array);
+        case arrow::Type::DATE64:
+            return std::make_unique<TemporalEncoder<arrow::Date64Type> >(array);
+        case arrow::Type::TIME32:
+            return std::make_unique<TemporalEncoder<arrow::Time32Type> >(array);
+        case arrow::Type::TIME64:
+            return std::make_unique<TemporalEncoder<arrow::Time64Type> >(array);
+        case arrow::Type::TIMESTAMP:
+            return std::make_unique<TemporalEncoder<arrow::TimestampType> >(array);
+        case arrow::Type::DECIMAL128:
+            return std::make_unique<DecimalEncoder<arrow::Decimal128Array> >(array);
+        case arrow::Type::DECIMAL256:
+            return std::make_unique<DecimalEncoder<arrow::Decimal256Array> >(array);
+        case arrow::Type::STRING:
+            return std::make_unique<StringEncoder<arrow::StringArray> >(array);
+        case arrow::Type::LARGE_STRING:
+            return std::make_unique<StringEncoder<arrow::LargeStringArray> >(array);
+#if ARROW_VERSION_MAJOR >= 15
+        case arrow::Type::STRING_VIEW:
+            return std::make_unique<StringEncoder<arrow::StringViewArray> >(array);
+#endif
+        case arrow::Type::BINARY:
+            return std::make_unique<BinaryEncoder<arrow::BinaryArray> >(array);
+        case arrow::Type::LARGE_BINARY:
+            return std::make_unique<BinaryEncoder<arrow::LargeBinaryArray> >(array);
+        case arrow::Type::FIXED_SIZE_BINARY:
+            return std::make_unique<BinaryEncoder<arrow::FixedSizeBinaryArray> >(array);
+        case arrow::Type::DICTIONARY:
+            return std::make_unique<DictionaryEncoder>(array);
+        case arrow::Type::STRUCT:
+            return std::make_unique<StructEncoder>(array);
+        case arrow::Type::LIST:
+            return std::make_unique<ListEncoder<arrow::ListArray> >(array);
+        case arrow::Type::LARGE_LIST:
+            return std::make_unique<ListEncoder<arrow::LargeListArray> >(array);
+        case arrow::Type::FIXED_SIZE_LIST:
+            return std::make_unique<ListEncoder<arrow::FixedSizeListArray> >(array);
+        case arrow::Type::MAP:
+            return std::make_unique<MapEncoder>(array);
+        default:
+            return make_cast_encoder(array);
+    }
+}
+}
+
+NdjsonWriter::NdjsonWriter(
+    const std::shared_ptr<arrow::Schema> &schema,
+    std::shared_ptr<arrow::io::OutputStream> stream,
+    const std::size_t threads
+) :
+    keys_(object_keys(schema->fields())),
+    encoder_(std::move(stream), "Error writing JSON", threads) {}
+
+void NdjsonWriter::write(
+    std::shared_ptr<arrow::RecordBatch> batch
+) {
+    for (std::int64_t offset = 0; offset < batch->num_rows(); offset += ENCODE_ROWS) {
+        encoder_.submit([this, slice = batch->Slice(offset, ENCODE_ROWS)] {
+            return encode(*slice);
+        });
+    }
+    encoder_.write_ready();
+}
+
+void NdjsonWriter::flush() {
+    encoder_.flush();
+}
+
+std::string NdjsonWriter::encode(
+    const arrow::RecordBatch &batch
+) const {
+    std::vector<std::unique_ptr<JsonEncoder> > encoders;
+    for (const auto &column: batch.columns()) {
+        encoders.push_back(make_encoder(column));
+    }
+
+    std::size_t keys_size = 0;
+    for (const auto &key: keys_) {
+        keys_size += key.size();
+    }
+    std::string out;
+    out.reserve(static_cast<std::size_t>(batch.num_rows()) * (keys_size + 8 * encoders.size() + 3));
+    for (std::int64_t row = 0; row < batch.num_rows(); ++row) {
+        for (std::size_t j = 0; j < encoders.size(); ++j) {
+            out.append(keys_[j]);
+            encoders[j]->append(row, out);
+        }
+        out.append(encoders.empty() ? "{}\n" : "}\n");
+    }
+    return out;
+}
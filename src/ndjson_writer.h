@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arrow/api.h>
+
+#include "parallel_encoder.h"
+#include "writer.h"
+
+// Writes newline-delimited JSON, one object per row keyed by column name. Slices of ENCODE_ROWS rows are encoded on a
+// pool of threads. Numbers and booleans are written as JSON literals, except for NaN and infinities, which become null,
+// structs and maps as objects, and lists as arrays. Dates, times and timestamps are strings, as is binary data, which
+// is base64 encoded, and anything else Arrow can cast to a string.
+class NdjsonWriter final : public Writer {
+public:
+    static constexpr std::int64_t ENCODE_ROWS = 16384;
+
+    // Zero threads uses one per core, up to 8.
+    NdjsonWriter(
+        const std::shared_ptr<arrow::Schema> &schema,
+        std::shared_ptr<arrow::io::OutputStream> stream,
+        std::size_t threads = 0
+    );
+
+    void write(
+        std::shared_ptr<arrow::RecordBatch> batch
+    ) override;
+
+    void flush() override;
+
+private:
+    [[nodiscard]] std::string encode(
+        const arrow::RecordBatch &batch
+    ) const;
+
+    // `{"name":` for the first column and `,"name":` for the rest.
+    std::vector<std::string> keys_;
+    ParallelEncoder encoder_;
+};
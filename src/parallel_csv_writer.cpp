@@ -0,0 +1,339 @@
+#include <string_view>
+#include <utility>
+
+#include <arrow/compute/api.h>
+#include <arrow/util/config.h>
+#include <arrow/util/formatting.h>
+
+#include "parallel_csv_writer.h"
+
+
+namespace {
+// Appends a column's value for one row, quoted if need be, but not the delimiter.
+class ColumnEncoder {
+public:
+    virtual ~ColumnEncoder() = default;
+
+    virtual void append(
+        std::int64_t row,
+        std::string &out
+    ) = 0;
+};
+
+// Quotes inside the value are doubled.
+void append_quoted(
+    std::string_view text,
+    std::string &out
+) {
+    out.push_back('"');
+    while (true) {
+        const auto quote = text.find('"');
+        out.append(text.substr(0, quote));
+        if (quote == std::string_view::npos) {
+            break;
+        }
+        out.append("\"\"");
+        text.remove_prefix(quote + 1);
+    }
+    out.push_back('"');
+}
+
+// Strings are quoted by default, whereas numbers, dates and so on are not.
+void append_text(
+    const std::string_view text,
+    const CsvDialect &dialect,
+    const bool is_string,
+    std::string &out
+) {
+    const auto needs_quotes = [&] {
+        return text.find_first_of(std::string_view{"\"\n\r"}) != std::string_view::npos ||
+               text.find(dialect.delimiter) != std::string_view::npos;
+    };
+
+    switch (dialect.quoting) {
+        case CsvQuoting::STRINGS:
+            if (is_string) {
+                append_quoted(text, out);
+                return;
+            }
+            break;
+        case CsvQuoting::ALL:
+            append_quoted(text, out);
+            return;
+        case CsvQuoting::MINIMAL:
+            if (needs_quotes()) {
+                append_quoted(text, out);
+                return;
+            }
+            break;
+        case CsvQuoting::NONE:
+            if (needs_quotes()) {
+                throw std::runtime_error(
+                    "Can't write '" + std::string(text) + "' without quotes, because it contains the delimiter, a "
+                    "quote or a line break."
+                );
+            }
+            break;
+    }
+    out.append(text);
+}
+
+template<typename ArrowType>
+class ValueEncoder final : public ColumnEncoder {
+    using ArrayType = typename arrow::TypeTraits<ArrowType>::ArrayType;
+
+public:
+    ValueEncoder(
+        const std::shared_ptr<arrow::Array> &array,
+        const CsvDialect &dialect
+    ) :
+        array_(std::static_pointer_cast<ArrayType>(array)),
+        dialect_(dialect),
+        formatter_(array_->type().get()) {}
+
+    void append(
+        const std::int64_t row,
+        std::string &out
+    ) override {
+        if (array_->IsNull(row)) {
+            out.append(dialect_.null_token);
+            return;
+        }
+        if (dialect_.quoting == CsvQuoting::STRINGS) {
+            formatter_(array_->Value(row), [&out](const std::string_view text) { out.append(text); });
+            return;
+        }
+        formatter_(array_->Value(row), [this, &out](const std::string_view text) {
+            append_text(text, dialect_, false, out);
+        });
+    }
+
+private:
+    std::shared_ptr<ArrayType> array_;
+    const CsvDialect &dialect_;
+    arrow::internal::StringFormatter<ArrowType> formatter_;
+};
+
+template<typename ArrayType>
+class DecimalEncoder final : public ColumnEncoder {
+public:
+    DecimalEncoder(
+        const std::shared_ptr<arrow::Array> &array,
+        const CsvDialect &dialect
+    ) :
+        array_(std::static_pointer_cast<ArrayType>(array)),
+        dialect_(dialect) {}
+
+    void append(
+        const std::int64_t row,
+        std::string &out
+    ) override {
+        if (array_->IsNull(row)) {
+            out.append(dialect_.null_token);
+            return;
+        }
+        append_text(array_->FormatValue(row), dialect_, false, out);
+    }
+
+private:
+    std::shared_ptr<ArrayType> array_;
+    const CsvDialect &dialect_;
+};
+
+template<typename ArrayType>
+class TextEncoder final : public ColumnEncoder {
+public:
+    TextEncoder(
+        const std::shared_ptr<arrow::Array> &array,
+        const CsvDialect &dialect,
+        const bool is_string
+    ) :
+        array_(std::static_pointer_cast<ArrayType>(array)),
+        dialect_(dialect),
+        is_string_(is_string) {}
+
+    void append(
+        const std::int64_t row,
+        std::string &out
+    ) override {
+        if (array_->IsNull(row)) {
+            out.append(dialect_.null_token);
+            return;
+        }
+        append_text(array_->GetView(row), dialect_, is_string_, out);
+    }
+
+private:
+    std::shared_ptr<ArrayType> array_;
+    const CsvDialect &dialect_;
+    bool is_string_;
+};
+
+std::unique_ptr<ColumnEncoder> make_encoder(
+    const std::shared_ptr<arrow::Array> &array,
+    const CsvDialect &dialect
+);
+
+class DictionaryEncoder final : public ColumnEncoder {
+public:
+    DictionaryEncoder(
+        const std::shared_ptr<arrow::Array> &array,
+        const CsvDialect &dialect
+    ) :
+        array_(std::static_pointer_cast<arrow::DictionaryArray>(array)),
+        dialect_(dialect),
+        values_(make_encoder(array_->dictionary(), dialect)) {}
+
+    void append(
+        const std::int64_t row,
+        std::string &out
+    ) override {
+        if (array_->IsNull(row)) {
+            out.append(dialect_.null_token);
+            return;
+        }
+        values_->append(array_->GetValueIndex(row), out);
+    }
+
+private:
+    std::shared_ptr<arrow::DictionaryArray> array_;
+    const CsvDialect &dialect_;
+    std::unique_ptr<ColumnEncoder> values_;
+};
+
+// Anything else that Arrow can cast to a string, such as durations, is cast a slice at a time.
+std::unique_ptr<ColumnEncoder> make_cast_encoder(
+    const std::shared_ptr<arrow::Array> &array,
+    const CsvDialect &dialect
+) {
+    auto cast = arrow::compute::Cast(*array, arrow::large_utf8());
+    if (!cast.ok()) {
+        throw std::runtime_error(
+            "Can't write values of type " + array->type()->ToString() + " as CSV. " + cast.status().ToString()
+        );
+    }
+    return std::make_unique<TextEncoder<arrow::LargeStringArray> >(*cast, dialect, false);
+}
+
+std::unique_ptr<ColumnEncoder> make_encoder(
+    const std::shared_ptr<arrow::Array> &array,
+    const CsvDialect &dialect
+) {
+    switch (array->type_id()) {
+        case arrow::Type::BOOL:
+            return std::make_unique<ValueEncoder<arrow::BooleanType> >(array, dialect);
+        case arrow::Type::INT8:
+            return std::make_unique<ValueEncoder<arrow::Int8Type> >(array, dialect);
+        case arrow::Type::INT16:
+            return std::make_unique<ValueEncoder<arrow::Int16Type> >(array, dialect);
+        case arrow::Type::INT32:
+            return std::make_unique<ValueEncoder<arrow::Int32Type> >(array, dialect);
+        case arrow::Type::INT64:
+            return std::make_unique<ValueEncoder<arrow::Int64Type> >(array, dialect);
+        case arrow::Type::UINT8:
+            return std::make_unique<ValueEncoder<arrow::UInt8Type> >(array, dialect);
+        case arrow::Type::UINT16:
+            return std::make_unique<ValueEncoder<arrow::UInt16Type> >(array, dialect);
+        case arrow::Type::UINT32:
+            return std::make_unique<ValueEncoder<arrow::UInt32Type> >(array, dialect);
+        case arrow::Type::UINT64:
+            return std::make_unique<ValueEncoder<arrow::UInt64Type> >(array, dialect);
+        case arrow::Type::FLOAT:
+            return std::make_unique<ValueEncoder<arrow::FloatType> >(array, dialect);
+        case arrow::Type::DOUBLE:
+            return std::make_unique<ValueEncoder<arrow::DoubleType> >(array, dialect);
+        case arrow::Type::DATE32:
+            return std::make_unique<ValueEncoder<arrow::Date32Type> >(array, dialect);
+        case arrow::Type::DATE64:
+            return std::make_unique<ValueEncoder<arrow::Date64Type> >(array, dialect);
+        case arrow::Type::TIME32:
+            return std::make_unique<ValueEncoder<arrow::Time32Type> >(array, dialect);
+        case arrow::Type::TIME64:
+            return std::make_unique<ValueEncoder<arrow::Time64Type> >(array, dialect);
+        case arrow::Type::TIMESTAMP:
+            return std::make_unique<ValueEncoder<arrow::TimestampType> >(array, dialect);
+        case arrow::Type::DECIMAL128:
+            return std::make_unique<DecimalEncoder<arrow::Decimal128Array> >(array, dialect);
+        case arrow::Type::DECIMAL256:
+            return std::make_unique<DecimalEncoder<arrow::Decimal256Array> >(array, dialect);
+        case arrow::Type::STRING:
+            return std::make_unique<TextEncoder<arrow::StringArray> >(array, dialect, true);
+        case arrow::Type::LARGE_STRING:
+            return std::make_unique<TextEncoder<arrow::LargeStringArray> >(array, dialect, true);
+#if ARROW_VERSION_MAJOR >= 15
+        case arrow::Type::STRING_VIEW:
+            return std::make_unique<TextEncoder<arrow::StringViewArray> >(array, dialect, true);
+#endif
+        case arrow::Type::BINARY:
+            return std::make_unique<TextEncoder<arrow::BinaryArray> >(array, dialect, true);
+        case arrow::Type::LARGE_BINARY:
+            return std::make_unique<TextEncoder<arrow::LargeBinaryArray> >(array, dialect, true);
+        case arrow::Type::DICTIONARY:
+            return std::make_unique<DictionaryEncoder>(array, dialect);
+        default:
+            return make_cast_encoder(array, dialect);
+    }
+}
+}
+
+ParallelCsvWriter::ParallelCsvWriter(
+    std::shared_ptr<arrow::Schema> schema,
+    std::shared_ptr<arrow::io::OutputStream> stream,
+    CsvDialect dialect,
+    const std::size_t threads
+) :
+    dialect_(std::move(dialect)),
+    encoder_(std::move(stream), "Error writing CSV", threads) {
+    if (dialect_.delimiter == '"' || dialect_.delimiter == '\n' || dialect_.delimiter == '\r') {
+        throw std::runtime_error("A CSV delimiter can't be a quote or a line break.");
+    }
+
+    if (dialect_.header) {
+        std::string header;
+        for (int i = 0; i < schema->num_fields(); ++i) {
+            if (i > 0) {
+                header.push_back(dialect_.delimiter);
+            }
+            append_text(schema->field(i)->name(), dialect_, true, header);
+        }
+        header.push_back('\n');
+        encoder_.submit_text(std::move(header));
+    }
+}
+
+void ParallelCsvWriter::write(
+    std::shared_ptr<arrow::RecordBatch> batch
+) {
+    for (std::int64_t offset = 0; offset < batch->num_rows(); offset += ENCODE_ROWS) {
+        encoder_.submit([this, slice = batch->Slice(offset, ENCODE_ROWS)] {
+            return encode(*slice);
+        });
+    }
+    encoder_.write_ready();
+}
+
+void ParallelCsvWriter::flush() {
+    encoder_.flush();
+}
+
+std::string ParallelCsvWriter::encode(
+    const arrow::RecordBatch &batch
+) const {
+    std::vector<std::unique_ptr<ColumnEncoder> > encoders;
+    for (const auto &column: batch.columns()) {
+        encoders.push_back(make_encoder(column, dialect_));
+    }
+
+    std::string out;
+    out.reserve(static_cast<std::size_t>(batch.num_rows()) * (8 * encoders.size() + 1));
+    for (std::int64_t row = 0; row < batch.num_rows(); ++row) {
+        for (std::size_t j = 0; j < encoders.size(); ++j) {
+            if (j > 0) {
+                out.push_back(dialect_.delimiter);
+            }
+            encoders[j]->append(row, out);
+        }
+        out.push_back('\n');
+    }
+    return out;
+}
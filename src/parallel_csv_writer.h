@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include <arrow/api.h>
+
+#include "parallel_encoder.h"
+#include "writer.h"
+
+// Encodes CSV on a pool of threads, each turning a slice of ENCODE_ROWS rows into one block of text, and writes the
+// blocks in the order the rows were written in. Values are formatted the way Arrow's CSV writer formats them, but
+// straight from the array buffers. A write only waits for encoding once enough slices are in flight to keep every
+// thread busy, and otherwise writes out whichever blocks are ready.
+class ParallelCsvWriter final : public Writer {
+public:
+    static constexpr std::int64_t ENCODE_ROWS = 16384;
+
+    // Zero threads uses one per core, up to 8.
+    ParallelCsvWriter(
+        std::shared_ptr<arrow::Schema> schema,
+        std::shared_ptr<arrow::io::OutputStream> stream,
+        CsvDialect dialect = {},
+        std::size_t threads = 0
+    );
+
+    ParallelCsvWriter(
+        const ParallelCsvWriter &
+    ) = delete;
+
+    ParallelCsvWriter &operator=(
+        const ParallelCsvWriter &
+    ) = delete;
+
+    ParallelCsvWriter(
+        ParallelCsvWriter &&
+    ) = delete;
+
+    ParallelCsvWriter &operator=(
+        ParallelCsvWriter &&
+    ) = delete;
+
+    ~ParallelCsvWriter() override = default;
+
+    void write(
+        std::shared_ptr<arrow::RecordBatch> batch
+    ) override;
+
+    void flush() override;
+
+private:
+    [[nodiscard]] std::string encode(
+        const arrow::RecordBatch &batch
+    ) const;
+
+    CsvDialect dialect_;
+    ParallelEncoder encoder_;
+};
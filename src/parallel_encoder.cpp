@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+#include "writer.h"
+
+#include "parallel_encoder.h"
+
+
+static std::size_t worker_count(
+    const std::size_t threads
+) {
+    if (threads > 0) {
+        return threads;
+    }
+    return std::clamp<std::size_t>(std::thread::hardware_concurrency(), 1, 8);
+}
+
+ParallelEncoder::ParallelEncoder(
+    std::shared_ptr<arrow::io::OutputStream> stream,
+    std::string context,
+    const std::size_t threads
+) :
+    stream_(std::move(stream)),
+    context_(std::move(context)),
+    max_pending_(2 * worker_count(threads)),
+    tasks_(max_pending_) {
+    for (std::size_t i = 0; i < worker_count(threads); ++i) {
+        workers_.emplace_back([this] {
+            while (auto task = tasks_.pop()) {
+                (*task)();
+            }
+        });
+    }
+}
+
+ParallelEncoder::~ParallelEncoder() {
+    tasks_.close();
+    workers_.clear();
+}
+
+void ParallelEncoder::submit_text(
+    std::string text
+) {
+    std::promise<std::string> encoded;
+    encoded.set_value(std::move(text));
+    pending_.push_back(encoded.get_future());
+}
+
+void ParallelEncoder::submit(
+    Task task
+) {
+    std::packaged_task<std::string ()> packaged(std::move(task));
+    pending_.push_back(packaged.get_future());
+    if (!tasks_.push(std::move(packaged))) {
+        throw std::logic_error("Can't encode after the encoder has stopped.");
+    }
+    while (pending_.size() > max_pending_) {
+        write_next();
+    }
+}
+
+void ParallelEncoder::write_ready() {
+    while (!pending_.empty() && pending_.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        write_next();
+    }
+}
+
+void ParallelEncoder::flush() {
+    while (!pending_.empty()) {
+        write_next();
+    }
+    check_write(stream_->Flush(), context_);
+}
+
+// Rethrows anything encoding the block threw.
+void ParallelEncoder::write_next() {
+    const auto text = pending_.front().get();
+    pending_.pop_front();
+    check_write(stream_->Write(text.data(), static_cast<std::int64_t>(text.size())), context_);
+}
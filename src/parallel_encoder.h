@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arrow/io/api.h>
+
+#include "bounded_queue.h"
+
+// Runs text encoding tasks on a pool of threads and writes the blocks they produce to the stream in the order the
+// tasks were submitted. Submitting only waits for encoding once enough tasks are in flight to keep every thread busy.
+// Declare it after anything its tasks use, so the threads are stopped first.
+class ParallelEncoder {
+public:
+    using Task = std::function<std::string ()>;
+
+    // Zero threads uses one per core, up to 8. The context prefixes errors writing to the stream.
+    ParallelEncoder(
+        std::shared_ptr<arrow::io::OutputStream> stream,
+        std::string context,
+        std::size_t threads = 0
+    );
+
+    ParallelEncoder(
+        const ParallelEncoder &
+    ) = delete;
+
+    ParallelEncoder &operator=(
+        const ParallelEncoder &
+    ) = delete;
+
+    ParallelEncoder(
+        ParallelEncoder &&
+    ) = delete;
+
+    ParallelEncoder &operator=(
+        ParallelEncoder &&
+    ) = delete;
+
+    ~ParallelEncoder();
+
+    // Text that is already encoded, such as a header, written after the blocks submitted before it.
+    void submit_text(
+        std::string text
+    );
+
+    void submit(
+        Task task
+    );
+
+    // Writes whichever blocks at the front are ready, without waiting.
+    void write_ready();
+
+    // Waits for every block and writes them, rethrowing anything a task threw.
+    void flush();
+
+private:
+    void write_next();
+
+    std::shared_ptr<arrow::io::OutputStream> stream_;
+    std::string context_;
+    std::size_t max_pending_;
+    BoundedQueue<std::packaged_task<std::string ()> > tasks_;
+    std::deque<std::future<std::string> > pending_;
+    std::vector<std::jthread> workers_;
+};
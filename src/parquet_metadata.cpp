@@ -0,0 +1,675 @@
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <thread>
+
+#include <json/json.h>
+#include <parquet/arrow/schema.h>
+#include <parquet/file_reader.h>
+#include <parquet/statistics.h>
+
+#include "fnv_hash.h"
+#include "result_cache.h"
+#include "verified_schema.h"
+
+#include "parquet_metadata.h"
+
+
+// Footer reads are dominated by latency rather than CPU, so use more threads than cores.
+static constexpr unsigned MIN_PREFETCH_THREADS = 4;
+
+// The type DuckDb reports for a Parquet column of this Arrow type. Only types whose mapping is unambiguous are listed.
+static std::optional<std::string> duckdb_type_name(
+    const arrow::DataType &type
+) {
+    switch (type.id()) {
+        case arrow::Type::BOOL:
+            return "BOOLEAN";
+        case arrow::Type::INT8:
+            return "TINYINT";
+        case arrow::Type::INT16:
+            return "SMALLINT";
+        case arrow::Type::INT32:
+            return "INTEGER";
+        case arrow::Type::INT64:
+            return "BIGINT";
+        case arrow::Type::UINT8:
+            return "UTINYINT";
+        case arrow::Type::UINT16:
+            return "USMALLINT";
+        case arrow::Type::UINT32:
+            return "UINTEGER";
+        case arrow::Type::UINT64:
+            return "UBIGINT";
+        case arrow::Type::FLOAT:
+            return "FLOAT";
+        case arrow::Type::DOUBLE:
+            return "DOUBLE";
+        case arrow::Type::STRING:
+        case arrow::Type::LARGE_STRING:
+            return "VARCHAR";
+        case arrow::Type::BINARY:
+        case arrow::Type::LARGE_BINARY:
+            return "BLOB";
+        case arrow::Type::DATE32:
+            return "DATE";
+        case arrow::Type::DECIMAL128: {
+            const auto &decimal = static_cast<const arrow::Decimal128Type &>(type);
+            return "DECIMAL(" + std::to_string(decimal.precision()) + "," + std::to_string(decimal.scale()) + ")";
+        }
+        case arrow::Type::TIMESTAMP: {
+            const auto &timestamp = static_cast<const arrow::TimestampType &>(type);
+            if (timestamp.unit() != arrow::TimeUnit::MICRO) {
+                return std::nullopt;
+            }
+            return timestamp.timezone().empty() ? "TIMESTAMP" : "TIMESTAMP WITH TIME ZONE";
+        }
+        default:
+            return std::nullopt;
+    }
+}
+
+template<typename Statistics>
+static std::pair<StatisticValue, StatisticValue> typed_range(
+    const parquet::Statistics &statistics
+) {
+    const auto &typed = static_cast<const Statistics &>(statistics);
+    return {typed.min(), typed.max()};
+}
+
+// Minimum and maximum of a column chunk, for the types a dgrep value can be compared with.
+static std::optional<std::pair<StatisticValue, StatisticValue> > statistic_range(
+    const parquet::ColumnDescriptor &column,
+    const parquet::Statistics &statistics
+) {
+    const auto &logical_type = column.logical_type();
+    const auto is_plain = !logical_type || logical_type->is_none();
+    const auto is_signed_int = logical_type && logical_type->is_int()
+                               && static_cast<const parquet::IntLogicalType &>(*logical_type).is_signed();
+
+    switch (column.physical_type()) {
+        case parquet::Type::INT32:
+            if (is_plain || is_signed_int) {
+                const auto &typed = static_cast<const parquet::Int32Statistics &>(statistics);
+                return std::pair{StatisticValue{std::int64_t{typed.min()}}, StatisticValue{std::int64_t{typed.max()}}};
+            }
+            break;
+        case parquet::Type::INT64:
+            if (is_plain || is_signed_int) {
+                const auto &typed = static_cast<const parquet::Int64Statistics &>(statistics);
+                return std::pair{StatisticValue{std::int64_t{typed.min()}}, StatisticValue{std::int64_t{typed.max()}}};
+            }
+            break;
+        case parquet::Type::FLOAT:
+        case parquet::Type::DOUBLE: {
+            if (!is_plain) {
+                break;
+            }
+            double min = 0;
+            double max = 0;
+            if (column.physical_type() == parquet::Type::FLOAT) {
+                const auto &typed = static_cast<const parquet::FloatStatistics &>(statistics);
+                min = typed.min();
+                max = typed.max();
+            } else {
+                const auto &typed = static_cast<const parquet::DoubleStatistics &>(statistics);
+                min = typed.min();
+                max = typed.max();
+            }
+            if (std::isnan(min) || std::isnan(max)) {
+                break;
+            }
+            return std::pair{StatisticValue{min}, StatisticValue{max}};
+        }
+        case parquet::Type::BYTE_ARRAY:
+            if (logical_type && logical_type->is_string()) {
+                const auto &typed = static_cast<const parquet::ByteArrayStatistics &>(statistics);
+                return std::pair{
+                    StatisticValue{std::string(parquet::ByteArrayToString(typed.min()))},
+                    StatisticValue{std::string(parquet::ByteArrayToString(typed.max()))}
+                };
+            }
+            break;
+        default:
+            break;
+    }
+    return std::nullopt;
+}
+
+static std::optional<ParquetFileMetadata> read_footer(
+    const InputFile &file
+) {
+    try {
+        const auto reader = parquet::ParquetFileReader::OpenFile(file.path);
+        const auto metadata = reader->metadata();
+        const auto *schema = metadata->schema();
+
+        ParquetFileMetadata result{.file = file, .num_rows = metadata->num_rows(), .columns = {}, .row_groups = {}};
+
+        if (std::shared_ptr<arrow::Schema> arrow_schema;
+            parquet::arrow::FromParquetSchema(schema, &arrow_schema).ok()) {
+            std::vector<ColumnSchema> columns;
+            for (const auto &field: arrow_schema->fields()) {
+                const auto type = duckdb_type_name(*field->type());
+                if (!type) {
+                    columns.clear();
+                    break;
+                }
+                columns.push_back(ColumnSchema{.name = field->name(), .type = *type});
+            }
+            if (columns.size() == static_cast<std::size_t>(arrow_schema->num_fields())) {
+                result.columns = std::move(columns);
+            }
+        }
+
+        for (int i = 0; i < metadata->num_row_groups(); ++i) {
+            const auto row_group = metadata->RowGroup(i);
+            RowGroupMetadata group{.num_rows = row_group->num_rows(), .statistics = {}};
+            for (int j = 0; j < schema->num_columns(); ++j) {
+                const auto *column = schema->Column(j);
+                if (column->path()->ToDotVector().size() != 1) {
+                    continue;
+                }
+                const auto chunk = row_group->ColumnChunk(j);
+                const auto statistics = chunk->is_stats_set() ? chunk->statistics() : nullptr;
+                if (!statistics || !statistics->HasMinMax()) {
+                    continue;
+                }
+                if (const auto range = statistic_range(*column, *statistics)) {
+                    group.statistics.push_back({.column = column->name(), .min = range->first, .max = range->second});
+                }
+            }
+            result.row_groups.push_back(std::move(group));
+        }
+        return result;
+    } catch (const std::exception &) {
+        return std::nullopt;
+    }
+}
+
+static Json::Value encode_statistic(
+    const StatisticValue &value
+) {
+    return std::visit([](
+        const auto &v
+    ) {
+        return Json::Value(v);
+    }, value);
+}
+
+static std::optional<StatisticValue> decode_statistic(
+    const Json::Value &json
+) {
+    switch (json.type()) {
+        case Json::intValue:
+            return StatisticValue{json.asInt64()};
+        case Json::realValue:
+            return StatisticValue{json.asDouble()};
+        case Json::stringValue:
+            return StatisticValue{json.asString()};
+        default:
+            return std::nullopt;
+    }
+}
+
+static Json::Value encode_metadata(
+    const ParquetFileMetadata &metadata
+) {
+    Json::Value json;
+    json["path"] = metadata.file.path;
+    json["size"] = Json::UInt64{metadata.file.size};
+    json["mtime"] = Json::Int64{metadata.file.mtime};
+    json["num_rows"] = Json::Int64{metadata.num_rows};
+
+    json["columns"] = Json::Value::null;
+    if (metadata.columns) {
+        json["columns"] = Json::Value(Json::arrayValue);
+        for (const auto &[name, type]: *metadata.columns) {
+            Json::Value column;
+            column["name"] = name;
+            column["type"] = type;
+            json["columns"].append(column);
+        }
+    }
+
+    json["row_groups"] = Json::Value(Json::arrayValue);
+    for (const auto &group: metadata.row_groups) {
+        Json::Value group_json;
+        group_json["num_rows"] = Json::Int64{group.num_rows};
+        group_json["statistics"] = Json::Value(Json::arrayValue);
+        for (const auto &[column, min, max]: group.statistics) {
+            Json::Value statistic;
+            statistic["column"] = column;
+            statistic["min"] = encode_statistic(min);
+            statistic["max"] = encode_statistic(max);
+            group_json["statistics"].append(statistic);
+        }
+        json["row_groups"].append(group_json);
+    }
+    return json;
+}
+
+static std::optional<ParquetFileMetadata> decode_metadata(
+    const Json::Value &json,
+    const InputFile &file
+) {
+    // Guards against hash collisions between different versions of files.
+    if (json["path"].asString() != file.path || json["size"].asUInt64() != file.size
+        || json["mtime"].asInt64() != file.mtime) {
+        return std::nullopt;
+    }
+
+    ParquetFileMetadata metadata{.file = file, .num_rows = json["num_rows"].asInt64(), .columns = {}, .row_groups = {}};
+    if (const auto &columns = json["columns"]; columns.isArray()) {
+        metadata.columns.emplace();
+        for (const auto &column: columns) {
+            metadata.columns->push_back(
+                ColumnSchema{.name = column["name"].asString(), .type = column["type"].asString()}
+            );
+        }
+    }
+    for (const auto &group_json: json["row_groups"]) {
+        RowGroupMetadata group{.num_rows = group_json["num_rows"].asInt64(), .statistics = {}};
+        for (const auto &statistic: group_json["statistics"]) {
+            const auto min = decode_statistic(statistic["min"]);
+            const auto max = decode_statistic(statistic["max"]);
+            if (!min || !max) {
+                return std::nullopt;
+            }
+            group.statistics.push_back({.column = statistic["column"].asString(), .min = *min, .max = *max});
+        }
+        metadata.row_groups.push_back(std::move(group));
+    }
+    return metadata;
+}
+
+ParquetMetadataCache::ParquetMetadataCache(
+    std::filesystem::path directory
+) :
+    directory_(std::move(directory)) {
+    // Without the directory footers are still read, they just aren't kept.
+    std::error_code error;
+    std::filesystem::create_directories(directory_, error);
+}
+
+std::filesystem::path ParquetMetadataCache::entry_path(
+    const InputFile &file
+) const {
+    Fnv1aHash hash;
+    hash.update(file.path);
+    hash.update(std::to_string(file.size));
+    hash.update(std::to_string(file.mtime));
+    return directory_ / (hash.hex() + ".json");
+}
+
+std::vector<std::optional<ParquetFileMetadata> > ParquetMetadataCache::load(
+    const std::vector<InputFile> &files
+) const {
+    std::vector<std::optional<ParquetFileMetadata> > results(files.size());
+    std::vector<std::size_t> missing;
+
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        Json::Value json;
+        JSONCPP_STRING errors;
+        std::ifstream in(entry_path(files[i]));
+        if (in && Json::parseFromStream(Json::CharReaderBuilder(), in, &json, &errors)) {
+            results[i] = decode_metadata(json, files[i]);
+        }
+        if (!results[i]) {
+            missing.push_back(i);
+        }
+    }
+
+    std::atomic<std::size_t> next{0};
+    const auto prefetch = [&] {
+        for (auto k = next.fetch_add(1); k < missing.size(); k = next.fetch_add(1)) {
+            const auto &file = files[missing[k]];
+            auto &result = results[missing[k]];
+            result = read_footer(file);
+            if (!result) {
+                continue;
+            }
+
+            // Written to a temporary name first so a concurrent reader never sees half an entry.
+            const auto path = entry_path(file);
+            auto temp_path = path;
+            temp_path += "." + std::to_string(getpid()) + "." + std::to_string(gettid()) + ".tmp";
+            const auto text = Json::writeString(Json::StreamWriterBuilder(), encode_metadata(*result));
+            if (std::ofstream out(temp_path); out << text) {
+                out.close();
+                std::error_code error;
+                std::filesystem::rename(temp_path, path, error);
+            }
+        }
+    };
+
+    const auto num_threads = std::min<std::size_t>(
+        missing.size(),
+        std::max(MIN_PREFETCH_THREADS, 2 * std::thread::hardware_concurrency())
+    );
+    {
+        std::vector<std::jthread> threads;
+        threads.reserve(num_threads);
+        for (std::size_t i = 0; i < num_threads; ++i) {
+            threads.emplace_back(prefetch);
+        }
+    }
+    return results;
+}
+
+std::filesystem::path default_metadata_cache_directory() {
+    const char *directory = std::getenv("DEVAL_METADATA_CACHE_DIR"); // NOLINT(*-mt-unsafe)
+    if (directory != nullptr && *directory != '\0') {
+        return directory;
+    }
+    return deval_cache_home() / "metadata";
+}
+
+std::optional<std::string> parquet_table_pattern(
+    const std::string &tablename
+) {
+    const auto first = tablename.find_first_not_of(" \t\n");
+    const auto last = tablename.find_last_not_of(" \t\n");
+    if (first == std::string::npos || last == first || tablename[first] != '\'' || tablename[last] != '\'') {
+        return std::nullopt;
+    }
+
+    const auto literals = table_literals(tablename);
+    if (literals.size() != 1 || is_remote_literal(literals.front()) || !literals.front().ends_with(".parquet")) {
+        return std::nullopt;
+    }
+    return literals.front();
+}
+
+std::optional<std::vector<InputFile> > parquet_table_files(
+    const std::string &tablename
+) {
+    if (parquet_table_pattern(tablename)) {
+        auto files = list_input_files({tablename});
+        if (files.empty()) {
+            return std::nullopt;
+        }
+        return files;
+    }
+
+    if (!tablename.starts_with("read_parquet([") || !tablename.ends_with("])")) {
+        return std::nullopt;
+    }
+    const auto literals = table_literals(tablename);
+    const auto is_local_parquet = [](
+        const std::string &literal
+    ) {
+        return !is_remote_literal(literal) && literal.ends_with(".parquet");
+    };
+    if (literals.empty() || !std::ranges::all_of(literals, is_local_parquet)) {
+        return std::nullopt;
+    }
+    // Every path is read as it is, so a missing one would make DuckDb fail rather than read less.
+    auto files = list_input_files({tablename});
+    if (files.size() != literals.size()) {
+        return std::nullopt;
+    }
+    return files;
+}
+
+bool same_columns(
+    const std::vector<std::optional<ParquetFileMetadata> > &metadata
+) {
+    if (metadata.empty() || !metadata.front() || !metadata.front()->columns) {
+        return false;
+    }
+    const auto &first = *metadata.front()->columns;
+    return std::ranges::all_of(metadata, [&first](
+        const std::optional<ParquetFileMetadata> &file
+    ) {
+        return file && file->columns && std::ranges::equal(
+            *file->columns,
+            first,
+            [](
+                const ColumnSchema &lhs,
+                const ColumnSchema &rhs
+            ) {
+                return lhs.name == rhs.name && lhs.type == rhs.type;
+            }
+        );
+    });
+}
+
+std::optional<ResolvedSchema> parquet_schema(
+    const std::vector<std::string> &tablenames
+) {
+    if (tablenames.size() != 1) {
+        return std::nullopt;
+    }
+    const auto files = parquet_table_files(tablenames.front());
+    if (!files) {
+        return std::nullopt;
+    }
+
+    const auto metadata = ParquetMetadataCache(default_metadata_cache_directory()).load(*files);
+    if (!same_columns(metadata)) {
+        return std::nullopt;
+    }
+
+    return ResolvedSchema{.fingerprint = fingerprint_inputs(tablenames), .columns = *metadata.front()->columns};
+}
+
+// The condition's value converted the same way evaluation converts it for a column with these statistics.
+static std::optional<StatisticValue> comparable_value(
+    const QueryParam &value,
+    const StatisticValue &statistic
+) {
+    try {
+        switch (value.type()) {
+            case ParamType::NUMERIC:
+                if (std::holds_alternative<std::int64_t>(statistic)) {
+                    return StatisticValue{value.get<std::int64_t>()};
+                }
+                if (std::holds_alternative<double>(statistic)) {
+                    return StatisticValue{static_cast<double>(value.get<std::int64_t>())};
+                }
+                return std::nullopt;
+            case ParamType::TEXT:
+                if (std::holds_alternative<std::string>(statistic)) {
+                    return StatisticValue{value.get<std::string>()};
+                }
+                return std::nullopt;
+            case ParamType::UNKNOWN: {
+                const auto text = value.get<std::string>();
+                std::size_t parsed = 0;
+                if (std::holds_alternative<std::int64_t>(statistic)) {
+                    const auto number = std::stoll(text, &parsed);
+                    return parsed == text.size() ? std::make_optional(StatisticValue{std::int64_t{number}})
+                                                 : std::nullopt;
+                }
+                if (std::holds_alternative<double>(statistic)) {
+                    // NaN compares equal to itself and above everything else in DuckDb, unlike in C++.
+                    const auto number = std::stod(text, &parsed);
+                    return parsed == text.size() && !std::isnan(number)
+                               ? std::make_optional(StatisticValue{number})
+                               : std::nullopt;
+                }
+                return StatisticValue{text};
+            }
+            default:
+                return std::nullopt;
+        }
+    } catch (const std::exception &) {
+        return std::nullopt;
+    }
+}
+
+static bool may_hold(
+    const RowGroupMetadata &group,
+    const Condition &condition
+) {
+    if (condition.value.is_null()) {
+        return true;
+    }
+    const auto statistic = std::ranges::find(group.statistics, condition.column, &ColumnStatistics::column);
+    if (statistic == group.statistics.end()) {
+        return true;
+    }
+    const auto value = comparable_value(condition.value, statistic->min);
+    if (!value) {
+        return true;
+    }
+
+    // Parquet statistics leave NaN out of the range, and DuckDb sorts NaN above every other value, so a floating
+    // point column may hold rows beyond its maximum.
+    const auto &predicate = condition.predicate;
+    if (std::holds_alternative<double>(statistic->min) && predicate != "<" && predicate != "<=") {
+        return true;
+    }
+    if (predicate == "=" || predicate == "==") {
+        return statistic->min <= *value && *value <= statistic->max;
+    }
+    if (predicate == "<") {
+        return statistic->min < *value;
+    }
+    if (predicate == "<=") {
+        return statistic->min <= *value;
+    }
+    if (predicate == ">") {
+        return statistic->max > *value;
+    }
+    if (predicate == ">=") {
+        return statistic->max >= *value;
+    }
+    return true;
+}
+
+bool may_contain_matches(
+    const ParquetFileMetadata &metadata,
+    const std::vector<Condition> &conditions
+) {
+    return std::ranges::any_of(metadata.row_groups, [&conditions](
+        const RowGroupMetadata &group
+    ) {
+        return std::ranges::all_of(conditions, [&group](
+            const Condition &condition
+        ) {
+            return may_hold(group, condition);
+        });
+    });
+}
+
+std::optional<double> estimated_selectivity(
+    const std::vector<std::optional<ParquetFileMetadata> > &metadata,
+    const Condition &condition
+) {
+    std::int64_t rows = 0;
+    std::int64_t matching = 0;
+    for (const auto &file: metadata) {
+        if (!file) {
+            continue;
+        }
+        for (const auto &group: file->row_groups) {
+            const auto &statistics = group.statistics;
+            if (std::ranges::find(statistics, condition.column, &ColumnStatistics::column) == statistics.end()) {
+                continue;
+            }
+            rows += group.num_rows;
+            matching += may_hold(group, condition) ? group.num_rows : 0;
+        }
+    }
+    if (rows == 0) {
+        return std::nullopt;
+    }
+    return static_cast<double>(matching) / static_cast<double>(rows);
+}
+
+static std::string quoted(
+    const std::string &path
+) {
+    std::string literal = "'";
+    for (const auto c: path) {
+        literal += c == '\'' ? "''" : std::string(1, c);
+    }
+    return literal + "'";
+}
+
+std::optional<std::vector<InputFile> > partitioned_table_files(
+    const PartitionedDataset &dataset,
+    const std::string &tablename
+) {
+    // Besides the files, or the glob matching them, the expression only quotes column names and a regular expression.
+    std::vector<std::string> sources;
+    for (const auto &literal: table_literals(tablename)) {
+        if (literal.starts_with(dataset.root) && literal.ends_with(".parquet")) {
+            sources.push_back(quoted(literal));
+        }
+    }
+    if (sources.empty()) {
+        return std::nullopt;
+    }
+
+    auto files = list_input_files(sources);
+    const auto is_glob = sources.size() == 1 && sources.front().find('*') != std::string::npos;
+    if (is_glob ? files.empty() : files.size() != sources.size()) {
+        return std::nullopt;
+    }
+    return files;
+}
+
+std::string read_parquet_expression(
+    const std::vector<InputFile> &files
+) {
+    std::string expression = "read_parquet([";
+    for (std::size_t i = 0; i < files.size(); ++i) {
+        expression += (i == 0 ? "" : ", ") + quoted(files[i].path);
+    }
+    return expression + "])";
+}
+
+OverallQueryPlan prune_parquet_files(
+    const OverallQueryPlan &query_plan,
+    PruningStats &stats
+) {
+    auto pruned = query_plan;
+    for (std::size_t index = 0; index < pruned.get_plans().size(); ++index) {
+        const auto &plan = pruned.get_plans()[index];
+        const auto partitions = plan.partitions;
+        std::vector<Condition> conditions;
+        for (const auto &condition: plan.where ? plan.where->get_conditions() : std::vector<Condition>{}) {
+            if (!partitions || std::ranges::find(partitions->columns, condition.column, &ColumnSchema::name)
+                               == partitions->columns.end()) {
+                conditions.push_back(condition);
+            }
+        }
+        const auto tablenames = plan.select ? plan.select->get_tablenames() : std::vector<std::string>{};
+        if (conditions.empty() || tablenames.size() != 1) {
+            continue;
+        }
+        const auto files = partitions
+                               ? partitioned_table_files(*partitions, tablenames.front())
+                               : parquet_table_files(tablenames.front());
+        if (!files) {
+            continue;
+        }
+
+        const auto metadata = ParquetMetadataCache(default_metadata_cache_directory()).load(*files);
+        std::vector<InputFile> kept;
+        for (std::size_t i = 0; i < files->size(); ++i) {
+            if (!metadata[i] || may_contain_matches(*metadata[i], conditions)) {
+                kept.push_back((*files)[i]);
+            }
+        }
+        stats.files += files->size();
+        stats.kept += kept.size();
+
+        if (kept.size() < files->size()) {
+            keep_one_file(kept, [&files] { return std::optional(files->front()); });
+            if (partitions) {
+                std::vector<std::string> paths;
+                std::ranges::transform(kept, std::back_inserter(paths), &InputFile::path);
+                pruned = replace_stage_tables(pruned, index, {partitioned_table_expression(*partitions, paths)});
+            } else {
+                pruned = replace_stage_tables(pruned, index, {read_parquet_expression(kept)});
+            }
+        }
+    }
+    return pruned;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "input_files.h"
+#include "query.h"
+#include "queryplan.h"
+
+using StatisticValue = std::variant<std::int64_t, double, std::string>;
+
+struct ColumnStatistics {
+    std::string column;
+    StatisticValue min;
+    StatisticValue max;
+};
+
+struct RowGroupMetadata {
+    std::int64_t num_rows;
+    // Only top-level integer, floating point and string columns that have a recorded minimum and maximum.
+    std::vector<ColumnStatistics> statistics;
+};
+
+struct ParquetFileMetadata {
+    InputFile file;
+    std::int64_t num_rows;
+    // Columns with DuckDb type names, or nullopt if some column's type doesn't map to one with certainty.
+    std::optional<std::vector<ColumnSchema> > columns;
+    std::vector<RowGroupMetadata> row_groups;
+};
+
+// Parquet footer contents persisted as one JSON file per path, size and modification time, so each version of a file
+// has its footer parsed only once. Footers missing from the cache are read in parallel.
+class ParquetMetadataCache {
+public:
+    explicit ParquetMetadataCache(
+        std::filesystem::path directory
+    );
+
+    // Metadata for each file, in order, or nullopt for files that can't be read as Parquet.
+    std::vector<std::optional<ParquetFileMetadata> > load(
+        const std::vector<InputFile> &files
+    ) const;
+
+private:
+    [[nodiscard]] std::filesystem::path entry_path(
+        const InputFile &file
+    ) const;
+
+    std::filesystem::path directory_;
+};
+
+// $DEVAL_METADATA_CACHE_DIR, or the metadata directory of deval_cache_home().
+std::filesystem::path default_metadata_cache_directory();
+
+// The path or glob inside a table expression that is a single quoted local path or glob of .parquet files such as
+// `'data/*/*.parquet'`. Function calls are left alone because their options can change what is read.
+std::optional<std::string> parquet_table_pattern(
+    const std::string &tablename
+);
+
+// The files matched by parquet_table_pattern(), or those listed by a read_parquet_expression(), or nullopt if the table
+// expression is neither or reads no files.
+std::optional<std::vector<InputFile> > parquet_table_files(
+    const std::string &tablename
+);
+
+// The files read by a partitioned_table_expression() of the dataset, or nullopt if some of those it lists are missing
+// or its glob matches nothing.
+std::optional<std::vector<InputFile> > partitioned_table_files(
+    const PartitionedDataset &dataset,
+    const std::string &tablename
+);
+
+// Pruning reads at least one file even when the conditions rule them all out, because DuckDb needs one to know the
+// columns; the conditions then filter out its rows. `any_file` is only called when nothing was kept, and returns
+// nullopt if there is no file at all.
+template<typename File, typename AnyFile>
+void keep_one_file(
+    std::vector<File> &kept,
+    const AnyFile &any_file
+) {
+    if (kept.empty()) {
+        if (std::optional<File> file = any_file()) {
+            kept.push_back(std::move(*file));
+        }
+    }
+}
+
+// A `read_parquet([...])` table expression reading exactly these files.
+std::string read_parquet_expression(
+    const std::vector<InputFile> &files
+);
+
+// Whether every file's footer was read and has the same, fully mapped, columns as the first.
+bool same_columns(
+    const std::vector<std::optional<ParquetFileMetadata> > &metadata
+);
+
+// The schema of a table expression of Parquet files, read from the metadata cache without DuckDb. Returns nullopt
+// unless every file has the same, fully mapped, columns.
+std::optional<ResolvedSchema> parquet_schema(
+    const std::vector<std::string> &tablenames
+);
+
+// False if the statistics show that no row group of the file can satisfy every condition.
+bool may_contain_matches(
+    const ParquetFileMetadata &metadata,
+    const std::vector<Condition> &conditions
+);
+
+// Share of the rows that are in row groups whose statistics allow the condition to hold, as a cheap estimate of how
+// selective it is. Returns nullopt if no row group has statistics for the condition's column.
+std::optional<double> estimated_selectivity(
+    const std::vector<std::optional<ParquetFileMetadata> > &metadata,
+    const Condition &condition
+);
+
+struct PruningStats {
+    std::size_t files = 0;
+    std::size_t kept = 0;
+};
+
+// Replace quoted Parquet paths and globs, and the files of partitioned datasets, in stages with WHERE conditions by the
+// list of files whose row group statistics allow a match, so DuckDb doesn't open the others at all. Conditions on
+// partition columns are left to prune_partitions().
+OverallQueryPlan prune_parquet_files(
+    const OverallQueryPlan &query_plan,
+    PruningStats &stats
+);
@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <iomanip>
+#include <limits>
+#include <string_view>
+#include <vector>
+
+#include <arrow/util/byte_size.h>
+#include <parquet/types.h>
+
+#include "parquet_writer.h"
+
+
+static constexpr std::string_view ALL_COLUMNS = "*";
+
+// Nested columns are stored as one Parquet column per leaf field.
+static std::int32_t count_leaves(
+    const arrow::DataType &type
+) {
+    if (type.num_fields() == 0) {
+        return 1;
+    }
+    std::int32_t leaves = 0;
+    for (const auto &field: type.fields()) {
+        leaves += count_leaves(*field->type());
+    }
+    return leaves;
+}
+
+// Paths into nested columns aren't checked, since Arrow spells them differently to Parquet.
+static void check_column(
+    const arrow::Schema &schema,
+    const std::string &column,
+    const std::string &action
+) {
+    if (column != ALL_COLUMNS && column.find('.') == std::string::npos && schema.GetFieldIndex(column) == -1) {
+        throw std::runtime_error("Can't " + action + " '" + column + "', which isn't a column of the result.");
+    }
+}
+
+// The leaf index of a top-level column, which is what Parquet's sorting columns refer to.
+static parquet::SortingColumn sorting_column(
+    const arrow::Schema &schema,
+    const ParquetSortingColumn &column
+) {
+    const auto index = schema.GetFieldIndex(column.column);
+    if (index == -1) {
+        throw std::runtime_error("Can't sort by '" + column.column + "', which isn't a column of the result.");
+    }
+    if (schema.field(index)->type()->num_fields() > 0) {
+        throw std::runtime_error("Can't record '" + column.column + "' as sorted, because it's a nested column.");
+    }
+    std::int32_t leaf = 0;
+    for (int i = 0; i < index; ++i) {
+        leaf += count_leaves(*schema.field(i)->type());
+    }
+    // DuckDb puts nulls last whichever way it sorts.
+    return {.column_idx = leaf, .descending = column.descending, .nulls_first = false};
+}
+
+std::shared_ptr<parquet::WriterProperties> parquet_writer_properties(
+    const arrow::Schema &schema,
+    const WriterOptions &options
+) {
+    const auto &parquet_options = options.parquet;
+    parquet::WriterProperties::Builder builder;
+
+    // Parquet's LZ4 codec is raw LZ4 blocks rather than frames.
+    builder.compression(
+        options.compression == arrow::Compression::LZ4_FRAME ? arrow::Compression::LZ4 : options.compression
+    );
+    if (parquet_options.compression_level) {
+        builder.compression_level(*parquet_options.compression_level);
+    }
+    if (parquet_options.row_group_rows > 0) {
+        builder.max_row_group_length(parquet_options.row_group_rows);
+    }
+
+    for (const auto &column: parquet_options.no_dictionary) {
+        check_column(schema, column, "disable dictionary encoding of");
+        if (column == ALL_COLUMNS) {
+            builder.disable_dictionary();
+        } else {
+            builder.disable_dictionary(column);
+        }
+    }
+    for (const auto &column: parquet_options.no_statistics) {
+        check_column(schema, column, "disable statistics of");
+        if (column == ALL_COLUMNS) {
+            builder.disable_statistics();
+        } else {
+            builder.disable_statistics(column);
+        }
+    }
+    if (parquet_options.page_index) {
+        builder.enable_write_page_index();
+    }
+
+    parquet::BloomFilterOptions bloom_filter;
+    bloom_filter.fpp = parquet_options.bloom_filter_fpp;
+    for (const auto &column: parquet_options.bloom_filter) {
+        check_column(schema, column, "write a bloom filter for");
+        if (column != ALL_COLUMNS) {
+            if (const auto field = schema.GetFieldByName(column); field && field->type()->id() == arrow::Type::BOOL) {
+                throw std::runtime_error("Can't write a bloom filter for '" + column + "', which is boolean.");
+            }
+            builder.enable_bloom_filter(column, bloom_filter);
+            continue;
+        }
+        // Every top-level column that can have one.
+        for (const auto &field: schema.fields()) {
+            if (field->type()->num_fields() == 0 && field->type()->id() != arrow::Type::BOOL) {
+                builder.enable_bloom_filter(field->name(), bloom_filter);
+            }
+        }
+    }
+
+    if (!parquet_options.sorting_columns.empty()) {
+        std::vector<parquet::SortingColumn> sorting_columns;
+        for (const auto &column: parquet_options.sorting_columns) {
+            sorting_columns.push_back(sorting_column(schema, column));
+        }
+        builder.set_sorting_columns(std::move(sorting_columns));
+    }
+    return builder.build();
+}
+
+// "yes", "no", or how many of the row groups have it.
+static std::string coverage(
+    const int count,
+    const int total
+) {
+    if (count == total) {
+        return "yes";
+    }
+    if (count == 0) {
+        return "no";
+    }
+    return std::to_string(count) + "/" + std::to_string(total);
+}
+
+void print_parquet_layout(
+    const parquet::FileMetaData &metadata,
+    std::ostream &out
+) {
+    struct ColumnLayout {
+        std::string path;
+        std::string codec;
+        std::int64_t compressed = 0;
+        std::int64_t uncompressed = 0;
+        std::vector<std::string> encodings;
+        int dictionary = 0;
+        int statistics = 0;
+        int page_index = 0;
+        int bloom_filter = 0;
+    };
+
+    const auto row_groups = metadata.num_row_groups();
+    std::vector<ColumnLayout> columns(metadata.num_columns());
+    std::int64_t compressed = 0;
+    std::int64_t uncompressed = 0;
+    std::int64_t min_rows = std::numeric_limits<std::int64_t>::max();
+    std::int64_t max_rows = 0;
+    for (int i = 0; i < row_groups; ++i) {
+        const auto row_group = metadata.RowGroup(i);
+        min_rows = std::min(min_rows, row_group->num_rows());
+        max_rows = std::max(max_rows, row_group->num_rows());
+        for (int j = 0; j < row_group->num_columns(); ++j) {
+            const auto chunk = row_group->ColumnChunk(j);
+            auto &column = columns[j];
+            column.path = chunk->path_in_schema()->ToDotString();
+            column.codec = arrow::util::Codec::GetCodecAsString(chunk->compression());
+            column.compressed += chunk->total_compressed_size();
+            column.uncompressed += chunk->total_uncompressed_size();
+            for (const auto encoding: chunk->encodings()) {
+                const auto name = parquet::EncodingToString(encoding);
+                if (std::ranges::find(column.encodings, name) == column.encodings.end()) {
+                    column.encodings.push_back(name);
+                }
+            }
+            column.dictionary += chunk->has_dictionary_page() ? 1 : 0;
+            column.statistics += chunk->is_stats_set() ? 1 : 0;
+            column.page_index += chunk->GetColumnIndexLocation() ? 1 : 0;
+            column.bloom_filter += chunk->bloom_filter_offset() ? 1 : 0;
+            compressed += chunk->total_compressed_size();
+            uncompressed += chunk->total_uncompressed_size();
+        }
+    }
+
+    out << "Parquet layout: " << metadata.num_rows() << " rows in " << row_groups << " row groups";
+    if (row_groups > 0) {
+        out << " of " << min_rows << " to " << max_rows << " rows";
+    }
+    out << ", " << compressed << " bytes of column data (" << uncompressed << " uncompressed)\n";
+
+    std::size_t width = 6;
+    for (const auto &column: columns) {
+        width = std::max(width, column.path.size());
+    }
+    out << std::left << std::setw(static_cast<int>(width + 2)) << "column" << std::setw(14) << "codec"
+            << std::right << std::setw(14) << "bytes" << std::setw(14) << "uncompressed" << "  " << std::left
+            << std::setw(32) << "encodings" << std::setw(12) << "dictionary" << std::setw(12) << "statistics"
+            << std::setw(12) << "page index" << "bloom filter\n";
+    for (const auto &column: columns) {
+        std::string encodings;
+        for (const auto &encoding: column.encodings) {
+            encodings += (encodings.empty() ? "" : ",") + encoding;
+        }
+        out << std::left << std::setw(static_cast<int>(width + 2)) << column.path << std::setw(14) << column.codec
+                << std::right << std::setw(14) << column.compressed << std::setw(14) << column.uncompressed << "  "
+                << std::left << std::setw(32) << encodings << std::setw(12) << coverage(column.dictionary, row_groups)
+                << std::setw(12) << coverage(column.statistics, row_groups) << std::setw(12)
+                << coverage(column.page_index, row_groups) << coverage(column.bloom_filter, row_groups) << '\n';
+    }
+    out << std::right;
+}
+
+ParquetWriter::ParquetWriter(
+    const std::shared_ptr<arrow::Schema> &schema,
+    const std::string &path,
+    const WriterOptions &options
+) :
+    ParquetWriter(schema, open_file_stream(path), options) {}
+
+ParquetWriter::ParquetWriter(
+    const std::shared_ptr<arrow::Schema> &schema,
+    std::shared_ptr<arrow::io::OutputStream> stream,
+    const WriterOptions &options
+) :
+    stream_(std::move(stream)),
+    row_group_rows_(options.parquet.row_group_rows),
+    row_group_bytes_(options.parquet.row_group_bytes),
+    layout_summary_(options.parquet.layout_summary) {
+    auto writer = parquet::arrow::FileWriter::Open(
+        *schema,
+        arrow::default_memory_pool(),
+        stream_,
+        parquet_writer_properties(*schema, options)
+    );
+    check_write(writer.status(), "Error starting Parquet file");
+    writer_ = std::move(*writer);
+}
+
+void ParquetWriter::write(
+    const std::shared_ptr<arrow::RecordBatch> batch
+) {
+    if (!writer_) {
+        throw std::logic_error("A Parquet file was written to after it was finished.");
+    }
+    const auto rows = batch->num_rows();
+    if (rows == 0) {
+        return;
+    }
+    if (row_group_rows_ == 0 && row_group_bytes_ == 0) {
+        start_row_group();
+        check_write(writer_->WriteRecordBatch(*batch), "Error writing Parquet batch");
+        return;
+    }
+
+    // The batch is split where row groups fill up, with its bytes assumed to be spread evenly over its rows.
+    const auto bytes_per_row = std::max<std::int64_t>(arrow::util::TotalBufferSize(*batch) / rows, 1);
+    for (std::int64_t offset = 0; offset < rows;) {
+        const auto full = (row_group_rows_ > 0 && rows_in_group_ >= row_group_rows_)
+                          || (row_group_bytes_ > 0 && bytes_in_group_ >= row_group_bytes_);
+        if (!row_group_open_ || full) {
+            start_row_group();
+        }
+        auto length = rows - offset;
+        if (row_group_rows_ > 0) {
+            length = std::min(length, row_group_rows_ - rows_in_group_);
+        }
+        if (row_group_bytes_ > 0) {
+            length = std::min(length, std::max<std::int64_t>((row_group_bytes_ - bytes_in_group_) / bytes_per_row, 1));
+        }
+        check_write(writer_->WriteRecordBatch(*batch->Slice(offset, length)), "Error writing Parquet batch");
+        rows_in_group_ += length;
+        bytes_in_group_ += length * bytes_per_row;
+        offset += length;
+    }
+}
+
+void ParquetWriter::flush() {
+    if (!writer_) {
+        return;
+    }
+    check_write(writer_->Close(), "Error finishing Parquet file");
+    if (layout_summary_) {
+        print_parquet_layout(*writer_->metadata(), *layout_summary_);
+    }
+    writer_.reset();
+}
+
+void ParquetWriter::start_row_group() {
+    check_write(writer_->NewBufferedRowGroup(), "Error writing Parquet row group");
+    row_group_open_ = true;
+    rows_in_group_ = 0;
+    bytes_in_group_ = 0;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+
+#include <arrow/api.h>
+#include <parquet/arrow/writer.h>
+#include <parquet/metadata.h>
+#include <parquet/properties.h>
+
+#include "writer.h"
+
+// Writer properties for Parquet output with the given options, shared with partitioned output.
+std::shared_ptr<parquet::WriterProperties> parquet_writer_properties(
+    const arrow::Schema &schema,
+    const WriterOptions &options
+);
+
+// Prints the row groups and, per column, the size, codec, encodings and indexes of each column chunk.
+void print_parquet_layout(
+    const parquet::FileMetaData &metadata,
+    std::ostream &out
+);
+
+// Fills each row group up to the row and byte limits of the options, or without them writes each batch as a row group
+// of its own. The row group being filled is buffered in memory. flush() writes the footer, after which nothing can be
+// written.
+class ParquetWriter final : public Writer {
+public:
+    ParquetWriter(
+        const std::shared_ptr<arrow::Schema> &schema,
+        const std::string &path,
+        const WriterOptions &options = {}
+    );
+
+    ParquetWriter(
+        const std::shared_ptr<arrow::Schema> &schema,
+        std::shared_ptr<arrow::io::OutputStream> stream,
+        const WriterOptions &options = {}
+    );
+
+    void write(
+        std::shared_ptr<arrow::RecordBatch> batch
+    ) override;
+
+    void flush() override;
+
+private:
+    void start_row_group();
+
+    std::shared_ptr<arrow::io::OutputStream> stream_;
+    std::unique_ptr<parquet::arrow::FileWriter> writer_;
+    std::int64_t row_group_rows_;
+    std::int64_t row_group_bytes_;
+    std::ostream *layout_summary_;
+
+    bool row_group_open_{false};
+    std::int64_t rows_in_group_{0};
+    std::int64_t bytes_in_group_{0};
+};
@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <utility>
+
+#include <arrow/compute/api.h>
+#include <arrow/dataset/api.h>
+#include <arrow/filesystem/api.h>
+#include <arrow/util/config.h>
+#if ARROW_VERSION_MAJOR >= 21
+#include <arrow/compute/initialize.h>
+#endif
+
+#include "arrow_result.h"
+#include "fnv_hash.h"
+#include "parquet_writer.h"
+
+#include "partitioned_writer.h"
+
+
+namespace {
+// Hands batches written to the PartitionedDatasetWriter to Arrow's dataset writer, which pulls them.
+class QueueReader final : public arrow::RecordBatchReader {
+public:
+    QueueReader(
+        std::shared_ptr<arrow::Schema> schema,
+        BoundedQueue<std::shared_ptr<arrow::RecordBatch> > &queue
+    ) :
+        schema_(std::move(schema)),
+        queue_(queue) {}
+
+    [[nodiscard]] std::shared_ptr<arrow::Schema> schema() const override {
+        return schema_;
+    }
+
+    arrow::Status ReadNext(
+        std::shared_ptr<arrow::RecordBatch> *batch
+    ) override {
+        auto next = queue_.pop();
+        *batch = next ? std::move(*next) : nullptr;
+        return arrow::Status::OK();
+    }
+
+private:
+    std::shared_ptr<arrow::Schema> schema_;
+    BoundedQueue<std::shared_ptr<arrow::RecordBatch> > &queue_;
+};
+}
+
+// Since Arrow 21 the compute functions the dataset writer relies on live in a separate library and have to be
+// registered before first use.
+static void register_compute_functions() {
+#if ARROW_VERSION_MAJOR >= 21
+    static const auto status = arrow::compute::Initialize();
+    if (!status.ok()) {
+        throw std::runtime_error("Error registering Arrow compute functions: " + status.ToString());
+    }
+#endif
+}
+
+static std::shared_ptr<arrow::dataset::FileFormat> dataset_format(
+    const OutputFormat format
+) {
+    switch (format) {
+        case OutputFormat::CSV:
+            return std::make_shared<arrow::dataset::CsvFileFormat>();
+        case OutputFormat::PARQUET:
+            return std::make_shared<arrow::dataset::ParquetFileFormat>();
+        case OutputFormat::COLUMNAR:
+            throw std::runtime_error("Columnar output can't be written as a partitioned dataset.");
+        case OutputFormat::ARROW:
+        case OutputFormat::ARROW_FILE:
+            throw std::runtime_error("Arrow output can't be written as a partitioned dataset.");
+        case OutputFormat::NDJSON:
+            throw std::runtime_error("NDJSON output can't be written as a partitioned dataset.");
+    }
+    throw std::logic_error("Unhandled output format.");
+}
+
+// Arrow has no equivalent of MINIMAL quoting.
+static void apply_dialect(
+    arrow::dataset::FileWriteOptions &file_options,
+    const CsvDialect &dialect
+) {
+    auto &write_options = *static_cast<arrow::dataset::CsvFileWriteOptions &>(file_options).write_options;
+    write_options.delimiter = dialect.delimiter;
+    write_options.null_string = dialect.null_token;
+    write_options.include_header = dialect.header;
+    switch (dialect.quoting) {
+        case CsvQuoting::STRINGS:
+            write_options.quoting_style = arrow::csv::QuotingStyle::Needed;
+            return;
+        case CsvQuoting::ALL:
+            write_options.quoting_style = arrow::csv::QuotingStyle::AllValid;
+            return;
+        case CsvQuoting::NONE:
+            write_options.quoting_style = arrow::csv::QuotingStyle::None;
+            return;
+        case CsvQuoting::MINIMAL:
+            throw std::runtime_error("Minimal quoting isn't supported for partitioned output.");
+    }
+    throw std::logic_error("Unhandled CSV quoting.");
+}
+
+static std::string bucket_column_name(
+    const std::string &column
+) {
+    return column + "_bucket";
+}
+
+// Values are hashed as text, so a value lands in the same bucket whether it was read as a 32 or 64-bit integer, say.
+// Nulls go in bucket 0.
+static std::shared_ptr<arrow::Array> bucket_numbers(
+    const arrow::Array &column,
+    const std::int32_t buckets
+) {
+    const auto text = assign_or_raise(arrow::compute::Cast(column, arrow::large_utf8()));
+    const auto &strings = static_cast<const arrow::LargeStringArray &>(*text);
+
+    arrow::Int32Builder builder;
+    if (const auto status = builder.Reserve(strings.length()); !status.ok()) {
+        throw std::runtime_error("Error assigning buckets: " + status.ToString());
+    }
+    for (std::int64_t i = 0; i < strings.length(); ++i) {
+        if (strings.IsNull(i)) {
+            builder.UnsafeAppend(0);
+            continue;
+        }
+        Fnv1aHash hash;
+        hash.update(strings.GetView(i));
+        builder.UnsafeAppend(static_cast<std::int32_t>(hash.value() % static_cast<std::uint64_t>(buckets)));
+    }
+    return assign_or_raise(builder.Finish());
+}
+
+PartitionedDatasetWriter::PartitionedDatasetWriter(
+    const OutputFormat format,
+    std::shared_ptr<arrow::Schema> schema,
+    const std::string &directory,
+    const PartitioningOptions &options,
+    const WriterOptions &writer_options
+) :
+    schema_(std::move(schema)),
+    bucket_by_(options.bucket_by),
+    buckets_(options.buckets),
+    queue_(8) {
+    register_compute_functions();
+
+    if (bucket_by_) {
+        if (buckets_ <= 0) {
+            throw std::runtime_error("The number of buckets must be at least 1.");
+        }
+        if (buckets_ > options.max_partitions) {
+            throw std::runtime_error("Can't write " + std::to_string(buckets_) + " buckets with a limit of "
+                                     + std::to_string(options.max_partitions) + " partitions.");
+        }
+        if (schema_->GetFieldIndex(*bucket_by_) == -1) {
+            throw std::runtime_error("Can't bucket by '" + *bucket_by_ + "', which isn't a column of the result.");
+        }
+        schema_ = assign_or_raise(
+            schema_->AddField(schema_->num_fields(), arrow::field(bucket_column_name(*bucket_by_), arrow::int32()))
+        );
+    }
+
+    arrow::FieldVector partition_fields;
+    for (const auto &name: options.partition_by) {
+        const auto field = schema_->GetFieldByName(name);
+        if (!field) {
+            throw std::runtime_error("Can't partition by '" + name + "', which isn't a column of the result.");
+        }
+        partition_fields.push_back(field);
+    }
+    if (bucket_by_) {
+        partition_fields.push_back(schema_->fields().back());
+    }
+
+    const auto file_format = dataset_format(format);
+    arrow::dataset::FileSystemDatasetWriteOptions write_options;
+    write_options.file_write_options = file_format->DefaultWriteOptions();
+    if (format == OutputFormat::CSV) {
+        apply_dialect(*write_options.file_write_options, writer_options.csv);
+    }
+    if (format == OutputFormat::PARQUET) {
+        if (writer_options.parquet.row_group_bytes > 0) {
+            throw std::runtime_error("Row group byte limits aren't supported for partitioned output.");
+        }
+        auto &parquet_options = static_cast<arrow::dataset::ParquetFileWriteOptions &>(
+            *write_options.file_write_options
+        );
+        parquet_options.writer_properties = parquet_writer_properties(*schema_, writer_options);
+        if (writer_options.parquet.row_group_rows > 0) {
+            // Rows are held back until a row group is full.
+            const auto rows = static_cast<std::uint64_t>(writer_options.parquet.row_group_rows);
+            write_options.max_rows_per_group = rows;
+            write_options.min_rows_per_group = rows;
+        }
+    }
+    write_options.filesystem = std::make_shared<arrow::fs::LocalFileSystem>();
+    write_options.base_dir = directory;
+    write_options.partitioning = std::make_shared<arrow::dataset::HivePartitioning>(arrow::schema(partition_fields));
+    write_options.basename_template = options.file_name_template.value_or("part-{i}." + file_format->type_name());
+    write_options.max_rows_per_file = options.max_rows_per_file;
+    write_options.max_partitions = options.max_partitions;
+    if (options.max_rows_per_file > 0) {
+        // Arrow refuses row groups that are larger than the files holding them.
+        write_options.max_rows_per_group = std::min(write_options.max_rows_per_group, options.max_rows_per_file);
+        write_options.min_rows_per_group = std::min(write_options.min_rows_per_group, options.max_rows_per_file);
+    }
+
+    const auto builder = arrow::dataset::ScannerBuilder::FromRecordBatchReader(
+        std::make_shared<QueueReader>(schema_, queue_)
+    );
+    if (const auto status = builder->UseThreads(true); !status.ok()) {
+        throw std::runtime_error("Error setting up dataset writer: " + status.ToString());
+    }
+    const auto scanner = assign_or_raise(builder->Finish());
+
+    thread_ = std::thread([this, write_options, scanner] {
+        status_ = arrow::dataset::FileSystemDataset::Write(write_options, scanner);
+        // Unblocks write() if the dataset writer stopped early.
+        queue_.close();
+    });
+}
+
+PartitionedDatasetWriter::~PartitionedDatasetWriter() {
+    if (thread_.joinable()) {
+        queue_.close();
+        thread_.join();
+    }
+}
+
+void PartitionedDatasetWriter::write(
+    std::shared_ptr<arrow::RecordBatch> batch
+) {
+    if (bucket_by_) {
+        const auto buckets = bucket_numbers(*batch->GetColumnByName(*bucket_by_), buckets_);
+        batch = assign_or_raise(batch->AddColumn(batch->num_columns(), schema_->fields().back(), buckets));
+    }
+    if (!queue_.push(std::move(batch))) {
+        finish();
+        throw std::logic_error("Can't write to a partitioned dataset after it has been flushed.");
+    }
+}
+
+void PartitionedDatasetWriter::flush() {
+    finish();
+}
+
+void PartitionedDatasetWriter::finish() {
+    if (thread_.joinable()) {
+        queue_.close();
+        thread_.join();
+    }
+    if (!status_.ok()) {
+        throw std::runtime_error("Error writing dataset: " + status_.ToString());
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arrow/api.h>
+
+#include "bounded_queue.h"
+#include "writer.h"
+
+struct PartitioningOptions {
+    // Columns whose values name the directories rows are written to, Hive style (`col=value/`).
+    std::vector<std::string> partition_by;
+    // Rows are also spread over this many buckets by a hash of the column, as a `<column>_bucket=N/` directory.
+    std::optional<std::string> bucket_by;
+    std::int32_t buckets = 0;
+    // Most directories the rows of one batch may be spread over; Arrow fails the write beyond it. Buckets count too.
+    std::int32_t max_partitions = 1024;
+    // Start a new file once one holds this many rows. Zero for no limit.
+    std::uint64_t max_rows_per_file = 0;
+    // Name of each file in a directory; `{i}` is replaced by a counter. Defaults to `part-{i}.<format>`.
+    std::optional<std::string> file_name_template;
+
+    [[nodiscard]] bool enabled() const {
+        return !partition_by.empty() || bucket_by || max_rows_per_file > 0 || file_name_template;
+    }
+};
+
+// Writes a directory of CSV or Parquet files rather than a single file. Files for different partitions are written
+// in parallel by Arrow's dataset writer, which runs on its own thread and is fed through a bounded queue. Nothing can
+// be written after flush().
+class PartitionedDatasetWriter final : public Writer {
+public:
+    PartitionedDatasetWriter(
+        OutputFormat format,
+        std::shared_ptr<arrow::Schema> schema,
+        const std::string &directory,
+        const PartitioningOptions &options,
+        const WriterOptions &writer_options = {}
+    );
+
+    PartitionedDatasetWriter(
+        const PartitionedDatasetWriter &
+    ) = delete;
+
+    PartitionedDatasetWriter &operator=(
+        const PartitionedDatasetWriter &
+    ) = delete;
+
+    PartitionedDatasetWriter(
+        PartitionedDatasetWriter &&
+    ) = delete;
+
+    PartitionedDatasetWriter &operator=(
+        PartitionedDatasetWriter &&
+    ) = delete;
+
+    ~PartitionedDatasetWriter() override;
+
+    void write(
+        std::shared_ptr<arrow::RecordBatch> batch
+    ) override;
+
+    void flush() override;
+
+private:
+    void finish();
+
+    std::shared_ptr<arrow::Schema> schema_;
+    std::optional<std::string> bucket_by_;
+    std::int32_t buckets_;
+    BoundedQueue<std::shared_ptr<arrow::RecordBatch> > queue_;
+    arrow::Status status_;
+    std::thread thread_;
+};
@@ -0,0 +1,286 @@
+#include <algorithm>
+#include <charconv>
+#include <filesystem>
+#include <iterator>
+#include <ranges>
+#include <stdexcept>
+#include <system_error>
+
+#include "partitioning.h"
+
+
+// Subdirectories, or Parquet files, of a directory sorted by name so that listings are reproducible.
+static std::vector<std::filesystem::path> sorted_entries(
+    const std::filesystem::path &directory,
+    const bool directories
+) {
+    std::vector<std::filesystem::path> entries;
+    std::error_code error;
+    for (std::filesystem::directory_iterator it(directory, error), end; !error && it != end; it.increment(error)) {
+        std::error_code type_error;
+        const auto wanted = directories
+                                ? it->is_directory(type_error)
+                                : it->is_regular_file(type_error) && it->path().extension() == ".parquet";
+        if (wanted) {
+            entries.push_back(it->path());
+        }
+    }
+    std::ranges::sort(entries);
+    return entries;
+}
+
+// Hive writers percent-encode characters such as `/` and spaces in values, and DuckDb decodes them when it reads the
+// partition columns. Malformed escapes are kept as they are.
+static std::string percent_decode(
+    const std::string &text
+) {
+    std::string decoded;
+    for (std::size_t i = 0; i < text.size(); ++i) {
+        unsigned char byte = 0;
+        if (text[i] == '%' && i + 2 < text.size()) {
+            const auto *digits = text.data() + i + 1;
+            if (const auto [end, error] = std::from_chars(digits, digits + 2, byte, 16);
+                error == std::errc{} && end == digits + 2) {
+                decoded.push_back(static_cast<char>(byte));
+                i += 2;
+                continue;
+            }
+        }
+        decoded.push_back(text[i]);
+    }
+    return decoded;
+}
+
+// Calls enter for each partition directory below `directory`, and leaf for each directory at the deepest level that
+// enter accepted all the way down. Returns false as soon as leaf does.
+static bool walk_partitions(
+    const std::filesystem::path &directory,
+    const PartitionLayout layout,
+    const std::vector<std::string> &columns,
+    const std::size_t level,
+    const std::function<bool (
+        std::size_t,
+        const std::optional<std::string> &
+    )> &enter,
+    const std::function<bool (
+        const std::filesystem::path &
+    )> &leaf
+) {
+    if (level == columns.size()) {
+        return leaf(directory);
+    }
+    for (const auto &subdirectory: sorted_entries(directory, true)) {
+        const auto name = subdirectory.filename().string();
+        std::optional<std::string> value = name;
+        if (layout == PartitionLayout::HIVE) {
+            const auto prefix = columns[level] + "=";
+            if (!name.starts_with(prefix)) {
+                continue;
+            }
+            value = percent_decode(name.substr(prefix.size()));
+            if (*value == HIVE_NULL_PARTITION) {
+                value.reset();
+            }
+        }
+        if (enter(level, value) && !walk_partitions(subdirectory, layout, columns, level + 1, enter, leaf)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::vector<std::string> column_names(
+    const PartitionedDataset &dataset
+) {
+    std::vector<std::string> names;
+    std::ranges::transform(dataset.columns, std::back_inserter(names), &ColumnSchema::name);
+    return names;
+}
+
+static bool is_integer(
+    const std::string &text
+) {
+    std::int64_t number = 0;
+    const auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), number);
+    return !text.empty() && error == std::errc{} && end == text.data() + text.size();
+}
+
+static std::string sql_string(
+    const std::string &text
+) {
+    std::string quoted = "'";
+    for (const auto c: text) {
+        quoted += c == '\'' ? "''" : std::string(1, c);
+    }
+    return quoted + "'";
+}
+
+std::optional<std::pair<PartitionLayout, std::vector<std::string> > > parse_partitioning(
+    const std::string &spec
+) {
+    if (spec == "hive") {
+        return std::make_pair(PartitionLayout::HIVE, std::vector<std::string>{});
+    }
+    const std::string prefix = "directory:";
+    if (!spec.starts_with(prefix)) {
+        return std::nullopt;
+    }
+    std::vector<std::string> names;
+    for (const auto name: spec.substr(prefix.size()) | std::views::split(',')) {
+        names.emplace_back(name.begin(), name.end());
+        if (names.back().empty()) {
+            return std::nullopt;
+        }
+    }
+    return std::make_pair(PartitionLayout::DIRECTORY, names);
+}
+
+PartitionedDataset discover_partitions(
+    const std::string &root,
+    const PartitionLayout layout,
+    const std::vector<std::string> &column_names
+) {
+    PartitionedDataset dataset{.root = root, .layout = layout, .columns = {}};
+    while (dataset.root.size() > 1 && dataset.root.ends_with('/')) {
+        dataset.root.pop_back();
+    }
+    std::error_code error;
+    if (!std::filesystem::is_directory(dataset.root, error)) {
+        throw std::runtime_error("'" + root + "' is not a directory.");
+    }
+
+    auto names = column_names;
+    if (layout == PartitionLayout::HIVE) {
+        // The keys are read off the first chain of key=value directories.
+        for (std::filesystem::path directory = dataset.root;;) {
+            const auto subdirectories = sorted_entries(directory, true);
+            const auto partition = std::ranges::find_if(subdirectories, [](const std::filesystem::path &path) {
+                return path.filename().string().find('=') != std::string::npos;
+            });
+            if (partition == subdirectories.end()) {
+                break;
+            }
+            const auto name = partition->filename().string();
+            names.push_back(name.substr(0, name.find('=')));
+            directory = *partition;
+        }
+        if (names.empty()) {
+            throw std::runtime_error("There are no key=value partition directories under '" + root + "'.");
+        }
+    }
+
+    std::vector<bool> integers(names.size(), true);
+    std::size_t partitions = 0;
+    walk_partitions(
+        dataset.root,
+        layout,
+        names,
+        0,
+        [&integers](
+            const std::size_t level,
+            const std::optional<std::string> &value
+        ) {
+            integers[level] = integers[level] && (!value || is_integer(*value));
+            return true;
+        },
+        [&partitions](
+            const std::filesystem::path &
+        ) {
+            ++partitions;
+            return true;
+        }
+    );
+    if (partitions == 0) {
+        throw std::runtime_error(
+            "There are no partition directories " + std::to_string(names.size()) + " levels deep under '" + root + "'."
+        );
+    }
+
+    for (std::size_t i = 0; i < names.size(); ++i) {
+        dataset.columns.push_back(ColumnSchema{.name = names[i], .type = integers[i] ? "BIGINT" : "VARCHAR"});
+    }
+    return dataset;
+}
+
+std::string partitioned_table_expression(
+    const PartitionedDataset &dataset,
+    const std::vector<std::string> &files
+) {
+    const auto hive = dataset.layout == PartitionLayout::HIVE;
+    std::string source;
+    if (files.empty()) {
+        auto pattern = dataset.root;
+        for (const auto &column: dataset.columns) {
+            pattern += hive ? "/" + column.name + "=*" : "/*";
+        }
+        source = sql_string(pattern + "/*.parquet");
+    } else {
+        source = "[";
+        for (std::size_t i = 0; i < files.size(); ++i) {
+            source += (i == 0 ? "" : ", ") + sql_string(files[i]);
+        }
+        source += "]";
+    }
+
+    if (hive) {
+        std::string types;
+        for (const auto &[name, type]: dataset.columns) {
+            types += (types.empty() ? "" : ", ") + sql_string(name) + ": " + type;
+        }
+        return "read_parquet(" + source + ", hive_partitioning = true, hive_types = {" + types + "})";
+    }
+
+    // The partition values are the names of the directories the file is in, the last of them being the deepest.
+    std::string pattern;
+    for (std::size_t i = 0; i < dataset.columns.size(); ++i) {
+        pattern += "([^/]*)/";
+    }
+    std::string expression = "(SELECT * EXCLUDE (filename)";
+    for (std::size_t i = 0; i < dataset.columns.size(); ++i) {
+        std::string name = "\"";
+        for (const auto c: dataset.columns[i].name) {
+            name += c == '"' ? "\"\"" : std::string(1, c);
+        }
+        expression += ", CAST(regexp_extract(filename, " + sql_string(pattern + "[^/]*$") + ", " +
+                std::to_string(i + 1) + ") AS " + dataset.columns[i].type + ") AS " + name + "\"";
+    }
+    return expression + " FROM read_parquet(" + source + ", filename = true))";
+}
+
+PartitionListing list_partition_files(
+    const PartitionedDataset &dataset,
+    const std::function<bool (
+        std::size_t level,
+        const std::optional<std::string> &value
+    )> &keep,
+    const std::size_t max_files
+) {
+    PartitionListing listing;
+    walk_partitions(
+        dataset.root,
+        dataset.layout,
+        column_names(dataset),
+        0,
+        [&listing, &keep](
+            const std::size_t level,
+            const std::optional<std::string> &value
+        ) {
+            ++listing.directories;
+            const auto kept = keep(level, value);
+            listing.skipped += kept ? 0 : 1;
+            return kept;
+        },
+        [&listing, max_files](
+            const std::filesystem::path &directory
+        ) {
+            for (const auto &file: sorted_entries(directory, false)) {
+                if (listing.files.size() >= max_files) {
+                    return false;
+                }
+                listing.files.push_back(file.string());
+            }
+            return listing.files.size() < max_files;
+        }
+    );
+    return listing;
+}
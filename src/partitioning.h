@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "query.h"
+
+// How partition values are encoded in the directories of a dataset: `year=2018/month=03/` or `2018/03/`.
+enum class PartitionLayout : std::uint8_t { HIVE, DIRECTORY };
+
+// A directory of Parquet files with one level of subdirectories per partition column, and the files directly inside
+// the deepest level.
+struct PartitionedDataset {
+    std::string root;
+    PartitionLayout layout;
+    // Partition columns in directory order, typed BIGINT if every value is an integer and VARCHAR otherwise.
+    std::vector<ColumnSchema> columns;
+};
+
+// The value of a Hive partition directory that stands for NULL.
+constexpr auto HIVE_NULL_PARTITION = "__HIVE_DEFAULT_PARTITION__";
+
+// Parses `hive` or `directory:col1,col2`, returning the layout and any column names it gives.
+std::optional<std::pair<PartitionLayout, std::vector<std::string> > > parse_partitioning(
+    const std::string &spec
+);
+
+// Finds the partition columns under root (from the `key=` directory names for Hive layouts, otherwise as named) and
+// infers their types from every directory name. Throws std::runtime_error if the directories don't fit the layout.
+PartitionedDataset discover_partitions(
+    const std::string &root,
+    PartitionLayout layout,
+    const std::vector<std::string> &column_names
+);
+
+// A table expression that reads the dataset, with the partition columns after the columns of the files. It reads the
+// given files if there are any, otherwise every file of the dataset.
+std::string partitioned_table_expression(
+    const PartitionedDataset &dataset,
+    const std::vector<std::string> &files = {}
+);
+
+struct PartitionListing {
+    std::vector<std::string> files;
+    std::size_t directories = 0;
+    std::size_t skipped = 0;
+};
+
+// Files of the partitions whose directories `keep` accepts at every level. `keep` is given the level and the value
+// (nullopt for a Hive NULL partition); directories it rejects are not looked into. Stops after max_files files.
+PartitionListing list_partition_files(
+    const PartitionedDataset &dataset,
+    const std::function<bool (
+        std::size_t level,
+        const std::optional<std::string> &value
+    )> &keep,
+    std::size_t max_files = SIZE_MAX
+);
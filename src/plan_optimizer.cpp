@@ -0,0 +1,896 @@
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <iterator>
+#include <optional>
+#include <ostream>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+#include <vector>
+
+#include "ascii_case.h"
+#include "parquet_metadata.h"
+#include "partitioning.h"
+#include "verified_schema.h"
+
+#include "plan_optimizer.h"
+
+
+// A relation a stage reads, and the name its columns are qualified with.
+struct Source {
+    std::string table;
+    std::string qualifier;
+    bool filterable;
+};
+
+static bool is_identifier(
+    const std::string &name
+) {
+    if (name.size() >= 2 && name.front() == '"' && name.back() == '"') {
+        return name.find('"', 1) == name.size() - 1;
+    }
+    const auto is_word = [](const unsigned char c) { return std::isalnum(c) || c == '_'; };
+    return !name.empty()
+           && !std::isdigit(static_cast<unsigned char>(name.front()))
+           && std::ranges::all_of(name, is_word);
+}
+
+static std::vector<Source> sources(
+    const QueryPlan &plan
+) {
+    std::vector<Source> sources;
+    const auto tablenames = plan.select->get_tablenames();
+    if (tablenames.size() != 1) {
+        return sources;
+    }
+    const auto how = plan.join ? to_upper(plan.join->get_how()) : "INNER";
+    sources.push_back({
+        .table = tablenames.front(),
+        .qualifier = plan.select->get_alias().value_or(tablenames.front()),
+        .filterable = how == "INNER" || how == "LEFT" || how == "LEFT OUTER"
+    });
+    if (plan.join) {
+        sources.push_back({
+            .table = plan.join->get_table(),
+            .qualifier = plan.join->get_alias().value_or(plan.join->get_table()),
+            .filterable = how == "INNER" || how == "RIGHT" || how == "RIGHT OUTER"
+        });
+    }
+    return sources;
+}
+
+// Counts SQL stages that mention the alias at all, since their references can't be told apart from other text.
+static std::size_t references(
+    const OverallQueryPlan &query_plan,
+    const std::string &alias
+) {
+    std::size_t count = 0;
+    for (const auto &plan: query_plan.get_plans()) {
+        if (plan.sql) {
+            count += plan.sql->get_sql().find(alias) != std::string::npos ? 1 : 0;
+            continue;
+        }
+        if (plan.select) {
+            count += std::ranges::count(plan.select->get_tablenames(), alias);
+        }
+        if (plan.join && plan.join->get_table() == alias) {
+            ++count;
+        }
+    }
+    return count;
+}
+
+// The earlier stage a condition on `column` of `source` can move into.
+static std::optional<std::size_t> target_stage(
+    const OverallQueryPlan &query_plan,
+    const std::size_t stage,
+    const Source &source,
+    const std::string &column
+) {
+    const auto &plans = query_plan.get_plans();
+    const auto *producer = query_plan.find_plan(source.table);
+    if (!source.filterable || producer == nullptr || producer >= &plans[stage]) {
+        return std::nullopt;
+    }
+    if (producer->sql || producer->join || producer->limit || references(query_plan, source.table) != 1) {
+        return std::nullopt;
+    }
+    // With an expression such as `fare + tip AS total` among the columns, even alongside `*`, the condition could name
+    // a column the producer computes rather than reads.
+    const auto columns = producer->select->get_columns();
+    const auto passed_through = [](const std::string &c) { return c == "*" || is_identifier(c); };
+    if (!std::ranges::all_of(columns, passed_through)
+        || (std::ranges::find(columns, column) == columns.end() && std::ranges::find(columns, "*") == columns.end())) {
+        return std::nullopt;
+    }
+    return static_cast<std::size_t>(producer - plans.data());
+}
+
+OverallQueryPlan push_down_filters(
+    const OverallQueryPlan &query_plan,
+    std::size_t &pushed
+) {
+    OverallQueryPlan optimised = query_plan;
+    auto &plans = optimised.get_plans();
+    // Later stages first, so that conditions moved into a stage can move on from it.
+    for (std::size_t stage = plans.size(); stage-- > 0;) {
+        if (!plans[stage].select || !plans[stage].where || plans[stage].sql) {
+            continue;
+        }
+        const auto stage_sources = sources(plans[stage]);
+        // Conditions moved in from later stages follow the stage's own, and were already counted.
+        const auto &original = query_plan.get_plans()[stage].where;
+        const auto own = original ? original->get_conditions().size() : 0;
+        const auto conditions = plans[stage].where->get_conditions();
+        WhereFragment kept;
+        for (std::size_t i = 0; i < conditions.size(); ++i) {
+            const auto &condition = conditions[i];
+            const auto dot = condition.column.find('.');
+            const auto qualifier = dot == std::string::npos ? "" : condition.column.substr(0, dot);
+            const auto column = dot == std::string::npos ? condition.column : condition.column.substr(dot + 1);
+            const auto source = std::ranges::find_if(stage_sources, [&](const Source &s) {
+                return qualifier.empty() ? stage_sources.size() == 1 : s.qualifier == qualifier;
+            });
+            const auto target = source != stage_sources.end() && is_identifier(column)
+                                    ? target_stage(optimised, stage, *source, column)
+                                    : std::nullopt;
+            if (!target) {
+                kept.add_condition(condition.column, condition.predicate, condition.value);
+                continue;
+            }
+            auto &where = plans[*target].where;
+            if (!where) {
+                where.emplace();
+            }
+            where->add_condition(column, condition.predicate, condition.value);
+            pushed += i < own ? 1 : 0;
+        }
+        if (kept.get_conditions().empty()) {
+            plans[stage].where.reset();
+        } else {
+            plans[stage].where = kept;
+        }
+    }
+    return optimised;
+}
+
+// Compares column names the way DuckDb does: case insensitively, whether quoted or not.
+static std::string column_key(
+    const std::string &name
+) {
+    const auto quoted = name.size() >= 2 && name.front() == '"' && name.back() == '"';
+    return to_lower(quoted ? name.substr(1, name.size() - 2) : name);
+}
+
+// The columns later stages use from a stage's output, or all of them.
+struct LiveColumns {
+    bool all = false;
+    std::vector<std::string> columns;
+    std::unordered_set<std::string> keys;
+
+    void add(
+        const std::string &column
+    ) {
+        if (!all && keys.insert(column_key(column)).second) {
+            columns.push_back(column);
+        }
+    }
+
+    [[nodiscard]] bool contains(
+        const std::string &column
+    ) const {
+        return all || keys.contains(column_key(column));
+    }
+};
+
+// The stage whose output `table` names, if it comes before `stage`.
+static std::optional<std::size_t> producer_of(
+    const OverallQueryPlan &query_plan,
+    const std::size_t stage,
+    const std::string &table
+) {
+    const auto &plans = query_plan.get_plans();
+    const auto *producer = query_plan.find_plan(table);
+    if (producer == nullptr || producer >= &plans[stage]) {
+        return std::nullopt;
+    }
+    return static_cast<std::size_t>(producer - plans.data());
+}
+
+// The names of the columns a stage produces, if they are known without asking DuckDb.
+static std::optional<std::vector<std::string>> output_columns(
+    const QueryPlan &plan
+) {
+    if (plan.sql || !plan.select) {
+        return std::nullopt;
+    }
+    const auto columns = plan.select->get_columns();
+    if (std::ranges::find(columns, "*") == columns.end()) {
+        if (!std::ranges::all_of(columns, is_identifier)) {
+            return std::nullopt;
+        }
+        return columns;
+    }
+    if (columns.size() != 1 || plan.join || !plan.schema) {
+        return std::nullopt;
+    }
+    std::vector<std::string> names;
+    std::ranges::transform(plan.schema->columns, std::back_inserter(names), &ColumnSchema::name);
+    return names;
+}
+
+// Records which columns of its sources one stage uses, given the columns later stages use from it.
+class ColumnUse {
+public:
+    ColumnUse(
+        const OverallQueryPlan &query_plan,
+        std::vector<LiveColumns> &live,
+        const std::size_t stage
+    ) :
+        query_plan_(query_plan),
+        live_(live),
+        stage_(stage),
+        sources_(sources(query_plan.get_plans()[stage])) {}
+
+    [[nodiscard]] bool understood() const {
+        return !sources_.empty();
+    }
+
+    // A column, optionally qualified by a source, used anywhere in the stage.
+    void use(
+        const std::string &reference
+    ) {
+        const auto dot = reference.find('.');
+        const auto qualifier = dot == std::string::npos ? "" : reference.substr(0, dot);
+        const auto column = dot == std::string::npos ? reference : reference.substr(dot + 1);
+        if (!is_identifier(column)) {
+            use_everything();
+            return;
+        }
+        if (!qualifier.empty()) {
+            const auto source = std::ranges::find(sources_, qualifier, &Source::qualifier);
+            if (source == sources_.end()) {
+                use_everything();
+            } else {
+                use(*source, column);
+            }
+            return;
+        }
+        for (const auto &source: sources_) {
+            if (sources_.size() == 1) {
+                use(source, column);
+                continue;
+            }
+            // Only a side that is known to have the column can be the one it comes from.
+            const auto producer = producer_of(query_plan_, stage_, source.table);
+            const auto columns = producer ? output_columns(query_plan_.get_plans()[*producer]) : std::nullopt;
+            const auto same_column = [&](const std::string &c) { return column_key(c) == column_key(column); };
+            if (!columns) {
+                use_all(source);
+            } else if (std::ranges::any_of(*columns, same_column)) {
+                use(source, column);
+            }
+        }
+    }
+
+    void use_everything() {
+        for (const auto &source: sources_) {
+            use_all(source);
+        }
+    }
+
+private:
+    const OverallQueryPlan &query_plan_;
+    std::vector<LiveColumns> &live_;
+    std::size_t stage_;
+    std::vector<Source> sources_;
+
+    void use(
+        const Source &source,
+        const std::string &column
+    ) {
+        if (const auto producer = producer_of(query_plan_, stage_, source.table)) {
+            live_[*producer].add(column);
+        }
+    }
+
+    void use_all(
+        const Source &source
+    ) {
+        if (const auto producer = producer_of(query_plan_, stage_, source.table)) {
+            live_[*producer].all = true;
+        }
+    }
+};
+
+// Narrows the column list of a stage to those later stages use. Returns whether it changed.
+static bool narrow_columns(
+    QueryPlan &plan,
+    const LiveColumns &live
+) {
+    if (live.all || live.columns.empty() || plan.join) {
+        return false;
+    }
+    const auto columns = plan.select->get_columns();
+    std::vector<std::string> narrowed;
+    if (columns == std::vector<std::string>{"*"}) {
+        const auto table_schema = plan.select->get_schema();
+        if (table_schema) {
+            // Keep the order of the input, and leave the stage alone if it doesn't seem to have the columns.
+            for (const auto &column: table_schema->columns) {
+                if (live.contains(column.name)) {
+                    narrowed.push_back(column.name);
+                }
+            }
+            if (narrowed.size() != live.columns.size()) {
+                return false;
+            }
+        } else {
+            narrowed = live.columns;
+        }
+    } else {
+        std::ranges::copy_if(columns, std::back_inserter(narrowed), [&](const std::string &column) {
+            const auto dot = column.find('.');
+            const auto name = dot == std::string::npos ? column : column.substr(dot + 1);
+            return !is_identifier(name) || live.contains(name);
+        });
+        if (narrowed.empty() || narrowed.size() == columns.size()) {
+            return false;
+        }
+    }
+    plan.select = SelectFragment(
+        plan.select->get_tablenames(),
+        narrowed,
+        plan.select->get_alias(),
+        plan.select->get_schema()
+    );
+    if (plan.schema) {
+        plan.schema = project_schema(*plan.schema, narrowed);
+    }
+    return true;
+}
+
+OverallQueryPlan prune_columns(
+    const OverallQueryPlan &query_plan,
+    std::size_t &narrowed
+) {
+    OverallQueryPlan pruned = query_plan;
+    auto &plans = pruned.get_plans();
+    if (plans.empty()) {
+        return pruned;
+    }
+    std::vector<LiveColumns> live(plans.size());
+    live.back().all = true;
+    // Every stage that reads a stage comes after it, so its columns are known by the time it is reached.
+    for (std::size_t stage = plans.size(); stage-- > 0;) {
+        auto &plan = plans[stage];
+        if (plan.sql) {
+            for (std::size_t earlier = 0; earlier < stage; ++earlier) {
+                const auto alias = plans[earlier].select ? plans[earlier].select->get_alias() : std::nullopt;
+                if (alias && plan.sql->get_sql().find(*alias) != std::string::npos) {
+                    live[earlier].all = true;
+                }
+            }
+            continue;
+        }
+        if (!plan.select) {
+            continue;
+        }
+        ColumnUse use(pruned, live, stage);
+        if (!use.understood()) {
+            for (const auto &table: plan.select->get_tablenames()) {
+                if (const auto producer = producer_of(pruned, stage, table)) {
+                    live[*producer].all = true;
+                }
+            }
+            continue;
+        }
+        if (stage + 1 < plans.size() && narrow_columns(plan, live[stage])) {
+            ++narrowed;
+        }
+        for (const auto &column: plan.select->get_columns()) {
+            if (column != "*") {
+                use.use(column);
+            } else if (live[stage].all) {
+                use.use_everything();
+            } else {
+                std::ranges::for_each(live[stage].columns, [&](const auto &c) { use.use(c); });
+            }
+        }
+        if (plan.where) {
+            for (const auto &condition: plan.where->get_conditions()) {
+                use.use(condition.column);
+            }
+        }
+        if (plan.order) {
+            std::ranges::for_each(plan.order->get_columns(), [&](const auto &c) { use.use(c); });
+        }
+        if (plan.join) {
+            for (const auto &condition: plan.join->get_conditions()) {
+                use.use(condition.left);
+                use.use(condition.right);
+            }
+        }
+    }
+    return pruned;
+}
+
+// The parameter as evaluation passes it for a column of this type, if comparisons with it order the way the values do.
+// FLOAT columns are left out because values that differ as doubles can round to the same float.
+static std::optional<StatisticValue> typed_value(
+    const QueryParam &value,
+    const std::string &type
+) {
+    try {
+        if (type == "BIGINT" || type == "INTEGER" || type == "SMALLINT") {
+            if (value.type() == ParamType::NUMERIC) {
+                return StatisticValue{value.get<std::int64_t>()};
+            }
+            if (value.type() == ParamType::UNKNOWN) {
+                const auto text = value.get<std::string>();
+                std::size_t parsed = 0;
+                const auto number = std::stoll(text, &parsed);
+                return parsed == text.size() ? std::make_optional(StatisticValue{std::int64_t{number}}) : std::nullopt;
+            }
+        } else if (type == "DOUBLE") {
+            if (value.type() == ParamType::NUMERIC) {
+                return StatisticValue{static_cast<double>(value.get<std::int64_t>())};
+            }
+            if (value.type() == ParamType::UNKNOWN) {
+                const auto text = value.get<std::string>();
+                std::size_t parsed = 0;
+                const auto number = std::stod(text, &parsed);
+                return parsed == text.size() && !std::isnan(number) ? std::make_optional(StatisticValue{number})
+                                                                    : std::nullopt;
+            }
+        } else if (type == "VARCHAR" || type == "TEXT") {
+            if (value.type() != ParamType::NUMERIC) {
+                return StatisticValue{value.get<std::string>()};
+            }
+        }
+    } catch (const std::exception &) {
+    }
+    return std::nullopt;
+}
+
+// The comparisons of one column with values of a known type, reduced to at most a lower and an upper bound or a
+// single value.
+class ColumnRange {
+public:
+    void add(
+        const Condition &condition,
+        StatisticValue value
+    ) {
+        const auto &predicate = condition.predicate;
+        if (predicate == "=" || predicate == "==") {
+            contradiction_ |= equal_ && equal_->value != value;
+            if (!equal_) {
+                equal_ = Bound{.value = std::move(value), .condition = condition};
+            }
+        } else if (predicate == ">" || predicate == ">=") {
+            if (!lower_ || value > lower_->value || (value == lower_->value && predicate == ">")) {
+                lower_ = Bound{.value = std::move(value), .condition = condition};
+            }
+        } else if (predicate == "<" || predicate == "<=") {
+            if (!upper_ || value < upper_->value || (value == upper_->value && predicate == "<")) {
+                upper_ = Bound{.value = std::move(value), .condition = condition};
+            }
+        }
+    }
+
+    // The conditions left, or nullopt if no value satisfies all of them.
+    [[nodiscard]] std::optional<std::vector<Condition> > conditions() const {
+        if (contradiction_) {
+            return std::nullopt;
+        }
+        if (equal_) {
+            const auto &value = equal_->value;
+            const auto above = !lower_ || value > lower_->value || (value == lower_->value && !strict(*lower_));
+            const auto below = !upper_ || value < upper_->value || (value == upper_->value && !strict(*upper_));
+            return above && below ? std::make_optional(std::vector{equal_->condition}) : std::nullopt;
+        }
+        if (lower_ && upper_ && lower_->value >= upper_->value) {
+            if (lower_->value > upper_->value || strict(*lower_) || strict(*upper_)) {
+                return std::nullopt;
+            }
+            auto equal = lower_->condition;
+            equal.predicate = "=";
+            return std::vector{equal};
+        }
+        std::vector<Condition> conditions;
+        for (const auto &bound: {lower_, upper_}) {
+            if (bound) {
+                conditions.push_back(bound->condition);
+            }
+        }
+        return conditions;
+    }
+
+private:
+    struct Bound {
+        StatisticValue value;
+        Condition condition;
+    };
+
+    std::optional<Bound> lower_, upper_, equal_;
+    bool contradiction_ = false;
+
+    static bool strict(
+        const Bound &bound
+    ) {
+        return bound.condition.predicate == ">" || bound.condition.predicate == "<";
+    }
+};
+
+// The column a condition of this stage compares, without the qualifier of its only source.
+static std::optional<std::string> unqualified_column(
+    const QueryPlan &plan,
+    const std::string &column
+) {
+    const auto dot = column.find('.');
+    if (dot == std::string::npos) {
+        return column;
+    }
+    const auto stage_sources = sources(plan);
+    if (stage_sources.size() != 1 || stage_sources.front().qualifier != column.substr(0, dot)) {
+        return std::nullopt;
+    }
+    return column.substr(dot + 1);
+}
+
+// The columns a select stage produces, named as in its result.
+static std::vector<std::string> unqualified_columns(
+    const QueryPlan &plan
+) {
+    std::vector<std::string> columns;
+    for (const auto &column: plan.select->get_columns()) {
+        columns.push_back(unqualified_column(plan, column).value_or(column));
+    }
+    return columns;
+}
+
+// The columns and types a stage reads, from the schema stored in the plan or else from the Parquet metadata cache,
+// following selects from earlier stages back to the files.
+static std::optional<ResolvedSchema> source_schema(
+    const OverallQueryPlan &query_plan,
+    const std::size_t stage
+) {
+    const auto &plan = query_plan.get_plans()[stage];
+    if (auto schema = verified_source_schema(query_plan, *plan.select)) {
+        return schema;
+    }
+    const auto tablenames = plan.select->get_tablenames();
+    if (tablenames.size() != 1) {
+        return std::nullopt;
+    }
+    if (const auto producer = producer_of(query_plan, stage, tablenames.front())) {
+        const auto &upstream = query_plan.get_plans()[*producer];
+        if (upstream.sql || upstream.join) {
+            return std::nullopt;
+        }
+        const auto schema = source_schema(query_plan, *producer);
+        return schema ? project_schema(*schema, unqualified_columns(upstream)) : std::nullopt;
+    }
+    return parquet_schema(tablenames);
+}
+
+// DuckDb types of the columns a stage reads, keyed by column_key(). Empty for joins, whose columns come from two
+// relations.
+static std::unordered_map<std::string, std::string> column_types(
+    const OverallQueryPlan &query_plan,
+    const std::size_t stage
+) {
+    std::unordered_map<std::string, std::string> types;
+    if (query_plan.get_plans()[stage].join) {
+        return types;
+    }
+    if (const auto schema = source_schema(query_plan, stage)) {
+        for (const auto &[name, type]: schema->columns) {
+            types.emplace(column_key(name), type);
+        }
+    }
+    return types;
+}
+
+// Puts the conditions most likely to rule rows out first, going by the row group statistics of the files the stage
+// scans. Conditions without statistics keep their order after the others.
+static void order_by_selectivity(
+    const QueryPlan &plan,
+    std::vector<Condition> &conditions
+) {
+    const auto tablenames = plan.select->get_tablenames();
+    const auto files = conditions.size() > 1 && tablenames.size() == 1 && !plan.join
+                           ? parquet_table_files(tablenames.front())
+                           : std::nullopt;
+    if (!files) {
+        return;
+    }
+    const auto metadata = ParquetMetadataCache(default_metadata_cache_directory()).load(*files);
+    std::vector<std::pair<double, Condition> > estimated;
+    for (const auto &condition: conditions) {
+        auto unqualified = condition;
+        unqualified.column = unqualified_column(plan, condition.column).value_or(condition.column);
+        estimated.emplace_back(estimated_selectivity(metadata, unqualified).value_or(1.0), condition);
+    }
+    std::ranges::stable_sort(estimated, {}, &std::pair<double, Condition>::first);
+    std::ranges::transform(estimated, conditions.begin(), &std::pair<double, Condition>::second);
+}
+
+// Whether a select's columns are all plain columns, so that it has no rows when its input has none.
+static bool passes_rows_through(
+    const SelectFragment &select
+) {
+    return std::ranges::all_of(select.get_columns(), [](const std::string &column) {
+        const auto dot = column.find('.');
+        return column == "*" || is_identifier(dot == std::string::npos ? column : column.substr(dot + 1));
+    });
+}
+
+static std::string quote_identifier(
+    const std::string &name
+) {
+    std::string quoted = "\"";
+    for (const auto c: name) {
+        quoted += c == '"' ? "\"\"" : std::string(1, c);
+    }
+    return quoted + "\"";
+}
+
+// A query with no rows and the given columns, which DuckDb answers without reading anything.
+static std::string empty_relation(
+    const ResolvedSchema &schema
+) {
+    std::string sql = "SELECT ";
+    for (std::size_t i = 0; i < schema.columns.size(); ++i) {
+        sql += i == 0 ? "" : ",\n       ";
+        sql += "CAST(NULL AS " + schema.columns[i].type + ") AS " + quote_identifier(schema.columns[i].name);
+    }
+    return sql + "\n LIMIT 0";
+}
+
+OverallQueryPlan simplify_conditions(
+    const OverallQueryPlan &query_plan,
+    PlanRewrites &rewrites
+) {
+    OverallQueryPlan simplified = query_plan;
+    auto &plans = simplified.get_plans();
+    std::vector<bool> empty(plans.size(), false);
+    for (std::size_t stage = 0; stage < plans.size(); ++stage) {
+        auto &plan = plans[stage];
+        if (!plan.select || plan.sql) {
+            continue;
+        }
+        // A stage computing anything else, such as count(*), can produce rows from no input.
+        const auto passes_rows = passes_rows_through(*plan.select);
+        for (const auto &source: sources(plan)) {
+            const auto producer = producer_of(simplified, stage, source.table);
+            empty[stage] = empty[stage] || (passes_rows && source.filterable && producer && empty[*producer]);
+        }
+        if (!plan.where) {
+            continue;
+        }
+
+        const auto types = column_types(simplified, stage);
+        const auto conditions = plan.where->get_conditions();
+        std::vector<Condition> kept;
+        std::vector<std::string> columns;
+        std::unordered_map<std::string, ColumnRange> ranges;
+        for (const auto &condition: conditions) {
+            const auto column = unqualified_column(plan, condition.column);
+            const auto type = column && is_identifier(*column) ? types.find(column_key(*column)) : types.end();
+            const auto value = type != types.end() && !condition.value.is_null()
+                                   ? typed_value(condition.value, type->second)
+                                   : std::nullopt;
+            const auto &predicate = condition.predicate;
+            const auto comparison = predicate == "=" || predicate == "==" || predicate == "<" || predicate == "<="
+                                    || predicate == ">" || predicate == ">=";
+            if (!value || !comparison) {
+                kept.push_back(condition);
+                continue;
+            }
+            if (!ranges.contains(type->first)) {
+                columns.push_back(type->first);
+            }
+            ranges[type->first].add(condition, *value);
+        }
+
+        bool contradiction = false;
+        for (const auto &column: columns) {
+            const auto reduced = ranges[column].conditions();
+            if (!reduced) {
+                contradiction = true;
+                break;
+            }
+            kept.insert(kept.end(), reduced->begin(), reduced->end());
+        }
+        if (contradiction) {
+            // Left as it is; DuckDb finds no rows either way.
+            empty[stage] = empty[stage] || passes_rows;
+            continue;
+        }
+
+        order_by_selectivity(plan, kept);
+        rewrites.conditions_dropped += conditions.size() - kept.size();
+        WhereFragment where;
+        for (const auto &condition: kept) {
+            where.add_condition(condition.column, condition.predicate, condition.value);
+        }
+        plan.where = where;
+    }
+
+    if (plans.empty() || !empty.back() || plans.back().join) {
+        return simplified;
+    }
+    const auto source = source_schema(simplified, plans.size() - 1);
+    const auto schema = source ? project_schema(*source, unqualified_columns(plans.back())) : std::nullopt;
+    if (!schema || schema->columns.empty()) {
+        return simplified;
+    }
+    rewrites.empty_result = true;
+    QueryPlan empty_plan;
+    empty_plan.sql = SqlFragment(empty_relation(*schema));
+    OverallQueryPlan short_circuit;
+    short_circuit.add_plan(empty_plan);
+    return short_circuit;
+}
+
+// SQL LIKE: `%` matches any run of characters and `_` any one character.
+static bool like(
+    const std::string_view text,
+    const std::string_view pattern
+) {
+    if (pattern.empty()) {
+        return text.empty();
+    }
+    if (pattern.front() == '%') {
+        for (std::size_t skip = 0; skip <= text.size(); ++skip) {
+            if (like(text.substr(skip), pattern.substr(1))) {
+                return true;
+            }
+        }
+        return false;
+    }
+    return !text.empty() && (pattern.front() == '_' || pattern.front() == text.front())
+           && like(text.substr(1), pattern.substr(1));
+}
+
+// False if no row of a partition with this value (nullopt for NULL) can satisfy the condition.
+static bool partition_may_match(
+    const Condition &condition,
+    const std::string &type,
+    const std::optional<std::string> &partition
+) {
+    const auto &predicate = condition.predicate;
+    const auto is_like = to_upper(predicate) == "LIKE" || to_upper(predicate) == "NOT LIKE";
+    const auto is_comparison = predicate == "=" || predicate == "==" || predicate == "!=" || predicate == "<>"
+                               || predicate == "<" || predicate == "<=" || predicate == ">" || predicate == ">=";
+    if (condition.value.is_null() || (!is_like && !is_comparison)) {
+        return true;
+    }
+    if (!partition) {
+        // Comparisons and LIKE are never true for NULL.
+        return false;
+    }
+    const auto actual = typed_value(QueryParam::unknown(*partition), type);
+    if (!actual) {
+        return true;
+    }
+    if (is_like) {
+        // The column is compared as text, so integer values lose any leading zeros of their directory names.
+        const auto text = std::holds_alternative<std::int64_t>(*actual)
+                              ? std::to_string(std::get<std::int64_t>(*actual))
+                              : *partition;
+        const auto pattern = condition.value.type() == ParamType::NUMERIC
+                                 ? std::to_string(condition.value.get<std::int64_t>())
+                                 : condition.value.get<std::string>();
+        return like(text, pattern) == (to_upper(predicate) == "LIKE");
+    }
+    const auto value = typed_value(condition.value, type);
+    if (!value) {
+        return true;
+    }
+    if (predicate == "=" || predicate == "==") {
+        return *actual == *value;
+    }
+    if (predicate == "!=" || predicate == "<>") {
+        return *actual != *value;
+    }
+    if (predicate == "<") {
+        return *actual < *value;
+    }
+    if (predicate == "<=") {
+        return *actual <= *value;
+    }
+    if (predicate == ">") {
+        return *actual > *value;
+    }
+    return *actual >= *value;
+}
+
+OverallQueryPlan prune_partitions(
+    const OverallQueryPlan &query_plan,
+    PlanRewrites &rewrites
+) {
+    OverallQueryPlan pruned = query_plan;
+    for (std::size_t index = 0; index < pruned.get_plans().size(); ++index) {
+        const auto &plan = pruned.get_plans()[index];
+        if (!plan.partitions || !plan.select || !plan.where || plan.join || plan.sql) {
+            continue;
+        }
+        const auto dataset = *plan.partitions;
+        std::vector<std::vector<Condition> > level_conditions(dataset.columns.size());
+        bool prunable = false;
+        for (const auto &condition: plan.where->get_conditions()) {
+            const auto column = unqualified_column(plan, condition.column);
+            const auto partition_column = std::ranges::find_if(dataset.columns, [&](const ColumnSchema &c) {
+                return column && column_key(c.name) == column_key(*column);
+            });
+            if (partition_column != dataset.columns.end()) {
+                level_conditions[partition_column - dataset.columns.begin()].push_back(condition);
+                prunable = true;
+            }
+        }
+        if (!prunable) {
+            continue;
+        }
+
+        auto listing = list_partition_files(dataset, [&](
+            const std::size_t level,
+            const std::optional<std::string> &value
+        ) {
+            return std::ranges::all_of(level_conditions[level], [&](const Condition &condition) {
+                return partition_may_match(condition, dataset.columns[level].type, value);
+            });
+        });
+        rewrites.partition_directories += listing.directories;
+        rewrites.partition_directories_skipped += listing.skipped;
+        keep_one_file(listing.files, [&dataset]() -> std::optional<std::string> {
+            auto any = list_partition_files(dataset, [](const auto, const auto &) { return true; }, 1).files;
+            return any.empty() ? std::nullopt : std::make_optional(any.front());
+        });
+        if (listing.files.empty()) {
+            continue;
+        }
+        pruned = replace_stage_tables(pruned, index, {partitioned_table_expression(dataset, listing.files)});
+    }
+    return pruned;
+}
+
+OverallQueryPlan optimise_query_plan(
+    const OverallQueryPlan &query_plan,
+    const PlanOptimiserOptions &options,
+    PlanRewrites &rewrites
+) {
+    auto optimised = options.push_down_filters ? push_down_filters(query_plan, rewrites.conditions_pushed) : query_plan;
+    if (options.simplify_conditions) {
+        optimised = simplify_conditions(optimised, rewrites);
+    }
+    if (options.prune_partitions) {
+        optimised = prune_partitions(optimised, rewrites);
+    }
+    if (options.prune_columns) {
+        optimised = prune_columns(optimised, rewrites.stages_narrowed);
+    }
+    return optimised;
+}
+
+std::ostream &operator<<(
+    std::ostream &os,
+    const PlanRewrites &rewrites
+) {
+    os << "pushed " << rewrites.conditions_pushed << " conditions down towards their scans, dropped "
+            << rewrites.conditions_dropped << " redundant conditions and narrowed " << rewrites.stages_narrowed
+            << " stages to the columns used later";
+    if (rewrites.partition_directories > 0) {
+        os << "; skipped " << rewrites.partition_directories_skipped << " of " << rewrites.partition_directories
+                << " partition directories";
+    }
+    if (rewrites.empty_result) {
+        os << "; the conditions can't all hold, so the result is empty without reading any files";
+    }
+    return os;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <cstddef>
+#include <ostream>
+
+#include "queryplan.h"
+
+// Moves the WHERE conditions of stages that select from an earlier stage's alias into that stage, and on down the
+// chain, so that they end up next to the scan of the input files, where DuckDb skips row groups and
+// prune_parquet_files skips whole files. A condition is only moved into a stage that is read by nothing else and has
+// no LIMIT, join or SQL of its own and selects only plain columns or `*`, and only if it names a column that the
+// stage passes through unchanged. On a join, a condition is only moved into the side whose rows the join doesn't add
+// back: either side of an inner join, the left of a left join and the right of a right join. `pushed` counts the
+// conditions moved, however far.
+OverallQueryPlan push_down_filters(
+    const OverallQueryPlan &query_plan,
+    std::size_t &pushed
+);
+
+// Narrows the column lists of stages that later stages select from to the columns those stages use, so that a
+// `SELECT *` early in the chain doesn't read every column of the input files. What a stage uses is worked out from
+// its selected columns, WHERE and ORDER BY columns and join conditions; anything that isn't a plain column, and any
+// stage read by SQL, keeps all of its columns. `narrowed` counts the stages whose column lists were narrowed.
+OverallQueryPlan prune_columns(
+    const OverallQueryPlan &query_plan,
+    std::size_t &narrowed
+);
+
+struct PlanOptimiserOptions {
+    bool push_down_filters = true;
+    bool simplify_conditions = true;
+    bool prune_partitions = true;
+    bool prune_columns = true;
+};
+
+struct PlanRewrites {
+    std::size_t conditions_pushed = 0;
+    std::size_t conditions_dropped = 0;
+    std::size_t stages_narrowed = 0;
+    std::size_t partition_directories = 0;
+    std::size_t partition_directories_skipped = 0;
+    bool empty_result = false;
+
+    [[nodiscard]] bool any() const {
+        return conditions_pushed > 0 || conditions_dropped > 0 || stages_narrowed > 0 || partition_directories > 0
+               || empty_result;
+    }
+};
+
+std::ostream &operator<<(
+    std::ostream &os,
+    const PlanRewrites &rewrites
+);
+
+// Reduces the comparisons (=, <, <=, > and >=) of each stage's WHERE with values of the column's type to at most a
+// lower and an upper bound, or a single value, per column, and puts the conditions that the Parquet row group
+// statistics suggest rule out the most rows first. Column types come from the schema stored in the plan, or the
+// Parquet metadata cache. If the final stage can have no rows because some stage's conditions can't all hold, the
+// plan is replaced by a query that returns no rows with the same columns without reading any files, provided their
+// types are known.
+OverallQueryPlan simplify_conditions(
+    const OverallQueryPlan &query_plan,
+    PlanRewrites &rewrites
+);
+
+// Replaces the table expression of each stage that reads a partitioned dataset (see PartitionedDataset) with one that
+// lists the files of the partitions its conditions on partition columns don't rule out. Directories are skipped
+// before anything inside them is listed. Conditions are compared with the partition values as DuckDb would compare
+// them with the column: =, !=, <, <=, >, >=, LIKE and NOT LIKE; other predicates don't rule anything out.
+OverallQueryPlan prune_partitions(
+    const OverallQueryPlan &query_plan,
+    PlanRewrites &rewrites
+);
+
+// Applies the enabled rewrites above, filters first so that columns only their conditions used can then be pruned.
+OverallQueryPlan optimise_query_plan(
+    const OverallQueryPlan &query_plan,
+    const PlanOptimiserOptions &options,
+    PlanRewrites &rewrites
+);
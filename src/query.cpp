@@ -1,5 +1,6 @@
 #include "query.h"
 
+#include <algorithm>
 #include <optional>
 #include <ranges>
 #include <sstream>
@@ -96,15 +97,39 @@ template std::string QueryParam::get<std::string>() const;
 template std::int64_t QueryParam::get<std::int64_t>() const;
 
 
+// ResolvedSchema
+std::optional<ResolvedSchema> project_schema(
+    const ResolvedSchema &schema,
+    const std::vector<std::string> &columns
+) {
+    ResolvedSchema projected{.fingerprint = schema.fingerprint, .columns = {}};
+
+    for (const auto &column: columns) {
+        if (column == "*") {
+            projected.columns.insert(projected.columns.end(), schema.columns.begin(), schema.columns.end());
+            continue;
+        }
+        const auto found = std::ranges::find(schema.columns, column, &ColumnSchema::name);
+        if (found == schema.columns.end()) {
+            return std::nullopt;
+        }
+        projected.columns.push_back(*found);
+    }
+
+    return projected;
+}
+
 // SelectFragment
 SelectFragment::SelectFragment(
     std::vector<std::string> tablenames,
     std::vector<std::string> columns,
-    std::optional<std::string> alias
+    std::optional<std::string> alias,
+    std::optional<ResolvedSchema> schema
 ) :
     tablenames_(std::move(tablenames)),
     columns_(std::move(columns)),
-    alias_(std::move(alias)) {}
+    alias_(std::move(alias)),
+    schema_(std::move(schema)) {}
 
 std::string SelectFragment::get_fragment(
     AliasGenerator &alias_generator
@@ -159,6 +184,10 @@ std::optional<std::string> SelectFragment::get_alias() const {
     return alias_;
 }
 
+std::optional<ResolvedSchema> SelectFragment::get_schema() const {
+    return schema_;
+}
+
 // WhereFragment
 WhereFragment::WhereFragment() = default;
 
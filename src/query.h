@@ -65,6 +65,23 @@ struct ColumnQueryParam {
     QueryParam value;
 };
 
+struct ColumnSchema {
+    std::string name;
+    std::string type;
+};
+
+// Column names and DuckDb types of a relation, along with the fingerprint of the input files they were read from.
+struct ResolvedSchema {
+    std::string fingerprint;
+    std::vector<ColumnSchema> columns;
+};
+
+// Restrict a schema to the given columns. Returns nullopt unless every column is "*" or a column name in the schema.
+std::optional<ResolvedSchema> project_schema(
+    const ResolvedSchema &schema,
+    const std::vector<std::string> &columns
+);
+
 
 class QueryFragment {
 public:
@@ -102,7 +119,8 @@ public:
     SelectFragment(
         std::vector<std::string> tablenames,
         std::vector<std::string> columns,
-        std::optional<std::string> alias
+        std::optional<std::string> alias,
+        std::optional<ResolvedSchema> schema = std::nullopt
     );
 
     [[nodiscard]] std::string get_fragment(
@@ -115,10 +133,14 @@ public:
 
     [[nodiscard]] std::optional<std::string> get_alias() const;
 
+    // Schema of the tables being selected from (not of the selected columns), if it has been resolved.
+    [[nodiscard]] std::optional<ResolvedSchema> get_schema() const;
+
 private:
     std::vector<std::string> tablenames_;
     std::vector<std::string> columns_;
     std::optional<std::string> alias_;
+    std::optional<ResolvedSchema> schema_;
 
     [[nodiscard]] std::string fragment_for_single_table(
         const std::string &tablename,
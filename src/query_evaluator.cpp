@@ -1,4 +1,8 @@
+#include <algorithm>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <optional>
 #include <string>
 #include <unordered_map>
 #include <utility>
@@ -6,13 +10,25 @@
 
 #include <arrow/c/abi.h>
 #include <arrow/c/bridge.h>
+#include <arrow/dataset/scanner.h>
 #include <arrow/record_batch.h>
+#include <arrow/util/byte_size.h>
+#include <arrow/util/thread_pool.h>
 #include <duckdb.hpp>
+#include <duckdb/common/arrow/result_arrow_wrapper.hpp>
 
 #include "arrow_result.h"
+#include "batch_coalescer.h"
+#include "engine_config.h"
+#include "input_files.h"
 #include "options.h"
+#include "parquet_metadata.h"
 #include "query.h"
 #include "queryplan.h"
+#include "result_cache.h"
+#include "result_pipeline.h"
+#include "tracer.h"
+#include "verified_schema.h"
 #include "writer.h"
 
 #include "query_evaluator.h"
@@ -35,12 +51,12 @@ T dd_check(
 
 static duckdb::Value infer_value_from_schema(
     const ColumnQueryParam &param,
-    const std::unordered_map<std::string, std::string> &param_types
+    const std::optional<std::string> &param_type
 ) {
     using std::string_literals::operator ""s;
 
-    if (const auto col_entry = param_types.find(param.column); col_entry != param_types.end()) {
-        const auto col_type = col_entry->second;
+    if (param_type) {
+        const auto &col_type = *param_type;
         const auto string_value = param.value.get<std::string>();
 
         if (col_type == "BIGINT" || col_type == "INTEGER" || col_type == "SMALLINT") {
@@ -73,11 +89,11 @@ static duckdb::Value infer_value_from_schema(
 
 static duckdb::vector<duckdb::Value> convert_params_to_duckdb(
     const std::vector<ColumnQueryParam> &query_params,
-    const std::unordered_map<std::string, std::string> &param_types
+    const std::vector<std::optional<std::string> > &param_types
 ) {
     duckdb::vector<duckdb::Value> duckdb_params;
 
-    int i = 0;
+    std::size_t i = 0;
     for (const auto &param: query_params) {
         duckdb::Value value;
         switch (param.value.type()) {
@@ -90,7 +106,7 @@ static duckdb::vector<duckdb::Value> convert_params_to_duckdb(
                 break;
 
             case ParamType::UNKNOWN:
-                value = infer_value_from_schema(param, param_types);
+                value = infer_value_from_schema(param, i < param_types.size() ? param_types[i] : std::nullopt);
                 break;
 
             default:
@@ -104,46 +120,83 @@ static duckdb::vector<duckdb::Value> convert_params_to_duckdb(
 }
 
 static std::shared_ptr<arrow::Schema> duckdb_schema_to_arrow(
-    const std::unique_ptr<duckdb::QueryResult> &result
+    const duckdb::QueryResult &result
 ) {
     ArrowSchema duck_arrow_schema{};
-    duckdb::ArrowConverter::ToArrowSchema(&duck_arrow_schema, result->types, result->names, result->client_properties);
+    duckdb::ArrowConverter::ToArrowSchema(&duck_arrow_schema, result.types, result.names, result.client_properties);
 
     return assign_or_raise(arrow::ImportSchema(&duck_arrow_schema));
 }
 
+// Hands the result over to DuckDB's Arrow C stream export, which fills each array with up to batch_rows rows and
+// converts whole chunks at a time instead of one 2048-row vector per call. The conversion runs on the calling thread;
+// DuckDB's parallel Arrow collector would only hand over batches once the whole result is materialised.
+static std::shared_ptr<arrow::RecordBatchReader> result_to_record_batch_reader(
+    duckdb::unique_ptr<duckdb::QueryResult> result,
+    const std::int64_t batch_rows
+) {
+    const auto batch_size = static_cast<duckdb::idx_t>(batch_rows > 0 ? batch_rows : DEFAULT_BATCH_ROWS);
+
+    // Ownership of the wrapper passes to the stream; its release callback deletes it.
+    auto *wrapper = new duckdb::ResultArrowArrayStreamWrapper(std::move(result), batch_size);
+    return assign_or_raise(arrow::ImportRecordBatchReader(&wrapper->stream));
+}
 
-std::shared_ptr<arrow::RecordBatch> chunk_to_record_batch(
-    const std::unique_ptr<duckdb::DataChunk> &data_chunk,
-    std::shared_ptr<arrow::Schema> arrow_schema,
-    const std::unique_ptr<duckdb::QueryResult> &result
+static std::vector<ColumnSchema> describe(
+    const std::string &query,
+    duckdb::Connection &conn
 ) {
-    ArrowArray arrow_array{};
+    using namespace std::string_literals;
+
+    const auto describe_query = "DESCRIBE ("s + query + ")"s;
 
-    // TODO: No need to recreate this multiple times
-    const std::unordered_map<duckdb::idx_t, const duckdb::shared_ptr<duckdb::ArrowTypeExtensionData>>
-            extension_type_cast;
-    duckdb::ArrowConverter::ToArrowArray(*data_chunk, &arrow_array, result->client_properties, extension_type_cast);
+    std::vector<ColumnSchema> columns;
 
-    return assign_or_raise(arrow::ImportRecordBatch(&arrow_array, std::move(arrow_schema)));
+    const auto prepared_statement = dd_check(conn.Prepare(describe_query));
+    const auto result = dd_check(prepared_statement->Execute());
+
+    for (auto data_chunk = result->Fetch(); data_chunk && data_chunk->size() > 0; data_chunk = result->Fetch()) {
+        for (duckdb::idx_t row = 0; row < data_chunk->size(); ++row) {
+            columns.push_back(
+                ColumnSchema{
+                    .name = data_chunk->GetValue(0, row).ToString(),
+                    .type = data_chunk->GetValue(1, row).ToString()
+                }
+            );
+        }
+    }
+
+    return columns;
 }
 
-static std::unordered_map<std::string, std::string> get_schema(
+// Types of every column the conditions of the stage at `index` can refer to: those of the relation it reads, along
+// with the ones it computes. Earlier stages are described without their conditions, ordering and limits, which don't
+// change their columns, so that the query has no parameters.
+static std::unordered_map<std::string, std::string> describe_stage_source(
     const OverallQueryPlan &query_plan,
+    const std::size_t index,
     duckdb::Connection &conn
 ) {
-    using namespace std::string_literals;
-
-    OverallQueryPlan base_query = query_plan;
-    if (base_query.get_plans().size() > 0) {
-        auto &final_plan = base_query.get_plans().back();
-        final_plan.limit = std::nullopt;
-        final_plan.order = std::nullopt;
-        final_plan.where = std::nullopt;
+    OverallQueryPlan source_plan;
+    for (std::size_t i = 0; i <= index; ++i) {
+        auto plan = query_plan.get_plans()[i];
+        plan.limit = std::nullopt;
+        plan.order = std::nullopt;
+        plan.where = std::nullopt;
+        if (i == index && plan.select) {
+            std::vector<std::string> columns{"*"};
+            std::ranges::copy_if(plan.select->get_columns(), std::back_inserter(columns), [](
+                const std::string &column
+            ) {
+                return column != "*";
+            });
+            plan.select = SelectFragment(plan.select->get_tablenames(), columns, plan.select->get_alias());
+        }
+        source_plan.add_plan(plan);
     }
 
     AliasGenerator alias_generator;
-    const auto query = base_query.generate_query(alias_generator);
+    const auto query = source_plan.generate_query(alias_generator);
     if (!query) {
         throw std::runtime_error("Error generating query from query plan.\n");
     }
@@ -152,66 +205,532 @@ static std::unordered_map<std::string, std::string> get_schema(
         throw std::logic_error("Stripping limit, order and where clauses should result in no query parameters.");
     }
 
-    const auto describe_query = "DESCRIBE ("s + base_query_str + ")"s;
-
+    // A condition on a name the stage both reads and computes refers to the column it reads, which comes first.
     std::unordered_map<std::string, std::string> column_types;
+    for (auto &[name, type]: describe(base_query_str, conn)) {
+        column_types.try_emplace(name, type);
+    }
+    return column_types;
+}
 
-    const auto prepared_statement = dd_check(conn.Prepare(describe_query));
-    const auto result = dd_check(prepared_statement->Execute());
+// Types of the columns compared with the untyped parameters of the stage at `index`, for any of them that exist. These
+// come from the schema stored in the plan when it is still valid, then from cached Parquet metadata, and only
+// otherwise from a DESCRIBE of the stage's source.
+static std::unordered_map<std::string, std::string> get_stage_param_types(
+    const OverallQueryPlan &query_plan,
+    const std::size_t index,
+    const std::vector<ColumnQueryParam> &stage_params,
+    duckdb::Connection &conn
+) {
+    const auto types_from_schema = [&stage_params](
+        const ResolvedSchema &schema
+    ) -> std::optional<std::unordered_map<std::string, std::string> > {
+        std::unordered_map<std::string, std::string> column_types;
+        for (const auto &[name, type]: schema.columns) {
+            column_types[name] = type;
+        }
 
-    for (auto data_chunk = result->Fetch(); data_chunk && data_chunk->size() > 0; data_chunk = result->Fetch()) {
-        for (duckdb::idx_t row = 0; row < data_chunk->size(); ++row) {
-            const auto column_name = data_chunk->GetValue(0, row).ToString();
-            const auto column_type = data_chunk->GetValue(1, row).ToString();
-            column_types[column_name] = column_type;
+        const auto is_known = [&column_types](
+            const ColumnQueryParam &param
+        ) {
+            return param.value.type() != ParamType::UNKNOWN || column_types.contains(param.column);
+        };
+        if (!std::ranges::all_of(stage_params, is_known)) {
+            return std::nullopt;
+        }
+        return column_types;
+    };
+
+    if (const auto &plan = query_plan.get_plans()[index]; plan.select) {
+        if (const auto schema = verified_source_schema(query_plan, *plan.select)) {
+            if (auto column_types = types_from_schema(*schema)) {
+                return *column_types;
+            }
+        }
+        if (const auto schema = parquet_schema(plan.select->get_tablenames())) {
+            if (auto column_types = types_from_schema(*schema)) {
+                return *column_types;
+            }
         }
     }
 
-    return column_types;
+    return describe_stage_source(query_plan, index, conn);
 }
 
-ExitStatus evaluate_query(
+// The type of the column each parameter is compared with, in the order of the parameters, or nullopt for typed
+// parameters and for columns that can't be found. Conditions can sit in any stage (the optimiser pushes them into
+// earlier ones), so each is typed by the relation of the stage holding it.
+static std::vector<std::optional<std::string> > get_param_types(
     const OverallQueryPlan &query_plan,
+    const std::vector<ColumnQueryParam> &query_params,
+    duckdb::Connection &conn
+) {
+    const auto needs_type = [](
+        const ColumnQueryParam &param
+    ) {
+        return param.value.type() == ParamType::UNKNOWN;
+    };
+    if (std::ranges::none_of(query_params, needs_type)) {
+        return {};
+    }
+
+    std::vector<std::optional<std::string> > param_types;
+    param_types.reserve(query_params.size());
+    const auto &plans = query_plan.get_plans();
+    for (std::size_t i = 0; i < plans.size(); ++i) {
+        // Only conditions carry parameters.
+        const auto stage_params = plans[i].where && !plans[i].sql
+                                      ? plans[i].where->get_params()
+                                      : std::vector<ColumnQueryParam>{};
+        if (std::ranges::none_of(stage_params, needs_type)) {
+            param_types.resize(param_types.size() + stage_params.size());
+            continue;
+        }
+
+        const auto column_types = get_stage_param_types(query_plan, i, stage_params, conn);
+        for (const auto &param: stage_params) {
+            const auto type = column_types.find(param.column);
+            param_types.push_back(
+                needs_type(param) && type != column_types.end() ? std::make_optional(type->second) : std::nullopt
+            );
+        }
+    }
+    return param_types;
+}
+
+std::optional<ResolvedSchema> resolve_select_schema(
+    const OverallQueryPlan &query_plan,
+    const SelectFragment &select
+) {
+    const auto tablenames = select.get_tablenames();
+    if (tablenames.size() == 1) {
+        if (const auto *upstream = query_plan.find_plan(tablenames.front())) {
+            return verified_output_schema(query_plan, *upstream);
+        }
+    }
+
+    if (auto schema = parquet_schema(tablenames)) {
+        return schema;
+    }
+
+    try {
+        duckdb::DuckDB db(nullptr);
+        duckdb::Connection con(db);
+
+        AliasGenerator alias_generator;
+        const SelectFragment select_all(tablenames, {"*"}, std::nullopt);
+        return ResolvedSchema{
+            .fingerprint = fingerprint_inputs(tablenames),
+            .columns = describe(select_all.get_fragment(alias_generator), con)
+        };
+    } catch (const std::runtime_error &error) {
+        std::cerr << "Unable to resolve schema; it will be resolved at evaluation time instead. " << error.what()
+                << '\n';
+        return std::nullopt;
+    }
+}
+
+static OverallQueryPlan optimise_and_prune(
+    const OverallQueryPlan &query_plan,
+    const EvaluationOptions &options
+) {
+    Tracer::Span span(options.tracer, "generate query");
+    PlanRewrites rewrites;
+    const auto optimised_plan = optimise_query_plan(query_plan, options.optimiser, rewrites);
+    span.arg("conditions_pushed", Json::UInt64{rewrites.conditions_pushed})
+        .arg("conditions_dropped", Json::UInt64{rewrites.conditions_dropped})
+        .arg("stages_narrowed", Json::UInt64{rewrites.stages_narrowed})
+        .arg("empty_result", rewrites.empty_result);
+    if (options.print_stats && rewrites.any()) {
+        *options.diagnostics << "Plan: " << rewrites << ".\n";
+    }
+    PruningStats stats;
+    const auto pruned_plan = prune_parquet_files(optimised_plan, stats);
+    span.arg("files", Json::UInt64{stats.files}).arg("files_kept", Json::UInt64{stats.kept});
+    if (options.print_stats && stats.files > 0) {
+        *options.diagnostics << "Parquet statistics: reading " << stats.kept << " of " << stats.files << " files.\n";
+    }
+    return pruned_plan;
+}
+
+// Batches were coalesced before they were stored, so they go straight to the writer.
+static void write_cached_result(
+    arrow::ipc::RecordBatchFileReader &reader,
     const std::function<std::unique_ptr<Writer> (
         const std::shared_ptr<arrow::Schema> &
     )> &writer_factory,
-    AliasGenerator &alias_generator
+    Tracer *tracer
 ) {
-    auto query = query_plan.generate_query(alias_generator);
-    if (!query) {
-        std::cerr << "Error generating query from query plan.\n";
-        return ExitStatus::QUERY_GENERATION_ERROR;
+    const auto writer = writer_factory(reader.schema());
+    for (int i = 0; i < reader.num_record_batches(); ++i) {
+        const auto batch = assign_or_raise(reader.ReadRecordBatch(i));
+        Tracer::Span span(tracer, "write");
+        span.arg("rows", Json::Int64{batch->num_rows()});
+        span.arg("bytes", Json::Int64{arrow::util::TotalBufferSize(*batch)});
+        writer->write(batch);
     }
+    const Tracer::Span span(tracer, "flush");
+    writer->flush();
+}
 
-    duckdb::DuckDB db(nullptr);
-    duckdb::Connection con(db);
-    auto [query_str, query_params] = *query;
+ExitStatus cancelled_status(
+    const CancelReason reason
+) {
+    return reason == CancelReason::OUTPUT_CLOSED ? ExitStatus::OUTPUT_CLOSED : ExitStatus::INTERRUPTED;
+}
+
+// The database is only opened once the result cache has missed.
+static ExitStatus evaluate_generated_query(
+    const OverallQueryPlan &query_plan,
+    const ParameterisedQuery &query,
+    const std::function<std::unique_ptr<Writer> (
+        const std::shared_ptr<arrow::Schema> &
+    )> &writer_factory,
+    const EvaluationOptions &options,
+    const std::function<duckdb::DuckDB &()> &database
+) {
+    auto &diagnostics = *options.diagnostics;
+    const auto &[query_str, query_params] = query;
+    // Without a token from the caller, a closed output still has to stop the query fetching on other threads.
+    CancellationToken own_cancellation;
+    auto &cancellation = options.cancellation ? *options.cancellation : own_cancellation;
 
     try {
-        const auto param_types = get_schema(query_plan, con);
+        auto *tracer = options.tracer;
+
+        std::optional<ResultCache> cache;
+        const auto cache_key = options.result_cache ? ResultCache::key(query_plan, query) : std::nullopt;
+        if (cache_key) {
+            cache.emplace(*options.result_cache);
+            std::shared_ptr<arrow::ipc::RecordBatchFileReader> cached;
+            {
+                Tracer::Span span(tracer, "result cache lookup");
+                cached = cache->lookup(*cache_key);
+                span.arg("hit", cached != nullptr);
+            }
+            if (cached) {
+                write_cached_result(*cached, writer_factory, tracer);
+                if (options.print_stats) {
+                    diagnostics << "Result cache: hit (" << cache->counters() << ").\n";
+                }
+                return ExitStatus::SUCCESS;
+            }
+        }
+
+        auto &db = [&]() -> duckdb::DuckDB & {
+            const Tracer::Span span(tracer, "open database");
+            return database();
+        }();
+        duckdb::Connection con(db);
+        const auto interrupt = CancellationToken::on_cancel(&cancellation, [&con] { con.Interrupt(); });
+
+        std::optional<SpillMonitor> spill_monitor;
+        if (options.print_stats) {
+            spill_monitor.emplace(db);
+        }
+
+        const auto param_types = [&] {
+            const Tracer::Span span(tracer, "resolve parameter types");
+            return get_param_types(query_plan, query_params, con);
+        }();
 
-        const auto prepared_statement = dd_check(con.Prepare(query_str));
+        if (tracer) {
+            dd_check(con.Query("PRAGMA enable_profiling = 'no_output'"));
+        }
+
+        const auto prepared_statement = [&] {
+            const Tracer::Span span(tracer, "prepare");
+            return dd_check(con.Prepare(query_str));
+        }();
         auto duckdb_params = convert_params_to_duckdb(query_params, param_types);
-        const auto result = dd_check(prepared_statement->Execute(duckdb_params, true));
-        const auto arrow_schema = duckdb_schema_to_arrow(result);
+
+        const auto execute_start = Tracer::Clock::now();
+        auto result = [&] {
+            const Tracer::Span span(tracer, "execute");
+            return dd_check(prepared_statement->Execute(duckdb_params, true));
+        }();
+
+        const auto arrow_schema = duckdb_schema_to_arrow(*result);
         const auto writer = writer_factory(arrow_schema);
+        const auto cache_entry = cache ? cache->insert(*cache_key, arrow_schema) : nullptr;
+
+        BatchCoalescer coalescer(
+            arrow_schema,
+            options.batch_rows,
+            options.batch_bytes,
+            [&writer, &cache_entry, &cancellation, tracer](
+                std::shared_ptr<arrow::RecordBatch> batch
+            ) {
+                Tracer::Span span(tracer, "write");
+                span.arg("rows", Json::Int64{batch->num_rows()});
+                span.arg("bytes", Json::Int64{arrow::util::TotalBufferSize(*batch)});
+                if (cache_entry) {
+                    cache_entry->write(batch);
+                }
+                try {
+                    writer->write(std::move(batch));
+                } catch (const OutputClosedException &) {
+                    cancellation.cancel(CancelReason::OUTPUT_CLOSED);
+                    throw;
+                }
+            }
+        );
+        const auto sink = [&coalescer](
+            std::shared_ptr<arrow::RecordBatch> batch
+        ) {
+            coalescer.add(std::move(batch));
+        };
+
+        if (options.pipelined) {
+            const PipelineOptions pipeline_options{
+                .batch_rows = options.batch_rows,
+                .queue_depth = options.queue_depth,
+                .convert_threads = options.convert_threads,
+                .tracer = tracer
+            };
+            const auto stats = run_result_pipeline(*result, arrow_schema, pipeline_options, sink);
+            if (options.print_stats) {
+                diagnostics << stats;
+            }
+        } else {
+            const auto reader = result_to_record_batch_reader(std::move(result), options.batch_rows);
+            const auto next_batch = [&reader, tracer] {
+                Tracer::Span span(tracer, "fetch and convert");
+                auto batch = assign_or_raise(reader->Next());
+                if (batch) {
+                    span.arg("rows", Json::Int64{batch->num_rows()});
+                    span.arg("bytes", Json::Int64{arrow::util::TotalBufferSize(*batch)});
+                }
+                return batch;
+            };
+            for (auto batch = next_batch(); batch; batch = next_batch()) {
+                sink(std::move(batch));
+            }
+        }
+        {
+            const Tracer::Span span(tracer, "flush");
+            coalescer.flush();
+            writer->flush();
+        }
+        const auto stored = cache_entry && cache_entry->commit();
+
+        if (tracer) {
+            const auto profile = con.GetProfilingInformation(duckdb::ProfilerPrintFormat::JSON);
+            trace_duckdb_profile(*tracer, profile, execute_start);
+        }
 
-        while (true) {
-            auto data_chunk = result->Fetch();
-            if (!data_chunk || data_chunk->size() == 0) {
+        if (spill_monitor) {
+            print_engine_summary(diagnostics, db, spill_monitor->stop());
+        }
+        if (options.print_stats && options.result_cache) {
+            if (cache) {
+                diagnostics << "Result cache: miss, " << (stored ? "stored" : "not stored") << " ("
+                        << cache->counters() << ").\n";
+            } else {
+                diagnostics << "Result cache: not used, because the query reads remote files or calls a function "
+                        "whose result varies between runs.\n";
+            }
+        }
+    } catch (const OutputClosedException &) {
+        return ExitStatus::OUTPUT_CLOSED;
+    } catch (const std::runtime_error &error) {
+        // Interrupting DuckDb makes the query fail, which isn't worth reporting.
+        if (cancellation.cancelled()) {
+            if (cancellation.reason() == CancelReason::SIGNAL) {
+                diagnostics << "Interrupted.\n";
+            }
+            return cancelled_status(cancellation.reason());
+        }
+        diagnostics << "Error executing statement or writing results. " << error.what() << '\n';
+        return ExitStatus::EXECUTION_ERROR;
+    } catch (const std::logic_error &error) {
+        diagnostics << "Programming error executing statement or writing results. " << error.what() << '\n';
+        return ExitStatus::PROGRAMMING_ERROR;
+    }
+    return ExitStatus::SUCCESS;
+}
+
+void configure_arrow_threads(
+    const EngineOptions &engine
+) {
+    if (const auto threads = with_environment_defaults(engine).threads) {
+        if (const auto status = arrow::SetCpuThreadPoolCapacity(static_cast<int>(*threads)); !status.ok()) {
+            throw ArrowException("Error setting the number of Arrow threads. " + status.ToString());
+        }
+    }
+}
+
+// Streams the scan into the writer, stopping at the limit. The result cache is left alone, because the scanner's
+// column types can differ from those of DuckDb's result for the same query.
+static ExitStatus evaluate_arrow_scan(
+    const ArrowScan &scan,
+    const std::function<std::unique_ptr<Writer> (
+        const std::shared_ptr<arrow::Schema> &
+    )> &writer_factory,
+    const EvaluationOptions &options
+) {
+    auto &diagnostics = *options.diagnostics;
+    CancellationToken own_cancellation;
+    auto &cancellation = options.cancellation ? *options.cancellation : own_cancellation;
+
+    try {
+        auto *tracer = options.tracer;
+        const auto reader = [&] {
+            const Tracer::Span span(tracer, "execute");
+            return assign_or_raise(scan.scanner->ToRecordBatchReader());
+        }();
+        const auto writer = writer_factory(reader->schema());
+
+        BatchCoalescer coalescer(
+            reader->schema(),
+            options.batch_rows,
+            options.batch_bytes,
+            [&writer, &cancellation, tracer](
+                std::shared_ptr<arrow::RecordBatch> batch
+            ) {
+                Tracer::Span span(tracer, "write");
+                span.arg("rows", Json::Int64{batch->num_rows()});
+                span.arg("bytes", Json::Int64{arrow::util::TotalBufferSize(*batch)});
+                try {
+                    writer->write(std::move(batch));
+                } catch (const OutputClosedException &) {
+                    cancellation.cancel(CancelReason::OUTPUT_CLOSED);
+                    throw;
+                }
+            }
+        );
+
+        auto remaining = scan.limit.value_or(std::numeric_limits<std::int64_t>::max());
+        std::int64_t rows = 0;
+        while (remaining > 0 && !cancellation.cancelled()) {
+            Tracer::Span span(tracer, "scan");
+            auto batch = assign_or_raise(reader->Next());
+            if (!batch) {
                 break;
             }
+            if (batch->num_rows() > remaining) {
+                batch = batch->Slice(0, remaining);
+            }
+            span.arg("rows", Json::Int64{batch->num_rows()});
+            remaining -= batch->num_rows();
+            rows += batch->num_rows();
+            coalescer.add(std::move(batch));
+        }
+        if (cancellation.cancelled()) {
+            if (cancellation.reason() == CancelReason::SIGNAL) {
+                diagnostics << "Interrupted.\n";
+            }
+            return cancelled_status(cancellation.reason());
+        }
+        {
+            const Tracer::Span span(tracer, "flush");
+            coalescer.flush();
+            writer->flush();
+        }
 
-            const auto batch_result = chunk_to_record_batch(data_chunk, arrow_schema, result);
-            writer->write(batch_result);
+        if (options.print_stats) {
+            diagnostics << "Arrow scan: " << rows << " rows from " << scan.files << " files, reading ahead "
+                    << options.arrow_scan.batch_readahead << " batches and " << options.arrow_scan.fragment_readahead
+                    << " files.\n";
         }
-        writer->flush();
+    } catch (const OutputClosedException &) {
+        return ExitStatus::OUTPUT_CLOSED;
     } catch (const std::runtime_error &error) {
-        std::cerr << "Error executing statement or writing results. " << error.what() << '\n';
+        // A scan stopped part way through fails, which isn't worth reporting.
+        if (cancellation.cancelled()) {
+            if (cancellation.reason() == CancelReason::SIGNAL) {
+                diagnostics << "Interrupted.\n";
+            }
+            return cancelled_status(cancellation.reason());
+        }
+        diagnostics << "Error scanning files or writing results. " << error.what() << '\n';
         return ExitStatus::EXECUTION_ERROR;
     } catch (const std::logic_error &error) {
-        std::cerr << "Programming error executing statement or writing results. " << error.what() << '\n';
+        diagnostics << "Programming error scanning files or writing results. " << error.what() << '\n';
         return ExitStatus::PROGRAMMING_ERROR;
     }
     return ExitStatus::SUCCESS;
 }
+
+// Evaluates the plan with Arrow's scanner if the options ask for it and it can, or returns nullopt to leave it to
+// DuckDb.
+static std::optional<ExitStatus> evaluate_with_arrow(
+    const OverallQueryPlan &query_plan,
+    const std::function<std::unique_ptr<Writer> (
+        const std::shared_ptr<arrow::Schema> &
+    )> &writer_factory,
+    const EvaluationOptions &options
+) {
+    if (options.backend == EvaluationBackend::DUCKDB) {
+        return std::nullopt;
+    }
+    std::string reason;
+    const auto scan = [&] {
+        const Tracer::Span span(options.tracer, "plan Arrow scan");
+        return plan_arrow_scan(query_plan, options.arrow_scan, options.batch_rows, reason);
+    }();
+    if (scan) {
+        return evaluate_arrow_scan(*scan, writer_factory, options);
+    }
+    if (options.backend == EvaluationBackend::ARROW) {
+        *options.diagnostics << "The Arrow engine can't evaluate this query, because " << reason << ".\n";
+        return ExitStatus::QUERY_GENERATION_ERROR;
+    }
+    if (options.print_stats) {
+        *options.diagnostics << "Evaluating with DuckDb, because " << reason << ".\n";
+    }
+    return std::nullopt;
+}
+
+ExitStatus evaluate_query(
+    const OverallQueryPlan &query_plan,
+    const std::function<std::unique_ptr<Writer> (
+        const std::shared_ptr<arrow::Schema> &
+    )> &writer_factory,
+    AliasGenerator &alias_generator,
+    const EvaluationOptions &options
+) {
+    const auto plan = optimise_and_prune(query_plan, options);
+    if (const auto status = evaluate_with_arrow(plan, writer_factory, options)) {
+        return *status;
+    }
+    const auto query = plan.generate_query(alias_generator);
+    if (!query) {
+        *options.diagnostics << "Error generating query from query plan.\n";
+        return ExitStatus::QUERY_GENERATION_ERROR;
+    }
+
+    std::unique_ptr<duckdb::DuckDB> db;
+    const auto database = [&db, &options]() -> duckdb::DuckDB & {
+        if (!db) {
+            db = open_database(options.engine);
+        }
+        return *db;
+    };
+    return evaluate_generated_query(plan, *query, writer_factory, options, database);
+}
+
+ExitStatus evaluate_query(
+    const OverallQueryPlan &query_plan,
+    const std::function<std::unique_ptr<Writer> (
+        const std::shared_ptr<arrow::Schema> &
+    )> &writer_factory,
+    AliasGenerator &alias_generator,
+    const EvaluationOptions &options,
+    duckdb::DuckDB &db
+) {
+    const auto plan = optimise_and_prune(query_plan, options);
+    if (const auto status = evaluate_with_arrow(plan, writer_factory, options)) {
+        return *status;
+    }
+    const auto query = plan.generate_query(alias_generator);
+    if (!query) {
+        *options.diagnostics << "Error generating query from query plan.\n";
+        return ExitStatus::QUERY_GENERATION_ERROR;
+    }
+
+    const auto database = [&db]() -> duckdb::DuckDB & {
+        return db;
+    };
+    return evaluate_generated_query(plan, *query, writer_factory, options, database);
+}
@@ -1,13 +1,31 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <iostream>
 #include <memory>
+#include <optional>
 
 #include <arrow/api.h>
 
+#include "arrow_scan.h"
+#include "cancellation.h"
+#include "engine_config.h"
+#include "exit_status.h"
+#include "plan_optimizer.h"
+#include "result_cache.h"
+
+namespace duckdb {
+class DuckDB;
+}
+
 class Writer;
+class Tracer;
 class OverallQueryPlan;
 class AliasGenerator;
+class SelectFragment;
+struct ResolvedSchema;
 
 struct DuckDbException final : std::runtime_error {
     explicit DuckDbException(
@@ -15,11 +33,43 @@ struct DuckDbException final : std::runtime_error {
     );
 };
 
-enum class ExitStatus : std::int8_t {
-    SUCCESS = 0,
-    QUERY_GENERATION_ERROR = 1,
-    EXECUTION_ERROR = 2,
-    PROGRAMMING_ERROR = 3
+// Matches the size of a DuckDB row group, so each batch is built from whole scan units.
+constexpr std::int64_t DEFAULT_BATCH_ROWS = 122880;
+
+struct EvaluationOptions {
+    // Batches handed to the writer hold at least this many rows (except the last). Zero disables the row target.
+    std::int64_t batch_rows = DEFAULT_BATCH_ROWS;
+    // Batches handed to the writer hold at least this many bytes (except the last). Zero disables the byte target.
+    std::int64_t batch_bytes = 0;
+
+    // Fetch, convert and write on separate threads connected by bounded queues instead of one after the other.
+    bool pipelined = false;
+    std::size_t queue_depth = 8;
+    std::size_t convert_threads = 2;
+
+    // Rewrites applied to the plan before generating SQL (see optimise_query_plan).
+    PlanOptimiserOptions optimiser;
+
+    // Whether DuckDb or Arrow's Dataset scanner evaluates the plan, and how the scanner reads ahead.
+    EvaluationBackend backend = EvaluationBackend::DUCKDB;
+    ArrowScanOptions arrow_scan;
+
+    // Print execution statistics to stderr when finished.
+    bool print_stats = false;
+
+    EngineOptions engine;
+
+    // Reuse stored results of identical queries over unchanged inputs.
+    std::optional<ResultCacheOptions> result_cache;
+
+    // Where errors and statistics are reported.
+    std::ostream *diagnostics = &std::cerr;
+
+    // Records a timeline of each phase and batch, and DuckDb's profile of the query, if set.
+    Tracer *tracer = nullptr;
+
+    // Interrupts the running query when cancelled. Evaluation also cancels it when a write finds the output closed.
+    CancellationToken *cancellation = nullptr;
 };
 
 ExitStatus evaluate_query(
@@ -27,5 +77,36 @@ ExitStatus evaluate_query(
     const std::function<std::unique_ptr<Writer> (
         const std::shared_ptr<arrow::Schema> &
     )> &writer_factory,
-    AliasGenerator &alias_generator
+    AliasGenerator &alias_generator,
+    const EvaluationOptions &options = {}
+);
+
+// Evaluate using an existing DuckDb instance, whose configuration takes the place of options.engine.
+ExitStatus evaluate_query(
+    const OverallQueryPlan &query_plan,
+    const std::function<std::unique_ptr<Writer> (
+        const std::shared_ptr<arrow::Schema> &
+    )> &writer_factory,
+    AliasGenerator &alias_generator,
+    const EvaluationOptions &options,
+    duckdb::DuckDB &db
+);
+
+// Sizes Arrow's CPU thread pool, which the Arrow scanner runs on, to the engine's thread count, if one is set. The pool
+// is shared by everything in the process, so this is done once at startup rather than for each query. Throws
+// ArrowException if the pool can't be resized.
+void configure_arrow_threads(
+    const EngineOptions &engine
+);
+
+// How to exit after evaluation was cancelled for the given reason.
+ExitStatus cancelled_status(
+    CancelReason reason
+);
+
+// Describe the tables a select reads from. Selects from an earlier stage's alias reuse that stage's schema. Returns
+// nullopt (after reporting why) if the schema can't be resolved now; it will then be resolved when evaluating.
+std::optional<ResolvedSchema> resolve_select_schema(
+    const OverallQueryPlan &query_plan,
+    const SelectFragment &select
 );
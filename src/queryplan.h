@@ -5,7 +5,8 @@
 #include <sstream>
 
 #include <query.h>
-#include <arrow/type_traits.h>
+
+#include "partitioning.h"
 
 struct ParameterisedQuery {
     std::string query;
@@ -19,6 +20,10 @@ struct QueryPlan {
     std::optional<LimitFragment> limit;
     std::optional<OrderFragment> order;
     std::optional<SqlFragment> sql;
+    // Columns produced by this stage before any filtering, ordering or limit, if they have been resolved.
+    std::optional<ResolvedSchema> schema;
+    // The partitioned dataset this stage's select reads, so evaluation can skip partitions its conditions rule out.
+    std::optional<PartitionedDataset> partitions;
     std::uint32_t next_alias_id{0};
 
     [[nodiscard]] std::optional<ParameterisedQuery> generate_query(
@@ -87,6 +92,18 @@ public:
         return plans_;
     }
 
+    // The plan whose CTE is named `alias`, if any.
+    [[nodiscard]] const QueryPlan *find_plan(
+        const std::string &alias
+    ) const {
+        for (const auto &plan : plans_) {
+            if (plan.select && plan.select->get_alias() == alias) {
+                return &plan;
+            }
+        }
+        return nullptr;
+    }
+
     [[nodiscard]] std::optional<ParameterisedQuery> generate_query(
         AliasGenerator &alias_generator
     ) const {
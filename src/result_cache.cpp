@@ -0,0 +1,398 @@
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+#include <arrow/util/key_value_metadata.h>
+
+#include "ascii_case.h"
+#include "fnv_hash.h"
+#include "input_files.h"
+#include "queryplan.h"
+
+#include "result_cache.h"
+
+
+// Stored in the file footer and compared on lookup, so a hash collision can't return someone else's result.
+static constexpr auto KEY_METADATA = "deval.cache_key";
+static constexpr auto ENTRY_EXTENSION = ".arrow";
+// Bump when the key material changes, so old entries are ignored rather than misread.
+static constexpr auto KEY_VERSION = "deval-result-v1";
+
+// Fragments of the names of functions whose result differs between runs over identical inputs. They are matched as
+// substrings, so a prefix covers a whole family (every current_* function, every uuid variant) and an unrelated column
+// that happens to contain one only costs a cache miss.
+static constexpr std::array VOLATILE_FUNCTIONS{
+    "random", "uuid", "setseed(", "now(", "today(", "current_", "localtime", "transaction_timestamp",
+    "statement_timestamp", "nextval(", "currval(", "getenv(", "txid_"
+};
+
+// Whitespace only matters inside string literals and quoted identifiers.
+static std::string normalize_sql(
+    const std::string_view sql
+) {
+    std::string normalized;
+    normalized.reserve(sql.size());
+    char quote = '\0';
+    bool pending_space = false;
+
+    for (const auto c: sql) {
+        if (quote == '\0' && std::isspace(static_cast<unsigned char>(c)) != 0) {
+            pending_space = !normalized.empty();
+            continue;
+        }
+        if (pending_space) {
+            normalized.push_back(' ');
+            pending_space = false;
+        }
+        if (quote == '\0' && (c == '\'' || c == '"')) {
+            quote = c;
+        } else if (c == quote) {
+            quote = '\0';
+        }
+        normalized.push_back(c);
+    }
+    return normalized;
+}
+
+static bool calls_volatile_function(
+    const std::string &sql
+) {
+    const auto lower = to_lower(sql);
+    return std::ranges::any_of(VOLATILE_FUNCTIONS, [&lower](
+        const std::string_view function
+    ) {
+        return lower.find(function) != std::string::npos;
+    });
+}
+
+// Table expressions read by the plan, other than the aliases of its own stages. Raw SQL is included whole so that any
+// file literals in it are versioned too.
+static std::vector<std::string> plan_inputs(
+    const OverallQueryPlan &query_plan
+) {
+    std::vector<std::string> inputs;
+    const auto add = [&](
+        const std::string &tablename
+    ) {
+        if (!query_plan.find_plan(tablename)) {
+            inputs.push_back(tablename);
+        }
+    };
+
+    for (const auto &plan: query_plan.get_plans()) {
+        if (plan.select) {
+            for (const auto &tablename: plan.select->get_tablenames()) {
+                add(tablename);
+            }
+        }
+        if (plan.join) {
+            add(plan.join->get_table());
+        }
+        if (plan.sql) {
+            inputs.push_back(plan.sql->get_sql());
+        }
+    }
+    return inputs;
+}
+
+static std::string environment_value(
+    const char *name
+) {
+    const char *value = std::getenv(name); // NOLINT(*-mt-unsafe)
+    return value == nullptr ? std::string{} : std::string(value);
+}
+
+std::filesystem::path deval_cache_home() {
+    if (const auto cache_home = environment_value("XDG_CACHE_HOME"); !cache_home.empty()) {
+        return std::filesystem::path(cache_home) / "deval";
+    }
+    return std::filesystem::path(environment_value("HOME")) / ".cache" / "deval";
+}
+
+ResultCacheOptions default_result_cache_options() {
+    ResultCacheOptions options;
+    if (const auto directory = environment_value("DEVAL_CACHE_DIR"); !directory.empty()) {
+        options.directory = directory;
+    } else {
+        options.directory = deval_cache_home() / "results";
+    }
+    return options;
+}
+
+std::ostream &operator<<(
+    std::ostream &os,
+    const ResultCacheCounters &counters
+) {
+    return os << counters.hits << " hits, " << counters.misses << " misses, " << counters.evictions << " evictions";
+}
+
+ResultCache::Entry::Entry(
+    ResultCache &cache,
+    std::filesystem::path temp_path,
+    std::filesystem::path path,
+    std::shared_ptr<arrow::io::OutputStream> stream,
+    std::shared_ptr<arrow::ipc::RecordBatchWriter> writer
+) :
+    cache_(cache),
+    temp_path_(std::move(temp_path)),
+    path_(std::move(path)),
+    stream_(std::move(stream)),
+    writer_(std::move(writer)) {}
+
+ResultCache::Entry::~Entry() {
+    abandon();
+}
+
+void ResultCache::Entry::abandon() {
+    if (!writer_) {
+        return;
+    }
+    // Nothing useful can be done if these fail; the temporary file is removed either way.
+    (void) writer_->Close();
+    (void) stream_->Close();
+    writer_.reset();
+    stream_.reset();
+    std::error_code error;
+    std::filesystem::remove(temp_path_, error);
+}
+
+void ResultCache::Entry::write(
+    const std::shared_ptr<arrow::RecordBatch> &batch
+) {
+    if (!writer_) {
+        return;
+    }
+    if (!writer_->WriteRecordBatch(*batch).ok()) {
+        abandon();
+        return;
+    }
+    if (const auto position = stream_->Tell();
+        !position.ok() || static_cast<std::uint64_t>(*position) > cache_.options_.max_bytes) {
+        abandon();
+    }
+}
+
+bool ResultCache::Entry::commit() {
+    if (!writer_) {
+        return false;
+    }
+    if (!writer_->Close().ok() || !stream_->Close().ok()) {
+        abandon();
+        return false;
+    }
+    writer_.reset();
+    stream_.reset();
+
+    // rename(2) is atomic, so concurrent readers see either no entry or a complete one.
+    std::error_code error;
+    std::filesystem::rename(temp_path_, path_, error);
+    if (error) {
+        std::filesystem::remove(temp_path_, error);
+        return false;
+    }
+    cache_.evict();
+    return true;
+}
+
+ResultCache::ResultCache(
+    ResultCacheOptions options
+) :
+    options_(std::move(options)) {
+    // If this fails every lookup misses and nothing is stored, which is the right outcome for an unusable cache.
+    std::error_code error;
+    std::filesystem::create_directories(options_.directory, error);
+}
+
+std::optional<std::string> ResultCache::key(
+    const OverallQueryPlan &query_plan,
+    const ParameterisedQuery &query
+) {
+    const auto inputs = plan_inputs(query_plan);
+    for (const auto &input: inputs) {
+        if (std::ranges::any_of(table_literals(input), is_remote_literal)) {
+            return std::nullopt;
+        }
+        if (std::ranges::any_of(table_literals(input), is_special_file_literal)) {
+            return std::nullopt;
+        }
+    }
+
+    const auto sql = normalize_sql(query.query);
+    if (calls_volatile_function(sql)) {
+        return std::nullopt;
+    }
+
+    std::ostringstream key;
+    key << KEY_VERSION << '\n' << sql << '\n';
+    for (const auto &param: query.params) {
+        key << param.column << '\t' << static_cast<int>(param.value.type()) << '\t' << param.value << '\n';
+    }
+    key << fingerprint_inputs(inputs);
+    return key.str();
+}
+
+std::filesystem::path ResultCache::entry_path(
+    const std::string &key
+) const {
+    Fnv1aHash hash;
+    hash.update(key);
+    return options_.directory / (hash.hex() + ENTRY_EXTENSION);
+}
+
+std::shared_ptr<arrow::ipc::RecordBatchFileReader> ResultCache::lookup(
+    const std::string &key
+) {
+    const auto path = entry_path(key);
+
+    const auto open = [&path]() -> std::shared_ptr<arrow::ipc::RecordBatchFileReader> {
+        std::error_code error;
+        if (!std::filesystem::exists(path, error)) {
+            return nullptr;
+        }
+        const auto file = arrow::io::MemoryMappedFile::Open(path.string(), arrow::io::FileMode::READ);
+        if (!file.ok()) {
+            return nullptr;
+        }
+        const auto reader = arrow::ipc::RecordBatchFileReader::Open(*file);
+        return reader.ok() ? *reader : nullptr;
+    };
+
+    auto reader = open();
+    const auto metadata = reader ? reader->metadata() : nullptr;
+    if (!metadata || metadata->Get(KEY_METADATA).ValueOr("") != key) {
+        update_counters({.misses = 1});
+        return nullptr;
+    }
+
+    // The modification time doubles as the last access time for eviction.
+    std::error_code error;
+    std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+    update_counters({.hits = 1});
+    return reader;
+}
+
+std::unique_ptr<ResultCache::Entry> ResultCache::insert(
+    const std::string &key,
+    const std::shared_ptr<arrow::Schema> &schema
+) {
+    const auto path = entry_path(key);
+    auto temp_path = path;
+    temp_path += "." + std::to_string(getpid()) + "." + std::to_string(gettid()) + ".tmp";
+
+    const auto stream = arrow::io::FileOutputStream::Open(temp_path.string());
+    if (!stream.ok()) {
+        return nullptr;
+    }
+    const auto metadata = arrow::key_value_metadata({KEY_METADATA}, {key});
+    const auto writer = arrow::ipc::MakeFileWriter(*stream, schema, arrow::ipc::IpcWriteOptions::Defaults(), metadata);
+    if (!writer.ok()) {
+        (void) (*stream)->Close();
+        std::error_code error;
+        std::filesystem::remove(temp_path, error);
+        return nullptr;
+    }
+
+    return std::make_unique<Entry>(*this, std::move(temp_path), path, *stream, *writer);
+}
+
+void ResultCache::evict() {
+    struct Stored {
+        std::filesystem::path path;
+        std::filesystem::file_time_type last_used;
+        std::uint64_t size;
+    };
+
+    std::vector<Stored> entries;
+    std::uint64_t total = 0;
+    std::error_code error;
+    for (const auto &entry: std::filesystem::directory_iterator(options_.directory, error)) {
+        if (entry.path().extension() != ENTRY_EXTENSION) {
+            continue;
+        }
+        const auto size = entry.file_size(error);
+        const auto last_used = entry.last_write_time(error);
+        if (!error) {
+            entries.push_back({.path = entry.path(), .last_used = last_used, .size = size});
+            total += size;
+        }
+    }
+    if (total <= options_.max_bytes) {
+        return;
+    }
+
+    std::ranges::sort(entries, {}, &Stored::last_used);
+    std::uint64_t evicted = 0;
+    for (const auto &entry: entries) {
+        if (total <= options_.max_bytes) {
+            break;
+        }
+        // Readers that still have the file mapped keep their copy until they unmap it.
+        if (std::filesystem::remove(entry.path, error)) {
+            total -= entry.size;
+            ++evicted;
+        }
+    }
+    update_counters({.evictions = evicted});
+}
+
+void ResultCache::update_counters(
+    const ResultCacheCounters &delta
+) const {
+    const auto path = options_.directory / "counters";
+    const int fd = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644); // NOLINT(*-vararg)
+    if (fd < 0) {
+        return;
+    }
+
+    // Counters are best effort: a failure here must never fail the query.
+    if (flock(fd, LOCK_EX) == 0) {
+        std::array<char, 128> buffer{};
+        const auto size = pread(fd, buffer.data(), buffer.size() - 1, 0);
+        ResultCacheCounters counters;
+        std::istringstream(std::string(buffer.data(), size > 0 ? static_cast<std::size_t>(size) : 0))
+                >> counters.hits >> counters.misses >> counters.evictions;
+
+        counters.hits += delta.hits;
+        counters.misses += delta.misses;
+        counters.evictions += delta.evictions;
+
+        const auto text = std::to_string(counters.hits) + ' ' + std::to_string(counters.misses) + ' '
+                          + std::to_string(counters.evictions) + '\n';
+        if (ftruncate(fd, 0) == 0) {
+            (void) pwrite(fd, text.data(), text.size(), 0);
+        }
+        flock(fd, LOCK_UN);
+    }
+    close(fd);
+}
+
+ResultCacheCounters ResultCache::counters() const {
+    ResultCacheCounters counters;
+    std::ifstream(options_.directory / "counters") >> counters.hits >> counters.misses >> counters.evictions;
+    return counters;
+}
+
+std::pair<std::size_t, std::uint64_t> ResultCache::usage() const {
+    std::size_t entries = 0;
+    std::uint64_t bytes = 0;
+    std::error_code error;
+    for (const auto &entry: std::filesystem::directory_iterator(options_.directory, error)) {
+        if (entry.path().extension() == ENTRY_EXTENSION) {
+            ++entries;
+            bytes += entry.file_size(error);
+        }
+    }
+    return {entries, bytes};
+}
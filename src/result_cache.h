@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <iosfwd>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include <arrow/api.h>
+#include <arrow/io/api.h>
+#include <arrow/ipc/api.h>
+
+class OverallQueryPlan;
+struct ParameterisedQuery;
+
+constexpr std::uint64_t DEFAULT_RESULT_CACHE_BYTES = std::uint64_t{1} << 30U;
+
+struct ResultCacheOptions {
+    std::filesystem::path directory;
+    std::uint64_t max_bytes = DEFAULT_RESULT_CACHE_BYTES;
+};
+
+// $XDG_CACHE_HOME/deval, or ~/.cache/deval.
+std::filesystem::path deval_cache_home();
+
+// Results go in $DEVAL_CACHE_DIR, or the results directory of deval_cache_home().
+ResultCacheOptions default_result_cache_options();
+
+struct ResultCacheCounters {
+    std::uint64_t hits = 0;
+    std::uint64_t misses = 0;
+    std::uint64_t evictions = 0;
+};
+
+std::ostream &operator<<(
+    std::ostream &os,
+    const ResultCacheCounters &counters
+);
+
+// Query results stored as Arrow IPC files, named by a hash of the normalized SQL, its parameters and the path, size and
+// modification time of every input file. Hits are read back through a memory map. Once the directory grows past
+// max_bytes the least recently used results are removed. Counters are kept in the directory so they cover every process
+// sharing it.
+class ResultCache {
+public:
+    // Result being written on a miss. It only becomes visible to lookups once committed; an abandoned entry is removed.
+    class Entry {
+    public:
+        Entry(
+            ResultCache &cache,
+            std::filesystem::path temp_path,
+            std::filesystem::path path,
+            std::shared_ptr<arrow::io::OutputStream> stream,
+            std::shared_ptr<arrow::ipc::RecordBatchWriter> writer
+        );
+
+        Entry(
+            const Entry &
+        ) = delete;
+
+        Entry &operator=(
+            const Entry &
+        ) = delete;
+
+        Entry(
+            Entry &&
+        ) = delete;
+
+        Entry &operator=(
+            Entry &&
+        ) = delete;
+
+        ~Entry();
+
+        // Stops caching, without failing the query, once the result would be larger than the whole cache.
+        void write(
+            const std::shared_ptr<arrow::RecordBatch> &batch
+        );
+
+        // Returns whether the result was stored. Older results are evicted if the cache is now over its limit.
+        bool commit();
+
+    private:
+        void abandon();
+
+        ResultCache &cache_;
+        std::filesystem::path temp_path_;
+        std::filesystem::path path_;
+        std::shared_ptr<arrow::io::OutputStream> stream_;
+        std::shared_ptr<arrow::ipc::RecordBatchWriter> writer_;
+    };
+
+    explicit ResultCache(
+        ResultCacheOptions options
+    );
+
+    // The cache key for a query, or nullopt if its result can't safely be reused: it reads remote files, which can't
+    // be checked for changes, or calls a function whose result varies between runs.
+    static std::optional<std::string> key(
+        const OverallQueryPlan &query_plan,
+        const ParameterisedQuery &query
+    );
+
+    // The stored result for the key, if any. Counts a hit or a miss.
+    std::shared_ptr<arrow::ipc::RecordBatchFileReader> lookup(
+        const std::string &key
+    );
+
+    // Start storing a result. Returns nullptr if the cache directory can't be written to.
+    std::unique_ptr<Entry> insert(
+        const std::string &key,
+        const std::shared_ptr<arrow::Schema> &schema
+    );
+
+    [[nodiscard]] ResultCacheCounters counters() const;
+
+    // Number of stored results and their total size.
+    [[nodiscard]] std::pair<std::size_t, std::uint64_t> usage() const;
+
+private:
+    [[nodiscard]] std::filesystem::path entry_path(
+        const std::string &key
+    ) const;
+
+    void evict();
+
+    void update_counters(
+        const ResultCacheCounters &delta
+    ) const;
+
+    ResultCacheOptions options_;
+};
@@ -0,0 +1,275 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <arrow/c/bridge.h>
+#include <arrow/util/byte_size.h>
+#include <duckdb.hpp>
+#include <duckdb/common/arrow/arrow_appender.hpp>
+
+#include "arrow_result.h"
+#include "query_evaluator.h"
+#include "tracer.h"
+
+#include "result_pipeline.h"
+
+
+namespace {
+struct ChunkGroup {
+    std::uint64_t sequence;
+    std::vector<duckdb::unique_ptr<duckdb::DataChunk> > chunks;
+    duckdb::idx_t rows;
+};
+
+struct ConvertedBatch {
+    std::uint64_t sequence;
+    std::shared_ptr<arrow::RecordBatch> batch;
+};
+
+// Keeps hold of the first exception thrown by any stage so it can be rethrown on the calling thread.
+class FirstError {
+public:
+    void set(
+        std::exception_ptr error
+    ) {
+        const std::lock_guard lock(mutex_);
+        if (!error_) {
+            error_ = std::move(error);
+        }
+    }
+
+    void rethrow_if_set() const {
+        const std::lock_guard lock(mutex_);
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::exception_ptr error_;
+};
+
+// Stops the fetch thread from running more than `size` groups ahead of the writer. Without it a single slow
+// conversion would let the reorder buffer on the writer side grow without bound.
+class SequenceWindow {
+public:
+    explicit SequenceWindow(
+        const std::uint64_t size
+    ) :
+        size_(size) {}
+
+    // Returns false if the window was closed while waiting.
+    bool wait_for(
+        const std::uint64_t sequence
+    ) {
+        while (true) {
+            const auto written = written_.load(std::memory_order_acquire);
+            if (closed_.load(std::memory_order_acquire)) {
+                return false;
+            }
+            if (sequence < written + size_) {
+                return true;
+            }
+            written_.wait(written, std::memory_order_acquire);
+        }
+    }
+
+    void advance() {
+        written_.fetch_add(1, std::memory_order_release);
+        written_.notify_all();
+    }
+
+    void close() {
+        closed_.store(true, std::memory_order_release);
+        // The counter has to change for waiters to wake up; it is meaningless once the window is closed.
+        written_.fetch_add(1, std::memory_order_release);
+        written_.notify_all();
+    }
+
+private:
+    std::uint64_t size_;
+    std::atomic<std::uint64_t> written_{0};
+    std::atomic<bool> closed_{false};
+};
+}
+
+static std::shared_ptr<arrow::RecordBatch> convert_chunk_group(
+    const ChunkGroup &group,
+    const duckdb::vector<duckdb::LogicalType> &types,
+    const duckdb::ClientProperties &client_properties,
+    const std::shared_ptr<arrow::Schema> &schema
+) {
+    const std::unordered_map<duckdb::idx_t, const duckdb::shared_ptr<duckdb::ArrowTypeExtensionData> >
+            extension_type_cast;
+    duckdb::ArrowAppender appender(types, group.rows, client_properties, extension_type_cast);
+    for (const auto &chunk: group.chunks) {
+        appender.Append(*chunk, 0, chunk->size(), chunk->size());
+    }
+
+    ArrowArray arrow_array = appender.Finalize();
+    return assign_or_raise(arrow::ImportRecordBatch(&arrow_array, schema));
+}
+
+PipelineStats run_result_pipeline(
+    duckdb::QueryResult &result,
+    const std::shared_ptr<arrow::Schema> &schema,
+    const PipelineOptions &options,
+    const std::function<void (std::shared_ptr<arrow::RecordBatch>)> &sink
+) {
+    const auto num_converters = std::max<std::size_t>(options.convert_threads, 1);
+    const auto target_rows = static_cast<duckdb::idx_t>(options.batch_rows > 0 ? options.batch_rows : 0);
+
+    // Copied up front so the workers never touch the result object, which belongs to the fetch thread.
+    const auto types = result.types;
+    const auto client_properties = result.client_properties;
+
+    BoundedQueue<ChunkGroup> convert_queue(options.queue_depth);
+    BoundedQueue<ConvertedBatch> write_queue(options.queue_depth);
+    SequenceWindow window(convert_queue.capacity() + write_queue.capacity() + num_converters);
+    FirstError error;
+
+    const auto cancel_all = [&] {
+        window.close();
+        convert_queue.close();
+        write_queue.close();
+    };
+
+    std::thread fetcher([&] {
+        if (options.tracer) {
+            options.tracer->name_thread("fetch");
+        }
+        try {
+            std::uint64_t sequence = 0;
+            ChunkGroup group{.sequence = sequence, .chunks = {}, .rows = 0};
+
+            const auto send = [&] {
+                if (group.chunks.empty()) {
+                    return true;
+                }
+                if (!window.wait_for(group.sequence) || !convert_queue.push(std::move(group))) {
+                    return false;
+                }
+                group = ChunkGroup{.sequence = ++sequence, .chunks = {}, .rows = 0};
+                return true;
+            };
+
+            while (true) {
+                duckdb::unique_ptr<duckdb::DataChunk> chunk;
+                {
+                    Tracer::Span span(options.tracer, "fetch chunk");
+                    chunk = result.Fetch();
+                    span.arg("rows", Json::UInt64{chunk ? chunk->size() : 0});
+                }
+                if (result.HasError()) {
+                    throw DuckDbException("Error fetching results. " + result.GetErrorObject().Message());
+                }
+                if (!chunk || chunk->size() == 0) {
+                    break;
+                }
+                group.rows += chunk->size();
+                group.chunks.push_back(std::move(chunk));
+                if (group.rows >= target_rows && !send()) {
+                    break;
+                }
+            }
+            send();
+        } catch (...) {
+            error.set(std::current_exception());
+            cancel_all();
+        }
+        convert_queue.close();
+    });
+
+    std::atomic<std::size_t> running_converters{num_converters};
+    std::vector<std::thread> converters;
+    converters.reserve(num_converters);
+    for (std::size_t i = 0; i < num_converters; ++i) {
+        converters.emplace_back([&, i] {
+            if (options.tracer) {
+                options.tracer->name_thread("convert " + std::to_string(i + 1));
+            }
+            try {
+                while (auto group = convert_queue.pop()) {
+                    std::shared_ptr<arrow::RecordBatch> batch;
+                    {
+                        Tracer::Span span(options.tracer, "convert");
+                        batch = convert_chunk_group(*group, types, client_properties, schema);
+                        span.arg("rows", Json::Int64{batch->num_rows()});
+                        span.arg("bytes", Json::Int64{arrow::util::TotalBufferSize(*batch)});
+                    }
+                    if (!write_queue.push({.sequence = group->sequence, .batch = std::move(batch)})) {
+                        break;
+                    }
+                }
+            } catch (...) {
+                error.set(std::current_exception());
+                cancel_all();
+            }
+            if (running_converters.fetch_sub(1) == 1) {
+                write_queue.close();
+            }
+        });
+    }
+
+    PipelineStats stats;
+    try {
+        std::map<std::uint64_t, std::shared_ptr<arrow::RecordBatch> > reorder_buffer;
+        std::uint64_t next_sequence = 0;
+
+        while (auto converted = write_queue.pop()) {
+            reorder_buffer.emplace(converted->sequence, std::move(converted->batch));
+
+            for (auto it = reorder_buffer.begin(); it != reorder_buffer.end() && it->first == next_sequence;
+                 it = reorder_buffer.erase(it)) {
+                stats.rows += static_cast<std::uint64_t>(it->second->num_rows());
+                ++stats.batches;
+                sink(std::move(it->second));
+                ++next_sequence;
+                window.advance();
+            }
+        }
+    } catch (...) {
+        error.set(std::current_exception());
+        cancel_all();
+    }
+
+    fetcher.join();
+    for (auto &converter: converters) {
+        converter.join();
+    }
+    error.rethrow_if_set();
+
+    stats.convert_queue = convert_queue.stats();
+    stats.write_queue = write_queue.stats();
+    return stats;
+}
+
+std::ostream &operator<<(
+    std::ostream &os,
+    const PipelineStats &stats
+) {
+    const auto millis = [](
+        const std::chrono::nanoseconds ns
+    ) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(ns).count();
+    };
+
+    os << "Pipeline: " << stats.batches << " batches, " << stats.rows << " rows.\n";
+    // A full queue means the consumer side is the bottleneck; an empty one means the producer side is.
+    os << "  fetch -> convert: fetch waited " << stats.convert_queue.push_stalls << " times ("
+            << millis(stats.convert_queue.push_stall_time) << " ms), converters waited "
+            << stats.convert_queue.pop_stalls << " times (" << millis(stats.convert_queue.pop_stall_time) << " ms)\n";
+    os << "  convert -> write: converters waited " << stats.write_queue.push_stalls << " times ("
+            << millis(stats.write_queue.push_stall_time) << " ms), writer waited " << stats.write_queue.pop_stalls
+            << " times (" << millis(stats.write_queue.pop_stall_time) << " ms)\n";
+    return os;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <memory>
+
+#include <arrow/api.h>
+
+#include "bounded_queue.h"
+
+namespace duckdb {
+class QueryResult;
+}
+
+class Tracer;
+
+struct PipelineOptions {
+    // Rows of DuckDB output gathered into each unit of conversion work.
+    std::int64_t batch_rows;
+    // Capacity of each of the queues between stages.
+    std::size_t queue_depth;
+    // Number of threads converting DuckDB chunks into Arrow record batches.
+    std::size_t convert_threads;
+    // Records a span for each chunk group fetched and converted, if set.
+    Tracer *tracer = nullptr;
+};
+
+struct PipelineStats {
+    // Fetch thread -> conversion workers.
+    QueueStats convert_queue;
+    // Conversion workers -> writer.
+    QueueStats write_queue;
+    std::uint64_t batches = 0;
+    std::uint64_t rows = 0;
+};
+
+// Drains the result with a fetch thread feeding a pool of conversion workers, which in turn feed the calling thread.
+// Batches are passed to the sink on the calling thread, in the order DuckDB produced them.
+PipelineStats run_result_pipeline(
+    duckdb::QueryResult &result,
+    const std::shared_ptr<arrow::Schema> &schema,
+    const PipelineOptions &options,
+    const std::function<void (std::shared_ptr<arrow::RecordBatch>)> &sink
+);
+
+std::ostream &operator<<(
+    std::ostream &os,
+    const PipelineStats &stats
+);
@@ -7,10 +7,9 @@
 
 #include <json/json.h>
 
+#include "engine.h"
 #include "query.h"
-#include "query_evaluator.h"
 #include "queryplan.h"
-#include "writer.h"
 
 static void dump_json(
     const Json::Value &value,
@@ -56,6 +55,65 @@ QueryParam QueryParamSerDes::decode(
     return QueryParam::unknown(value.asString());
 }
 
+Json::Value SchemaSerDes::encode(
+    const ResolvedSchema &schema
+) {
+    Json::Value value;
+    value["fingerprint"] = schema.fingerprint;
+    value["columns"] = Json::Value(Json::arrayValue);
+
+    for (const auto &[name, type]: schema.columns) {
+        Json::Value json_column;
+        json_column["name"] = name;
+        json_column["type"] = type;
+        value["columns"].append(json_column);
+    }
+
+    return value;
+}
+
+ResolvedSchema SchemaSerDes::decode(
+    const Json::Value &json
+) {
+    ResolvedSchema schema{.fingerprint = json["fingerprint"].asString(), .columns = {}};
+    for (const auto &column: json["columns"]) {
+        schema.columns.push_back(ColumnSchema{.name = column["name"].asString(), .type = column["type"].asString()});
+    }
+    return schema;
+}
+
+Json::Value PartitionSerDes::encode(
+    const PartitionedDataset &dataset
+) {
+    Json::Value value;
+    value["root"] = dataset.root;
+    value["layout"] = dataset.layout == PartitionLayout::HIVE ? "hive" : "directory";
+    value["columns"] = Json::Value(Json::arrayValue);
+
+    for (const auto &[name, type]: dataset.columns) {
+        Json::Value json_column;
+        json_column["name"] = name;
+        json_column["type"] = type;
+        value["columns"].append(json_column);
+    }
+
+    return value;
+}
+
+PartitionedDataset PartitionSerDes::decode(
+    const Json::Value &json
+) {
+    PartitionedDataset dataset{
+        .root = json["root"].asString(),
+        .layout = json["layout"].asString() == "hive" ? PartitionLayout::HIVE : PartitionLayout::DIRECTORY,
+        .columns = {}
+    };
+    for (const auto &column: json["columns"]) {
+        dataset.columns.push_back(ColumnSchema{.name = column["name"].asString(), .type = column["type"].asString()});
+    }
+    return dataset;
+}
+
 Json::Value SelectSerDes::encode(
     const SelectFragment &fragment
 ) {
@@ -70,6 +128,9 @@ Json::Value SelectSerDes::encode(
         value["columns"][i++] = col;
     }
 
+    const auto schema = fragment.get_schema();
+    value["schema"] = schema ? SchemaSerDes::encode(*schema) : Json::Value::null;
+
     return value;
 }
 
@@ -88,7 +149,12 @@ SelectFragment SelectSerDes::decode(
     const auto &alias_value = fragment["alias"];
     const auto alias_opt = alias_value != Json::Value::null ? std::make_optional(alias_value.asString()) : std::nullopt;
 
-    return {tablenames, columns, alias_opt};
+    const auto &schema_value = fragment["schema"];
+    const auto schema_opt = schema_value != Json::Value::null
+                                ? std::make_optional(SchemaSerDes::decode(schema_value))
+                                : std::nullopt;
+
+    return {tablenames, columns, alias_opt, schema_opt};
 }
 
 Json::Value WhereSerDes::encode(
@@ -233,6 +299,8 @@ Json::Value QueryPlanSerDes::encode(
     root["order"] = Json::Value::null;
     root["sql"] = Json::Value::null;
     root["join"] = Json::Value::null;
+    root["schema"] = Json::Value::null;
+    root["partitions"] = Json::Value::null;
 
     if (query_plan.select) {
         root["select"] = SelectSerDes::encode(*query_plan.select);
@@ -258,6 +326,14 @@ Json::Value QueryPlanSerDes::encode(
         root["join"] = JoinSerDes::encode(*query_plan.join);
     }
 
+    if (query_plan.schema) {
+        root["schema"] = SchemaSerDes::encode(*query_plan.schema);
+    }
+
+    if (query_plan.partitions) {
+        root["partitions"] = PartitionSerDes::encode(*query_plan.partitions);
+    }
+
     return root;
 }
 
@@ -290,6 +366,14 @@ QueryPlan QueryPlanSerDes::decode(
         query_plan.join = JoinSerDes::decode(join);
     }
 
+    if (const auto &schema = root["schema"]; schema != Json::Value::null) {
+        query_plan.schema = SchemaSerDes::decode(schema);
+    }
+
+    if (const auto &partitions = root["partitions"]; partitions != Json::Value::null) {
+        query_plan.partitions = PartitionSerDes::decode(partitions);
+    }
+
     return query_plan;
 }
 
@@ -364,8 +448,7 @@ ExitStatus dump_or_eval_query_plan(
     const OverallQueryPlan &query_plan
 ) {
     if (isatty(fileno(stdout)) == 1) {
-        AliasGenerator alias_generator;
-        return evaluate_query(query_plan, default_writer, alias_generator);
+        return engine().evaluate_to_stdout(query_plan);
     }
     dump_query_plan(query_plan, std::cout);
     return ExitStatus::SUCCESS;
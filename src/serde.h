@@ -1,12 +1,15 @@
 #pragma once
 
+#include <iostream>
 #include <optional>
 
-#include "query_evaluator.h"
+#include "exit_status.h"
 
 #include <json/json.h>
 
 struct QueryPlan;
+struct ResolvedSchema;
+struct PartitionedDataset;
 class QueryParam;
 class SelectFragment;
 class JoinFragment;
@@ -27,6 +30,28 @@ public:
     );
 };
 
+class SchemaSerDes final {
+public:
+    static Json::Value encode(
+        const ResolvedSchema &schema
+    );
+
+    static ResolvedSchema decode(
+        const Json::Value &json
+    );
+};
+
+class PartitionSerDes final {
+public:
+    static Json::Value encode(
+        const PartitionedDataset &dataset
+    );
+
+    static PartitionedDataset decode(
+        const Json::Value &json
+    );
+};
+
 class SelectSerDes final {
 public:
     static Json::Value encode(
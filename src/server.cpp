@@ -0,0 +1,600 @@
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <arrow/util/io_util.h>
+#include <duckdb.hpp>
+#include <json/json.h>
+
+#include "arrow_result.h"
+#include "bounded_queue.h"
+#include "cancellation.h"
+#include "input_files.h"
+#include "queryplan.h"
+#include "serde.h"
+
+#include "server.h"
+
+
+// Requests are a single JSON document terminated by the client shutting down its side of the socket. Responses are a
+// sequence of frames: a one byte kind, a four byte big-endian payload length and the payload. The last frame is always
+// STATUS, whose payload is the exit status.
+namespace {
+enum class FrameKind : char { DATA = 'D', DIAGNOSTICS = 'E', STATUS = 'X' };
+
+constexpr std::size_t FRAME_HEADER_SIZE = 5;
+constexpr std::size_t FRAME_BUFFER_SIZE = 1 << 16;
+
+// Closes the descriptor when it goes out of scope.
+class FileDescriptor {
+public:
+    explicit FileDescriptor(
+        const int fd
+    ) :
+        fd_(fd) {}
+
+    FileDescriptor(
+        const FileDescriptor &
+    ) = delete;
+
+    FileDescriptor &operator=(
+        const FileDescriptor &
+    ) = delete;
+
+    FileDescriptor(
+        FileDescriptor &&
+    ) = delete;
+
+    FileDescriptor &operator=(
+        FileDescriptor &&
+    ) = delete;
+
+    ~FileDescriptor() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    [[nodiscard]] int get() const {
+        return fd_;
+    }
+
+private:
+    int fd_;
+};
+
+// MSG_NOSIGNAL stops a client that hangs up early from killing the whole server with SIGPIPE.
+bool send_all(
+    const int fd,
+    const char *data,
+    std::size_t size
+) {
+    while (size > 0) {
+        const auto sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += sent; // NOLINT(*-pointer-arithmetic)
+        size -= static_cast<std::size_t>(sent);
+    }
+    return true;
+}
+
+// Returns false at end of stream as well as on error.
+bool recv_all(
+    const int fd,
+    char *data,
+    std::size_t size
+) {
+    while (size > 0) {
+        const auto received = recv(fd, data, size, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        data += received; // NOLINT(*-pointer-arithmetic)
+        size -= static_cast<std::size_t>(received);
+    }
+    return true;
+}
+
+bool send_frame(
+    const int fd,
+    const FrameKind kind,
+    const std::string_view payload
+) {
+    const auto size = static_cast<std::uint32_t>(payload.size());
+    const std::array header{
+        static_cast<char>(kind),
+        static_cast<char>(size >> 24U),
+        static_cast<char>(size >> 16U),
+        static_cast<char>(size >> 8U),
+        static_cast<char>(size)
+    };
+    return send_all(fd, header.data(), header.size()) && send_all(fd, payload.data(), payload.size());
+}
+
+// Wraps everything written in DATA frames, so any writer that targets an arrow OutputStream can write to a client.
+class FramedOutputStream final : public arrow::io::OutputStream {
+public:
+    explicit FramedOutputStream(
+        const int fd
+    ) :
+        fd_(fd) {
+        buffer_.reserve(FRAME_BUFFER_SIZE);
+    }
+
+    arrow::Status Write(
+        const void *data,
+        const int64_t nbytes
+    ) override {
+        if (closed_) {
+            return arrow::Status::Invalid("Write to closed stream.");
+        }
+        buffer_.append(static_cast<const char *>(data), static_cast<std::size_t>(nbytes));
+        position_ += nbytes;
+        if (buffer_.size() >= FRAME_BUFFER_SIZE) {
+            return Flush();
+        }
+        return arrow::Status::OK();
+    }
+
+    arrow::Status Flush() override {
+        if (buffer_.empty()) {
+            return arrow::Status::OK();
+        }
+        if (!send_frame(fd_, FrameKind::DATA, buffer_)) {
+            // Keeps errno in the status, so writers can tell a client that hung up from other failures.
+            return arrow::internal::IOErrorFromErrno(errno, "Unable to send results to client");
+        }
+        buffer_.clear();
+        return arrow::Status::OK();
+    }
+
+    arrow::Status Close() override {
+        if (closed_) {
+            return arrow::Status::OK();
+        }
+        closed_ = true;
+        return Flush();
+    }
+
+    [[nodiscard]] arrow::Result<int64_t> Tell() const override {
+        return position_;
+    }
+
+    [[nodiscard]] bool closed() const override {
+        return closed_;
+    }
+
+private:
+    int fd_;
+    std::string buffer_;
+    int64_t position_ = 0;
+    bool closed_ = false;
+};
+
+Json::Value encode_options(
+    const EvaluationOptions &options
+) {
+    Json::Value json;
+    json["batch_rows"] = Json::Int64{options.batch_rows};
+    json["batch_bytes"] = Json::Int64{options.batch_bytes};
+    json["pipelined"] = options.pipelined;
+    json["queue_depth"] = Json::UInt64{options.queue_depth};
+    json["convert_threads"] = Json::UInt64{options.convert_threads};
+    json["push_down_filters"] = options.optimiser.push_down_filters;
+    json["simplify_conditions"] = options.optimiser.simplify_conditions;
+    json["prune_partitions"] = options.optimiser.prune_partitions;
+    json["prune_columns"] = options.optimiser.prune_columns;
+    json["backend"] = to_string(options.backend);
+    json["batch_readahead"] = options.arrow_scan.batch_readahead;
+    json["fragment_readahead"] = options.arrow_scan.fragment_readahead;
+    json["print_stats"] = options.print_stats;
+    if (options.result_cache) {
+        json["cache_directory"] = std::filesystem::absolute(options.result_cache->directory).string();
+        json["cache_size"] = Json::UInt64{options.result_cache->max_bytes};
+    }
+    return json;
+}
+
+EvaluationOptions decode_options(
+    const Json::Value &json
+) {
+    EvaluationOptions options;
+    options.batch_rows = json.get("batch_rows", Json::Int64{options.batch_rows}).asInt64();
+    options.batch_bytes = json.get("batch_bytes", Json::Int64{options.batch_bytes}).asInt64();
+    options.pipelined = json.get("pipelined", options.pipelined).asBool();
+    options.queue_depth = json.get("queue_depth", Json::UInt64{options.queue_depth}).asUInt64();
+    options.convert_threads = json.get("convert_threads", Json::UInt64{options.convert_threads}).asUInt64();
+    options.optimiser.push_down_filters = json.get("push_down_filters", options.optimiser.push_down_filters).asBool();
+    options.optimiser.simplify_conditions =
+            json.get("simplify_conditions", options.optimiser.simplify_conditions).asBool();
+    options.optimiser.prune_partitions = json.get("prune_partitions", options.optimiser.prune_partitions).asBool();
+    options.optimiser.prune_columns = json.get("prune_columns", options.optimiser.prune_columns).asBool();
+    options.backend = parse_evaluation_backend(json.get("backend", "duckdb").asString()).value_or(options.backend);
+    options.arrow_scan.batch_readahead = json.get("batch_readahead", options.arrow_scan.batch_readahead).asInt();
+    options.arrow_scan.fragment_readahead =
+            json.get("fragment_readahead", options.arrow_scan.fragment_readahead).asInt();
+    options.print_stats = json.get("print_stats", options.print_stats).asBool();
+    if (json.isMember("cache_directory")) {
+        options.result_cache = ResultCacheOptions{
+            .directory = json["cache_directory"].asString(),
+            .max_bytes = json.get("cache_size", Json::UInt64{DEFAULT_RESULT_CACHE_BYTES}).asUInt64()
+        };
+    }
+    return options;
+}
+
+Json::Value encode_dialect(
+    const CsvDialect &dialect
+) {
+    Json::Value json;
+    json["delimiter"] = std::string(1, dialect.delimiter);
+    json["quoting"] = csv_quoting_name(dialect.quoting);
+    json["null"] = dialect.null_token;
+    json["header"] = dialect.header;
+    return json;
+}
+
+CsvDialect decode_dialect(
+    const Json::Value &json
+) {
+    CsvDialect dialect;
+    if (const auto delimiter = json.get("delimiter", "").asString(); delimiter.size() == 1) {
+        dialect.delimiter = delimiter.front();
+    }
+    dialect.quoting = parse_csv_quoting(json.get("quoting", "").asString()).value_or(dialect.quoting);
+    dialect.null_token = json.get("null", dialect.null_token).asString();
+    dialect.header = json.get("header", dialect.header).asBool();
+    return dialect;
+}
+
+// The server's working directory is unrelated to the client's, so relative paths the client's plan reads are resolved
+// against the client's.
+OverallQueryPlan resolve_paths(
+    const OverallQueryPlan &query_plan,
+    const std::filesystem::path &cwd
+) {
+    OverallQueryPlan resolved;
+    for (auto plan: query_plan.get_plans()) {
+        if (plan.select) {
+            auto tablenames = plan.select->get_tablenames();
+            for (auto &tablename: tablenames) {
+                tablename = resolve_table_literals(tablename, cwd);
+            }
+            plan.select = SelectFragment(
+                std::move(tablenames),
+                plan.select->get_columns(),
+                plan.select->get_alias(),
+                plan.select->get_schema()
+            );
+        }
+        if (plan.join) {
+            plan.join = JoinFragment(
+                resolve_table_literals(plan.join->get_table(), cwd),
+                plan.join->get_how(),
+                plan.join->get_conditions(),
+                plan.join->get_alias()
+            );
+        }
+        if (plan.partitions) {
+            plan.partitions->root = (cwd / plan.partitions->root).string();
+        }
+        resolved.add_plan(plan);
+    }
+    return resolved;
+}
+
+ExitStatus evaluate_request(
+    const int fd,
+    const std::string &request,
+    duckdb::DuckDB &db,
+    std::ostream &diagnostics
+) {
+    Json::Value root;
+    JSONCPP_STRING errors;
+    std::istringstream request_stream(request);
+    if (const Json::CharReaderBuilder builder; !Json::parseFromStream(builder, request_stream, &root, &errors)) {
+        diagnostics << "Unable to parse request. " << errors << '\n';
+        return ExitStatus::QUERY_GENERATION_ERROR;
+    }
+
+    const auto format = parse_output_format(root["format"].asString());
+    if (!format || requires_seekable_output(*format)) {
+        diagnostics << "Unsupported output format '" << root["format"].asString() << "'.\n";
+        return ExitStatus::QUERY_GENERATION_ERROR;
+    }
+
+    const std::filesystem::path cwd = root["cwd"].asString();
+    if (!cwd.is_absolute()) {
+        diagnostics << "Request has no working directory to resolve relative paths against.\n";
+        return ExitStatus::QUERY_GENERATION_ERROR;
+    }
+
+    const auto query_plan = resolve_paths(OverallQueryPlanSerDes::decode(root["plan"]), cwd);
+    WriterOptions writer_options;
+    writer_options.csv = decode_dialect(root["csv"]);
+    writer_options.compression = parse_compression(root.get("compression", "none").asString())
+            .value_or(writer_options.compression);
+    writer_options.compress = parse_stream_compression(root.get("compress", "").asString())
+            .value_or(writer_options.compress);
+    auto options = decode_options(root["options"]);
+    options.diagnostics = &diagnostics;
+    // A client that hangs up, say because its output was closed, stops the query even while it produces no rows.
+    CancellationToken cancellation;
+    const CancellationWatcher watcher(cancellation, fd, false);
+    options.cancellation = &cancellation;
+
+    const auto stream = std::make_shared<FramedOutputStream>(fd);
+    const auto writer_factory = [&](
+        const std::shared_ptr<arrow::Schema> &schema
+    ) {
+        return make_writer(*format, schema, stream, true, writer_options);
+    };
+
+    AliasGenerator alias_generator;
+    const auto status = evaluate_query(query_plan, writer_factory, alias_generator, options, db);
+    if (const auto close_status = stream->Close(); !close_status.ok() && status == ExitStatus::SUCCESS) {
+        diagnostics << close_status.ToString() << '\n';
+        return ExitStatus::EXECUTION_ERROR;
+    }
+    return status;
+}
+
+void handle_connection(
+    const int client_fd,
+    duckdb::DuckDB &db
+) {
+    const FileDescriptor client(client_fd);
+
+    std::string request;
+    std::array<char, 4096> buffer{};
+    while (true) {
+        const auto received = recv(client.get(), buffer.data(), buffer.size(), 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received < 0) {
+            return;
+        }
+        if (received == 0) {
+            break;
+        }
+        request.append(buffer.data(), static_cast<std::size_t>(received));
+    }
+
+    std::ostringstream diagnostics;
+    ExitStatus status;
+    try {
+        status = evaluate_request(client.get(), request, db, diagnostics);
+    } catch (const std::exception &error) {
+        diagnostics << "Error handling request. " << error.what() << '\n';
+        status = ExitStatus::EXECUTION_ERROR;
+    }
+
+    if (const auto messages = diagnostics.str(); !messages.empty()) {
+        send_frame(client.get(), FrameKind::DIAGNOSTICS, messages);
+    }
+    const std::array status_payload{static_cast<char>(status)};
+    send_frame(client.get(), FrameKind::STATUS, {status_payload.data(), status_payload.size()});
+}
+
+std::optional<sockaddr_un> socket_address(
+    const std::string &socket_path
+) {
+    sockaddr_un address{};
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        return std::nullopt;
+    }
+    address.sun_family = AF_UNIX;
+    std::ranges::copy(socket_path, static_cast<char *>(address.sun_path));
+    return address;
+}
+
+int connect_to(
+    const sockaddr_un &address
+) {
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) { // NOLINT(*-reinterpret-cast)
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+}
+
+std::optional<std::string> default_socket_path() {
+    const char *value = std::getenv("DEVAL_SOCKET"); // NOLINT(*-mt-unsafe)
+    if (value == nullptr || *value == '\0') {
+        return std::nullopt;
+    }
+    return std::string(value);
+}
+
+ExitStatus serve(
+    const std::string &socket_path,
+    const EngineOptions &engine,
+    const std::size_t workers
+) {
+    const auto address = socket_address(socket_path);
+    if (!address) {
+        std::cerr << "Socket path is too long: " << socket_path << '\n';
+        return ExitStatus::EXECUTION_ERROR;
+    }
+
+    // A socket file that nothing answers on was left behind by a server that didn't shut down cleanly.
+    if (std::filesystem::exists(socket_path)) {
+        if (const FileDescriptor existing(connect_to(*address)); existing.get() >= 0) {
+            std::cerr << "A server is already listening on " << socket_path << ".\n";
+            return ExitStatus::EXECUTION_ERROR;
+        }
+        std::filesystem::remove(socket_path);
+    }
+
+    std::unique_ptr<duckdb::DuckDB> db;
+    try {
+        db = open_database(engine);
+    } catch (const std::runtime_error &error) {
+        std::cerr << "Error configuring DuckDb. " << error.what() << '\n';
+        return ExitStatus::EXECUTION_ERROR;
+    }
+
+    const FileDescriptor listener(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+    const auto *listen_address = reinterpret_cast<const sockaddr *>(&*address); // NOLINT(*-reinterpret-cast)
+    if (listener.get() < 0
+        || bind(listener.get(), listen_address, sizeof(*address)) != 0
+        || listen(listener.get(), SOMAXCONN) != 0) {
+        std::cerr << "Unable to listen on " << socket_path << ": " << std::strerror(errno) << '\n';
+        return ExitStatus::EXECUTION_ERROR;
+    }
+    std::cerr << "Serving on " << socket_path << ".\n";
+
+    // Declared after the database so that outstanding queries are joined before it is destroyed. Connections accepted
+    // while every worker is busy wait in the queue, and beyond that in the listen backlog.
+    BoundedQueue<int> connections(workers);
+    std::vector<std::jthread> pool;
+    for (std::size_t i = 0; i < workers; ++i) {
+        pool.emplace_back([&connections, &db] {
+            while (const auto client_fd = connections.pop()) {
+                handle_connection(*client_fd, *db);
+            }
+        });
+    }
+
+    while (true) {
+        const int client_fd = accept4(listener.get(), nullptr, nullptr, SOCK_CLOEXEC);
+        if (client_fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            std::cerr << "Unable to accept connection: " << std::strerror(errno) << '\n';
+            break;
+        }
+        connections.push(client_fd);
+    }
+
+    connections.close();
+    return ExitStatus::EXECUTION_ERROR;
+}
+
+std::optional<ExitStatus> evaluate_remotely(
+    const std::string &socket_path,
+    const OverallQueryPlan &query_plan,
+    const OutputFormat format,
+    const WriterOptions &writer_options,
+    const EvaluationOptions &options,
+    const std::string &out_path
+) {
+    // SQL stages can name files anywhere in their text, where their relative paths can't be resolved for the server.
+    if (std::ranges::any_of(query_plan.get_plans(), [](const QueryPlan &plan) { return plan.sql.has_value(); })) {
+        return std::nullopt;
+    }
+    const auto address = socket_address(socket_path);
+    if (!address) {
+        return std::nullopt;
+    }
+    const FileDescriptor server(connect_to(*address));
+    if (server.get() < 0) {
+        return std::nullopt;
+    }
+
+    Json::Value request;
+    request["plan"] = OverallQueryPlanSerDes::encode(query_plan);
+    request["cwd"] = std::filesystem::current_path().string();
+    request["format"] = output_format_name(format);
+    request["csv"] = encode_dialect(writer_options.csv);
+    request["compression"] = compression_name(writer_options.compression);
+    request["compress"] = stream_compression_spec(writer_options.compress);
+    request["options"] = encode_options(options);
+    const auto request_str = Json::writeString(Json::StreamWriterBuilder(), request);
+    if (!send_all(server.get(), request_str.data(), request_str.size()) || shutdown(server.get(), SHUT_WR) != 0) {
+        std::cerr << "Unable to send query plan to " << socket_path << ": " << std::strerror(errno) << '\n';
+        return ExitStatus::EXECUTION_ERROR;
+    }
+
+    const auto output = out_path.empty() ? open_stdout_stream() : open_file_stream(out_path);
+    // Hanging up makes the server cancel the query, and ends the loop below.
+    const auto hang_up = CancellationToken::on_cancel(options.cancellation, [&server] {
+        shutdown(server.get(), SHUT_RDWR);
+    });
+    const auto check_output = [](
+        const arrow::Status &status
+    ) -> std::optional<ExitStatus> {
+        try {
+            check_write(status, "Unable to write results");
+        } catch (const OutputClosedException &) {
+            return ExitStatus::OUTPUT_CLOSED;
+        } catch (const std::runtime_error &error) {
+            std::cerr << error.what() << '\n';
+            return ExitStatus::EXECUTION_ERROR;
+        }
+        return std::nullopt;
+    };
+
+    std::array<char, FRAME_HEADER_SIZE> header{};
+    std::string payload;
+    while (recv_all(server.get(), header.data(), header.size())) {
+        const auto byte = [&header](
+            const std::size_t i
+        ) {
+            return static_cast<std::uint32_t>(static_cast<unsigned char>(header.at(i)));
+        };
+        const auto size = byte(1) << 24U | byte(2) << 16U | byte(3) << 8U | byte(4);
+        payload.resize(size);
+        if (!recv_all(server.get(), payload.data(), payload.size())) {
+            break;
+        }
+
+        switch (static_cast<FrameKind>(header[0])) {
+            case FrameKind::DATA:
+                if (const auto status = check_output(
+                    output->Write(payload.data(), static_cast<int64_t>(payload.size()))
+                )) {
+                    return status;
+                }
+                break;
+            case FrameKind::DIAGNOSTICS:
+                *options.diagnostics << payload;
+                break;
+            case FrameKind::STATUS:
+                if (payload.size() != 1) {
+                    throw std::logic_error("Malformed status frame from server.");
+                }
+                if (const auto status = check_output(output->Close())) {
+                    return status;
+                }
+                return static_cast<ExitStatus>(payload[0]);
+            default:
+                throw std::logic_error("Unknown frame kind from server.");
+        }
+    }
+
+    if (options.cancellation && options.cancellation->cancelled()) {
+        if (options.cancellation->reason() == CancelReason::SIGNAL) {
+            *options.diagnostics << "Interrupted.\n";
+        }
+        return cancelled_status(options.cancellation->reason());
+    }
+    std::cerr << "Connection to " << socket_path << " closed before the query finished.\n";
+    return ExitStatus::EXECUTION_ERROR;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+
+#include "engine_config.h"
+#include "query_evaluator.h"
+#include "writer.h"
+
+class OverallQueryPlan;
+
+// Path of the socket of a running `deval --serve`, taken from DEVAL_SOCKET.
+std::optional<std::string> default_socket_path();
+
+// Number of connections a server evaluates queries for at once, unless told otherwise.
+constexpr std::size_t DEFAULT_SERVE_WORKERS = 8;
+
+// Evaluate query plans sent over a Unix socket against a single long-lived DuckDb instance, so that its catalog and
+// Parquet metadata caches stay warm between queries. Connections are served by a fixed pool of worker threads, and
+// wait for one to be free. Only returns if the socket can't be served.
+ExitStatus serve(
+    const std::string &socket_path,
+    const EngineOptions &engine,
+    std::size_t workers
+);
+
+// Evaluate the plan on the server listening at socket_path and copy the results to out_path, or stdout if it is empty.
+// Returns nullopt, having done nothing, if no server is listening or the plan has SQL stages, so that the caller can
+// evaluate the plan itself. The server resolves relative paths against this process's working directory.
+std::optional<ExitStatus> evaluate_remotely(
+    const std::string &socket_path,
+    const OverallQueryPlan &query_plan,
+    OutputFormat format,
+    const WriterOptions &writer_options,
+    const EvaluationOptions &options,
+    const std::string &out_path
+);
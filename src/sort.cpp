@@ -7,6 +7,7 @@
 #include "options.h"
 #include "queryplan.h"
 #include "serde.h"
+#include "stages.h"
 
 
 class SortOptions final : public Options {
@@ -47,7 +48,7 @@ private:
 };
 
 
-int main(
+int sort_main(
     const int argc,
     const char *argv[]
 ) {
@@ -5,6 +5,7 @@
 #include "options.h"
 #include "queryplan.h"
 #include "serde.h"
+#include "stages.h"
 
 
 class SqlOptions final : public Options {
@@ -28,7 +29,7 @@ private:
 };
 
 
-int main(
+int sql_main(
     const int argc,
     const char *argv[]
 ) {
@@ -0,0 +1,38 @@
+#pragma once
+
+// Entry points of the stages, which the multi-call executable runs by the name it was invoked as. `deval` is
+// eval_main, in the engine module.
+int cat_main(
+    int argc,
+    const char *argv[] // NOLINT(*-avoid-c-arrays)
+);
+
+int cut_main(
+    int argc,
+    const char *argv[] // NOLINT(*-avoid-c-arrays)
+);
+
+int grep_main(
+    int argc,
+    const char *argv[] // NOLINT(*-avoid-c-arrays)
+);
+
+int head_main(
+    int argc,
+    const char *argv[] // NOLINT(*-avoid-c-arrays)
+);
+
+int join_main(
+    int argc,
+    const char *argv[] // NOLINT(*-avoid-c-arrays)
+);
+
+int sort_main(
+    int argc,
+    const char *argv[] // NOLINT(*-avoid-c-arrays)
+);
+
+int sql_main(
+    int argc,
+    const char *argv[] // NOLINT(*-avoid-c-arrays)
+);
@@ -0,0 +1,203 @@
+#include <iostream>
+#include <sstream>
+
+#include "tracer.h"
+
+
+static constexpr int PROCESS_ID = 1;
+
+Tracer::Span::Span(
+    Tracer *tracer,
+    std::string name
+) :
+    tracer_(tracer),
+    name_(std::move(name)),
+    start_(tracer ? Clock::now() : Clock::time_point{}),
+    args_(Json::objectValue) {}
+
+Tracer::Span::~Span() {
+    if (tracer_) {
+        tracer_->add_span(name_, start_, Clock::now() - start_, args_);
+    }
+}
+
+Tracer::Span &Tracer::Span::arg(
+    const std::string &key,
+    const Json::Value &value
+) {
+    if (tracer_) {
+        args_[key] = value;
+    }
+    return *this;
+}
+
+Tracer::Tracer() :
+    origin_(Clock::now()) {}
+
+double Tracer::microseconds_since_start(
+    const Clock::time_point time
+) const {
+    return std::chrono::duration<double, std::micro>(time - origin_).count();
+}
+
+// Must be called with the mutex held.
+int Tracer::add_track(
+    const std::string &track
+) {
+    const auto id = next_track_id_++;
+    Json::Value event;
+    event["name"] = "thread_name";
+    event["ph"] = "M";
+    event["pid"] = PROCESS_ID;
+    event["tid"] = id;
+    event["args"]["name"] = track;
+    events_.append(event);
+    return id;
+}
+
+// Must be called with the mutex held.
+int Tracer::thread_track_id() {
+    const auto thread = std::this_thread::get_id();
+    if (const auto it = thread_tracks_.find(thread); it != thread_tracks_.end()) {
+        return it->second;
+    }
+    const auto id = add_track(thread_tracks_.empty() ? "main" : "thread " + std::to_string(thread_tracks_.size()));
+    thread_tracks_.emplace(thread, id);
+    return id;
+}
+
+void Tracer::name_thread(
+    const std::string &name
+) {
+    const std::lock_guard lock(mutex_);
+    const auto thread = std::this_thread::get_id();
+    if (const auto it = thread_tracks_.find(thread); it != thread_tracks_.end()) {
+        thread_tracks_.erase(it);
+    }
+    thread_tracks_.emplace(thread, add_track(name));
+}
+
+// Must be called with the mutex held.
+void Tracer::append_span(
+    const int track,
+    const std::string &name,
+    const Clock::time_point start,
+    const Clock::duration duration,
+    const Json::Value &args
+) {
+    Json::Value event;
+    event["name"] = name;
+    event["ph"] = "X";
+    event["pid"] = PROCESS_ID;
+    event["tid"] = track;
+    event["ts"] = microseconds_since_start(start);
+    event["dur"] = std::chrono::duration<double, std::micro>(duration).count();
+    event["args"] = args;
+    events_.append(event);
+}
+
+void Tracer::add_span(
+    const std::string &name,
+    const Clock::time_point start,
+    const Clock::duration duration,
+    const Json::Value &args
+) {
+    const std::lock_guard lock(mutex_);
+    append_span(thread_track_id(), name, start, duration, args);
+}
+
+void Tracer::add_span_on_track(
+    const std::string &track,
+    const std::string &name,
+    const Clock::time_point start,
+    const Clock::duration duration,
+    const Json::Value &args
+) {
+    const std::lock_guard lock(mutex_);
+    auto it = named_tracks_.find(track);
+    if (it == named_tracks_.end()) {
+        it = named_tracks_.emplace(track, add_track(track)).first;
+    }
+    append_span(it->second, name, start, duration, args);
+}
+
+void Tracer::set_metadata(
+    const std::string &key,
+    const Json::Value &value
+) {
+    const std::lock_guard lock(mutex_);
+    metadata_[key] = value;
+}
+
+void Tracer::write(
+    std::ostream &out
+) const {
+    const std::lock_guard lock(mutex_);
+
+    Json::Value root;
+    root["traceEvents"] = events_;
+    root["displayTimeUnit"] = "ms";
+    root["otherData"] = metadata_;
+
+    const Json::StreamWriterBuilder builder;
+    const std::unique_ptr<Json::StreamWriter> json_writer(builder.newStreamWriter());
+    json_writer->write(root, &out);
+    out << '\n';
+}
+
+// DuckDb renamed the profile's keys over time; accept both spellings.
+static const Json::Value &profile_field(
+    const Json::Value &node,
+    const char *name,
+    const char *legacy_name
+) {
+    return node.isMember(name) ? node[name] : node[legacy_name];
+}
+
+static Tracer::Clock::time_point trace_operator(
+    Tracer &tracer,
+    const Json::Value &node,
+    Tracer::Clock::time_point start
+) {
+    const auto seconds = profile_field(node, "operator_timing", "timing").asDouble();
+    const auto duration = std::chrono::duration_cast<Tracer::Clock::duration>(std::chrono::duration<double>(seconds));
+
+    Json::Value args;
+    args["cardinality"] = profile_field(node, "operator_cardinality", "cardinality");
+    if (const auto &extra = node["extra_info"]; !extra.isNull()) {
+        args["extra_info"] = extra;
+    }
+
+    auto name = profile_field(node, "operator_name", "name").asString();
+    if (name.empty()) {
+        name = node["operator_type"].asString();
+    }
+    if (!name.empty()) {
+        tracer.add_span_on_track("DuckDb operators", name, start, duration, args);
+        start += duration;
+    }
+
+    for (const auto &child: node["children"]) {
+        start = trace_operator(tracer, child, start);
+    }
+    return start;
+}
+
+void trace_duckdb_profile(
+    Tracer &tracer,
+    const std::string &profile_json,
+    const Tracer::Clock::time_point start
+) {
+    Json::Value profile;
+    JSONCPP_STRING errors;
+    std::istringstream in(profile_json);
+    if (!Json::parseFromStream(Json::CharReaderBuilder(), in, &profile, &errors)) {
+        tracer.set_metadata("duckdb_profile_error", errors);
+        return;
+    }
+
+    tracer.set_metadata("duckdb_profile", profile);
+    for (const auto &child: profile["children"]) {
+        trace_operator(tracer, child, start);
+    }
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <chrono>
+#include <iosfwd>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include <json/json.h>
+
+// Collects timed spans from any thread and writes them in the Chrome trace event format, which chrome://tracing and
+// Perfetto both open.
+class Tracer {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // Records the time between its construction and destruction. A span with no tracer does nothing.
+    class Span {
+    public:
+        Span(
+            Tracer *tracer,
+            std::string name
+        );
+
+        Span(
+            const Span &
+        ) = delete;
+
+        Span &operator=(
+            const Span &
+        ) = delete;
+
+        Span(
+            Span &&
+        ) = delete;
+
+        Span &operator=(
+            Span &&
+        ) = delete;
+
+        ~Span();
+
+        // Shown alongside the span, e.g. row and byte counts.
+        Span &arg(
+            const std::string &key,
+            const Json::Value &value
+        );
+
+    private:
+        Tracer *tracer_;
+        std::string name_;
+        Clock::time_point start_;
+        Json::Value args_;
+    };
+
+    Tracer();
+
+    // Name the calling thread's track.
+    void name_thread(
+        const std::string &name
+    );
+
+    void add_span(
+        const std::string &name,
+        Clock::time_point start,
+        Clock::duration duration,
+        const Json::Value &args
+    );
+
+    // Add a span to a named track of its own rather than the calling thread's.
+    void add_span_on_track(
+        const std::string &track,
+        const std::string &name,
+        Clock::time_point start,
+        Clock::duration duration,
+        const Json::Value &args
+    );
+
+    // Stored alongside the events, e.g. DuckDb's profile of the query.
+    void set_metadata(
+        const std::string &key,
+        const Json::Value &value
+    );
+
+    void write(
+        std::ostream &out
+    ) const;
+
+private:
+    int add_track(
+        const std::string &track
+    );
+
+    int thread_track_id();
+
+    void append_span(
+        int track,
+        const std::string &name,
+        Clock::time_point start,
+        Clock::duration duration,
+        const Json::Value &args
+    );
+
+    [[nodiscard]] double microseconds_since_start(
+        Clock::time_point time
+    ) const;
+
+    Clock::time_point origin_;
+
+    mutable std::mutex mutex_;
+    Json::Value events_{Json::arrayValue};
+    Json::Value metadata_{Json::objectValue};
+    std::map<std::thread::id, int> thread_tracks_;
+    std::map<std::string, int> named_tracks_;
+    int next_track_id_ = 1;
+};
+
+// Lay out the operators of DuckDb's JSON profile on their own track, one after another from `start`, so their
+// timings can be read next to the phases around them. The whole profile is also stored in the trace's metadata.
+void trace_duckdb_profile(
+    Tracer &tracer,
+    const std::string &profile_json,
+    Tracer::Clock::time_point start
+);
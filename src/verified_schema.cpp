@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <cstddef>
+
+#include "input_files.h"
+
+#include "verified_schema.h"
+
+
+static std::optional<ResolvedSchema> verified_output_schema(
+    const OverallQueryPlan &query_plan,
+    const QueryPlan &plan,
+    std::size_t depth
+);
+
+static std::optional<ResolvedSchema> verified_source_schema(
+    const OverallQueryPlan &query_plan,
+    const SelectFragment &select,
+    const std::size_t depth
+) {
+    const auto tablenames = select.get_tablenames();
+    if (tablenames.size() == 1) {
+        if (const auto *upstream = query_plan.find_plan(tablenames.front()); upstream && upstream->select) {
+            // Guard against a stage that (nonsensically) selects from its own alias.
+            if (depth >= query_plan.get_plans().size() || &*upstream->select == &select) {
+                return std::nullopt;
+            }
+            return verified_output_schema(query_plan, *upstream, depth + 1);
+        }
+    }
+
+    const auto schema = select.get_schema();
+    if (!schema || schema->fingerprint != fingerprint_inputs(tablenames)) {
+        return std::nullopt;
+    }
+    return schema;
+}
+
+static std::optional<ResolvedSchema> verified_output_schema(
+    const OverallQueryPlan &query_plan,
+    const QueryPlan &plan,
+    const std::size_t depth
+) {
+    if (!plan.schema || !plan.select || plan.join || plan.sql) {
+        return std::nullopt;
+    }
+    const auto source = verified_source_schema(query_plan, *plan.select, depth);
+    if (!source || source->fingerprint != plan.schema->fingerprint) {
+        return std::nullopt;
+    }
+    return plan.schema;
+}
+
+std::optional<ResolvedSchema> verified_source_schema(
+    const OverallQueryPlan &query_plan,
+    const SelectFragment &select
+) {
+    return verified_source_schema(query_plan, select, 0);
+}
+
+std::optional<ResolvedSchema> verified_output_schema(
+    const OverallQueryPlan &query_plan,
+    const QueryPlan &plan
+) {
+    return verified_output_schema(query_plan, plan, 0);
+}
+
+OverallQueryPlan replace_stage_tables(
+    const OverallQueryPlan &query_plan,
+    const std::size_t index,
+    const std::vector<std::string> &tablenames
+) {
+    auto plans = query_plan.get_plans();
+    const auto &select = *plans[index].select;
+    const auto verified = verified_source_schema(query_plan, select);
+    const auto fingerprint = fingerprint_inputs(tablenames);
+    const auto restamp = [&fingerprint](
+        const ResolvedSchema &schema
+    ) {
+        return ResolvedSchema{.fingerprint = fingerprint, .columns = schema.columns};
+    };
+
+    plans[index].select = SelectFragment(
+        tablenames,
+        select.get_columns(),
+        select.get_alias(),
+        verified ? std::optional(restamp(*verified)) : select.get_schema()
+    );
+
+    if (verified) {
+        // Output schemas carry the fingerprint of the source they were resolved from down the chain of stages.
+        std::vector<std::string> derived;
+        for (auto i = index; i < plans.size(); ++i) {
+            auto &plan = plans[i];
+            if (!plan.select || !plan.schema || plan.schema->fingerprint != verified->fingerprint) {
+                continue;
+            }
+            const auto sources = plan.select->get_tablenames();
+            if (i != index && (sources.size() != 1 || std::ranges::find(derived, sources.front()) == derived.end())) {
+                continue;
+            }
+            plan.schema = restamp(*plan.schema);
+            if (const auto alias = plan.select->get_alias()) {
+                derived.push_back(*alias);
+            }
+        }
+    }
+
+    OverallQueryPlan replaced;
+    for (const auto &plan: plans) {
+        replaced.add_plan(plan);
+    }
+    return replaced;
+}
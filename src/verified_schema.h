@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "query.h"
+#include "queryplan.h"
+
+// The schema stored for the relation a select reads from, provided the input files haven't changed since it was
+// resolved. Selects from an earlier stage's alias are checked against that stage.
+std::optional<ResolvedSchema> verified_source_schema(
+    const OverallQueryPlan &query_plan,
+    const SelectFragment &select
+);
+
+// The schema stored for the columns a stage produces, provided its source schema still holds.
+std::optional<ResolvedSchema> verified_output_schema(
+    const OverallQueryPlan &query_plan,
+    const QueryPlan &plan
+);
+
+// Point the select of the stage at `index` to other tables holding the same columns, such as a subset of its files.
+// Schemas that verified against the old tables are re-stamped for the new ones, in that stage and in every stage that
+// derives from it, so that the rewrite doesn't send later lookups back to DuckDb.
+OverallQueryPlan replace_stage_tables(
+    const OverallQueryPlan &query_plan,
+    std::size_t index,
+    const std::vector<std::string> &tablenames
+);
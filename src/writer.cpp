@@ -1,25 +1,210 @@
-#include <fstream>
+#include <algorithm>
+#include <cerrno>
+
+#include <arrow/util/io_util.h>
 
 #include "arrow_result.h"
+#include "cell_formatter.h"
+#include "ndjson_writer.h"
+#include "parallel_csv_writer.h"
+#include "parquet_writer.h"
 
 #include "writer.h"
 
 
-std::shared_ptr<arrow::io::OutputStream> open_stdout_stream() {
+// Rendered rows are written in blocks of about this size.
+constexpr std::size_t BLOCK_BYTES = 1 << 20;
+
+void check_write(
+    const arrow::Status &status,
+    const std::string &context
+) {
+    if (status.ok()) {
+        return;
+    }
+    if (const auto error = arrow::internal::ErrnoFromStatus(status); error == EPIPE || error == ECONNRESET) {
+        throw OutputClosedException(context + ": " + status.ToString());
+    }
+    throw std::runtime_error(context + ": " + status.ToString());
+}
+
+std::shared_ptr<arrow::io::OutputStream> open_stdout_stream(
+    const AsyncOutputOptions &options
+) {
     int const stdout_fd = fileno(stdout);
     if (stdout_fd == -1) {
         throw std::runtime_error("Unable to obtain file number of stdout.");
     }
-    return assign_or_raise(arrow::io::FileOutputStream::Open(stdout_fd));
+    auto stream = assign_or_raise(arrow::io::FileOutputStream::Open(stdout_fd));
+    return std::make_shared<AsyncOutputStream>(std::move(stream), options);
+}
+
+std::shared_ptr<arrow::io::OutputStream> open_file_stream(
+    const std::string &path,
+    const bool append,
+    const AsyncOutputOptions &options
+) {
+    auto stream = assign_or_raise(arrow::io::FileOutputStream::Open(path, append));
+    return std::make_shared<AsyncOutputStream>(std::move(stream), options);
+}
+
+std::string output_format_name(
+    const OutputFormat format
+) {
+    switch (format) {
+        case OutputFormat::CSV:
+            return "csv";
+        case OutputFormat::PARQUET:
+            return "parquet";
+        case OutputFormat::COLUMNAR:
+            return "column";
+        case OutputFormat::ARROW:
+            return "arrow";
+        case OutputFormat::ARROW_FILE:
+            return "arrow-file";
+        case OutputFormat::NDJSON:
+            return "ndjson";
+    }
+    throw std::logic_error("Unhandled output format.");
 }
 
-std::shared_ptr<std::ostream> non_owning_stdout() {
-    return {
-        &std::cout,
-        [](
-    std::ostream *
-) {}
-    };
+std::optional<OutputFormat> parse_output_format(
+    const std::string &name
+) {
+    for (const auto format: {
+             OutputFormat::CSV,
+             OutputFormat::PARQUET,
+             OutputFormat::COLUMNAR,
+             OutputFormat::ARROW,
+             OutputFormat::ARROW_FILE,
+             OutputFormat::NDJSON
+         }) {
+        if (output_format_name(format) == name) {
+            return format;
+        }
+    }
+    return std::nullopt;
+}
+
+std::string csv_quoting_name(
+    const CsvQuoting quoting
+) {
+    switch (quoting) {
+        case CsvQuoting::STRINGS:
+            return "strings";
+        case CsvQuoting::MINIMAL:
+            return "minimal";
+        case CsvQuoting::ALL:
+            return "all";
+        case CsvQuoting::NONE:
+            return "none";
+    }
+    throw std::logic_error("Unhandled CSV quoting.");
+}
+
+std::optional<CsvQuoting> parse_csv_quoting(
+    const std::string &name
+) {
+    for (const auto quoting: {CsvQuoting::STRINGS, CsvQuoting::MINIMAL, CsvQuoting::ALL, CsvQuoting::NONE}) {
+        if (csv_quoting_name(quoting) == name) {
+            return quoting;
+        }
+    }
+    return std::nullopt;
+}
+
+std::string compression_name(
+    const arrow::Compression::type compression
+) {
+    switch (compression) {
+        case arrow::Compression::UNCOMPRESSED:
+            return "none";
+        case arrow::Compression::SNAPPY:
+            return "snappy";
+        case arrow::Compression::GZIP:
+            return "gzip";
+        case arrow::Compression::BROTLI:
+            return "brotli";
+        case arrow::Compression::LZ4_FRAME:
+            return "lz4";
+        case arrow::Compression::ZSTD:
+            return "zstd";
+        default:
+            throw std::logic_error("Unhandled compression.");
+    }
+}
+
+std::optional<arrow::Compression::type> parse_compression(
+    const std::string &name
+) {
+    for (const auto compression: {
+             arrow::Compression::UNCOMPRESSED,
+             arrow::Compression::SNAPPY,
+             arrow::Compression::GZIP,
+             arrow::Compression::BROTLI,
+             arrow::Compression::LZ4_FRAME,
+             arrow::Compression::ZSTD
+         }) {
+        if (compression_name(compression) == name) {
+            return compression;
+        }
+    }
+    return std::nullopt;
+}
+
+bool supports_ipc_compression(
+    const arrow::Compression::type compression
+) {
+    return compression == arrow::Compression::UNCOMPRESSED
+           || compression == arrow::Compression::LZ4_FRAME
+           || compression == arrow::Compression::ZSTD;
+}
+
+bool requires_seekable_output(
+    const OutputFormat format
+) {
+    return format == OutputFormat::PARQUET;
+}
+
+bool can_append_output(
+    const OutputFormat format
+) {
+    return format == OutputFormat::CSV || format == OutputFormat::COLUMNAR || format == OutputFormat::NDJSON;
+}
+
+std::unique_ptr<Writer> make_writer(
+    const OutputFormat format,
+    const std::shared_ptr<arrow::Schema> &schema,
+    std::shared_ptr<arrow::io::OutputStream> stream,
+    const bool include_header,
+    const WriterOptions &options
+) {
+    if (options.compress.enabled()) {
+        if (format == OutputFormat::PARQUET || format == OutputFormat::ARROW || format == OutputFormat::ARROW_FILE) {
+            throw std::runtime_error(
+                "Only text output can be compressed as a whole, not " + output_format_name(format) + "."
+            );
+        }
+        stream = compress_stream(std::move(stream), options.compress);
+    }
+    switch (format) {
+        case OutputFormat::CSV: {
+            auto csv_dialect = options.csv;
+            csv_dialect.header = include_header && options.csv.header;
+            return std::make_unique<ParallelCsvWriter>(schema, std::move(stream), std::move(csv_dialect));
+        }
+        case OutputFormat::PARQUET:
+            return std::make_unique<ParquetWriter>(schema, std::move(stream), options);
+        case OutputFormat::COLUMNAR:
+            return std::make_unique<ColumnarWriter>(schema, std::move(stream), include_header);
+        case OutputFormat::ARROW:
+            return std::make_unique<ArrowIpcWriter>(schema, std::move(stream), false, options.compression);
+        case OutputFormat::ARROW_FILE:
+            return std::make_unique<ArrowIpcWriter>(schema, std::move(stream), true, options.compression);
+        case OutputFormat::NDJSON:
+            return std::make_unique<NdjsonWriter>(schema, std::move(stream));
+    }
+    throw std::logic_error("Unhandled output format.");
 }
 
 
@@ -28,7 +213,7 @@ ArrowDatasetWriter::ArrowDatasetWriter(
     const std::string &path,
     const std::shared_ptr<arrow::dataset::FileFormat> &file_format
 ) :
-    ArrowDatasetWriter(std::move(schema), file_format, assign_or_raise(arrow::io::FileOutputStream::Open(path))) {}
+    ArrowDatasetWriter(std::move(schema), file_format, open_file_stream(path)) {}
 
 ArrowDatasetWriter::ArrowDatasetWriter(
     std::shared_ptr<arrow::Schema> schema,
@@ -39,131 +224,213 @@ ArrowDatasetWriter::ArrowDatasetWriter(
 ArrowDatasetWriter::ArrowDatasetWriter(
     std::shared_ptr<arrow::Schema> schema,
     const std::shared_ptr<arrow::dataset::FileFormat> &file_format,
-    std::shared_ptr<arrow::io::OutputStream> stream
+    std::shared_ptr<arrow::io::OutputStream> stream,
+    std::shared_ptr<arrow::dataset::FileWriteOptions> file_options
 ) {
     const auto fs = std::make_shared<arrow::fs::LocalFileSystem>();
-    const auto file_options = file_format->DefaultWriteOptions();
+    if (!file_options) {
+        file_options = file_format->DefaultWriteOptions();
+    }
 
-    // The "path" parameter in the FileLocator member doesn't seem to be used for anything.
-    writer_ = assign_or_raise(
-        file_format->MakeWriter(std::move(stream), std::move(schema), file_options, {.filesystem = fs, .path = ""})
+    // The "path" parameter in the FileLocator member doesn't seem to be used for anything. Making a CSV writer writes
+    // the header, which can find the output closed.
+    auto writer = file_format->MakeWriter(
+        std::move(stream),
+        std::move(schema),
+        file_options,
+        {.filesystem = fs, .path = ""}
     );
+    check_write(writer.status(), "Error writing header");
+    writer_ = std::move(*writer);
 }
 
 
 void ArrowDatasetWriter::write(
     const std::shared_ptr<arrow::RecordBatch> batch
 ) {
-    if (const auto status = writer_->Write(batch); !status.ok()) {
-        throw std::runtime_error("Error writing batch: " + status.ToString());
+    if (!writer_) {
+        throw std::logic_error("A file was written to after it was finished.");
     }
+    check_write(writer_->Write(batch), "Error writing batch");
 }
 
+void ArrowDatasetWriter::flush() {
+    if (writer_) {
+        check_write(writer_->Finish().status(), "Error finishing file");
+        writer_.reset();
+    }
+}
 
-ParquetWriter::ParquetWriter(
-    std::shared_ptr<arrow::Schema> schema,
-    const std::string &path
+
+std::shared_ptr<arrow::dataset::FileWriteOptions> CsvWriter::write_options(
+    const bool include_header
+) {
+    const auto options = std::static_pointer_cast<arrow::dataset::CsvFileWriteOptions>(
+        std::make_shared<file_format>()->DefaultWriteOptions()
+    );
+    options->write_options->include_header = include_header;
+    return options;
+}
+
+ArrowIpcWriter::ArrowIpcWriter(
+    const std::shared_ptr<arrow::Schema> &schema,
+    std::shared_ptr<arrow::io::OutputStream> stream,
+    const bool file_format,
+    const arrow::Compression::type compression
 ) :
-    ArrowDatasetWriter(std::move(schema), path, std::make_shared<file_format>()) {}
+    stream_(std::move(stream)) {
+    if (!supports_ipc_compression(compression)) {
+        throw std::runtime_error("Arrow output can't be compressed with " + compression_name(compression) + ".");
+    }
+    auto options = arrow::ipc::IpcWriteOptions::Defaults();
+    if (compression != arrow::Compression::UNCOMPRESSED) {
+        options.codec = assign_or_raise(arrow::util::Codec::Create(compression));
+    }
+    // Both write the schema straight away, which can find the output closed.
+    auto writer = file_format
+                      ? arrow::ipc::MakeFileWriter(stream_, schema, options)
+                      : arrow::ipc::MakeStreamWriter(stream_, schema, options);
+    check_write(writer.status(), "Error writing Arrow schema");
+    writer_ = std::move(*writer);
+}
+
+void ArrowIpcWriter::write(
+    const std::shared_ptr<arrow::RecordBatch> batch
+) {
+    if (!writer_) {
+        throw std::logic_error("Arrow output was written to after it was finished.");
+    }
+    check_write(writer_->WriteRecordBatch(*batch), "Error writing Arrow batch");
+}
+
+void ArrowIpcWriter::flush() {
+    if (writer_) {
+        check_write(writer_->Close(), "Error finishing Arrow output");
+        writer_.reset();
+    }
+    check_write(stream_->Flush(), "Error writing Arrow output");
+}
 
 ColumnarWriter::ColumnarWriter(
     std::shared_ptr<arrow::Schema> schema
 ) :
-    schema_(std::move(schema)),
-    stream_(non_owning_stdout()),
-    print_options_(print_options()) {
-    init();
-}
+    ColumnarWriter(std::move(schema), open_stdout_stream()) {}
 
 ColumnarWriter::ColumnarWriter(
     std::shared_ptr<arrow::Schema> schema,
     const std::string &path
+) :
+    ColumnarWriter(std::move(schema), open_file_stream(path)) {}
+
+ColumnarWriter::ColumnarWriter(
+    std::shared_ptr<arrow::Schema> schema,
+    std::shared_ptr<arrow::io::OutputStream> stream,
+    const bool include_header
 ) :
     schema_(std::move(schema)),
-    stream_(open_output_stream(path)),
-    print_options_(print_options()) {
-    init();
+    stream_(std::move(stream)) {
+    init(include_header);
 }
 
 void ColumnarWriter::write(
     std::shared_ptr<arrow::RecordBatch> batch
 ) {
-    const auto cols = batch->columns();
-
-    std::int64_t num_rows = 0;
-    if (cols.size() == 0) {
+    if (batch->num_columns() == 0) {
         throw std::runtime_error("No columns were provided");
     }
-    num_rows = cols[0]->length();
 
-    std::stringstream stream;
-    std::vector<std::string> row;
+    std::vector<std::unique_ptr<CellFormatter> > formatters;
+    for (const auto &column: batch->columns()) {
+        formatters.push_back(make_cell_formatter(column));
+    }
 
-    for (std::int64_t i = 0; i < num_rows; ++i) {
-        for (std::size_t j = 0; j < cols.size(); ++j) {
-            const auto column = cols[j];
-            const auto slice = column->Slice(i, 1);
-            if (const auto status = arrow::PrettyPrint(*slice, print_options_, &stream); !status.ok()) {
-                throw std::runtime_error("Error printing column: " + status.ToString());
+    for (std::int64_t i = 0; i < batch->num_rows(); ++i) {
+        if (sampling_) {
+            std::vector<std::string> row;
+            for (std::size_t j = 0; j < formatters.size(); ++j) {
+                std::string text;
+                formatters[j]->append(i, text);
+                max_col_width_[j] = std::max(max_col_width_[j], text.size());
+                row.push_back(std::move(text));
             }
-            auto str = stream.str();
-            // Remove comments
-            str = std::regex_replace(str, comment_regex_, "");
-            str = std::regex_replace(str, newline_regex_, " ");
-
-            row.push_back(str);
-            max_col_width_[j] = std::max(max_col_width_[j], str.size());
-
-            stream.str({});
+            sample_rows_.push_back(std::move(row));
+            if (sample_rows_.size() >= SAMPLE_ROWS) {
+                release_sample();
+            }
+            continue;
         }
-        rendered_rows_.push_back(row);
-        row.clear();
-    }
-}
 
-void ColumnarWriter::flush() {
-    for (const auto &row: rendered_rows_) {
-        for (std::size_t i = 0; i < row.size(); ++i) {
-            const auto width = max_col_width_[i];
-            const auto delimiter = i == 0 ? "" : " ";
-            *stream_ << delimiter << std::left << std::setw(width);
-            *stream_ << row[i];
+        for (std::size_t j = 0; j < formatters.size(); ++j) {
+            cell_.clear();
+            formatters[j]->append(i, cell_);
+            append_cell(j, cell_);
+        }
+        block_.push_back('\n');
+        if (block_.size() >= BLOCK_BYTES) {
+            write_block();
         }
-        *stream_ << '\n';
     }
+    write_block();
 }
 
-arrow::PrettyPrintOptions ColumnarWriter::print_options() {
-    arrow::PrettyPrintOptions print_options{};
-    print_options.show_field_metadata = false;
-    print_options.array_delimiters = {.open = "", .close = ""};
-    print_options.indent_size = 0;
-    print_options.skip_new_lines = true;
-    return print_options;
+void ColumnarWriter::flush() {
+    release_sample();
+    write_block();
+    check_write(stream_->Flush(), "Error writing columns");
 }
 
-void ColumnarWriter::init() {
+void ColumnarWriter::init(
+    const bool include_header
+) {
     std::vector<std::string> header;
     for (const auto &field: schema_->fields()) {
         const auto name = field->name();
         header.push_back(name);
         max_col_width_.push_back(name.size());
     }
-    rendered_rows_.push_back(header);
+    if (include_header) {
+        sample_rows_.push_back(header);
+    }
 }
 
-std::shared_ptr<std::ostream> ColumnarWriter::open_output_stream(
-    const std::string &path
+void ColumnarWriter::append_cell(
+    const std::size_t column,
+    const std::string &text
 ) {
-    const auto stream_ptr = std::make_shared<std::ofstream>(path);
-    if (!stream_ptr->is_open()) {
-        throw std::runtime_error("Unable to open file " + path + " for writing.");
+    if (column > 0) {
+        block_.push_back(' ');
+    }
+    block_.append(text);
+    auto &width = max_col_width_[column];
+    if (text.size() < width) {
+        block_.append(width - text.size(), ' ');
+    } else {
+        width = text.size();
+    }
+}
+
+// Column widths are fixed from here on, apart from growing to fit wider values.
+void ColumnarWriter::release_sample() {
+    sampling_ = false;
+    for (const auto &row: sample_rows_) {
+        for (std::size_t j = 0; j < row.size(); ++j) {
+            append_cell(j, row[j]);
+        }
+        block_.push_back('\n');
+    }
+    sample_rows_ = {};
+}
+
+void ColumnarWriter::write_block() {
+    if (block_.empty()) {
+        return;
     }
-    return std::static_pointer_cast<std::ostream>(stream_ptr);
+    check_write(stream_->Write(block_.data(), static_cast<std::int64_t>(block_.size())), "Error writing columns");
+    block_.clear();
 }
 
 std::unique_ptr<Writer> default_writer(
     const std::shared_ptr<arrow::Schema> &schema
 ) {
-    return std::make_unique<CsvWriter>(schema);
+    return std::make_unique<ParallelCsvWriter>(schema, open_stdout_stream());
 }
@@ -1,20 +1,147 @@
 #pragma once
 
+#include <cstdint>
 #include <iostream>
 #include <memory>
-#include <regex>
+#include <optional>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include <arrow/api.h>
 #include <arrow/dataset/api.h>
 #include <arrow/filesystem/api.h>
+#include <arrow/ipc/api.h>
+
+#include "async_output_stream.h"
+#include "compressed_stream.h"
 
 class Writer;
 
-std::shared_ptr<arrow::io::OutputStream> open_stdout_stream();
+// Thrown by writers when the reader of their output has gone away, such as `head` exiting after enough lines.
+struct OutputClosedException final : std::runtime_error {
+    explicit OutputClosedException(
+        const std::string &msg
+    ) :
+        std::runtime_error(msg) {}
+};
+
+// Throws OutputClosedException if the write failed because of a broken pipe or reset connection, and
+// std::runtime_error for any other failure.
+void check_write(
+    const arrow::Status &status,
+    const std::string &context
+);
+
+// ARROW is the Arrow IPC streaming format, and ARROW_FILE the IPC file format (Feather v2), whose footer lets readers
+// memory-map it and jump to any batch. NDJSON is newline-delimited JSON.
+enum class OutputFormat : std::uint8_t { CSV, PARQUET, COLUMNAR, ARROW, ARROW_FILE, NDJSON };
+
+std::string output_format_name(
+    OutputFormat format
+);
+
+std::optional<OutputFormat> parse_output_format(
+    const std::string &name
+);
+
+// Which values are enclosed in double quotes. STRINGS, the default, quotes every string and binary value, as Arrow
+// does. MINIMAL only quotes values containing the delimiter, a quote or a line break, and NONE refuses to write them.
+enum class CsvQuoting : std::uint8_t { STRINGS, MINIMAL, ALL, NONE };
+
+std::string csv_quoting_name(
+    CsvQuoting quoting
+);
+
+std::optional<CsvQuoting> parse_csv_quoting(
+    const std::string &name
+);
+
+struct CsvDialect {
+    char delimiter = ',';
+    CsvQuoting quoting = CsvQuoting::STRINGS;
+    // Written, unquoted, in place of nulls.
+    std::string null_token;
+    bool header = true;
+};
+
+// Arrow IPC output can be compressed with lz4 (LZ4 frames) or zstd, and Parquet output with any of them. Parquet
+// stores lz4 as raw LZ4 blocks.
+std::string compression_name(
+    arrow::Compression::type compression
+);
+
+std::optional<arrow::Compression::type> parse_compression(
+    const std::string &name
+);
+
+bool supports_ipc_compression(
+    arrow::Compression::type compression
+);
+
+struct ParquetSortingColumn {
+    std::string column;
+    bool descending = false;
+};
+
+// Columns are named by their path in the Parquet schema, which for top-level columns is just their name; "*" stands for
+// every column.
+struct ParquetOptions {
+    std::optional<int> compression_level;
+    // Each row group is filled up to this many rows and bytes of Arrow data. Without either limit, each batch written
+    // becomes a row group of its own.
+    std::int64_t row_group_rows = 0;
+    std::int64_t row_group_bytes = 0;
+    std::vector<std::string> no_dictionary;
+    std::vector<std::string> no_statistics;
+    bool page_index = false;
+    std::vector<std::string> bloom_filter;
+    double bloom_filter_fpp = 0.05;
+    // Recorded in each row group's metadata for readers to rely on; the order of the rows isn't checked.
+    std::vector<ParquetSortingColumn> sorting_columns;
+    // If set, a summary of the file's row groups and column chunks is printed here once it is finished.
+    std::ostream *layout_summary = nullptr;
+};
+
+struct WriterOptions {
+    CsvDialect csv;
+    arrow::Compression::type compression = arrow::Compression::UNCOMPRESSED;
+    ParquetOptions parquet;
+    // Compresses the whole output of the text formats.
+    StreamCompression compress;
+};
+
+// Whether the format can only be written to a seekable file rather than a pipe or socket.
+bool requires_seekable_output(
+    OutputFormat format
+);
+
+// Both are written asynchronously, through an AsyncOutputStream.
+std::shared_ptr<arrow::io::OutputStream> open_stdout_stream(
+    const AsyncOutputOptions &options = {}
+);
+
+std::shared_ptr<arrow::io::OutputStream> open_file_stream(
+    const std::string &path,
+    bool append = false,
+    const AsyncOutputOptions &options = {}
+);
+
+// Whether rows can be appended to existing output of the format, which CSV and columnar output, written without a
+// header, and NDJSON allow.
+bool can_append_output(
+    OutputFormat format
+);
 
-std::shared_ptr<std::ostream> non_owning_stdout();
+// The CSV dialect only applies to CSV, whose header is only written if both include_header and the dialect's header
+// are set, the compression only to Arrow and Parquet output, and the stream compression to any other format.
+std::unique_ptr<Writer> make_writer(
+    OutputFormat format,
+    const std::shared_ptr<arrow::Schema> &schema,
+    std::shared_ptr<arrow::io::OutputStream> stream,
+    bool include_header = true,
+    const WriterOptions &options = {}
+);
 
 std::unique_ptr<Writer> default_writer(
     const std::shared_ptr<arrow::Schema> &schema
@@ -66,7 +193,8 @@ protected:
     ArrowDatasetWriter(
         std::shared_ptr<arrow::Schema> schema,
         const std::shared_ptr<arrow::dataset::FileFormat> &file_format,
-        std::shared_ptr<arrow::io::OutputStream> stream
+        std::shared_ptr<arrow::io::OutputStream> stream,
+        std::shared_ptr<arrow::dataset::FileWriteOptions> file_options = nullptr
     );
 
 public:
@@ -74,20 +202,13 @@ public:
         std::shared_ptr<arrow::RecordBatch> batch
     ) override;
 
+    // Finishes the file, after which nothing can be written.
+    void flush() override;
+
 private:
     std::shared_ptr<arrow::dataset::FileWriter> writer_;
 };
 
-class ParquetWriter final : public ArrowDatasetWriter {
-    using file_format = arrow::dataset::ParquetFileFormat;
-
-public:
-    ParquetWriter(
-        std::shared_ptr<arrow::Schema> schema,
-        const std::string &path
-    );
-};
-
 class CsvWriter final : public ArrowDatasetWriter {
     using file_format = arrow::dataset::CsvFileFormat;
 
@@ -102,10 +223,54 @@ public:
         std::shared_ptr<arrow::Schema> schema
     ) :
         ArrowDatasetWriter(std::move(schema), std::make_shared<file_format>()) {}
+
+    CsvWriter(
+        std::shared_ptr<arrow::Schema> schema,
+        std::shared_ptr<arrow::io::OutputStream> stream,
+        const bool include_header = true
+    ) :
+        ArrowDatasetWriter(
+            std::move(schema),
+            std::make_shared<file_format>(),
+            std::move(stream),
+            write_options(include_header)
+        ) {}
+
+private:
+    static std::shared_ptr<arrow::dataset::FileWriteOptions> write_options(
+        bool include_header
+    );
 };
 
+// Arrow IPC output, which readers can use without parsing. Both the stream and file formats are written sequentially,
+// so either can go to a pipe. flush() writes the end-of-stream marker or file footer, after which nothing can be
+// written.
+class ArrowIpcWriter final : public Writer {
+public:
+    ArrowIpcWriter(
+        const std::shared_ptr<arrow::Schema> &schema,
+        std::shared_ptr<arrow::io::OutputStream> stream,
+        bool file_format = false,
+        arrow::Compression::type compression = arrow::Compression::UNCOMPRESSED
+    );
+
+    void write(
+        std::shared_ptr<arrow::RecordBatch> batch
+    ) override;
+
+    void flush() override;
+
+private:
+    std::shared_ptr<arrow::io::OutputStream> stream_;
+    std::shared_ptr<arrow::ipc::RecordBatchWriter> writer_;
+};
+
+// Lines columns up by padding each to the widest of its first SAMPLE_ROWS values, which are held back until then.
+// Later rows are written as they arrive; a wider value is written in full and widens its column from then on.
 class ColumnarWriter final : public Writer {
 public:
+    static constexpr std::size_t SAMPLE_ROWS = 1000;
+
     explicit ColumnarWriter(
         std::shared_ptr<arrow::Schema> schema
     );
@@ -115,6 +280,11 @@ public:
         const std::string &path
     );
 
+    ColumnarWriter(
+        std::shared_ptr<arrow::Schema> schema,
+        std::shared_ptr<arrow::io::OutputStream> stream,
+        bool include_header = true
+    );
 
     void write(
         std::shared_ptr<arrow::RecordBatch> batch
@@ -123,20 +293,24 @@ public:
     void flush() override;
 
 private:
-    static arrow::PrettyPrintOptions print_options();
-
-    void init();
+    void init(
+        bool include_header
+    );
 
-    static std::shared_ptr<std::ostream> open_output_stream(
-        const std::string &path
+    void append_cell(
+        std::size_t column,
+        const std::string &text
     );
 
-    std::regex comment_regex_{"--.*\\n"};
-    std::regex newline_regex_{"\\n+"};
+    void release_sample();
+
+    void write_block();
 
     std::shared_ptr<arrow::Schema> schema_;
-    std::shared_ptr<std::ostream> stream_;
-    arrow::PrettyPrintOptions print_options_;
-    std::vector<std::vector<std::string> > rendered_rows_;
+    std::shared_ptr<arrow::io::OutputStream> stream_;
+    std::vector<std::vector<std::string> > sample_rows_;
+    bool sampling_ = true;
     std::vector<std::size_t> max_col_width_;
+    std::string cell_;
+    std::string block_;
 };
@@ -0,0 +1,335 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <arrow/api.h>
+#include <arrow/io/file.h>
+#include <parquet/arrow/writer.h>
+
+#include "input_files.h"
+#include "parquet_metadata.h"
+#include "partitioning.h"
+#include "plan_optimizer.h"
+#include "queryplan.h"
+#include "verified_schema.h"
+
+
+static int failures = 0;
+
+static void check(
+    const bool condition,
+    const std::string &description
+) {
+    if (!condition) {
+        std::cerr << "FAILED: " << description << '\n';
+        ++failures;
+    }
+}
+
+static QueryPlan select_stage(
+    const std::string &table,
+    const std::vector<std::string> &columns,
+    const std::string &alias,
+    const std::optional<ResolvedSchema> &schema = std::nullopt
+) {
+    QueryPlan plan;
+    plan.select = SelectFragment({table}, columns, alias, schema);
+    return plan;
+}
+
+static WhereFragment where(
+    const std::vector<Condition> &conditions
+) {
+    WhereFragment fragment;
+    for (const auto &[column, predicate, value]: conditions) {
+        fragment.add_condition(column, predicate, value);
+    }
+    return fragment;
+}
+
+static std::vector<std::string> condition_columns(
+    const QueryPlan &plan
+) {
+    std::vector<std::string> columns;
+    for (const auto &condition: plan.where ? plan.where->get_conditions() : std::vector<Condition>{}) {
+        columns.push_back(condition.column + " " + condition.predicate);
+    }
+    return columns;
+}
+
+// A schema that verifies against the table, which has no files to fingerprint.
+static ResolvedSchema schema_of(
+    const std::string &table,
+    const std::vector<ColumnSchema> &columns
+) {
+    return ResolvedSchema{.fingerprint = fingerprint_inputs({table}), .columns = columns};
+}
+
+static void test_push_down_filters() {
+    OverallQueryPlan plan;
+    plan.add_plan(select_stage("'trips.parquet'", {"*"}, "t1"));
+    auto filtered = select_stage("t1", {"*"}, "t2");
+    filtered.where = where({{.column = "fare", .predicate = ">", .value = QueryParam(std::int64_t{10})}});
+    plan.add_plan(filtered);
+
+    std::size_t pushed = 0;
+    auto optimised = push_down_filters(plan, pushed);
+    check(pushed == 1, "a condition on a passed through column is pushed");
+    check(condition_columns(optimised.get_plans()[0]) == std::vector<std::string>{"fare >"},
+          "the condition moves into the scan");
+    check(!optimised.get_plans()[1].where, "the stage it came from has no conditions left");
+
+    OverallQueryPlan computed;
+    computed.add_plan(select_stage("'trips.parquet'", {"*", "fare + tip AS total"}, "t1"));
+    auto on_total = select_stage("t1", {"*"}, "t2");
+    on_total.where = where({
+        {.column = "total", .predicate = ">", .value = QueryParam(std::int64_t{10})},
+        {.column = "fare", .predicate = ">", .value = QueryParam(std::int64_t{5})}
+    });
+    computed.add_plan(on_total);
+
+    pushed = 0;
+    optimised = push_down_filters(computed, pushed);
+    check(pushed == 0, "nothing is pushed into a stage that computes columns, even alongside *");
+    check(condition_columns(optimised.get_plans()[1]) == std::vector<std::string>{"total >", "fare >"},
+          "the conditions stay where they were");
+
+    OverallQueryPlan limited;
+    auto head = select_stage("'trips.parquet'", {"*"}, "t1");
+    head.limit = LimitFragment(10);
+    limited.add_plan(head);
+    limited.add_plan(filtered);
+
+    pushed = 0;
+    optimised = push_down_filters(limited, pushed);
+    check(pushed == 0, "nothing is pushed past a LIMIT");
+}
+
+static void test_prune_columns() {
+    const auto schema = schema_of("trips", {{"fare", "DOUBLE"}, {"tip", "DOUBLE"}, {"vendor", "VARCHAR"}});
+    OverallQueryPlan plan;
+    plan.add_plan(select_stage("trips", {"*"}, "t1", schema));
+    auto filtered = select_stage("t1", {"fare"}, "t2");
+    filtered.where = where({{.column = "vendor", .predicate = "=", .value = QueryParam(std::string("1"))}});
+    plan.add_plan(filtered);
+
+    std::size_t narrowed = 0;
+    const auto pruned = prune_columns(plan, narrowed);
+    check(narrowed == 1, "the scan is narrowed");
+    check(pruned.get_plans()[0].select->get_columns() == std::vector<std::string>{"fare", "vendor"},
+          "the scan keeps the selected and filtered columns, in the order of the input");
+
+    OverallQueryPlan with_sql;
+    with_sql.add_plan(select_stage("trips", {"*"}, "t1", schema));
+    QueryPlan sql;
+    sql.sql = SqlFragment("SELECT count(*) FROM t1");
+    with_sql.add_plan(sql);
+
+    narrowed = 0;
+    prune_columns(with_sql, narrowed);
+    check(narrowed == 0, "a stage read by SQL keeps all of its columns");
+}
+
+static void test_simplify_conditions() {
+    const auto schema = schema_of("trips", {{"fare", "BIGINT"}, {"vendor", "VARCHAR"}});
+    OverallQueryPlan plan;
+    auto bounded = select_stage("trips", {"*"}, "t1", schema);
+    bounded.where = where({
+        {.column = "fare", .predicate = ">", .value = QueryParam::unknown("1")},
+        {.column = "fare", .predicate = ">", .value = QueryParam::unknown("5")},
+        {.column = "fare", .predicate = "<", .value = QueryParam::unknown("10")}
+    });
+    plan.add_plan(bounded);
+
+    PlanRewrites rewrites;
+    const auto simplified = simplify_conditions(plan, rewrites);
+    check(rewrites.conditions_dropped == 1, "the looser lower bound is dropped");
+    const auto conditions = simplified.get_plans()[0].where->get_conditions();
+    check(conditions.size() == 2 && conditions[0].value.get<std::string>() == "5"
+          && conditions[1].value.get<std::string>() == "10", "the tightest bounds are kept");
+    check(!rewrites.empty_result, "satisfiable conditions don't short-circuit the plan");
+
+    OverallQueryPlan contradiction;
+    auto impossible = select_stage("trips", {"*"}, "t1", schema);
+    impossible.where = where({
+        {.column = "fare", .predicate = ">", .value = QueryParam::unknown("5")},
+        {.column = "fare", .predicate = "<", .value = QueryParam::unknown("3")}
+    });
+    contradiction.add_plan(impossible);
+
+    rewrites = {};
+    const auto empty = simplify_conditions(contradiction, rewrites);
+    check(rewrites.empty_result, "contradictory conditions short-circuit the plan");
+    check(empty.get_plans().size() == 1 && empty.get_plans()[0].sql, "the plan becomes a query of no rows");
+
+    OverallQueryPlan untyped;
+    auto text = select_stage("trips", {"*"}, "t1", schema);
+    text.where = where({
+        {.column = "vendor", .predicate = ">", .value = QueryParam::unknown("a")},
+        {.column = "vendor", .predicate = "LIKE", .value = QueryParam::unknown("b%")}
+    });
+    untyped.add_plan(text);
+
+    rewrites = {};
+    simplify_conditions(untyped, rewrites);
+    check(rewrites.conditions_dropped == 0, "a LIKE is never dropped");
+}
+
+static void test_prune_partitions() {
+    const auto root = std::filesystem::temp_directory_path() / ("deval-partitions-" + std::to_string(getpid()));
+    for (const auto *directory: {"year=2020/month=1", "year=2021/month=1", "year=2021/month=2"}) {
+        std::filesystem::create_directories(root / directory);
+        std::ofstream(root / directory / "part-0.parquet");
+    }
+
+    const auto dataset = discover_partitions(root.string(), PartitionLayout::HIVE, {});
+    OverallQueryPlan plan;
+    auto scan = select_stage(partitioned_table_expression(dataset), {"*"}, "t1");
+    scan.partitions = dataset;
+    scan.where = where({
+        {.column = "year", .predicate = "=", .value = QueryParam::unknown("2021")},
+        {.column = "month", .predicate = ">", .value = QueryParam::unknown("1")}
+    });
+    plan.add_plan(scan);
+
+    PlanRewrites rewrites;
+    const auto pruned = prune_partitions(plan, rewrites);
+    const auto files = list_input_files(pruned.get_plans()[0].select->get_tablenames());
+    check(files.size() == 1 && files.front().path.find("year=2021/month=2") != std::string::npos,
+          "only the matching partition is read");
+    check(rewrites.partition_directories_skipped == 2, "the other year and month are skipped without listing them");
+    std::filesystem::remove_all(root);
+
+    for (const auto *directory: {"city=Boston", "city=New%20York"}) {
+        std::filesystem::create_directories(root / directory);
+        std::ofstream(root / directory / "part-0.parquet");
+    }
+    const auto cities = discover_partitions(root.string(), PartitionLayout::HIVE, {});
+    OverallQueryPlan encoded;
+    auto city_scan = select_stage(partitioned_table_expression(cities), {"*"}, "t1");
+    city_scan.partitions = cities;
+    city_scan.where = where({{.column = "city", .predicate = "=", .value = QueryParam::unknown("New York")}});
+    encoded.add_plan(city_scan);
+
+    rewrites = {};
+    const auto decoded = prune_partitions(encoded, rewrites);
+    const auto city_files = list_input_files(decoded.get_plans()[0].select->get_tablenames());
+    check(city_files.size() == 1 && city_files.front().path.find("New%20York") != std::string::npos,
+          "percent-encoded values are decoded before they are compared");
+    std::filesystem::remove_all(root);
+}
+
+static void test_replace_stage_tables() {
+    const auto schema = schema_of("'trips.parquet'", {{"fare", "DOUBLE"}, {"vendor", "VARCHAR"}});
+    OverallQueryPlan plan;
+    auto scan = select_stage("'trips.parquet'", {"*"}, "t1", schema);
+    scan.schema = schema;
+    plan.add_plan(scan);
+    auto narrowed = select_stage("t1", {"fare"}, "t2");
+    narrowed.schema = ResolvedSchema{.fingerprint = schema.fingerprint, .columns = {{"fare", "DOUBLE"}}};
+    plan.add_plan(narrowed);
+
+    const auto replaced = replace_stage_tables(plan, 0, {"read_parquet(['trips-1.parquet'])"});
+    const auto &plans = replaced.get_plans();
+    check(plans[0].select->get_tablenames() == std::vector<std::string>{"read_parquet(['trips-1.parquet'])"},
+          "the stage reads the new tables");
+    check(verified_source_schema(replaced, *plans[0].select).has_value(), "the scan's schema holds for the new tables");
+    const auto output = verified_output_schema(replaced, plans[1]);
+    check(output && output->columns.size() == 1, "the schemas of later stages still verify");
+
+    OverallQueryPlan stale;
+    stale.add_plan(select_stage("'trips.parquet'", {"*"}, "t1", schema_of("'other.parquet'", {})));
+    const auto unverified = replace_stage_tables(stale, 0, {"'trips-1.parquet'"});
+    check(!verified_source_schema(unverified, *unverified.get_plans()[0].select),
+          "a schema that didn't hold before isn't made to hold");
+}
+
+static void test_parquet_table_files() {
+    const auto root = std::filesystem::temp_directory_path() / ("deval-files-" + std::to_string(getpid()));
+    std::filesystem::create_directories(root);
+    for (const auto *name: {"a.parquet", "b.parquet", "c.parquet"}) {
+        std::ofstream(root / name);
+    }
+
+    const auto all = parquet_table_files("'" + (root / "*.parquet").string() + "'");
+    check(all && all->size() == 3, "a quoted glob reads every matching file");
+    const auto some = parquet_table_files(read_parquet_expression({(*all)[0], (*all)[2]}));
+    check(some && some->size() == 2 && some->back().path == (*all)[2].path,
+          "the list written for pruned files reads exactly those files");
+
+    std::filesystem::remove(root / "c.parquet");
+    check(!parquet_table_files(read_parquet_expression({(*all)[0], (*all)[2]})),
+          "a list naming a missing file isn't treated as the files that remain");
+    std::filesystem::remove_all(root);
+}
+
+// A Parquet file with one BIGINT column holding the given values, in a single row group.
+static void write_parquet(
+    const std::filesystem::path &path,
+    const std::vector<std::int64_t> &values
+) {
+    arrow::Int64Builder builder;
+    if (!builder.AppendValues(values).ok()) {
+        throw std::runtime_error("Can't build test values.");
+    }
+    const auto table = arrow::Table::Make(
+        arrow::schema({arrow::field("fare", arrow::int64())}),
+        {builder.Finish().ValueOrDie()}
+    );
+    const auto out = arrow::io::FileOutputStream::Open(path.string()).ValueOrDie();
+    if (!parquet::arrow::WriteTable(*table, arrow::default_memory_pool(), out).ok() || !out->Close().ok()) {
+        throw std::runtime_error("Can't write " + path.string());
+    }
+}
+
+static void test_prune_partitioned_files() {
+    const auto root = std::filesystem::temp_directory_path() / ("deval-statistics-" + std::to_string(getpid()));
+    setenv("DEVAL_METADATA_CACHE_DIR", (root / "metadata").c_str(), 1); // NOLINT(*-mt-unsafe)
+    std::filesystem::create_directories(root / "data" / "year=2021");
+    write_parquet(root / "data" / "year=2021" / "part-0.parquet", {1, 5, 10});
+    write_parquet(root / "data" / "year=2021" / "part-1.parquet", {100, 150});
+
+    const auto dataset = discover_partitions((root / "data").string(), PartitionLayout::HIVE, {});
+    OverallQueryPlan plan;
+    auto scan = select_stage(partitioned_table_expression(dataset), {"*"}, "t1");
+    scan.partitions = dataset;
+    scan.where = where({
+        {.column = "year", .predicate = "=", .value = QueryParam::unknown("2021")},
+        {.column = "fare", .predicate = ">", .value = QueryParam::unknown("50")}
+    });
+    plan.add_plan(scan);
+
+    PruningStats stats;
+    const auto pruned = prune_parquet_files(plan, stats);
+    const auto &stage = pruned.get_plans()[0];
+    const auto files = partitioned_table_files(dataset, stage.select->get_tablenames().front());
+    check(stats.files == 2 && stats.kept == 1, "statistics rule out a file of a partition that matches");
+    check(files && files->size() == 1 && files->front().path.ends_with("part-1.parquet"),
+          "only the file that may match is read");
+    check(stage.partitions.has_value(), "the stage still reads a partitioned dataset");
+
+    std::filesystem::remove_all(root);
+    unsetenv("DEVAL_METADATA_CACHE_DIR"); // NOLINT(*-mt-unsafe)
+}
+
+int main() {
+    test_push_down_filters();
+    test_prune_columns();
+    test_simplify_conditions();
+    test_prune_partitions();
+    test_replace_stage_tables();
+    test_parquet_table_files();
+    test_prune_partitioned_files();
+    if (failures > 0) {
+        std::cerr << failures << " checks failed.\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,112 @@
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <arrow/api.h>
+
+#include "query_evaluator.h"
+#include "queryplan.h"
+#include "writer.h"
+
+
+static int failures = 0;
+
+static void check(
+    const bool condition,
+    const std::string &description
+) {
+    if (!condition) {
+        std::cerr << "FAILED: " << description << '\n';
+        ++failures;
+    }
+}
+
+class CollectingWriter final : public Writer {
+public:
+    explicit CollectingWriter(
+        std::int64_t &rows
+    ) :
+        rows_(rows) {}
+
+    void write(
+        const std::shared_ptr<arrow::RecordBatch> batch
+    ) override {
+        rows_ += batch->num_rows();
+    }
+
+private:
+    std::int64_t &rows_;
+};
+
+static QueryPlan select_stage(
+    const std::string &table,
+    const std::vector<std::string> &columns,
+    const std::optional<std::string> &alias
+) {
+    QueryPlan plan;
+    plan.select = SelectFragment({table}, columns, alias);
+    return plan;
+}
+
+// The rows a plan evaluates to, or -1 if evaluation fails.
+static std::int64_t evaluate(
+    const OverallQueryPlan &plan,
+    const EvaluationOptions &options = {}
+) {
+    std::int64_t rows = 0;
+    AliasGenerator alias_generator;
+    const auto status = evaluate_query(
+        plan,
+        [&rows](
+            const std::shared_ptr<arrow::Schema> &
+        ) {
+            return std::make_unique<CollectingWriter>(rows);
+        },
+        alias_generator,
+        options
+    );
+    return status == ExitStatus::SUCCESS ? rows : -1;
+}
+
+// `dcat -a a 'trips.csv' | dcat a | dgrep fare 100`, with no schema stored: the optimiser moves the untyped condition
+// into the scan of the file, whose columns are then only known to DuckDb.
+static void test_pushed_down_untyped_condition() {
+    const auto path = std::filesystem::temp_directory_path() / ("deval-trips-" + std::to_string(getpid()) + ".csv");
+    std::ofstream(path) << "fare,vendor\n50,a\n150,b\n250,c\n";
+
+    OverallQueryPlan plan;
+    plan.add_plan(select_stage("'" + path.string() + "'", {"*"}, "a"));
+    auto filtered = select_stage("a", {"*"}, std::nullopt);
+    filtered.where.emplace();
+    filtered.where->add_condition("fare", ">", QueryParam::unknown("100"));
+    plan.add_plan(filtered);
+    check(evaluate(plan) == 2, "a condition pushed into an undescribed stage is typed from that stage");
+
+    OverallQueryPlan narrowed;
+    narrowed.add_plan(select_stage("'" + path.string() + "'", {"*"}, "a"));
+    auto vendors = select_stage("a", {"vendor"}, std::nullopt);
+    vendors.where.emplace();
+    vendors.where->add_condition("fare", "<", QueryParam::unknown("100"));
+    narrowed.add_plan(vendors);
+    EvaluationOptions unoptimised;
+    unoptimised.optimiser.push_down_filters = false;
+    check(evaluate(narrowed, unoptimised) == 1,
+          "a condition on a column the stage doesn't select is typed from its source");
+
+    std::filesystem::remove(path);
+}
+
+int main() {
+    test_pushed_down_untyped_condition();
+    if (failures > 0) {
+        std::cerr << failures << " checks failed.\n";
+        return 1;
+    }
+    return 0;
+}